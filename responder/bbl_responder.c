@@ -0,0 +1,401 @@
+/*
+ * BNG Blaster Responder
+ *
+ * Minimal software BNG answering the PPPoE and IPoE
+ * setup sequence of BNG Blaster sessions and forwarding
+ * BBL session traffic between access and network side.
+ *
+ * The responder core is independent of the I/O backend,
+ * which provides responder_tx_buf() and responder_tx_commit()
+ * and feeds received frames into responder_rx_access() and
+ * responder_rx_network(). The packet ring backend is part
+ * of the standalone bbl-responder, the memory backend is
+ * part of the BNG Blaster itself.
+ *
+ * Copyright (C) 2020-2021, RtBrick, Inc.
+ */
+
+#include "bbl_responder.h"
+
+/*
+ * xorshift64* pseudo random number generator,
+ * good enough to decide if a packet should be dropped.
+ */
+uint64_t
+responder_random (responder_ctx_s *ctx)
+{
+    ctx->random ^= ctx->random >> 12;
+    ctx->random ^= ctx->random << 25;
+    ctx->random ^= ctx->random >> 27;
+    return ctx->random * 0x2545F4914F6CDD1DULL;
+}
+
+bool
+responder_random_loss (responder_ctx_s *ctx, uint32_t loss)
+{
+    if(!loss) {
+        return false;
+    }
+    return (responder_random(ctx) % 1000000) < loss;
+}
+
+/*
+ * HASH TABLE
+ * ------------------------------------------------------------------------
+ */
+
+uint32_t
+responder_hash_key (responder_key_t *key)
+{
+    uint64_t h = key->mac_vlan ^ (key->vlan * 0x9E3779B97F4A7C15ULL);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return (uint32_t)h;
+}
+
+bool
+responder_hash_init (responder_hash_t *hash, uint32_t max_entries)
+{
+    uint32_t size = 1;
+    /* Keep the load factor below 50% */
+    while(size < max_entries * 2) {
+        size <<= 1;
+    }
+    hash->entries = calloc(size, sizeof(responder_hash_entry_t));
+    if(!hash->entries) {
+        return false;
+    }
+    hash->mask = size - 1;
+    hash->count = 0;
+    return true;
+}
+
+bool
+responder_hash_lookup (responder_hash_t *hash, responder_key_t *key, uint32_t *value)
+{
+    responder_hash_entry_t *entry;
+    uint32_t i = responder_hash_key(key) & hash->mask;
+
+    while(true) {
+        entry = &hash->entries[i];
+        if(!entry->used) {
+            return false;
+        }
+        if(entry->key.mac_vlan == key->mac_vlan && entry->key.vlan == key->vlan) {
+            *value = entry->value;
+            return true;
+        }
+        i = (i + 1) & hash->mask;
+    }
+}
+
+bool
+responder_hash_insert (responder_hash_t *hash, responder_key_t *key, uint32_t value)
+{
+    responder_hash_entry_t *entry;
+    uint32_t i = responder_hash_key(key) & hash->mask;
+
+    if(hash->count >= hash->mask) {
+        return false;
+    }
+    while(true) {
+        entry = &hash->entries[i];
+        if(!entry->used) {
+            entry->key = *key;
+            entry->value = value;
+            entry->used = true;
+            hash->count++;
+            return true;
+        }
+        if(entry->key.mac_vlan == key->mac_vlan && entry->key.vlan == key->vlan) {
+            entry->value = value;
+            return true;
+        }
+        i = (i + 1) & hash->mask;
+    }
+}
+
+void
+responder_hash_delete (responder_hash_t *hash, responder_key_t *key)
+{
+    responder_hash_entry_t *entry;
+    uint32_t i = responder_hash_key(key) & hash->mask;
+    uint32_t j, home;
+
+    while(true) {
+        entry = &hash->entries[i];
+        if(!entry->used) {
+            return;
+        }
+        if(entry->key.mac_vlan == key->mac_vlan && entry->key.vlan == key->vlan) {
+            break;
+        }
+        i = (i + 1) & hash->mask;
+    }
+
+    /* Shift following entries of the same cluster back,
+     * such that no tombstones are required. */
+    j = i;
+    while(true) {
+        hash->entries[i].used = false;
+        while(true) {
+            j = (j + 1) & hash->mask;
+            if(!hash->entries[j].used) {
+                hash->count--;
+                return;
+            }
+            home = responder_hash_key(&hash->entries[j].key) & hash->mask;
+            /* Entry j can be moved to i if its home
+             * position is not cyclically in (i, j]. */
+            if(i <= j ? (i < home && home <= j) : (i < home || home <= j)) {
+                continue;
+            }
+            break;
+        }
+        hash->entries[i] = hash->entries[j];
+        i = j;
+    }
+}
+
+/*
+ * SESSIONS
+ * ------------------------------------------------------------------------
+ */
+
+responder_session_s *
+responder_session_get (responder_ctx_s *ctx, responder_key_t *key, uint8_t *mac,
+                       uint16_t *vlan, responder_session_type_t type)
+{
+    responder_session_s *session;
+    uint32_t idx;
+
+    if(responder_hash_lookup(&ctx->session_hash, key, &idx)) {
+        return &ctx->sessions[idx];
+    }
+
+    session = ctx->free_sessions;
+    if(!session) {
+        ctx->stats.sessions_exhausted++;
+        return NULL;
+    }
+    ctx->free_sessions = session->next_free;
+
+    idx = session->idx;
+    memset(session, 0x0, sizeof(responder_session_s));
+    session->idx = idx;
+    session->type = type;
+    session->key = *key;
+    memcpy(session->mac, mac, ETH_ADDR_LEN);
+    memcpy(session->vlan, vlan, sizeof(session->vlan));
+    session->magic = htobe32(responder_random(ctx) | 1);
+    if(type == RESPONDER_SESSION_PPPOE) {
+        session->ipv4 = htobe32(RESPONDER_IPV4_POOL + idx);
+    }
+    responder_hash_insert(&ctx->session_hash, key, idx);
+    ctx->sessions_active++;
+    ctx->stats.sessions_created++;
+    return session;
+}
+
+void
+responder_session_free (responder_ctx_s *ctx, responder_session_s *session)
+{
+    responder_key_t ipv4_key = {0};
+
+    if(session->type == RESPONDER_SESSION_FREE) {
+        return;
+    }
+    if(session->ipv4) {
+        ipv4_key.mac_vlan = session->ipv4;
+        responder_hash_delete(&ctx->ipv4_hash, &ipv4_key);
+    }
+    responder_hash_delete(&ctx->session_hash, &session->key);
+    session->type = RESPONDER_SESSION_FREE;
+    session->pending = 0;
+    session->next_free = ctx->free_sessions;
+    ctx->free_sessions = session;
+    ctx->sessions_active--;
+    ctx->stats.sessions_terminated++;
+}
+
+static bool
+responder_init_sessions (responder_ctx_s *ctx)
+{
+    uint32_t i;
+
+    ctx->sessions = calloc(ctx->config.max_sessions, sizeof(responder_session_s));
+    if(!ctx->sessions) {
+        return false;
+    }
+    for(i = ctx->config.max_sessions; i > 0; i--) {
+        ctx->sessions[i-1].idx = i-1;
+        ctx->sessions[i-1].next_free = ctx->free_sessions;
+        ctx->free_sessions = &ctx->sessions[i-1];
+    }
+    if(!responder_hash_init(&ctx->session_hash, ctx->config.max_sessions)) {
+        return false;
+    }
+    return responder_hash_init(&ctx->ipv4_hash, ctx->config.max_sessions);
+}
+
+/*
+ * responder_send
+ *
+ * Encode and send a control response, which is
+ * queued for later if a delay is configured.
+ */
+void
+responder_send (responder_ctx_s *ctx, responder_side_t side, bbl_ethernet_header_t *eth)
+{
+    responder_delayed_s *delayed;
+    uint8_t *buf;
+    uint len = 0;
+
+    eth->src = ctx->interface[side].mac;
+
+    if(ctx->config.delay_nsec) {
+        if(ctx->delay_tail - ctx->delay_head >= RESPONDER_DELAY_QUEUE_LEN) {
+            ctx->stats.delay_queue_full++;
+            return;
+        }
+        delayed = &ctx->delay_queue[ctx->delay_tail % RESPONDER_DELAY_QUEUE_LEN];
+        if(encode_ethernet(delayed->buf, &len, eth) != PROTOCOL_SUCCESS || len > RESPONDER_DELAY_FRAME_LEN) {
+            return;
+        }
+        delayed->due_nsec = ctx->now_nsec + ctx->config.delay_nsec;
+        delayed->side = side;
+        delayed->len = len;
+        ctx->delay_tail++;
+        return;
+    }
+
+    buf = responder_tx_buf(ctx, side);
+    if(!buf) {
+        return;
+    }
+    if(encode_ethernet(buf, &len, eth) == PROTOCOL_SUCCESS) {
+        responder_tx_commit(ctx, side, buf, len);
+    }
+}
+
+static void
+responder_delay_job (responder_ctx_s *ctx)
+{
+    responder_delayed_s *delayed;
+    uint8_t *buf;
+
+    while(ctx->delay_head != ctx->delay_tail) {
+        delayed = &ctx->delay_queue[ctx->delay_head % RESPONDER_DELAY_QUEUE_LEN];
+        if(delayed->due_nsec > ctx->now_nsec) {
+            return;
+        }
+        buf = responder_tx_buf(ctx, delayed->side);
+        if(!buf) {
+            return;
+        }
+        memcpy(buf, delayed->buf, delayed->len);
+        responder_tx_commit(ctx, delayed->side, buf, delayed->len);
+        ctx->delay_head++;
+    }
+}
+
+static void
+responder_retry_job (responder_ctx_s *ctx)
+{
+    uint32_t i;
+
+    for(i = 0; i < ctx->config.max_sessions; i++) {
+        if(ctx->sessions[i].pending && ctx->sessions[i].retry_nsec <= ctx->now_nsec) {
+            responder_retry(ctx, &ctx->sessions[i]);
+        }
+    }
+}
+
+void
+responder_stats_stdout (responder_ctx_s *ctx)
+{
+    responder_interface_s *interface;
+    int i;
+
+    printf("\nSessions: %u active, %lu created, %lu terminated, %lu exhausted\n",
+           ctx->sessions_active, ctx->stats.sessions_created,
+           ctx->stats.sessions_terminated, ctx->stats.sessions_exhausted);
+    printf("Control RX: PADI %lu PADR %lu PADT %lu LCP %lu PAP %lu CHAP %lu IPCP %lu IP6CP %lu\n",
+           ctx->stats.padi, ctx->stats.padr, ctx->stats.padt, ctx->stats.lcp,
+           ctx->stats.pap, ctx->stats.chap, ctx->stats.ipcp, ctx->stats.ip6cp);
+    printf("            ARP %lu ICMPv6 %lu DHCPv6 %lu\n",
+           ctx->stats.arp, ctx->stats.icmpv6, ctx->stats.dhcpv6);
+    printf("Traffic: %lu upstream, %lu downstream, %lu no session, %lu unresolved, %lu invalid\n",
+           ctx->stats.traffic_upstream, ctx->stats.traffic_downstream,
+           ctx->stats.traffic_no_session, ctx->stats.traffic_unresolved,
+           ctx->stats.traffic_invalid);
+    printf("Injected: %lu control loss, %lu traffic loss, %lu delay queue full\n",
+           ctx->stats.control_loss, ctx->stats.traffic_loss, ctx->stats.delay_queue_full);
+    for(i = 0; i < RESPONDER_INTERFACE_MAX; i++) {
+        interface = &ctx->interface[i];
+        if(!interface->name) {
+            continue;
+        }
+        printf("Interface %s: RX %lu TX %lu TX busy %lu sendto failed %lu decode error %lu\n",
+               interface->name, interface->stats.packets_rx, interface->stats.packets_tx,
+               interface->stats.tx_busy, interface->stats.sendto_failed,
+               interface->stats.decode_error);
+    }
+}
+
+/*
+ * responder_init
+ *
+ * Allocate sessions and the delay queue. The interface MAC
+ * addresses and ctx->now_nsec must be set before, the pseudo
+ * random generator is seeded from the latter if not set.
+ */
+bool
+responder_init (responder_ctx_s *ctx)
+{
+    int i;
+
+    if(!responder_init_sessions(ctx)) {
+        return false;
+    }
+    if(ctx->config.delay_nsec) {
+        ctx->delay_queue = calloc(RESPONDER_DELAY_QUEUE_LEN, sizeof(responder_delayed_s));
+        if(!ctx->delay_queue) {
+            return false;
+        }
+    }
+    if(!ctx->random) {
+        ctx->random = ctx->now_nsec | 1;
+    }
+    for(i = 0; i < RESPONDER_AC_COOKIE_LEN; i++) {
+        ctx->ac_cookie[i] = responder_random(ctx);
+    }
+    /* DUID-LL with access interface MAC address */
+    ctx->server_duid[1] = 3;
+    ctx->server_duid[3] = 1;
+    memcpy(&ctx->server_duid[4], ctx->interface[RESPONDER_ACCESS].mac, ETH_ADDR_LEN);
+    return true;
+}
+
+/*
+ * responder_job
+ *
+ * Send delayed responses which are due and repeat
+ * unanswered requests. This must be called periodically
+ * with ctx->now_nsec set to the current time.
+ */
+void
+responder_job (responder_ctx_s *ctx)
+{
+    if(ctx->delay_queue) {
+        responder_delay_job(ctx);
+    }
+    if(ctx->now_nsec >= ctx->retry_nsec) {
+        responder_retry_job(ctx);
+        ctx->retry_nsec = ctx->now_nsec + RESPONDER_RETRY_INTERVAL_NSEC;
+    }
+}
+
@@ -0,0 +1,265 @@
+/*
+ * BNG Blaster Responder
+ *
+ * Minimal software BNG answering the PPPoE and IPoE
+ * setup sequence of BNG Blaster sessions and forwarding
+ * BBL session traffic between access and network side.
+ *
+ * Copyright (C) 2020-2021, RtBrick, Inc.
+ */
+
+#ifndef __BBL_RESPONDER_H__
+#define __BBL_RESPONDER_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <net/if.h>
+#include <linux/if_packet.h>
+
+#include "bbl_protocols.h"
+
+#define RESPONDER_MAX_SESSIONS          65535 /* PPPoE session identifier is session index + 1 */
+#define RESPONDER_DEFAULT_SESSIONS      4096
+#define RESPONDER_RING_SLOTS            4096
+#define RESPONDER_SCRATCHPAD_LEN        4096
+#define RESPONDER_DELAY_QUEUE_LEN       65536 /* delayed control responses */
+#define RESPONDER_DELAY_FRAME_LEN       384 /* max length of a delayed control response */
+#define RESPONDER_RETRY_INTERVAL_NSEC   1000000000 /* resend unanswered requests */
+#define RESPONDER_CHAP_CHALLENGE_LEN    16
+#define RESPONDER_AC_COOKIE_LEN         16
+#define RESPONDER_SERVER_DUID_LEN       10 /* DUID-LL */
+
+#define RESPONDER_IPV4_GATEWAY          0x64400001 /* 100.64.0.1 */
+#define RESPONDER_IPV4_POOL             0x64400002 /* 100.64.0.2 + session index */
+#define RESPONDER_IPV6_RA_PREFIX        0xfc661000 /* fc66:1000:<session index>::/64 */
+#define RESPONDER_IPV6_PD_PREFIX        0xfc662000 /* fc66:2000:<session index>::/64 */
+
+#define NSEC                            1000000000ULL
+
+typedef enum {
+    RESPONDER_ACCESS = 0,
+    RESPONDER_NETWORK,
+    RESPONDER_INTERFACE_MAX
+} responder_side_t;
+
+typedef enum {
+    RESPONDER_SESSION_FREE = 0,
+    RESPONDER_SESSION_PPPOE,
+    RESPONDER_SESSION_IPOE
+} responder_session_type_t;
+
+/* Requests sent by the responder which are
+ * repeated until answered by the client. */
+#define RESPONDER_PENDING_LCP           0x01
+#define RESPONDER_PENDING_CHAP          0x02
+#define RESPONDER_PENDING_IPCP          0x04
+#define RESPONDER_PENDING_IP6CP         0x08
+
+typedef struct responder_key_ {
+    uint64_t mac_vlan; /* client MAC and outer VLAN */
+    uint64_t vlan; /* inner and third VLAN */
+} responder_key_t;
+
+typedef struct responder_hash_entry_ {
+    responder_key_t key;
+    uint32_t value;
+    bool used;
+} responder_hash_entry_t;
+
+/*
+ * Open addressing hash table with linear probing
+ * and backward shift deletion.
+ */
+typedef struct responder_hash_ {
+    responder_hash_entry_t *entries;
+    uint32_t mask;
+    uint32_t count;
+} responder_hash_t;
+
+typedef struct responder_session_ {
+    uint32_t idx;
+    responder_session_type_t type;
+    responder_key_t key;
+
+    uint8_t mac[ETH_ADDR_LEN];
+    uint16_t vlan[MAX_VLANS];
+
+    uint32_t ipv4; /* network byte order */
+    uint32_t magic;
+    uint8_t identifier; /* identifier of the requests sent by the responder */
+    uint8_t pending;
+    uint8_t challenge[RESPONDER_CHAP_CHALLENGE_LEN];
+    uint64_t retry_nsec;
+
+    bool lcp_ack_sent;
+    bool lcp_opened;
+    bool ipcp_opened;
+    bool ip6cp_opened;
+
+    struct responder_session_ *next_free;
+} responder_session_s;
+
+typedef struct responder_interface_ {
+    char *name;
+    responder_side_t side;
+    int fd_tx;
+    int fd_rx;
+    uint8_t mac[ETH_ADDR_LEN];
+    struct sockaddr_ll addr;
+
+    struct tpacket_req req_tx;
+    struct tpacket_req req_rx;
+    uint8_t *ring_tx;
+    uint8_t *ring_rx;
+    uint cursor_tx;
+    uint cursor_rx;
+    bool tx_pending;
+
+    struct {
+        uint64_t packets_rx;
+        uint64_t packets_tx;
+        uint64_t tx_busy;
+        uint64_t sendto_failed;
+        uint64_t decode_error;
+    } stats;
+} responder_interface_s;
+
+typedef struct responder_delayed_ {
+    uint64_t due_nsec;
+    responder_side_t side;
+    uint16_t len;
+    uint8_t buf[RESPONDER_DELAY_FRAME_LEN];
+} responder_delayed_s;
+
+typedef struct responder_ctx_ {
+    responder_interface_s interface[RESPONDER_INTERFACE_MAX];
+    bool network_enabled;
+
+    struct {
+        uint32_t max_sessions;
+        uint16_t auth;
+        uint64_t delay_nsec;
+        uint32_t loss; /* control packets dropped per 1000000 */
+        uint32_t traffic_loss; /* BBL traffic packets dropped per 1000000 */
+    } config;
+
+    responder_session_s *sessions;
+    responder_session_s *free_sessions;
+    responder_hash_t session_hash; /* client MAC and VLAN */
+    responder_hash_t ipv4_hash; /* client IPv4 address */
+    uint32_t sessions_active;
+
+    /* Network side peer learned from ARP or ICMPv6 ND. */
+    uint8_t network_peer_mac[ETH_ADDR_LEN];
+    uint16_t network_vlan[MAX_VLANS];
+    bool network_resolved;
+
+    responder_delayed_s *delay_queue;
+    uint32_t delay_head;
+    uint32_t delay_tail;
+
+    uint64_t now_nsec;
+    uint64_t retry_nsec;
+    uint64_t random;
+
+    void *io_data; /* private data of the I/O backend */
+
+    uint8_t ac_cookie[RESPONDER_AC_COOKIE_LEN];
+    uint8_t server_duid[RESPONDER_SERVER_DUID_LEN];
+    uint8_t sp[RESPONDER_SCRATCHPAD_LEN];
+
+    struct {
+        uint64_t padi;
+        uint64_t padr;
+        uint64_t padt;
+        uint64_t lcp;
+        uint64_t pap;
+        uint64_t chap;
+        uint64_t ipcp;
+        uint64_t ip6cp;
+        uint64_t arp;
+        uint64_t icmpv6;
+        uint64_t dhcpv6;
+        uint64_t sessions_created;
+        uint64_t sessions_terminated;
+        uint64_t sessions_exhausted;
+        uint64_t traffic_upstream;
+        uint64_t traffic_downstream;
+        uint64_t traffic_no_session;
+        uint64_t traffic_unresolved;
+        uint64_t traffic_invalid; /* IP length exceeds frame */
+        uint64_t control_loss;
+        uint64_t traffic_loss;
+        uint64_t delay_queue_full;
+    } stats;
+} responder_ctx_s;
+
+/*
+ * I/O backend (bbl_responder_main.c or bbl_io_memory.c)
+ */
+uint8_t *
+responder_tx_buf (responder_ctx_s *ctx, responder_side_t side);
+
+void
+responder_tx_commit (responder_ctx_s *ctx, responder_side_t side, uint8_t *buf, uint len);
+
+/*
+ * bbl_responder.c
+ */
+bool
+responder_init (responder_ctx_s *ctx);
+
+void
+responder_job (responder_ctx_s *ctx);
+
+void
+responder_stats_stdout (responder_ctx_s *ctx);
+
+void
+responder_send (responder_ctx_s *ctx, responder_side_t side, bbl_ethernet_header_t *eth);
+
+uint64_t
+responder_random (responder_ctx_s *ctx);
+
+bool
+responder_random_loss (responder_ctx_s *ctx, uint32_t loss);
+
+uint32_t
+responder_hash_key (responder_key_t *key);
+
+bool
+responder_hash_init (responder_hash_t *hash, uint32_t max_entries);
+
+bool
+responder_hash_lookup (responder_hash_t *hash, responder_key_t *key, uint32_t *value);
+
+bool
+responder_hash_insert (responder_hash_t *hash, responder_key_t *key, uint32_t value);
+
+void
+responder_hash_delete (responder_hash_t *hash, responder_key_t *key);
+
+responder_session_s *
+responder_session_get (responder_ctx_s *ctx, responder_key_t *key, uint8_t *mac,
+                       uint16_t *vlan, responder_session_type_t type);
+
+void
+responder_session_free (responder_ctx_s *ctx, responder_session_s *session);
+
+/*
+ * bbl_responder_rx.c
+ */
+void
+responder_rx_access (responder_ctx_s *ctx, struct tpacket2_hdr *tphdr, uint8_t *buf, uint len);
+
+void
+responder_rx_network (responder_ctx_s *ctx, struct tpacket2_hdr *tphdr, uint8_t *buf, uint len);
+
+void
+responder_retry (responder_ctx_s *ctx, responder_session_s *session);
+
+#endif
@@ -0,0 +1,363 @@
+/*
+ * BNG Blaster Responder - Packet Ring I/O
+ *
+ * Standalone responder attached to network interfaces
+ * using the same TPACKET_V2 rings as the BNG Blaster.
+ * This allows to measure the setup rate and traffic
+ * capacity of the BNG Blaster itself on a veth pair
+ * without any external device.
+ *
+ * Copyright (C) 2020-2021, RtBrick, Inc.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <linux/if_ether.h>
+
+#include "bbl_responder.h"
+
+static volatile sig_atomic_t g_teardown = 0;
+
+static struct option long_options[] = {
+    {"access-interface",    required_argument,  NULL, 'a'},
+    {"network-interface",   required_argument,  NULL, 'n'},
+    {"max-sessions",        required_argument,  NULL, 'm'},
+    {"authentication",      required_argument,  NULL, 'A'},
+    {"delay",               required_argument,  NULL, 'd'},
+    {"loss",                required_argument,  NULL, 'l'},
+    {"traffic-loss",        required_argument,  NULL, 't'},
+    {"help",                no_argument,        NULL, 'h'},
+    {NULL,                  0,                  NULL,  0}
+};
+
+static void
+responder_usage (void)
+{
+    printf("Usage: bbl-responder [OPTIONS]\n\n");
+    printf("  -a --access-interface <interface>   access interface facing the BNG Blaster access side\n");
+    printf("  -n --network-interface <interface>  network interface facing the BNG Blaster network side\n");
+    printf("  -m --max-sessions <sessions>        default %u, max %u\n", RESPONDER_DEFAULT_SESSIONS, RESPONDER_MAX_SESSIONS);
+    printf("  -A --authentication pap|chap        authentication protocol (default pap)\n");
+    printf("  -d --delay <msec>                   delay all control responses\n");
+    printf("  -l --loss <percent>                 drop received control packets\n");
+    printf("  -t --traffic-loss <percent>         drop forwarded BBL session traffic\n");
+    printf("  -h --help\n");
+}
+
+static void
+responder_teardown_handler (int sig)
+{
+    (void)sig;
+    g_teardown = 1;
+}
+
+static inline uint64_t
+responder_now (void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * NSEC + now.tv_nsec;
+}
+
+/*
+ * INTERFACES
+ * ------------------------------------------------------------------------
+ */
+
+static bool
+responder_open_interface (responder_interface_s *interface)
+{
+    struct ifreq ifr;
+    size_t ring_size;
+    int version, qdisc_bypass;
+
+    interface->fd_tx = socket(AF_PACKET, SOCK_RAW, htobe16(ETH_P_ALL));
+    interface->fd_rx = socket(AF_PACKET, SOCK_RAW, htobe16(ETH_P_ALL));
+    if(interface->fd_tx == -1 || interface->fd_rx == -1) {
+        fprintf(stderr, "socket() error %s (%d) for interface %s\n", strerror(errno), errno, interface->name);
+        return false;
+    }
+
+    version = TPACKET_V2;
+    if(setsockopt(interface->fd_tx, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) == -1 ||
+       setsockopt(interface->fd_rx, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) == -1) {
+        fprintf(stderr, "setsockopt() error %s (%d) for interface %s\n", strerror(errno), errno, interface->name);
+        return false;
+    }
+
+    memset(&ifr, 0, sizeof(ifr));
+    snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", interface->name);
+    if(ioctl(interface->fd_tx, SIOCGIFINDEX, &ifr) == -1) {
+        fprintf(stderr, "Get interface index error %s (%d) for interface %s\n", strerror(errno), errno, interface->name);
+        return false;
+    }
+    interface->addr.sll_family = AF_PACKET;
+    interface->addr.sll_ifindex = ifr.ifr_ifindex;
+    interface->addr.sll_protocol = htobe16(ETH_P_ALL);
+    if(bind(interface->fd_tx, (struct sockaddr*)&interface->addr, sizeof(interface->addr)) == -1 ||
+       bind(interface->fd_rx, (struct sockaddr*)&interface->addr, sizeof(interface->addr)) == -1) {
+        fprintf(stderr, "bind() error %s (%d) for interface %s\n", strerror(errno), errno, interface->name);
+        return false;
+    }
+
+    memset(&ifr, 0, sizeof(ifr));
+    snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", interface->name);
+    if(ioctl(interface->fd_rx, SIOCGIFHWADDR, &ifr) == -1) {
+        fprintf(stderr, "Getting MAC address error %s (%d) for interface %s\n", strerror(errno), errno, interface->name);
+        return false;
+    }
+    memcpy(interface->mac, ifr.ifr_hwaddr.sa_data, ETH_ADDR_LEN);
+
+    memset(&ifr, 0, sizeof(ifr));
+    snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", interface->name);
+    if(ioctl(interface->fd_rx, SIOCGIFFLAGS, &ifr) == -1) {
+        fprintf(stderr, "Getting socket flags error %s (%d) for interface %s\n", strerror(errno), errno, interface->name);
+        return false;
+    }
+    ifr.ifr_flags |= IFF_PROMISC;
+    if(ioctl(interface->fd_rx, SIOCSIFFLAGS, &ifr) == -1) {
+        fprintf(stderr, "Setting promiscuous mode error %s (%d) for interface %s\n", strerror(errno), errno, interface->name);
+        return false;
+    }
+
+    qdisc_bypass = 1;
+    if(setsockopt(interface->fd_tx, SOL_PACKET, PACKET_QDISC_BYPASS, &qdisc_bypass, sizeof(qdisc_bypass)) == -1) {
+        fprintf(stderr, "Setting qdisc bypass error %s (%d) for interface %s\n", strerror(errno), errno, interface->name);
+        return false;
+    }
+
+    interface->req_tx.tp_block_size = sysconf(_SC_PAGESIZE); /* 4096 */
+    interface->req_tx.tp_frame_size = interface->req_tx.tp_block_size/2; /* 2048 */
+    interface->req_tx.tp_block_nr = RESPONDER_RING_SLOTS/2;
+    interface->req_tx.tp_frame_nr = RESPONDER_RING_SLOTS;
+    if(setsockopt(interface->fd_tx, SOL_PACKET, PACKET_TX_RING, &interface->req_tx, sizeof(interface->req_tx)) == -1) {
+        fprintf(stderr, "Allocating TX ringbuffer error %s (%d) for interface %s\n", strerror(errno), errno, interface->name);
+        return false;
+    }
+    ring_size = interface->req_tx.tp_block_nr * interface->req_tx.tp_block_size;
+    interface->ring_tx = mmap(0, ring_size, PROT_READ|PROT_WRITE, MAP_SHARED, interface->fd_tx, 0);
+
+    interface->req_rx.tp_block_size = sysconf(_SC_PAGESIZE); /* 4096 */
+    interface->req_rx.tp_frame_size = interface->req_rx.tp_block_size/2; /* 2048 */
+    interface->req_rx.tp_block_nr = RESPONDER_RING_SLOTS;
+    interface->req_rx.tp_frame_nr = RESPONDER_RING_SLOTS*2;
+    if(setsockopt(interface->fd_rx, SOL_PACKET, PACKET_RX_RING, &interface->req_rx, sizeof(interface->req_rx)) == -1) {
+        fprintf(stderr, "Allocating RX ringbuffer error %s (%d) for interface %s\n", strerror(errno), errno, interface->name);
+        return false;
+    }
+    ring_size = interface->req_rx.tp_block_nr * interface->req_rx.tp_block_size;
+    interface->ring_rx = mmap(0, ring_size, PROT_READ|PROT_WRITE, MAP_SHARED, interface->fd_rx, 0);
+
+    if(interface->ring_tx == MAP_FAILED || interface->ring_rx == MAP_FAILED) {
+        fprintf(stderr, "mmap() error %s (%d) for interface %s\n", strerror(errno), errno, interface->name);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * TRANSMIT
+ * ------------------------------------------------------------------------
+ */
+
+static void
+responder_tx_flush (responder_interface_s *interface)
+{
+    if(interface->tx_pending) {
+        interface->tx_pending = false;
+        if(sendto(interface->fd_tx, NULL, 0 , 0, NULL, 0) == -1) {
+            interface->stats.sendto_failed++;
+        }
+    }
+}
+
+/*
+ * responder_tx_buf
+ *
+ * Return the frame buffer of the next free TX ring
+ * slot or NULL if the ring is full.
+ */
+uint8_t *
+responder_tx_buf (responder_ctx_s *ctx, responder_side_t side)
+{
+    responder_interface_s *interface = &ctx->interface[side];
+    struct tpacket2_hdr *tphdr;
+
+    tphdr = (struct tpacket2_hdr*)(interface->ring_tx + (interface->cursor_tx * interface->req_tx.tp_frame_size));
+    if(tphdr->tp_status != TP_STATUS_AVAILABLE) {
+        /* Kick the kernel and try again. */
+        responder_tx_flush(interface);
+        if(tphdr->tp_status != TP_STATUS_AVAILABLE) {
+            interface->stats.tx_busy++;
+            return NULL;
+        }
+    }
+    return (uint8_t*)tphdr + TPACKET2_HDRLEN - sizeof(struct sockaddr_ll);
+}
+
+void
+responder_tx_commit (responder_ctx_s *ctx, responder_side_t side, uint8_t *buf, uint len)
+{
+    responder_interface_s *interface = &ctx->interface[side];
+    struct tpacket2_hdr *tphdr;
+
+    tphdr = (struct tpacket2_hdr*)(buf - (TPACKET2_HDRLEN - sizeof(struct sockaddr_ll)));
+    tphdr->tp_len = len;
+    tphdr->tp_status = TP_STATUS_SEND_REQUEST;
+    interface->cursor_tx = (interface->cursor_tx + 1) % interface->req_tx.tp_frame_nr;
+    interface->tx_pending = true;
+    interface->stats.packets_tx++;
+}
+
+/*
+ * RECEIVE
+ * ------------------------------------------------------------------------
+ */
+
+static uint
+responder_rx_job (responder_ctx_s *ctx, responder_side_t side)
+{
+    responder_interface_s *interface = &ctx->interface[side];
+    struct tpacket2_hdr *tphdr;
+    uint packets = 0;
+
+    while(true) {
+        tphdr = (struct tpacket2_hdr*)(interface->ring_rx + (interface->cursor_rx * interface->req_rx.tp_frame_size));
+        if(!(tphdr->tp_status & TP_STATUS_USER)) {
+            break;
+        }
+        interface->stats.packets_rx++;
+        /* Ignore our own packets. */
+        if(memcmp((uint8_t*)tphdr + tphdr->tp_mac + ETH_ADDR_LEN, interface->mac, ETH_ADDR_LEN) != 0) {
+            if(side == RESPONDER_ACCESS) {
+                responder_rx_access(ctx, tphdr, (uint8_t*)tphdr + tphdr->tp_mac, tphdr->tp_len);
+            } else {
+                responder_rx_network(ctx, tphdr, (uint8_t*)tphdr + tphdr->tp_mac, tphdr->tp_len);
+            }
+        }
+        tphdr->tp_status = TP_STATUS_KERNEL; /* Return ownership back to kernel */
+        interface->cursor_rx = (interface->cursor_rx + 1) % interface->req_rx.tp_frame_nr;
+        packets++;
+    }
+    return packets;
+}
+
+int
+main (int argc, char *argv[])
+{
+    responder_ctx_s *ctx;
+    struct pollfd fds[RESPONDER_INTERFACE_MAX];
+    uint nfds = 0;
+    uint packets;
+    int ch, i;
+
+    ctx = calloc(1, sizeof(responder_ctx_s));
+    if(!ctx) {
+        return 1;
+    }
+    ctx->config.max_sessions = RESPONDER_DEFAULT_SESSIONS;
+    ctx->config.auth = PROTOCOL_PAP;
+
+    while((ch = getopt_long(argc, argv, "a:n:m:A:d:l:t:h", long_options, NULL)) != -1) {
+        switch(ch) {
+            case 'a':
+                ctx->interface[RESPONDER_ACCESS].name = optarg;
+                break;
+            case 'n':
+                ctx->interface[RESPONDER_NETWORK].name = optarg;
+                break;
+            case 'm':
+                ctx->config.max_sessions = strtoul(optarg, NULL, 0);
+                if(!ctx->config.max_sessions || ctx->config.max_sessions > RESPONDER_MAX_SESSIONS) {
+                    fprintf(stderr, "Invalid max sessions %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'A':
+                if(strcmp(optarg, "chap") == 0) {
+                    ctx->config.auth = PROTOCOL_CHAP;
+                } else if(strcmp(optarg, "pap") == 0) {
+                    ctx->config.auth = PROTOCOL_PAP;
+                } else {
+                    fprintf(stderr, "Invalid authentication protocol %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'd':
+                ctx->config.delay_nsec = strtoull(optarg, NULL, 0) * 1000000ULL;
+                break;
+            case 'l':
+                ctx->config.loss = strtod(optarg, NULL) * 10000;
+                break;
+            case 't':
+                ctx->config.traffic_loss = strtod(optarg, NULL) * 10000;
+                break;
+            default:
+                responder_usage();
+                return 0;
+        }
+    }
+    if(!ctx->interface[RESPONDER_ACCESS].name) {
+        responder_usage();
+        return 1;
+    }
+
+    for(i = 0; i < RESPONDER_INTERFACE_MAX; i++) {
+        if(!ctx->interface[i].name) {
+            continue;
+        }
+        ctx->interface[i].side = i;
+        if(!responder_open_interface(&ctx->interface[i])) {
+            return 1;
+        }
+        fds[nfds].fd = ctx->interface[i].fd_rx;
+        fds[nfds].events = POLLIN;
+        nfds++;
+    }
+    ctx->network_enabled = ctx->interface[RESPONDER_NETWORK].name ? true : false;
+
+    ctx->now_nsec = responder_now();
+    if(!responder_init(ctx)) {
+        fprintf(stderr, "Failed to allocate %u sessions\n", ctx->config.max_sessions);
+        return 1;
+    }
+
+    signal(SIGINT, responder_teardown_handler);
+    signal(SIGTERM, responder_teardown_handler);
+
+    printf("BNG Blaster Responder started on %s%s%s with %u sessions (%s)\n",
+           ctx->interface[RESPONDER_ACCESS].name,
+           ctx->network_enabled ? " and " : "",
+           ctx->network_enabled ? ctx->interface[RESPONDER_NETWORK].name : "",
+           ctx->config.max_sessions,
+           ctx->config.auth == PROTOCOL_CHAP ? "CHAP" : "PAP");
+
+    while(!g_teardown) {
+        ctx->now_nsec = responder_now();
+        packets = 0;
+        for(i = 0; i < RESPONDER_INTERFACE_MAX; i++) {
+            if(ctx->interface[i].name) {
+                packets += responder_rx_job(ctx, i);
+            }
+        }
+        responder_job(ctx);
+        for(i = 0; i < RESPONDER_INTERFACE_MAX; i++) {
+            if(ctx->interface[i].name) {
+                responder_tx_flush(&ctx->interface[i]);
+            }
+        }
+        if(!packets) {
+            /* Wait for packets but wake up for delayed responses. */
+            poll(fds, nfds, 1);
+        }
+    }
+
+    responder_stats_stdout(ctx);
+    return 0;
+}
@@ -0,0 +1,934 @@
+/*
+ * BNG Blaster Responder - Receive Handlers
+ *
+ * Copyright (C) 2020-2021, RtBrick, Inc.
+ */
+
+#include "bbl_responder.h"
+
+static const ipv6addr_t responder_link_local = {0xFE, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01};
+static const uint8_t responder_ip6cp_identifier[IPV6_IDENTIFER_LEN] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01};
+static char responder_name[] = "bbl-responder";
+
+/*
+ * Combine the VLAN from the packet socket meta data (if the outer
+ * tag was stripped by the kernel) with the VLAN tags in the frame.
+ */
+static void
+responder_vlan (struct tpacket2_hdr *tphdr, bbl_parse_t *parse, uint16_t *vlan)
+{
+    if(tphdr->tp_status & TP_STATUS_VLAN_VALID) {
+        vlan[0] = tphdr->tp_vlan_tci & ETH_VLAN_ID_MAX;
+        vlan[1] = parse->vlan_outer;
+        vlan[2] = parse->vlan_inner;
+    } else {
+        vlan[0] = parse->vlan_outer;
+        vlan[1] = parse->vlan_inner;
+        vlan[2] = parse->vlan_three;
+    }
+}
+
+static void
+responder_key (responder_key_t *key, uint8_t *mac, uint16_t *vlan)
+{
+    key->mac_vlan = 0;
+    memcpy(&key->mac_vlan, mac, ETH_ADDR_LEN);
+    key->mac_vlan |= (uint64_t)vlan[0] << 48;
+    key->vlan = (uint64_t)vlan[1] << 16 | vlan[2];
+}
+
+static void
+responder_session_prefix (responder_session_s *session, uint32_t base, ipv6_prefix *prefix)
+{
+    memset(prefix, 0x0, sizeof(ipv6_prefix));
+    prefix->len = 64;
+    *(uint32_t*)&prefix->address[0] = htobe32(base);
+    *(uint32_t*)&prefix->address[4] = htobe32(session->idx);
+}
+
+/*
+ * Write ethernet header including VLAN tags
+ * and return the header length.
+ */
+static inline uint
+responder_eth_header (uint8_t *buf, uint8_t *dst, uint8_t *src, uint16_t *vlan, uint16_t type)
+{
+    uint len = 12;
+    int i;
+
+    memcpy(buf, dst, ETH_ADDR_LEN);
+    memcpy(buf+ETH_ADDR_LEN, src, ETH_ADDR_LEN);
+    for(i = 0; i < MAX_VLANS && vlan[i]; i++) {
+        *(uint16_t*)(buf+len) = htobe16(ETH_TYPE_VLAN);
+        *(uint16_t*)(buf+len+2) = htobe16(vlan[i]);
+        len += 4;
+    }
+    *(uint16_t*)(buf+len) = htobe16(type);
+    return len + 2;
+}
+
+/*
+ * Send a control packet to the session, encapsulated
+ * in PPPoE for PPPoE sessions.
+ */
+static void
+responder_session_send (responder_ctx_s *ctx, responder_session_s *session,
+                        uint16_t protocol, void *next)
+{
+    bbl_ethernet_header_t eth = {0};
+    bbl_pppoe_session_t pppoes = {0};
+
+    eth.dst = session->mac;
+    eth.vlan_outer = session->vlan[0];
+    eth.vlan_inner = session->vlan[1];
+    eth.vlan_three = session->vlan[2];
+    if(session->type == RESPONDER_SESSION_PPPOE) {
+        eth.type = ETH_TYPE_PPPOE_SESSION;
+        eth.next = &pppoes;
+        pppoes.session_id = session->idx + 1;
+        pppoes.protocol = protocol;
+        pppoes.next = next;
+    } else {
+        eth.type = protocol;
+        eth.next = next;
+    }
+    responder_send(ctx, RESPONDER_ACCESS, &eth);
+}
+
+/*
+ * REQUESTS
+ * ------------------------------------------------------------------------
+ */
+
+static void
+responder_lcp_request (responder_ctx_s *ctx, responder_session_s *session)
+{
+    bbl_lcp_t lcp = {0};
+    uint8_t options[16];
+    uint8_t len = 0;
+
+    options[len++] = PPP_LCP_OPTION_MRU;
+    options[len++] = 4;
+    *(uint16_t*)&options[len] = htobe16(1492);
+    len += 2;
+    options[len++] = PPP_LCP_OPTION_AUTH;
+    if(ctx->config.auth == PROTOCOL_CHAP) {
+        options[len++] = 5;
+        *(uint16_t*)&options[len] = htobe16(PROTOCOL_CHAP);
+        len += 2;
+        options[len++] = 5; /* MD5 */
+    } else {
+        options[len++] = 4;
+        *(uint16_t*)&options[len] = htobe16(PROTOCOL_PAP);
+        len += 2;
+    }
+    options[len++] = PPP_LCP_OPTION_MAGIC;
+    options[len++] = 6;
+    *(uint32_t*)&options[len] = session->magic;
+    len += 4;
+
+    lcp.code = PPP_CODE_CONF_REQUEST;
+    lcp.identifier = 1;
+    lcp.options = options;
+    lcp.options_len = len;
+    responder_session_send(ctx, session, PROTOCOL_LCP, &lcp);
+}
+
+static void
+responder_chap_challenge (responder_ctx_s *ctx, responder_session_s *session)
+{
+    bbl_chap_t chap = {0};
+
+    chap.code = CHAP_CODE_CHALLENGE;
+    chap.identifier = 1;
+    chap.challenge = session->challenge;
+    chap.challenge_len = RESPONDER_CHAP_CHALLENGE_LEN;
+    chap.name = responder_name;
+    chap.name_len = sizeof(responder_name) - 1;
+    responder_session_send(ctx, session, PROTOCOL_CHAP, &chap);
+}
+
+static void
+responder_ipcp_request (responder_ctx_s *ctx, responder_session_s *session)
+{
+    bbl_ipcp_t ipcp = {0};
+
+    ipcp.code = PPP_CODE_CONF_REQUEST;
+    ipcp.identifier = 1;
+    ipcp.option_address = true;
+    ipcp.address = htobe32(RESPONDER_IPV4_GATEWAY);
+    responder_session_send(ctx, session, PROTOCOL_IPCP, &ipcp);
+}
+
+static void
+responder_ip6cp_request (responder_ctx_s *ctx, responder_session_s *session)
+{
+    bbl_ip6cp_t ip6cp = {0};
+
+    ip6cp.code = PPP_CODE_CONF_REQUEST;
+    ip6cp.identifier = 1;
+    ip6cp.ipv6_identifier = *(uint64_t*)responder_ip6cp_identifier;
+    responder_session_send(ctx, session, PROTOCOL_IP6CP, &ip6cp);
+}
+
+static void
+responder_pending (responder_ctx_s *ctx, responder_session_s *session, uint8_t request)
+{
+    session->pending |= request;
+    session->retry_nsec = ctx->now_nsec + RESPONDER_RETRY_INTERVAL_NSEC;
+}
+
+/*
+ * responder_retry
+ *
+ * Repeat all requests which are not answered by the client.
+ */
+void
+responder_retry (responder_ctx_s *ctx, responder_session_s *session)
+{
+    if(session->pending & RESPONDER_PENDING_LCP) {
+        responder_lcp_request(ctx, session);
+    }
+    if(session->pending & RESPONDER_PENDING_CHAP) {
+        responder_chap_challenge(ctx, session);
+    }
+    if(session->pending & RESPONDER_PENDING_IPCP) {
+        responder_ipcp_request(ctx, session);
+    }
+    if(session->pending & RESPONDER_PENDING_IP6CP) {
+        responder_ip6cp_request(ctx, session);
+    }
+    session->retry_nsec = ctx->now_nsec + RESPONDER_RETRY_INTERVAL_NSEC;
+}
+
+/*
+ * PPPOE
+ * ------------------------------------------------------------------------
+ */
+
+static void
+responder_rx_discovery (responder_ctx_s *ctx, bbl_ethernet_header_t *eth, responder_key_t *key, uint16_t *vlan)
+{
+    bbl_pppoe_discovery_t *pppoed = (bbl_pppoe_discovery_t*)eth->next;
+    bbl_pppoe_discovery_t reply = {0};
+    responder_session_s *session;
+
+    switch(pppoed->code) {
+        case PPPOE_PADI:
+            ctx->stats.padi++;
+            reply.code = PPPOE_PADO;
+            reply.ac_cookie = ctx->ac_cookie;
+            reply.ac_cookie_len = RESPONDER_AC_COOKIE_LEN;
+            break;
+        case PPPOE_PADR:
+            ctx->stats.padr++;
+            session = responder_session_get(ctx, key, eth->src, vlan, RESPONDER_SESSION_PPPOE);
+            if(!session || session->type != RESPONDER_SESSION_PPPOE) {
+                return;
+            }
+            reply.code = PPPOE_PADS;
+            reply.session_id = session->idx + 1;
+            break;
+        case PPPOE_PADT:
+            ctx->stats.padt++;
+            if(pppoed->session_id && pppoed->session_id <= ctx->config.max_sessions) {
+                session = &ctx->sessions[pppoed->session_id - 1];
+                if(session->type == RESPONDER_SESSION_PPPOE &&
+                   session->key.mac_vlan == key->mac_vlan && session->key.vlan == key->vlan) {
+                    responder_session_free(ctx, session);
+                }
+            }
+            return;
+        default:
+            return;
+    }
+
+    eth->dst = eth->src;
+    eth->vlan_outer = vlan[0];
+    eth->vlan_inner = vlan[1];
+    eth->vlan_three = vlan[2];
+    eth->next = &reply;
+    responder_send(ctx, RESPONDER_ACCESS, eth);
+}
+
+static void
+responder_rx_lcp (responder_ctx_s *ctx, responder_session_s *session, bbl_lcp_t *lcp)
+{
+    bbl_lcp_t reply = {0};
+
+    ctx->stats.lcp++;
+    reply.identifier = lcp->identifier;
+    switch(lcp->code) {
+        case PPP_CODE_CONF_REQUEST:
+            reply.code = PPP_CODE_CONF_ACK;
+            reply.options = lcp->options;
+            reply.options_len = lcp->options_len;
+            responder_session_send(ctx, session, PROTOCOL_LCP, &reply);
+            session->lcp_ack_sent = true;
+            if(!session->lcp_opened && !(session->pending & RESPONDER_PENDING_LCP)) {
+                responder_lcp_request(ctx, session);
+                responder_pending(ctx, session, RESPONDER_PENDING_LCP);
+            }
+            return;
+        case PPP_CODE_CONF_ACK:
+            if(!(session->pending & RESPONDER_PENDING_LCP)) {
+                return;
+            }
+            session->pending &= ~RESPONDER_PENDING_LCP;
+            session->lcp_opened = true;
+            if(ctx->config.auth == PROTOCOL_CHAP) {
+                *(uint64_t*)&session->challenge[0] = responder_random(ctx);
+                *(uint64_t*)&session->challenge[8] = responder_random(ctx);
+                responder_chap_challenge(ctx, session);
+                responder_pending(ctx, session, RESPONDER_PENDING_CHAP);
+            }
+            return;
+        case PPP_CODE_ECHO_REQUEST:
+            reply.code = PPP_CODE_ECHO_REPLY;
+            reply.magic = session->magic;
+            break;
+        case PPP_CODE_TERM_REQUEST:
+            reply.code = PPP_CODE_TERM_ACK;
+            session->pending = 0;
+            session->lcp_opened = false;
+            session->lcp_ack_sent = false;
+            break;
+        default:
+            return;
+    }
+    responder_session_send(ctx, session, PROTOCOL_LCP, &reply);
+}
+
+static void
+responder_rx_pap (responder_ctx_s *ctx, responder_session_s *session, bbl_pap_t *pap)
+{
+    bbl_pap_t reply = {0};
+
+    ctx->stats.pap++;
+    if(pap->code != PAP_CODE_REQUEST || !session->lcp_opened) {
+        return;
+    }
+    reply.code = PAP_CODE_ACK;
+    reply.identifier = pap->identifier;
+    responder_session_send(ctx, session, PROTOCOL_PAP, &reply);
+}
+
+static void
+responder_rx_chap (responder_ctx_s *ctx, responder_session_s *session, bbl_chap_t *chap)
+{
+    bbl_chap_t reply = {0};
+
+    ctx->stats.chap++;
+    if(chap->code != CHAP_CODE_RESPONSE || !session->lcp_opened) {
+        return;
+    }
+    /* The response is not verified, any password is accepted. */
+    session->pending &= ~RESPONDER_PENDING_CHAP;
+    reply.code = CHAP_CODE_SUCCESS;
+    reply.identifier = chap->identifier;
+    responder_session_send(ctx, session, PROTOCOL_CHAP, &reply);
+}
+
+static void
+responder_rx_ipcp (responder_ctx_s *ctx, responder_session_s *session, bbl_ipcp_t *ipcp)
+{
+    bbl_ipcp_t reply = {0};
+    responder_key_t ipv4_key = {0};
+    uint32_t dns = htobe32(RESPONDER_IPV4_GATEWAY);
+
+    ctx->stats.ipcp++;
+    switch(ipcp->code) {
+        case PPP_CODE_CONF_REQUEST:
+            reply.identifier = ipcp->identifier;
+            if(ipcp->address == session->ipv4 &&
+               (!ipcp->option_dns1 || ipcp->dns1 == dns) &&
+               (!ipcp->option_dns2 || ipcp->dns2 == dns)) {
+                reply.code = PPP_CODE_CONF_ACK;
+                reply.options = ipcp->options;
+                reply.options_len = ipcp->options_len;
+                ipv4_key.mac_vlan = session->ipv4;
+                responder_hash_insert(&ctx->ipv4_hash, &ipv4_key, session->idx);
+            } else {
+                reply.code = PPP_CODE_CONF_NAK;
+                reply.option_address = true;
+                reply.address = session->ipv4;
+                reply.option_dns1 = ipcp->option_dns1;
+                reply.dns1 = dns;
+                reply.option_dns2 = ipcp->option_dns2;
+                reply.dns2 = dns;
+            }
+            responder_session_send(ctx, session, PROTOCOL_IPCP, &reply);
+            if(!session->ipcp_opened && !(session->pending & RESPONDER_PENDING_IPCP)) {
+                responder_ipcp_request(ctx, session);
+                responder_pending(ctx, session, RESPONDER_PENDING_IPCP);
+            }
+            break;
+        case PPP_CODE_CONF_ACK:
+            if(session->pending & RESPONDER_PENDING_IPCP) {
+                session->pending &= ~RESPONDER_PENDING_IPCP;
+                session->ipcp_opened = true;
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+static void
+responder_rx_ip6cp (responder_ctx_s *ctx, responder_session_s *session, bbl_ip6cp_t *ip6cp)
+{
+    bbl_ip6cp_t reply = {0};
+
+    ctx->stats.ip6cp++;
+    switch(ip6cp->code) {
+        case PPP_CODE_CONF_REQUEST:
+            reply.code = PPP_CODE_CONF_ACK;
+            reply.identifier = ip6cp->identifier;
+            reply.options = ip6cp->options;
+            reply.options_len = ip6cp->options_len;
+            responder_session_send(ctx, session, PROTOCOL_IP6CP, &reply);
+            if(!session->ip6cp_opened && !(session->pending & RESPONDER_PENDING_IP6CP)) {
+                responder_ip6cp_request(ctx, session);
+                responder_pending(ctx, session, RESPONDER_PENDING_IP6CP);
+            }
+            break;
+        case PPP_CODE_CONF_ACK:
+            if(session->pending & RESPONDER_PENDING_IP6CP) {
+                session->pending &= ~RESPONDER_PENDING_IP6CP;
+                session->ip6cp_opened = true;
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+ * IPV6
+ * ------------------------------------------------------------------------
+ */
+
+static void
+responder_send_icmpv6 (responder_ctx_s *ctx, responder_session_s *session,
+                       uint8_t *dst, bbl_icmpv6_t *icmpv6)
+{
+    bbl_ipv6_t ipv6 = {0};
+
+    ipv6.src = (uint8_t*)responder_link_local;
+    ipv6.dst = dst;
+    ipv6.protocol = IPV6_NEXT_HEADER_ICMPV6;
+    ipv6.ttl = 255;
+    ipv6.next = icmpv6;
+    responder_session_send(ctx, session,
+                           session->type == RESPONDER_SESSION_PPPOE ? PROTOCOL_IPV6 : ETH_TYPE_IPV6,
+                           &ipv6);
+}
+
+/*
+ * Search the client identifier option which
+ * is not stored by the DHCPv6 decoder.
+ */
+static bool
+responder_dhcpv6_client_duid (uint8_t *buf, uint len, uint8_t **duid, uint16_t *duid_len)
+{
+    uint16_t option, option_len;
+
+    if(len < DHCPV6_HDR_LEN) {
+        return false;
+    }
+    BUMP_BUFFER(buf, len, DHCPV6_HDR_LEN);
+    while(len >= DHCPV6_OPTION_HDR_LEN) {
+        option = be16toh(*(uint16_t*)buf);
+        option_len = be16toh(*(uint16_t*)(buf+2));
+        BUMP_BUFFER(buf, len, DHCPV6_OPTION_HDR_LEN);
+        if(option_len > len) {
+            return false;
+        }
+        if(option == DHCPV6_OPTION_CLIENTID) {
+            *duid = buf;
+            *duid_len = option_len;
+            return option_len <= DHCPV6_DUID_LEN_MAX;
+        }
+        BUMP_BUFFER(buf, len, option_len);
+    }
+    return false;
+}
+
+static void
+responder_rx_dhcpv6 (responder_ctx_s *ctx, responder_session_s *session, bbl_ipv6_t *ipv6,
+                     uint8_t *buf, bbl_parse_t *parse)
+{
+    bbl_udp_t *udp = (bbl_udp_t*)ipv6->next;
+    bbl_dhcpv6_t *dhcpv6 = (bbl_dhcpv6_t*)udp->next;
+    bbl_ipv6_t reply_ipv6 = {0};
+    bbl_udp_t reply_udp = {0};
+    bbl_dhcpv6_t reply = {0};
+    ipv6_prefix prefix;
+    uint8_t *duid;
+    uint16_t duid_len;
+
+    ctx->stats.dhcpv6++;
+    if(udp->dst != DHCPV6_UDP_SERVER || !parse->payload_offset) {
+        return;
+    }
+    if(!responder_dhcpv6_client_duid(buf + parse->payload_offset, udp->payload_len, &duid, &duid_len)) {
+        return;
+    }
+    switch(dhcpv6->type) {
+        case DHCPV6_MESSAGE_SOLICIT:
+            if(dhcpv6->rapid) {
+                reply.type = DHCPV6_MESSAGE_REPLY;
+                reply.rapid = true;
+            } else {
+                reply.type = DHCPV6_MESSAGE_ADVERTISE;
+            }
+            break;
+        case DHCPV6_MESSAGE_REQUEST:
+        case DHCPV6_MESSAGE_RENEW:
+        case DHCPV6_MESSAGE_REBIND:
+            reply.type = DHCPV6_MESSAGE_REPLY;
+            break;
+        default:
+            return;
+    }
+    reply.transaction_id = htobe32(dhcpv6->transaction_id);
+    reply.client_duid = duid;
+    reply.client_duid_len = duid_len;
+    reply.server_duid = ctx->server_duid;
+    reply.server_duid_len = RESPONDER_SERVER_DUID_LEN;
+    if(dhcpv6->ia_pd_option && dhcpv6->ia_pd_option_len >= sizeof(uint32_t)) {
+        responder_session_prefix(session, RESPONDER_IPV6_PD_PREFIX, &prefix);
+        reply.delegated_prefix_iaid = *(uint32_t*)dhcpv6->ia_pd_option;
+        reply.delegated_prefix = &prefix;
+    }
+
+    reply_udp.src = DHCPV6_UDP_SERVER;
+    reply_udp.dst = DHCPV6_UDP_CLIENT;
+    reply_udp.protocol = UDP_PROTOCOL_DHCPV6;
+    reply_udp.next = &reply;
+    reply_ipv6.src = (uint8_t*)responder_link_local;
+    reply_ipv6.dst = ipv6->src;
+    reply_ipv6.protocol = IPV6_NEXT_HEADER_UDP;
+    reply_ipv6.ttl = 255;
+    reply_ipv6.next = &reply_udp;
+    responder_session_send(ctx, session,
+                           session->type == RESPONDER_SESSION_PPPOE ? PROTOCOL_IPV6 : ETH_TYPE_IPV6,
+                           &reply_ipv6);
+}
+
+static void
+responder_rx_ipv6 (responder_ctx_s *ctx, responder_session_s *session, bbl_ipv6_t *ipv6,
+                   uint8_t *buf, bbl_parse_t *parse)
+{
+    bbl_icmpv6_t *icmpv6;
+    bbl_icmpv6_t reply = {0};
+
+    if(ipv6->protocol == IPV6_NEXT_HEADER_UDP) {
+        if(ipv6->next && ((bbl_udp_t*)ipv6->next)->protocol == UDP_PROTOCOL_DHCPV6) {
+            responder_rx_dhcpv6(ctx, session, ipv6, buf, parse);
+        }
+        return;
+    }
+    if(ipv6->protocol != IPV6_NEXT_HEADER_ICMPV6) {
+        return;
+    }
+    ctx->stats.icmpv6++;
+    icmpv6 = (bbl_icmpv6_t*)ipv6->next;
+    switch(icmpv6->type) {
+        case IPV6_ICMPV6_ROUTER_SOLICITATION:
+            reply.type = IPV6_ICMPV6_ROUTER_ADVERTISEMENT;
+            reply.other = true;
+            reply.mac = ctx->interface[RESPONDER_ACCESS].mac;
+            responder_session_prefix(session, RESPONDER_IPV6_RA_PREFIX, &reply.prefix);
+            responder_send_icmpv6(ctx, session, (uint8_t*)ipv6_multicast_all_nodes, &reply);
+            break;
+        case IPV6_ICMPV6_NEIGHBOR_SOLICITATION:
+            if(*(uint64_t*)ipv6->src == 0) {
+                /* Ignore duplicate address detection. */
+                break;
+            }
+            reply.type = IPV6_ICMPV6_NEIGHBOR_ADVERTISEMENT;
+            reply.mac = ctx->interface[RESPONDER_ACCESS].mac;
+            memcpy(reply.prefix.address, icmpv6->prefix.address, IPV6_ADDR_LEN);
+            responder_send_icmpv6(ctx, session, ipv6->src, &reply);
+            break;
+        default:
+            break;
+    }
+}
+
+static void
+responder_rx_pppoe_session (responder_ctx_s *ctx, bbl_ethernet_header_t *eth, responder_key_t *key,
+                            uint8_t *buf, bbl_parse_t *parse)
+{
+    bbl_pppoe_session_t *pppoes = (bbl_pppoe_session_t*)eth->next;
+    responder_session_s *session;
+
+    if(!pppoes->session_id || pppoes->session_id > ctx->config.max_sessions) {
+        return;
+    }
+    session = &ctx->sessions[pppoes->session_id - 1];
+    if(session->type != RESPONDER_SESSION_PPPOE ||
+       session->key.mac_vlan != key->mac_vlan || session->key.vlan != key->vlan) {
+        return;
+    }
+
+    switch(pppoes->protocol) {
+        case PROTOCOL_LCP:
+            responder_rx_lcp(ctx, session, (bbl_lcp_t*)pppoes->next);
+            break;
+        case PROTOCOL_PAP:
+            responder_rx_pap(ctx, session, (bbl_pap_t*)pppoes->next);
+            break;
+        case PROTOCOL_CHAP:
+            responder_rx_chap(ctx, session, (bbl_chap_t*)pppoes->next);
+            break;
+        case PROTOCOL_IPCP:
+            responder_rx_ipcp(ctx, session, (bbl_ipcp_t*)pppoes->next);
+            break;
+        case PROTOCOL_IP6CP:
+            responder_rx_ip6cp(ctx, session, (bbl_ip6cp_t*)pppoes->next);
+            break;
+        case PROTOCOL_IPV6:
+            responder_rx_ipv6(ctx, session, (bbl_ipv6_t*)pppoes->next, buf, parse);
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+ * IPOE
+ * ------------------------------------------------------------------------
+ */
+
+static void
+responder_rx_arp_access (responder_ctx_s *ctx, bbl_ethernet_header_t *eth, responder_key_t *key, uint16_t *vlan)
+{
+    bbl_arp_t *arp = (bbl_arp_t*)eth->next;
+    bbl_arp_t reply = {0};
+    responder_session_s *session;
+    responder_key_t ipv4_key = {0};
+
+    ctx->stats.arp++;
+    if(arp->code != ARP_REQUEST || !arp->sender_ip || arp->sender_ip == arp->target_ip) {
+        return;
+    }
+    session = responder_session_get(ctx, key, eth->src, vlan, RESPONDER_SESSION_IPOE);
+    if(!session) {
+        return;
+    }
+    if(session->ipv4 != arp->sender_ip) {
+        if(session->ipv4) {
+            ipv4_key.mac_vlan = session->ipv4;
+            responder_hash_delete(&ctx->ipv4_hash, &ipv4_key);
+        }
+        session->ipv4 = arp->sender_ip;
+        ipv4_key.mac_vlan = session->ipv4;
+        responder_hash_insert(&ctx->ipv4_hash, &ipv4_key, session->idx);
+    }
+
+    reply.code = ARP_REPLY;
+    reply.sender = ctx->interface[RESPONDER_ACCESS].mac;
+    reply.sender_ip = arp->target_ip;
+    reply.target = arp->sender;
+    reply.target_ip = arp->sender_ip;
+    responder_session_send(ctx, session, ETH_TYPE_ARP, &reply);
+}
+
+/*
+ * TRAFFIC
+ * ------------------------------------------------------------------------
+ */
+
+/*
+ * Return the IP packet length from the IP header or
+ * zero if it exceeds the received frame.
+ */
+static inline uint16_t
+responder_ip_len (uint8_t *buf, uint8_t *ip, bbl_parse_t *parse)
+{
+    uint remaining = parse->len - (ip - buf);
+    uint ip_len;
+
+    if(parse->l3_type == ETH_TYPE_IPV4) {
+        ip_len = be16toh(*(uint16_t*)(ip+2));
+        if(ip_len < 20) {
+            return 0;
+        }
+    } else {
+        ip_len = be16toh(*(uint16_t*)(ip+4)) + 40;
+    }
+    if(ip_len > remaining) {
+        return 0;
+    }
+    return ip_len;
+}
+
+/*
+ * Forward BBL session traffic received from
+ * the access side to the network interface.
+ */
+static void
+responder_forward_upstream (responder_ctx_s *ctx, uint8_t *buf, bbl_parse_t *parse)
+{
+    uint8_t *ip = buf + parse->l3_offset;
+    uint8_t *tx;
+    uint16_t ip_len;
+    uint len;
+
+    if(parse->eth_type == ETH_TYPE_PPPOE_SESSION) {
+        ip += 8;
+    }
+    ip_len = responder_ip_len(buf, ip, parse);
+    if(!ip_len) {
+        ctx->stats.traffic_invalid++;
+        return;
+    }
+    if(!ctx->network_resolved) {
+        ctx->stats.traffic_unresolved++;
+        return;
+    }
+    if(responder_random_loss(ctx, ctx->config.traffic_loss)) {
+        ctx->stats.traffic_loss++;
+        return;
+    }
+    tx = responder_tx_buf(ctx, RESPONDER_NETWORK);
+    if(!tx) {
+        return;
+    }
+    len = responder_eth_header(tx, ctx->network_peer_mac, ctx->interface[RESPONDER_NETWORK].mac,
+                               ctx->network_vlan, parse->l3_type);
+    memcpy(tx + len, ip, ip_len);
+    responder_tx_commit(ctx, RESPONDER_NETWORK, tx, len + ip_len);
+    ctx->stats.traffic_upstream++;
+}
+
+/*
+ * Forward BBL session traffic received from the
+ * network side to the session of the destination.
+ */
+static void
+responder_forward_downstream (responder_ctx_s *ctx, uint8_t *buf, bbl_parse_t *parse)
+{
+    responder_session_s *session = NULL;
+    responder_key_t ipv4_key = {0};
+    uint8_t *ip = buf + parse->l3_offset;
+    uint8_t *tx;
+    uint16_t ip_len;
+    uint32_t idx, prefix;
+    uint len;
+
+    ip_len = responder_ip_len(buf, ip, parse);
+    if(!ip_len) {
+        ctx->stats.traffic_invalid++;
+        return;
+    }
+    if(parse->l3_type == ETH_TYPE_IPV4) {
+        ipv4_key.mac_vlan = *(uint32_t*)(ip+16);
+        if(responder_hash_lookup(&ctx->ipv4_hash, &ipv4_key, &idx)) {
+            session = &ctx->sessions[idx];
+        }
+    } else {
+        /* Session index is encoded in the RA and PD prefix. */
+        prefix = be32toh(*(uint32_t*)(ip+24));
+        idx = be32toh(*(uint32_t*)(ip+28));
+        if((prefix == RESPONDER_IPV6_RA_PREFIX || prefix == RESPONDER_IPV6_PD_PREFIX) &&
+           idx < ctx->config.max_sessions) {
+            session = &ctx->sessions[idx];
+        }
+    }
+    if(!session || session->type == RESPONDER_SESSION_FREE) {
+        ctx->stats.traffic_no_session++;
+        return;
+    }
+    if(responder_random_loss(ctx, ctx->config.traffic_loss)) {
+        ctx->stats.traffic_loss++;
+        return;
+    }
+    tx = responder_tx_buf(ctx, RESPONDER_ACCESS);
+    if(!tx) {
+        return;
+    }
+    if(session->type == RESPONDER_SESSION_PPPOE) {
+        len = responder_eth_header(tx, session->mac, ctx->interface[RESPONDER_ACCESS].mac,
+                                   session->vlan, ETH_TYPE_PPPOE_SESSION);
+        *(tx+len) = 17;
+        *(tx+len+1) = 0;
+        *(uint16_t*)(tx+len+2) = htobe16(session->idx + 1);
+        *(uint16_t*)(tx+len+4) = htobe16(ip_len + 2);
+        *(uint16_t*)(tx+len+6) = htobe16(parse->l3_type == ETH_TYPE_IPV4 ? PROTOCOL_IPV4 : PROTOCOL_IPV6);
+        len += 8;
+    } else {
+        len = responder_eth_header(tx, session->mac, ctx->interface[RESPONDER_ACCESS].mac,
+                                   session->vlan, parse->l3_type);
+    }
+    memcpy(tx + len, ip, ip_len);
+    responder_tx_commit(ctx, RESPONDER_ACCESS, tx, len + ip_len);
+    ctx->stats.traffic_downstream++;
+}
+
+/*
+ * ACCESS
+ * ------------------------------------------------------------------------
+ */
+
+void
+responder_rx_access (responder_ctx_s *ctx, struct tpacket2_hdr *tphdr, uint8_t *buf, uint len)
+{
+    responder_interface_s *interface = &ctx->interface[RESPONDER_ACCESS];
+    bbl_ethernet_header_t *eth;
+    bbl_parse_t parse;
+    responder_key_t key;
+    responder_session_s *session;
+    uint16_t vlan[MAX_VLANS];
+    protocol_error_t result;
+
+    result = parse_ethernet(buf, len, &parse);
+    if(result == UNKNOWN_PROTOCOL) {
+        return;
+    }
+    if(result != PROTOCOL_SUCCESS) {
+        interface->stats.decode_error++;
+        return;
+    }
+
+    /* Fast path for BBL session traffic. */
+    if(parse.dst_port == BBL_UDP_PORT) {
+        if(ctx->network_enabled) {
+            responder_forward_upstream(ctx, buf, &parse);
+        }
+        return;
+    }
+
+    if(responder_random_loss(ctx, ctx->config.loss)) {
+        ctx->stats.control_loss++;
+        return;
+    }
+    result = decode_ethernet(buf, len, ctx->sp, RESPONDER_SCRATCHPAD_LEN, &eth);
+    if(result != PROTOCOL_SUCCESS) {
+        if(result != UNKNOWN_PROTOCOL) {
+            interface->stats.decode_error++;
+        }
+        return;
+    }
+    responder_vlan(tphdr, &parse, vlan);
+    responder_key(&key, eth->src, vlan);
+
+    switch(eth->type) {
+        case ETH_TYPE_PPPOE_DISCOVERY:
+            responder_rx_discovery(ctx, eth, &key, vlan);
+            break;
+        case ETH_TYPE_PPPOE_SESSION:
+            responder_rx_pppoe_session(ctx, eth, &key, buf, &parse);
+            break;
+        case ETH_TYPE_ARP:
+            responder_rx_arp_access(ctx, eth, &key, vlan);
+            break;
+        case ETH_TYPE_IPV6:
+            session = responder_session_get(ctx, &key, eth->src, vlan, RESPONDER_SESSION_IPOE);
+            if(session && session->type == RESPONDER_SESSION_IPOE) {
+                responder_rx_ipv6(ctx, session, (bbl_ipv6_t*)eth->next, buf, &parse);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+ * NETWORK
+ * ------------------------------------------------------------------------
+ */
+
+static void
+responder_network_learn (responder_ctx_s *ctx, bbl_ethernet_header_t *eth, uint16_t *vlan)
+{
+    if(!ctx->network_resolved) {
+        memcpy(ctx->network_peer_mac, eth->src, ETH_ADDR_LEN);
+        memcpy(ctx->network_vlan, vlan, sizeof(ctx->network_vlan));
+        ctx->network_resolved = true;
+    }
+    eth->dst = eth->src;
+    eth->vlan_outer = vlan[0];
+    eth->vlan_inner = vlan[1];
+    eth->vlan_three = vlan[2];
+}
+
+void
+responder_rx_network (responder_ctx_s *ctx, struct tpacket2_hdr *tphdr, uint8_t *buf, uint len)
+{
+    responder_interface_s *interface = &ctx->interface[RESPONDER_NETWORK];
+    bbl_ethernet_header_t *eth;
+    bbl_parse_t parse;
+    bbl_arp_t *arp;
+    bbl_arp_t arp_reply = {0};
+    bbl_ipv6_t *ipv6;
+    bbl_ipv6_t ipv6_reply = {0};
+    bbl_icmpv6_t *icmpv6;
+    bbl_icmpv6_t icmpv6_reply = {0};
+    uint16_t vlan[MAX_VLANS];
+    protocol_error_t result;
+
+    result = parse_ethernet(buf, len, &parse);
+    if(result == UNKNOWN_PROTOCOL) {
+        return;
+    }
+    if(result != PROTOCOL_SUCCESS) {
+        interface->stats.decode_error++;
+        return;
+    }
+
+    /* Fast path for BBL session traffic. */
+    if(parse.dst_port == BBL_UDP_PORT) {
+        responder_forward_downstream(ctx, buf, &parse);
+        return;
+    }
+
+    if(parse.eth_type != ETH_TYPE_ARP &&
+       !(parse.l3_type == ETH_TYPE_IPV6 && parse.ip_protocol == IPV6_NEXT_HEADER_ICMPV6)) {
+        return;
+    }
+    if(decode_ethernet(buf, len, ctx->sp, RESPONDER_SCRATCHPAD_LEN, &eth) != PROTOCOL_SUCCESS) {
+        interface->stats.decode_error++;
+        return;
+    }
+    responder_vlan(tphdr, &parse, vlan);
+
+    /* Answer all address resolution requests (proxy),
+     * such that any gateway address can be used. */
+    if(eth->type == ETH_TYPE_ARP) {
+        ctx->stats.arp++;
+        arp = (bbl_arp_t*)eth->next;
+        if(arp->code != ARP_REQUEST || arp->sender_ip == arp->target_ip) {
+            return;
+        }
+        responder_network_learn(ctx, eth, vlan);
+        arp_reply.code = ARP_REPLY;
+        arp_reply.sender = interface->mac;
+        arp_reply.sender_ip = arp->target_ip;
+        arp_reply.target = arp->sender;
+        arp_reply.target_ip = arp->sender_ip;
+        eth->next = &arp_reply;
+        responder_send(ctx, RESPONDER_NETWORK, eth);
+    } else {
+        ctx->stats.icmpv6++;
+        ipv6 = (bbl_ipv6_t*)eth->next;
+        icmpv6 = (bbl_icmpv6_t*)ipv6->next;
+        if(icmpv6->type != IPV6_ICMPV6_NEIGHBOR_SOLICITATION || *(uint64_t*)ipv6->src == 0) {
+            return;
+        }
+        responder_network_learn(ctx, eth, vlan);
+        icmpv6_reply.type = IPV6_ICMPV6_NEIGHBOR_ADVERTISEMENT;
+        icmpv6_reply.mac = interface->mac;
+        memcpy(icmpv6_reply.prefix.address, icmpv6->prefix.address, IPV6_ADDR_LEN);
+        ipv6_reply.src = icmpv6->prefix.address;
+        ipv6_reply.dst = ipv6->src;
+        ipv6_reply.protocol = IPV6_NEXT_HEADER_ICMPV6;
+        ipv6_reply.ttl = 255;
+        ipv6_reply.next = &icmpv6_reply;
+        eth->type = ETH_TYPE_IPV6;
+        eth->next = &ipv6_reply;
+        responder_send(ctx, RESPONDER_NETWORK, eth);
+    }
+}
@@ -10,12 +10,23 @@
 #include "bbl.h"
 #include "bbl_config.h"
 #include "bbl_pcap.h"
+#include "bbl_recorder.h"
 #include "bbl_stats.h"
+#include "bbl_counters.h"
+#include "bbl_metrics.h"
 #include "bbl_interactive.h"
 #include "bbl_ctrl.h"
+#include "bbl_retry.h"
+#include "bbl_replay.h"
+#include "bbl_io_memory.h"
 
 #include "bbl_logging.h"
 
+/* Max time spent per control job interval and
+ * number of sessions processed between checks. */
+#define BBL_CTRL_JOB_BUDGET_MSEC 100
+#define BBL_CTRL_JOB_BUDGET_CHECK 128
+
 /* Global Variables */
 bool g_interactive = false; // interactive mode using ncurses
 char *g_log_file = NULL;
@@ -92,11 +103,87 @@ bbl_session_network_tx_qnode_remove (bbl_session_s *session)
     }
 }
 
+static bbl_session_list_t
+bbl_session_list (session_state_t state)
+{
+    switch(state) {
+        case BBL_IDLE:
+            return BBL_SESSIONS_IDLE;
+        case BBL_ESTABLISHED:
+            return BBL_SESSIONS_ESTABLISHED;
+        case BBL_PPP_TERMINATING:
+        case BBL_TERMINATING:
+            return BBL_SESSIONS_TERMINATING;
+        case BBL_TERMINATED:
+            return BBL_SESSIONS_TERMINATED;
+        default:
+            return BBL_SESSIONS_SETUP;
+    }
+}
+
+/*
+ * Move session to the list of the given state.
+ */
+static void
+bbl_session_list_update (bbl_ctx_s *ctx, bbl_session_s *session, session_state_t state)
+{
+    bbl_session_list_t list = bbl_session_list(state);
+
+    if(CIRCLEQ_NEXT(session, session_state_qnode)) {
+        if(session->session_list == list) {
+            return;
+        }
+        CIRCLEQ_REMOVE(&ctx->sessions_qhead[session->session_list], session, session_state_qnode);
+        ctx->sessions_count[session->session_list]--;
+    }
+    CIRCLEQ_INSERT_TAIL(&ctx->sessions_qhead[list], session, session_state_qnode);
+    ctx->sessions_count[list]++;
+    session->session_list = list;
+}
+
 void
 bbl_session_update_state(bbl_ctx_s *ctx, bbl_session_s *session, session_state_t state)
 {
     if(session->session_state != state) {
         /* State has changed ... */
+        switch(state) {
+            /* Setup latency per phase */
+            case BBL_IPOE_SETUP:
+                bbl_stats_setup_phase_start(session, BBL_SETUP_PHASE_TOTAL);
+                if(session->access_config->ipv6_enable) {
+                    bbl_stats_setup_phase_start(session, BBL_SETUP_PHASE_ICMPV6_RA);
+                }
+                break;
+            case BBL_PPPOE_INIT:
+                bbl_stats_setup_phase_start(session, BBL_SETUP_PHASE_TOTAL);
+                bbl_stats_setup_phase_start(session, BBL_SETUP_PHASE_PADO);
+                break;
+            case BBL_PPPOE_REQUEST:
+                bbl_stats_setup_phase_stop(ctx, session, BBL_SETUP_PHASE_PADO);
+                bbl_stats_setup_phase_start(session, BBL_SETUP_PHASE_PADS);
+                break;
+            case BBL_PPP_LINK:
+                bbl_stats_setup_phase_stop(ctx, session, BBL_SETUP_PHASE_PADS);
+                bbl_stats_setup_phase_start(session, BBL_SETUP_PHASE_LCP);
+                break;
+            case BBL_PPP_AUTH:
+                bbl_stats_setup_phase_stop(ctx, session, BBL_SETUP_PHASE_LCP);
+                bbl_stats_setup_phase_start(session, BBL_SETUP_PHASE_AUTH);
+                break;
+            case BBL_PPP_NETWORK:
+                bbl_stats_setup_phase_stop(ctx, session, BBL_SETUP_PHASE_AUTH);
+                bbl_stats_setup_phase_start(session, BBL_SETUP_PHASE_IPCP);
+                bbl_stats_setup_phase_start(session, BBL_SETUP_PHASE_IP6CP);
+                break;
+            case BBL_ESTABLISHED:
+                bbl_stats_setup_phase_stop(ctx, session, BBL_SETUP_PHASE_TOTAL);
+                break;
+            case BBL_TERMINATED:
+                memset(session->setup_phase_start, 0x0, sizeof(session->setup_phase_start));
+                break;
+            default:
+                break;
+        }
         if(session->session_state == BBL_ESTABLISHED && ctx->sessions_established) {
             /* Decrement sessions established if old state is established. */
             ctx->sessions_established--;
@@ -119,18 +206,10 @@ bbl_session_update_state(bbl_ctx_s *ctx, bbl_session_s *session, session_state_t
         }
         if(state == BBL_TERMINATED) {
             /* Stop all session tiemrs */
-            timer_del(session->timer_arp);
-            timer_del(session->timer_padi);
-            timer_del(session->timer_padr);
-            timer_del(session->timer_lcp);
+            bbl_retry_del_all(session);
             timer_del(session->timer_lcp_echo);
-            timer_del(session->timer_auth);
-            timer_del(session->timer_ipcp);
-            timer_del(session->timer_ip6cp);
-            timer_del(session->timer_dhcpv6);
             timer_del(session->timer_igmp);
             timer_del(session->timer_zapping);
-            timer_del(session->timer_icmpv6);
             timer_del(session->timer_session);
             timer_del(session->timer_session_traffic_ipv4);
             timer_del(session->timer_session_traffic_ipv6);
@@ -148,7 +227,6 @@ bbl_session_update_state(bbl_ctx_s *ctx, bbl_session_s *session, session_state_t
                 if(session->access_type == ACCESS_TYPE_PPPOE) {
                     if(ctx->config.pppoe_reconnect) {
                         state = BBL_IDLE;
-                        CIRCLEQ_INSERT_TAIL(&ctx->sessions_idle_qhead, session, session_idle_qnode);
                         memset(&session->server_mac, 0xff, ETH_ADDR_LEN); // init with broadcast MAC
                         session->pppoe_session_id = 0;
                         session->pppoe_ac_cookie_len = 0;
@@ -177,8 +255,12 @@ bbl_session_update_state(bbl_ctx_s *ctx, bbl_session_s *session, session_state_t
                     /* IPoE */
                     ctx->sessions_terminated++;
                 }
+                if(ctx->config.recorder_session_down) {
+                    bbl_recorder_trigger(ctx, BBL_RECORDER_TRIGGER_SESSION_DOWN);
+                }
             }
         }
+        bbl_session_list_update(ctx, session, state);
         session->session_state = state;
     }
 }
@@ -229,6 +311,7 @@ bbl_add_multicast_packets (bbl_ctx_s *ctx, bbl_interface_s *interface)
             udp.src = BBL_UDP_PORT;
             udp.dst = BBL_UDP_PORT;
             udp.protocol = UDP_PROTOCOL_BBL;
+            udp.checksum = ctx->config.session_traffic_ipv4_udp_checksum;
             udp.next = &bbl;
             bbl.type = BBL_TYPE_MULTICAST;
             bbl.direction = BBL_DIRECTION_DOWN;
@@ -245,25 +328,15 @@ bbl_add_multicast_packets (bbl_ctx_s *ctx, bbl_interface_s *interface)
 }
 
 /*
- * Allocate an interface and setup Tx and Rx rings.
+ * Open the RAW sockets and setup Tx and Rx rings.
  */
-bbl_interface_s *
-bbl_add_interface (bbl_ctx_s *ctx, char *interface_name, int slots)
+static bool
+bbl_open_interface (bbl_interface_s *interface, char *interface_name, int slots)
 {
-    bbl_interface_s *interface;
-    char timer_name[16];
     struct ifreq ifr;
     size_t ring_size;
     int version, qdisc_bypass;
 
-    interface = calloc(1, sizeof(bbl_interface_s));
-    if (!interface) {
-        LOG(ERROR, "No memory for interface %s\n", interface_name);
-        return NULL;
-    }
-
-    interface->name = strdup(interface_name);
-
     /*
      * Open RAW socket for all Ethertypes.
      * https://man7.org/linux/man-pages/man7/packet.7.html
@@ -271,13 +344,13 @@ bbl_add_interface (bbl_ctx_s *ctx, char *interface_name, int slots)
     interface->fd_tx = socket(AF_PACKET, SOCK_RAW, htobe16(ETH_P_ALL));
     if (interface->fd_tx == -1) {
         LOG(ERROR, "socket() TX error %s (%d) for interface %s\n", strerror(errno), errno, interface->name);
-        return NULL;
+        return false;
     }
 
     interface->fd_rx = socket(AF_PACKET, SOCK_RAW, htobe16(ETH_P_ALL));
     if (interface->fd_rx == -1) {
         LOG(ERROR, "socket() RX error %s (%d) for interface %s\n", strerror(errno), errno, interface->name);
-        return NULL;
+        return false;
     }
 
     /*
@@ -286,12 +359,12 @@ bbl_add_interface (bbl_ctx_s *ctx, char *interface_name, int slots)
     version = TPACKET_V2;
     if ((setsockopt(interface->fd_tx, SOL_PACKET, PACKET_VERSION, &version, sizeof(version))) == -1) {
         LOG(ERROR, "setsockopt() TX error %s (%d) for interface %s\n", strerror(errno), errno, interface->name);
-        return NULL;
+        return false;
     }
 
     if ((setsockopt(interface->fd_rx, SOL_PACKET, PACKET_VERSION, &version, sizeof(version))) == -1) {
         LOG(ERROR, "setsockopt() RX error %s (%d) for interface %s\n", strerror(errno), errno, interface->name);
-        return NULL;
+        return false;
     }
 
     /*
@@ -303,7 +376,7 @@ bbl_add_interface (bbl_ctx_s *ctx, char *interface_name, int slots)
     if (ioctl(interface->fd_tx, SIOCGIFINDEX, &ifr) == -1) {
         LOG(ERROR, "Get interface index error %s (%d) for interface %s\n",
         strerror(errno), errno, interface->name);
-        return NULL;
+        return false;
     }
 
     interface->addr.sll_family = AF_PACKET;
@@ -312,13 +385,13 @@ bbl_add_interface (bbl_ctx_s *ctx, char *interface_name, int slots)
     if (bind(interface->fd_tx, (struct sockaddr*)&interface->addr, sizeof(interface->addr)) == -1) {
         LOG(ERROR, "bind() TX error %s (%d) for interface %s\n",
         strerror(errno), errno, interface->name);
-        return NULL;
+        return false;
     }
 
     if (bind(interface->fd_rx, (struct sockaddr*)&interface->addr, sizeof(interface->addr)) == -1) {
         LOG(ERROR, "bind() RX error %s (%d) for interface %s\n",
         strerror(errno), errno, interface->name);
-        return NULL;
+        return false;
     }
 
     /*
@@ -329,7 +402,7 @@ bbl_add_interface (bbl_ctx_s *ctx, char *interface_name, int slots)
     if (ioctl(interface->fd_rx, SIOCGIFHWADDR, &ifr) == -1) {
         LOG(ERROR, "Getting MAC address error %s (%d) for interface %s\n",
         strerror(errno), errno, interface->name);
-        return NULL;
+        return false;
     }
     memcpy(&interface->mac, ifr.ifr_hwaddr.sa_data, IFHWADDRLEN);
     LOG(NORMAL, "Getting MAC address %02x:%02x:%02x:%02x:%02x:%02x for interface %s\n",
@@ -344,14 +417,14 @@ bbl_add_interface (bbl_ctx_s *ctx, char *interface_name, int slots)
     if (ioctl(interface->fd_rx, SIOCGIFFLAGS, &ifr) == -1) {
         LOG(ERROR, "Getting socket flags error %s (%d) when setting promiscuous mode for interface %s\n",
         strerror(errno), errno, interface->name);
-        return NULL;
+        return false;
     }
 
     ifr.ifr_flags |= IFF_PROMISC;
-    if (ioctl(interface->fd_rx, SIOCSIFFLAGS, ifr) == -1){
+    if (ioctl(interface->fd_rx, SIOCSIFFLAGS, &ifr) == -1){
         LOG(ERROR, "Setting socket flags error %s (%d) when setting promiscuous mode for interface %s\n",
         strerror(errno), errno, interface->name);
-        return NULL;
+        return false;
     }
 
     /*
@@ -372,7 +445,7 @@ bbl_add_interface (bbl_ctx_s *ctx, char *interface_name, int slots)
     qdisc_bypass = 1;
     if (setsockopt(interface->fd_tx, SOL_PACKET, PACKET_QDISC_BYPASS, &qdisc_bypass, sizeof(qdisc_bypass)) == -1) {
         LOG(ERROR, "Setting qdisc bypass error %s (%d) for interface %s\n", strerror(errno), errno, interface->name);
-        return NULL;
+        return false;
     }
 
     /*
@@ -386,7 +459,7 @@ bbl_add_interface (bbl_ctx_s *ctx, char *interface_name, int slots)
     if (setsockopt(interface->fd_tx, SOL_PACKET, PACKET_TX_RING, &interface->req_tx, sizeof(interface->req_tx)) == -1) {
         LOG(ERROR, "Allocating TX ringbuffer error %s (%d) for interface %s\n",
         strerror(errno), errno, interface->name);
-        return NULL;
+        return false;
     }
 
     /*
@@ -407,7 +480,7 @@ bbl_add_interface (bbl_ctx_s *ctx, char *interface_name, int slots)
     if (setsockopt(interface->fd_rx, SOL_PACKET, PACKET_RX_RING, &interface->req_rx, sizeof(interface->req_rx)) == -1) {
         LOG(ERROR, "Allocating RX ringbuffer error %s (%d) for interface %s\n",
         strerror(errno), errno, interface->name);
-        return NULL;
+        return false;
     }
 
     /*
@@ -416,15 +489,55 @@ bbl_add_interface (bbl_ctx_s *ctx, char *interface_name, int slots)
     ring_size = interface->req_rx.tp_block_nr * interface->req_rx.tp_block_size;
     interface->ring_rx = mmap(0, ring_size, PROT_READ|PROT_WRITE, MAP_SHARED, interface->fd_rx, 0);
 
+    return true;
+}
+
+/*
+ * Allocate an interface and setup Tx and Rx rings.
+ */
+bbl_interface_s *
+bbl_add_interface (bbl_ctx_s *ctx, char *interface_name, int slots)
+{
+    bbl_interface_s *interface;
+    char timer_name[16];
+
+    /* Cache line aligned for the interface counters. */
+    if (posix_memalign((void**)&interface, BBL_CACHE_LINE, sizeof(bbl_interface_s))) {
+        LOG(ERROR, "No memory for interface %s\n", interface_name);
+        return NULL;
+    }
+    memset(interface, 0x0, sizeof(bbl_interface_s));
+
+    interface->name = strdup(interface_name);
+
+    /*
+     * Frames are injected directly into the RX path
+     * if replaying a packet capture, no sockets required.
+     */
+    if (ctx->config.replay_filename) {
+        /* Unique index used as session key. */
+        interface->addr.sll_ifindex = ctx->pcap.index + 1;
+    } else if (ctx->config.simulation) {
+        if (!bbl_io_memory_open_interface(ctx, interface, slots)) {
+            return NULL;
+        }
+    } else {
+        if (!bbl_open_interface(interface, interface_name, slots)) {
+            return NULL;
+        }
+    }
+
     LOG(NORMAL, "Add interface %s\n", interface->name);
 
     /*
      * Add an periodic timer for polling I/O.
      */
-    snprintf(timer_name, sizeof(timer_name), "%s TX", interface_name);
-    timer_add_periodic(&ctx->timer_root, &interface->tx_job, timer_name, 0, ctx->config.tx_interval * MSEC, interface, bbl_tx_job);
-    snprintf(timer_name, sizeof(timer_name), "%s RX", interface_name);
-    timer_add_periodic(&ctx->timer_root, &interface->rx_job, timer_name, 0, ctx->config.rx_interval * MSEC, interface, bbl_rx_job);
+    if (!ctx->config.replay_filename) {
+        snprintf(timer_name, sizeof(timer_name), "%s TX", interface_name);
+        timer_add_periodic(&ctx->timer_root, &interface->tx_job, timer_name, 0, ctx->config.tx_interval * MSEC, interface, bbl_tx_job);
+        snprintf(timer_name, sizeof(timer_name), "%s RX", interface_name);
+        timer_add_periodic(&ctx->timer_root, &interface->rx_job, timer_name, 0, ctx->config.rx_interval * MSEC, interface, bbl_rx_job);
+    }
 
     /*
      * Timer to compute periodic rates.
@@ -471,6 +584,9 @@ bbl_add_access_interfaces (bbl_ctx_s *ctx) {
             return false;
         }
         access_if->access = true;
+        bbl_slab_init(&access_if->session_slab, access_if->name, sizeof(bbl_session_s),
+                      ctx->config.memory_hugepages,
+                      ctx->config.memory_numa ? bbl_slab_numa_node(access_if->name) : -1);
         access_config->access_if = access_if;
         ctx->op.access_if[ctx->op.access_if_count++] = access_if;
 Next:
@@ -482,13 +598,14 @@ Next:
 /*
  * Command line options.
  */
-const char *optstring = "vhC:l:L:a:n:u:p:P:J:c:g:s:r:z:S:I";
+const char *optstring = "vhC:l:L:f:a:n:u:p:P:J:c:g:s:r:z:S:M:IR:";
 static struct option long_options[] = {
     { "version",                no_argument,        NULL, 'v' },
     { "help",                   no_argument,        NULL, 'h' },
     { "config",                 required_argument,  NULL, 'C' },
     { "logging",                required_argument,  NULL, 'l' },
     { "log-file",               required_argument,  NULL, 'L' },
+    { "log-filter",             required_argument,  NULL, 'f' },
     { "access-interface",       required_argument,  NULL, 'a' },
     { "network-interface",      required_argument,  NULL, 'n' },
     { "username",               required_argument,  NULL, 'u' },
@@ -501,7 +618,9 @@ static struct option long_options[] = {
     { "mc-group-count",         required_argument,  NULL, 'r' },
     { "mc-zapping-interval",    required_argument,  NULL, 'z' },
     { "control socket (UDS)",   required_argument,  NULL, 'S' },
+    { "metrics",                required_argument,  NULL, 'M' },
     { "interactive (ncurses)",  no_argument,        NULL, 'I' },
+    { "replay",                 required_argument,  NULL, 'R' },
     { NULL,                     0,                  NULL,  0 }
 };
 
@@ -512,6 +631,12 @@ bbl_print_usage_arg (struct option *option)
         if (strcmp(option->name, "logging") == 0) {
             return log_usage();
         }
+        if (strcmp(option->name, "metrics") == 0) {
+            return " [<host>]:<port>|<path>";
+        }
+        if (strcmp(option->name, "log-filter") == 0) {
+            return " [<ifindex>/]<outer-vlan>[-<max>][:<inner-vlan>[-<max>]]";
+        }
 
         return " <args>";
     }
@@ -576,29 +701,6 @@ bbl_free_session (void *key __attribute__((unused)), void *s)
 }
 #endif
 
-/*
- * A session key fits in 64-Bits. Lets do this instead of a memcmp()
- */
-int
-bbl_compare_session (void *key1, void *key2)
-{
-    const uint64_t a = *(const uint64_t*)key1;
-    const uint64_t b = *(const uint64_t*)key2;
-    return (a > b) - (a < b);
-}
-
-uint
-bbl_session_hash (const void* k)
-{
-    uint hash = 2166136261U;
-
-    hash ^= *(uint32_t *)k;
-    hash ^= *(uint16_t *)(k+4) << 12;
-    hash ^= *(uint16_t *)(k+6);
-
-    return hash;
-}
-
 /*
  * Allocate a context which is our top-level data structure.
  */
@@ -606,6 +708,7 @@ bbl_ctx_s *
 bbl_add_ctx (void)
 {
     bbl_ctx_s *ctx;
+    int i;
 
     ctx = calloc(1, sizeof(bbl_ctx_s));
         if (!ctx) {
@@ -621,8 +724,9 @@ bbl_add_ctx (void)
      */
     timer_init_root(&ctx->timer_root);
 
-    CIRCLEQ_INIT(&ctx->sessions_idle_qhead);
-    CIRCLEQ_INIT(&ctx->sessions_teardown_qhead);
+    for(i = 0; i < BBL_SESSIONS_MAX; i++) {
+        CIRCLEQ_INIT(&ctx->sessions_qhead[i]);
+    }
     CIRCLEQ_INIT(&ctx->interface_qhead);
 
     ctx->flow_id = 1;
@@ -654,6 +758,9 @@ bbl_del_ctx (bbl_ctx_s *ctx) {
     if(ctx->sp_tx) {
         free(ctx->sp_tx);
     }
+    if(ctx->sessions_pending) {
+        free(ctx->sessions_pending);
+    }
 
     pcapng_free(ctx);
     timer_flush_root(&ctx->timer_root);
@@ -667,7 +774,7 @@ bbl_add_session (bbl_ctx_s *ctx, bbl_interface_s *interface, bbl_session_s *sess
     bbl_session_s *session;
     dict_insert_result result;
 
-    session = calloc(1, sizeof(bbl_session_s));
+    session = bbl_slab_alloc(&interface->session_slab);
     if (!session) {
         return NULL;
     }
@@ -715,7 +822,7 @@ bbl_add_session (bbl_ctx_s *ctx, bbl_interface_s *interface, bbl_session_s *sess
      */
     result = dict_insert(ctx->session_dict, &session->key);
     if (!result.inserted) {
-        free(session);
+        bbl_slab_free(&interface->session_slab, session);
         return NULL;
     }
     *result.datum_ptr = session;
@@ -725,26 +832,77 @@ bbl_add_session (bbl_ctx_s *ctx, bbl_interface_s *interface, bbl_session_s *sess
      */
     session->interface = interface;
     session->session_state = BBL_IDLE;
-    CIRCLEQ_INSERT_TAIL(&ctx->sessions_idle_qhead, session, session_idle_qnode);
-    ctx->sessions++;
-    if(session->access_type == ACCESS_TYPE_PPPOE) {
-        ctx->sessions_pppoe++;
-    } else {
-        ctx->sessions_ipoe++;
+    bbl_session_list_update(ctx, session, BBL_IDLE);
+    return session;
+}
+
+/*
+ * Create session from allocation recorded in bbl_init_sessions.
+ */
+static bbl_session_s *
+bbl_session_materialize (bbl_ctx_s *ctx, bbl_session_pending_s *pending)
+{
+    bbl_session_s session_template;
+    bbl_session_s *session;
+    bbl_access_config_s *access_config = pending->access_config;
+    uint32_t i = pending->session_global;
+
+    memset(&session_template, 0, sizeof(session_template));
+    memset(&session_template.server_mac, 0xff, ETH_ADDR_LEN); // init with broadcast MAC
+    session_template.key.outer_vlan_id= pending->outer_vlan_id;
+    session_template.key.inner_vlan_id = pending->inner_vlan_id;
+    session_template.key.ifindex = access_config->access_if->addr.sll_ifindex;
+    session_template.client_mac[0] = 0x02; //
+    session_template.client_mac[1] = 0x00; // set client OUI ro locally administered
+    session_template.client_mac[2] = 0x00; //
+    session_template.mru = ctx->config.ppp_mru;
+    session_template.access_type = access_config->access_type;
+    session_template.client_mac[3] = i>>16;
+    session_template.client_mac[4] = i>>8;
+    session_template.client_mac[5] = i;
+    session_template.magic_number = i;
+    /* Populate session identifiaction attributes */
+    session_template_render(&access_config->username_template, session_template.username, USERNAME_LEN, pending->session, i);
+    session_template_render(&access_config->password_template, session_template.password, PASSWORD_LEN, pending->session, i);
+    session_template_render(&access_config->agent_circuit_id_template, session_template.agent_circuit_id, ACI_LEN, pending->session, i);
+    session_template_render(&access_config->agent_remote_id_template, session_template.agent_remote_id, ARI_LEN, pending->session, i);
+    /* Update rates ... */
+    session_template.rate_up = access_config->rate_up;
+    session_template.rate_down = access_config->rate_down;
+
+    session = bbl_add_session(ctx, access_config->access_if, &session_template, access_config);
+    if(!session) {
+        LOG(ERROR, "Failed to create session (%s Q-in-Q %u:%u)\n", access_config->interface, pending->outer_vlan_id, pending->inner_vlan_id);
     }
     return session;
 }
 
+/*
+ * Materialize next pending session (lazy mode). Sessions which
+ * could not be created are counted as terminated.
+ */
+bbl_session_s *
+bbl_session_pending_next (bbl_ctx_s *ctx)
+{
+    bbl_session_s *session;
+
+    while(ctx->sessions_pending_next < ctx->sessions_pending_count) {
+        session = bbl_session_materialize(ctx, &ctx->sessions_pending[ctx->sessions_pending_next++]);
+        if(session) {
+            return session;
+        }
+        ctx->sessions_terminated++;
+    }
+    return NULL;
+}
+
 bool
 bbl_init_sessions (bbl_ctx_s *ctx)
 {
-    bbl_session_s session_template;
+    bbl_session_pending_s pending;
     bbl_access_config_s *access_config;
         
     uint32_t i = 1;
-    char *s;
-    char snum1[32];
-    char snum2[32];
 
     /* The variable t counts how many sessions are created in one 
      * loop over all access configurations and is reset to zero
@@ -752,6 +910,27 @@ bbl_init_sessions (bbl_ctx_s *ctx)
      * is still zero after processing last access profile means 
      * that all VLAN ranges are exhausted. */
     int t = 0;
+
+    /* Precompile {session} and {session-global} templates. */
+    access_config = ctx->config.access_config;
+    while(access_config) {
+        if(!(session_template_compile(&access_config->username_template, access_config->username) &&
+             session_template_compile(&access_config->password_template, access_config->password) &&
+             session_template_compile(&access_config->agent_circuit_id_template, access_config->agent_circuit_id) &&
+             session_template_compile(&access_config->agent_remote_id_template, access_config->agent_remote_id))) {
+            LOG(ERROR, "Failed to compile session templates for interface %s\n", access_config->interface);
+            return false;
+        }
+        access_config = access_config->next;
+    }
+
+    if(ctx->config.sessions_lazy) {
+        ctx->sessions_pending = calloc(ctx->config.sessions, sizeof(bbl_session_pending_s));
+        if(!ctx->sessions_pending) {
+            LOG(ERROR, "Failed to allocate pending sessions\n");
+            return false;
+        }
+    }
     
     access_config = ctx->config.access_config;
 
@@ -780,50 +959,24 @@ bbl_init_sessions (bbl_ctx_s *ctx)
         }
         t++;
         access_config->sessions++;
-        memset(&session_template, 0, sizeof(session_template));
-        memset(&session_template.server_mac, 0xff, ETH_ADDR_LEN); // init with broadcast MAC
-        session_template.key.outer_vlan_id= access_config->access_outer_vlan;
-        session_template.key.inner_vlan_id = access_config->access_inner_vlan;
-        session_template.key.ifindex = access_config->access_if->addr.sll_ifindex;
-        session_template.client_mac[0] = 0x02; //
-        session_template.client_mac[1] = 0x00; // set client OUI ro locally administered
-        session_template.client_mac[2] = 0x00; //
-        session_template.mru = ctx->config.ppp_mru;
-        session_template.access_type = access_config->access_type;
-        session_template.client_mac[3] = i>>16;
-        session_template.client_mac[4] = i>>8;
-        session_template.client_mac[5] = i;
-        session_template.magic_number = i;
-        /* Populate session identifiaction attributes */
-        snprintf(snum1, 6, "%d", i);
-        snprintf(snum2, 6, "%d", access_config->sessions);
-        /* Update username */
-        s = replace_substring(access_config->username, "{session-global}", snum1);
-        snprintf(session_template.username, USERNAME_LEN, "%s", s);
-        s = replace_substring(session_template.username, "{session}", snum2);
-        snprintf(session_template.username, USERNAME_LEN, "%s", s);
-        /* Update password */
-        s = replace_substring(access_config->password, "{session-global}", snum1);
-        snprintf(session_template.password, PASSWORD_LEN, "%s", s);
-        s = replace_substring(session_template.password, "{session}", snum2);
-        snprintf(session_template.password, PASSWORD_LEN, "%s", s);
-        /* Update ACI */
-        s = replace_substring(access_config->agent_circuit_id, "{session-global}", snum1);
-        snprintf(session_template.agent_circuit_id, ACI_LEN, "%s", s);
-        s = replace_substring(session_template.agent_circuit_id, "{session}", snum2);
-        snprintf(session_template.agent_circuit_id, ACI_LEN, "%s", s);
-        /* Update ARI */
-        s = replace_substring(access_config->agent_remote_id, "{session-global}", snum1);
-        snprintf(session_template.agent_remote_id, ARI_LEN, "%s", s);
-        s = replace_substring(session_template.agent_remote_id, "{session}", snum2);
-        snprintf(session_template.agent_remote_id, ARI_LEN, "%s", s);
-        /* Update rates ... */
-        session_template.rate_up = access_config->rate_up;
-        session_template.rate_down = access_config->rate_down;
-        if(bbl_add_session(ctx, access_config->access_if, &session_template, access_config) == NULL) {
-            LOG(ERROR, "Failed to create session (%s Q-in-Q %u:%u)\n", access_config->interface, access_config->access_outer_vlan, access_config->access_inner_vlan);
+        pending.session_global = i;
+        pending.session = access_config->sessions;
+        pending.outer_vlan_id = access_config->access_outer_vlan;
+        pending.inner_vlan_id = access_config->access_inner_vlan;
+        pending.access_config = access_config;
+        if(ctx->config.sessions_lazy) {
+            /* Record allocation only, the session
+             * is created when started. */
+            ctx->sessions_pending[ctx->sessions_pending_count++] = pending;
+        } else if(bbl_session_materialize(ctx, &pending) == NULL) {
             return false;
         }
+        ctx->sessions++;
+        if(access_config->access_type == ACCESS_TYPE_PPPOE) {
+            ctx->sessions_pppoe++;
+        } else {
+            ctx->sessions_ipoe++;
+        }
         i++;
 Next:
         if(access_config->next) {
@@ -918,12 +1071,83 @@ bbl_smear_job (timer_s *timer)
     }
 }
 
+/*
+ * Clear sessions from the given list until the list is empty,
+ * the optional rate is exhausted or the time budget is spent.
+ * Returns false if the caller should not continue with the
+ * next list in this interval.
+ */
+static bool
+bbl_ctrl_job_teardown (bbl_ctx_s *ctx, bbl_session_list_t list, int *rate, struct timespec *deadline)
+{
+    bbl_session_s *session;
+    struct timespec now;
+    uint32_t count = 0;
+
+    while (!CIRCLEQ_EMPTY(&ctx->sessions_qhead[list])) {
+        if(rate && *rate <= 0) {
+            return false;
+        }
+        if((++count % BBL_CTRL_JOB_BUDGET_CHECK) == 0) {
+            timer_clock_gettime(&ctx->timer_root, CLOCK_MONOTONIC, &now);
+            if(now.tv_sec > deadline->tv_sec ||
+               (now.tv_sec == deadline->tv_sec && now.tv_nsec >= deadline->tv_nsec)) {
+                return false;
+            }
+        }
+        session = CIRCLEQ_FIRST(&ctx->sessions_qhead[list]);
+        bbl_session_clear(ctx, session);
+        if(CIRCLEQ_FIRST(&ctx->sessions_qhead[list]) == session) {
+            /* Session has not left the list. */
+            return false;
+        }
+        if(rate) (*rate)--;
+    }
+    return true;
+}
+
+/*
+ * Start session by scheduling the first request.
+ */
+void
+bbl_session_start (bbl_ctx_s *ctx, bbl_session_s *session)
+{
+    switch (session->access_type) {
+        case ACCESS_TYPE_PPPOE:
+            /* PPP over Ethernet (PPPoE) */
+            bbl_session_update_state(ctx, session, BBL_PPPOE_INIT);
+            session->send_requests = BBL_SEND_DISCOVERY;
+            break;
+        case ACCESS_TYPE_IPOE:
+            /* IP over Ethernet (IPoE) */
+            bbl_session_update_state(ctx, session, BBL_IPOE_SETUP);
+            session->send_requests = 0;
+            if(session->access_config->ipv4_enable) {
+                if(session->access_config->dhcp_enable) {
+                    /* Start IPoE session by sending DHCP discovery if enabled. */
+                    session->send_requests |= BBL_SEND_DHCPREQUEST;
+                } else if (session->ip_address && session->peer_ip_address) {
+                    /* Start IPoE session by sending ARP request if local and 
+                     * remote IP addresses are already provided. */
+                    session->send_requests |= BBL_SEND_ARP_REQUEST;
+                }
+            }
+            if(session->access_config->ipv6_enable) {
+                /* Start IPoE session by sending RS. */
+                session->send_requests |= BBL_SEND_ICMPV6_RS;
+            }
+            break;
+    }
+    bbl_session_tx_qnode_insert(session);
+}
+
 void
 bbl_ctrl_job (timer_s *timer)
 {
     bbl_ctx_s *ctx = timer->data;
     bbl_session_s *session;
-    struct dict_itor *itor;
+    struct timespec deadline;
+    struct timespec budget = {0, BBL_CTRL_JOB_BUDGET_MSEC * MSEC};
     int rate = 0;
 
     if(ctx->sessions_outstanding) ctx->sessions_outstanding--;
@@ -943,36 +1167,24 @@ bbl_ctrl_job (timer_s *timer)
     }
 
     if(g_teardown) {
-        /* Teardown phase ... */
-        if(g_teardown_request) {
-            /* Put all sessions on the teardown list. */
-            itor = dict_itor_new(ctx->session_dict);
-            dict_itor_first(itor);
-            for (; dict_itor_valid(itor); dict_itor_next(itor)) {
-                session = (bbl_session_s*)*dict_itor_datum(itor);
-                if(!CIRCLEQ_NEXT(session, session_teardown_qnode)) {
-                    /* Add only if not already on teardown list. */
-                    CIRCLEQ_INSERT_TAIL(&ctx->sessions_teardown_qhead, session, session_teardown_qnode);
-                }
-            }
-            dict_itor_free(itor);
-            g_teardown_request = false;
-        } else {
-            /* Process teardown list in chunks. */
-            rate = ctx->config.sessions_stop_rate;
-            while (!CIRCLEQ_EMPTY(&ctx->sessions_teardown_qhead)) {
-                session = CIRCLEQ_FIRST(&ctx->sessions_teardown_qhead);
-                if(rate > 0) {
-                    if(session->session_state != BBL_IDLE) rate--;
-                    bbl_session_clear(ctx, session);
-                    /* Remove from teardown queue. */
-                    CIRCLEQ_REMOVE(&ctx->sessions_teardown_qhead, session, session_teardown_qnode);
-                    CIRCLEQ_NEXT(session, session_teardown_qnode) = NULL;
-                    CIRCLEQ_PREV(session, session_teardown_qnode) = NULL;
-                } else {
-                    break;
-                }
-            }
+        /* Teardown phase ...
+         * Sessions are taken from the per state lists, so there
+         * is no need to walk over all sessions. Idle sessions are
+         * terminated immediately, established sessions and those
+         * in setup are cleared as permitted by stop rate. Sessions
+         * already terminating proceed on their own. */
+        g_teardown_request = false;
+        if(ctx->sessions_pending_next < ctx->sessions_pending_count) {
+            /* Sessions not created yet are terminated. */
+            ctx->sessions_terminated += ctx->sessions_pending_count - ctx->sessions_pending_next;
+            ctx->sessions_pending_next = ctx->sessions_pending_count;
+        }
+        rate = ctx->config.sessions_stop_rate;
+        timer_clock_gettime(&ctx->timer_root, CLOCK_MONOTONIC, &deadline);
+        timespec_add(&deadline, &deadline, &budget);
+        if(bbl_ctrl_job_teardown(ctx, BBL_SESSIONS_IDLE, NULL, &deadline) &&
+           bbl_ctrl_job_teardown(ctx, BBL_SESSIONS_ESTABLISHED, &rate, &deadline)) {
+            bbl_ctrl_job_teardown(ctx, BBL_SESSIONS_SETUP, &rate, &deadline);
         }
     } else {
         /* Setup phase ... 
@@ -982,49 +1194,18 @@ bbl_ctrl_job (timer_s *timer)
          * from idle list. */
         bbl_stats_update_cps(ctx);
         rate = ctx->config.sessions_start_rate;
-        while (!CIRCLEQ_EMPTY(&ctx->sessions_idle_qhead)) {
-            session = CIRCLEQ_FIRST(&ctx->sessions_idle_qhead);
-            if(rate > 0) {
-                if(ctx->sessions_outstanding < ctx->config.sessions_max_outstanding) {
-                    ctx->sessions_outstanding++;
-                    /* Start session */
-                    switch (session->access_type) {
-                        case ACCESS_TYPE_PPPOE:
-                            /* PPP over Ethernet (PPPoE) */
-                            session->session_state = BBL_PPPOE_INIT;
-                            session->send_requests = BBL_SEND_DISCOVERY;
-                            break;
-                        case ACCESS_TYPE_IPOE:
-                            /* IP over Ethernet (IPoE) */
-                            session->session_state = BBL_IPOE_SETUP;
-                            session->send_requests = 0;
-                            if(session->access_config->ipv4_enable) {
-                                if(session->access_config->dhcp_enable) {
-                                    /* Start IPoE session by sending DHCP discovery if enabled. */
-                                    session->send_requests |= BBL_SEND_DHCPREQUEST;
-                                } else if (session->ip_address && session->peer_ip_address) {
-                                    /* Start IPoE session by sending ARP request if local and 
-                                     * remote IP addresses are already provided. */
-                                    session->send_requests |= BBL_SEND_ARP_REQUEST;
-                                }
-                            }
-                            if(session->access_config->ipv6_enable) {
-                                /* Start IPoE session by sending RS. */
-                                session->send_requests |= BBL_SEND_ICMPV6_RS;
-                            }
-                            break;
-                    }
-                    bbl_session_tx_qnode_insert(session);
-                    /* Remove from idle queue */
-                    CIRCLEQ_REMOVE(&ctx->sessions_idle_qhead, session, session_idle_qnode);
-                    CIRCLEQ_NEXT(session, session_idle_qnode) = NULL;
-                    CIRCLEQ_PREV(session, session_idle_qnode) = NULL;
-                } else {
+        while (rate > 0 && ctx->sessions_outstanding < ctx->config.sessions_max_outstanding) {
+            if(!CIRCLEQ_EMPTY(&ctx->sessions_qhead[BBL_SESSIONS_IDLE])) {
+                session = CIRCLEQ_FIRST(&ctx->sessions_qhead[BBL_SESSIONS_IDLE]);
+            } else {
+                /* Create next session (lazy mode). */
+                session = bbl_session_pending_next(ctx);
+                if(!session) {
                     break;
                 }
-            } else {
-                break;
             }
+            ctx->sessions_outstanding++;
+            bbl_session_start(ctx, session);
         }
     }
 }
@@ -1036,7 +1217,9 @@ main (int argc, char *argv[])
     int long_index = 0;
     int ch = 0;
     uint32_t ipv4;
+    int numa_node = -1;
     bbl_stats_t stats = {0};
+    log_filter_s log_filter;
 
     char *config_file = NULL;
     char *username = NULL;
@@ -1095,6 +1278,12 @@ main (int argc, char *argv[])
             case 'L':
 		        g_log_file = optarg;
                 break;
+            case 'f':
+                if(!log_filter_parse(optarg, &log_filter) || !log_filter_add(&log_filter)) {
+                    fprintf(stderr, "Error: Invalid log filter %s\n", optarg);
+                    exit(1);
+                }
+                break;
             case 'u':
                 username = optarg;
                 break;
@@ -1122,16 +1311,17 @@ main (int argc, char *argv[])
             case 'S':
 		        ctx->ctrl_socket_path = optarg;
                 break;
+            case 'M':
+                ctx->metrics_address = optarg;
+                break;
+            case 'R':
+                ctx->config.replay_filename = optarg;
+                break;
             default:
                 bbl_print_usage();
                 exit(1);
         }
     }
-    if (geteuid() != 0) {
-        fprintf(stderr, "Error: Must be run with root privileges\n");
-	    exit(1);
-    }
-
     if(!config_file) {
         fprintf(stderr, "Error: No configuration specified (-C / --config <file>)\n");
         exit(1);
@@ -1164,6 +1354,30 @@ main (int argc, char *argv[])
     if(igmp_group_count) ctx->config.igmp_group_count = atoi(igmp_group_count);
     if(igmp_zap_interval) ctx->config.igmp_zap_interval = atoi(igmp_zap_interval);
 
+    if (geteuid() != 0 && !ctx->config.replay_filename && !ctx->config.simulation) {
+        fprintf(stderr, "Error: Must be run with root privileges\n");
+	    exit(1);
+    }
+
+    /*
+     * Virtual time must be enabled before the first timer is added.
+     */
+    if(ctx->config.simulation && ctx->config.simulation_virtual_time) {
+        timer_enable_virtual_time(&ctx->timer_root);
+    }
+
+    /*
+     * Setup slab allocators for timers before the first timer is added,
+     * placed on the NUMA node of the first access interface if enabled.
+     */
+    if(ctx->config.memory_numa && ctx->config.access_config) {
+        numa_node = bbl_slab_numa_node(ctx->config.access_config->interface);
+    }
+    bbl_slab_init(&ctx->timer_slab, "timers", sizeof(timer_s), ctx->config.memory_hugepages, numa_node);
+    bbl_slab_init(&ctx->timer_bucket_slab, "timer-buckets", sizeof(timer_bucket_s), ctx->config.memory_hugepages, numa_node);
+    ctx->timer_root.timer_slab = &ctx->timer_slab;
+    ctx->timer_root.timer_bucket_slab = &ctx->timer_bucket_slab;
+
     /*
      * Start curses.
      */
@@ -1214,10 +1428,31 @@ main (int argc, char *argv[])
         }
     }
 
+    /*
+     * Connect interfaces to the built-in responder.
+     */
+    if(ctx->config.simulation && !ctx->config.replay_filename) {
+        if(!bbl_io_memory_init(ctx)) {
+            if (interactive) endwin();
+            fprintf(stderr, "Error: Failed to setup simulation\n");
+            exit(1);
+        }
+    }
+
     /*
      * Setup resources in case PCAP dumping is desired.
      */
     pcapng_init(ctx);
+    if(!bbl_recorder_init(ctx)) {
+        if (interactive) endwin();
+        fprintf(stderr, "Error: Failed to setup flight recorder\n");
+        exit(1);
+    }
+    if(!bbl_loss_init(ctx)) {
+        if (interactive) endwin();
+        fprintf(stderr, "Error: Failed to setup loss events\n");
+        exit(1);
+    }
 
     /*
      * Setup test.
@@ -1230,6 +1465,33 @@ main (int argc, char *argv[])
         };
     }
 
+    /*
+     * Replay packet capture through the RX path instead
+     * of running the event loop.
+     */
+    if(ctx->config.replay_filename) {
+        if(!bbl_replay_load(ctx)) {
+            fprintf(stderr, "Error: Failed to load replay capture %s\n", ctx->config.replay_filename);
+            exit(1);
+        }
+        clock_gettime(CLOCK_REALTIME, &ctx->timestamp_start);
+        bbl_replay_run(ctx);
+        clock_gettime(CLOCK_REALTIME, &ctx->timestamp_stop);
+        pcapng_close(ctx);
+        bbl_stats_generate(ctx, &stats);
+        bbl_stats_stdout(ctx, &stats);
+        bbl_replay_stdout(ctx);
+        bbl_stats_json(ctx, &stats);
+        bbl_replay_free(ctx);
+        bbl_del_ctx(ctx);
+        exit(0);
+    }
+
+    /*
+     * Setup retransmission job.
+     */
+    bbl_retry_init(ctx);
+
     /*
      * Setup control job.
      */
@@ -1244,6 +1506,16 @@ main (int argc, char *argv[])
             exit(1);
         }
     }
+
+    /*
+     * Setup OpenMetrics listener
+     */
+    if(ctx->metrics_address) {
+        if(!bbl_metrics_open(ctx)) {
+            if (interactive) endwin();
+            exit(1);
+        }
+    }
     
     /*
      * Start smear job. Use a crazy nsec bucket '12345678', such that we do not accidentally smear ourselves.
@@ -1254,32 +1526,53 @@ main (int argc, char *argv[])
      * Start event loop.
      */
     log_open();
-    clock_gettime(CLOCK_REALTIME, &ctx->timestamp_start);
+    if(g_interactive) {
+        bbl_interactive_start(ctx);
+    }
+    timer_clock_gettime(&ctx->timer_root, CLOCK_REALTIME, &ctx->timestamp_start);
     signal(SIGINT, teardown_handler);
     timer_walk(&ctx->timer_root);
     while(ctx->sessions_terminated < ctx->sessions && g_teardown_request_count < 10) {
         timer_walk(&ctx->timer_root);
     }
-    clock_gettime(CLOCK_REALTIME, &ctx->timestamp_stop);
+    timer_clock_gettime(&ctx->timer_root, CLOCK_REALTIME, &ctx->timestamp_stop);
+
+    /*
+     * Emit remaining loss events and write pending log messages.
+     */
+    bbl_loss_close(ctx);
+    log_flush();
 
     /*
      * Stop curses. Do this before the final reports.
      */
     if(g_interactive) {
-        endwin();
+        bbl_interactive_stop(ctx);
     }
 
+    /*
+     * Write remaining captured packets.
+     */
+    pcapng_close(ctx);
+
     /*
      * Generate reports.
      */
     bbl_stats_generate(ctx, &stats);
     bbl_stats_stdout(ctx, &stats);
+    bbl_io_memory_stdout(ctx);
     bbl_stats_json(ctx, &stats);
 
     /*
      * Cleanup ressources.
      */
     log_close();
+    if(ctx->metrics_address) {
+        bbl_metrics_close(ctx);
+    }
+    bbl_recorder_free(ctx);
+    bbl_loss_free(ctx);
+    bbl_io_memory_free(ctx);
     if(ctx->ctrl_socket_path) {
         bbl_ctrl_socket_close(ctx);
     }
@@ -39,10 +39,12 @@
 #include "libdict/dict.h"
 #include "bbl_logging.h"
 #include "bbl_timer.h"
+#include "bbl_slab.h"
 #include "bbl_protocols.h"
 #include "bbl_utils.h"
 #include "bbl_rx.h"
 #include "bbl_tx.h"
+#include "bbl_loss.h"
 
 #define WRITE_BUF_LEN               1514
 #define SCRATCHPAD_LEN              1514
@@ -53,6 +55,7 @@
 #define ARI_LEN                     65
 #define ACI_LEN                     65
 #define CHALLENGE_LEN               16
+#define PCAP_INTERFACES_MAX         8
 
 /* Access Interface */
 #define BBL_SEND_DISCOVERY          0x00000001
@@ -90,6 +93,7 @@
 
 #define BBL_MAX_ACCESS_INTERFACES   64
 #define BBL_AVG_SAMPLES             5
+#define BBL_CACHE_LINE              64
 #define DATA_TRAFFIC_MAX_LEN        1500
 
 typedef struct bbl_rate_
@@ -107,6 +111,67 @@ typedef enum {
     ACCESS_TYPE_IPOE
 } __attribute__ ((__packed__)) bbl_access_type_t;
 
+/*
+ * Session setup phases used for the
+ * setup latency statistics.
+ */
+typedef enum {
+    BBL_SETUP_PHASE_PADO = 0,   // PADI -> PADO
+    BBL_SETUP_PHASE_PADS,       // PADR -> PADS
+    BBL_SETUP_PHASE_LCP,        // PADS -> LCP opened
+    BBL_SETUP_PHASE_AUTH,       // LCP opened -> authentication success
+    BBL_SETUP_PHASE_IPCP,       // authentication success -> IPCP opened
+    BBL_SETUP_PHASE_IP6CP,      // authentication success -> IP6CP opened
+    BBL_SETUP_PHASE_ICMPV6_RA,  // RS -> RA
+    BBL_SETUP_PHASE_DHCPV6,     // DHCPv6 solicit -> reply
+    BBL_SETUP_PHASE_TOTAL,      // session started -> established
+    BBL_SETUP_PHASE_MAX
+} bbl_setup_phase_t;
+
+/*
+ * Retransmission lists, each with a fixed
+ * timeout (see bbl_retry.c).
+ */
+typedef enum {
+    BBL_RETRY_DISCOVERY = 0,    // PADI and PADR
+    BBL_RETRY_LCP,              // LCP configure request
+    BBL_RETRY_LCP_TERMINATE,    // LCP terminate request
+    BBL_RETRY_AUTH,             // PAP request or CHAP response
+    BBL_RETRY_IPCP,             // IPCP configure request
+    BBL_RETRY_IP6CP,            // IP6CP configure request
+    BBL_RETRY_ICMPV6,           // ICMPv6 router solicitation
+    BBL_RETRY_DHCPV6,           // DHCPv6 solicit or request
+    BBL_RETRY_ARP,              // ARP request (unresolved)
+    BBL_RETRY_ARP_REFRESH,      // ARP request (resolved)
+    BBL_RETRY_MAX
+} bbl_retry_type_t;
+
+/* Bucket N counts latencies below 2^N ms,
+ * the last bucket counts everything above. */
+#define BBL_SETUP_LATENCY_BUCKETS   16
+
+typedef struct bbl_setup_latency_
+{
+    uint32_t count;
+    uint32_t min_us;
+    uint32_t max_us;
+    uint64_t sum_us;
+    uint32_t bucket[BBL_SETUP_LATENCY_BUCKETS];
+} bbl_setup_latency_s;
+
+/*
+ * Session lists, each session is on exactly one
+ * of those lists depending on the session state.
+ */
+typedef enum {
+    BBL_SESSIONS_IDLE = 0,      // idle
+    BBL_SESSIONS_SETUP,         // setup in progress
+    BBL_SESSIONS_ESTABLISHED,   // established
+    BBL_SESSIONS_TERMINATING,   // teardown in progress
+    BBL_SESSIONS_TERMINATED,    // terminated
+    BBL_SESSIONS_MAX
+} bbl_session_list_t;
+
 typedef enum {
     IGMP_GROUP_IDLE = 0,
     IGMP_GROUP_LEAVING,
@@ -152,8 +217,12 @@ typedef struct bbl_interface_
     u_char *ring_rx; /* ringbuffer */
     uint cursor_tx; /* slot # inside the ringbuffer */
     uint cursor_rx; /* slot # inside the ringbuffer */
+    uint io_cursor_tx; /* slot # consumed by the memory I/O backend */
+    uint io_cursor_rx; /* slot # filled by the memory I/O backend */
 
     uint32_t pcap_index; /* interface index for packet captures */
+    bool pcap_exclude; /* not selected by pcap interface filter */
+    struct bbl_recorder_ring_ *recorder; /* flight recorder frames */
 
     uint32_t send_requests;
     bool     arp_resolved;
@@ -170,11 +239,15 @@ typedef struct bbl_interface_
     uint     mc_packet_len;
     uint64_t mc_packet_seq;
 
-    struct {
+    /* Counters written by the event loop. All counters
+     * are 64 bit (see bbl_counters_update) and kept in
+     * their own cache lines, separated from the rates
+     * which are updated once per second. Only uint64_t
+     * members are allowed, because the block is summed
+     * up as an array (see bbl_counters_interface_add). */
+    struct bbl_interface_stats_ {
         uint64_t packets_tx;
         uint64_t packets_rx;
-        bbl_rate_s rate_packets_tx;
-        bbl_rate_s rate_packets_rx;
         uint64_t packets_rx_drop_unknown;
         uint64_t packets_rx_drop_decode_error;
         uint64_t sendto_failed;
@@ -184,70 +257,75 @@ typedef struct bbl_interface_
         uint64_t encode_errors;
 
         uint64_t mc_tx;
-        bbl_rate_s rate_mc_tx;
         uint64_t mc_rx;
-        bbl_rate_s rate_mc_rx;
         uint64_t mc_loss;
 
-        /* Packet Stats */
-        uint32_t arp_tx;
-        uint32_t arp_rx;
-        uint32_t padi_tx;
-        uint32_t pado_rx;
-        uint32_t padr_tx;
-        uint32_t pads_rx;
-        uint32_t padt_tx;
-        uint32_t padt_rx;
-        uint32_t lcp_tx;
-        uint32_t lcp_rx;
-        uint32_t lcp_timeout;
-        uint32_t lcp_echo_timeout;
-        uint32_t pap_tx;
-        uint32_t pap_rx;
-        uint32_t pap_timeout;
-        uint32_t chap_tx;
-        uint32_t chap_rx;
-        uint32_t chap_timeout;
-        uint32_t ipcp_tx;
-        uint32_t ipcp_rx;
-        uint32_t ipcp_timeout;
-        uint32_t ip6cp_tx;
-        uint32_t ip6cp_rx;
-        uint32_t ip6cp_timeout;
-        uint32_t igmp_rx;
-        uint32_t igmp_tx;
-        uint32_t icmp_tx;
-        uint32_t icmp_rx;
-        uint32_t icmpv6_tx;
-        uint32_t icmpv6_rx;
-        uint32_t icmpv6_rs_timeout;
-
-        uint32_t dhcpv6_tx;
-        uint32_t dhcpv6_rx;
-        uint32_t dhcpv6_timeout;
-
         uint64_t session_ipv4_tx;
-        bbl_rate_s rate_session_ipv4_tx;
         uint64_t session_ipv4_rx;
-        bbl_rate_s rate_session_ipv4_rx;
         uint64_t session_ipv4_loss;
 
         uint64_t session_ipv6_tx;
-        bbl_rate_s rate_session_ipv6_tx;
         uint64_t session_ipv6_rx;
-        bbl_rate_s rate_session_ipv6_rx;
         uint64_t session_ipv6_loss;
 
         uint64_t session_ipv6pd_tx;
-        bbl_rate_s rate_session_ipv6pd_tx;
         uint64_t session_ipv6pd_rx;
-        bbl_rate_s rate_session_ipv6pd_rx;
         uint64_t session_ipv6pd_loss;
 
         uint64_t session_ipv4_wrong_session;
         uint64_t session_ipv6_wrong_session;
         uint64_t session_ipv6pd_wrong_session;
-    } stats;
+
+        /* Packet Stats */
+        uint64_t arp_tx;
+        uint64_t arp_rx;
+        uint64_t padi_tx;
+        uint64_t pado_rx;
+        uint64_t padr_tx;
+        uint64_t pads_rx;
+        uint64_t padt_tx;
+        uint64_t padt_rx;
+        uint64_t lcp_tx;
+        uint64_t lcp_rx;
+        uint64_t lcp_timeout;
+        uint64_t lcp_echo_timeout;
+        uint64_t pap_tx;
+        uint64_t pap_rx;
+        uint64_t pap_timeout;
+        uint64_t chap_tx;
+        uint64_t chap_rx;
+        uint64_t chap_timeout;
+        uint64_t ipcp_tx;
+        uint64_t ipcp_rx;
+        uint64_t ipcp_timeout;
+        uint64_t ip6cp_tx;
+        uint64_t ip6cp_rx;
+        uint64_t ip6cp_timeout;
+        uint64_t igmp_rx;
+        uint64_t igmp_tx;
+        uint64_t icmp_tx;
+        uint64_t icmp_rx;
+        uint64_t icmpv6_tx;
+        uint64_t icmpv6_rx;
+        uint64_t icmpv6_rs_timeout;
+
+        uint64_t dhcpv6_tx;
+        uint64_t dhcpv6_rx;
+        uint64_t dhcpv6_timeout;
+    } stats __attribute__((aligned(BBL_CACHE_LINE)));
+
+    struct bbl_interface_rates_ {
+        bbl_rate_s packets_tx;
+        bbl_rate_s packets_rx;
+        bbl_rate_s mc_tx;
+        bbl_rate_s mc_rx;
+        bbl_rate_s session_ipv4_tx;
+        bbl_rate_s session_ipv4_rx;
+        bbl_rate_s session_ipv6_tx;
+        bbl_rate_s session_ipv6_rx;
+        bbl_rate_s session_ipv6pd_tx;
+        bbl_rate_s session_ipv6pd_rx;
+    } rate __attribute__((aligned(BBL_CACHE_LINE)));
 
     struct timer_ *tx_job;
     struct timer_ *rx_job;
@@ -256,6 +334,8 @@ typedef struct bbl_interface_
     struct timespec tx_timestamp; /* user space timestamps */
     struct timespec rx_timestamp; /* user space timestamps */
     CIRCLEQ_HEAD(bbl_interface__, bbl_session_ ) session_tx_qhead; /* list of sessions that want to transmit */
+
+    bbl_slab_s session_slab; /* sessions on this access interface */
 } bbl_interface_s;
 
 typedef struct bbl_access_config_
@@ -293,6 +373,12 @@ typedef struct bbl_access_config_
         uint32_t rate_up;
         uint32_t rate_down;
 
+        /* Precompiled templates for the strings above */
+        session_template_s username_template;
+        session_template_s password_template;
+        session_template_s agent_remote_id_template;
+        session_template_s agent_circuit_id_template;
+
         /* Protocols */
         bool ipcp_enable;
         bool ip6cp_enable;
@@ -304,9 +390,26 @@ typedef struct bbl_access_config_
         uint8_t igmp_version;
         bool session_traffic_autostart;
 
+        /* Setup latency per phase */
+        bbl_setup_latency_s setup_latency[BBL_SETUP_PHASE_MAX];
+
         void *next; /* pointer to next access config element */
 } bbl_access_config_s;
 
+/*
+ * Session allocation recorded at startup
+ * and materialized when session is started
+ * (lazy mode).
+ */
+typedef struct bbl_session_pending_
+{
+    uint32_t session_global;    // {session-global}
+    uint32_t session;           // {session}
+    uint16_t outer_vlan_id;
+    uint16_t inner_vlan_id;
+    bbl_access_config_s *access_config;
+} bbl_session_pending_s;
+
 /*
  * BBL context. Top level data structure.
  */
@@ -317,7 +420,9 @@ typedef struct bbl_ctx_
     struct timer_ *smear_timer;
     struct timer_ *stats_timer;
     struct timer_ *keyboard_timer;
+    struct timer_ *counters_timer;
     struct timer_ *ctrl_socket_timer;
+    struct timer_ *retry_timer;
 
     struct timespec timestamp_start;
     struct timespec timestamp_stop;
@@ -335,16 +440,46 @@ typedef struct bbl_ctx_
     uint32_t dhcpv6_established;
     uint32_t dhcpv6_established_max;
 
-    CIRCLEQ_HEAD(bbl_ctx_idle_, bbl_session_ ) sessions_idle_qhead;
-    CIRCLEQ_HEAD(bbl_ctx_teardown_, bbl_session_ ) sessions_teardown_qhead;
+    /* Session lists per state group */
+    CIRCLEQ_HEAD(bbl_ctx_sessions_, bbl_session_ ) sessions_qhead[BBL_SESSIONS_MAX];
+    uint32_t sessions_count[BBL_SESSIONS_MAX];
+
+    /* Sessions not materialized yet (lazy mode) */
+    bbl_session_pending_s *sessions_pending;
+    uint32_t sessions_pending_count;
+    uint32_t sessions_pending_next;
+
+    /* Slab allocators for timers */
+    bbl_slab_s timer_slab;
+    bbl_slab_s timer_bucket_slab;
+
     CIRCLEQ_HEAD(bbl_ctx__, bbl_interface_ ) interface_qhead; /* list of interfaces */
 
+    /* Retransmission lists */
+    struct {
+        CIRCLEQ_HEAD(bbl_ctx_retry_, bbl_session_ ) qhead;
+        uint64_t timeout; /* msec */
+        uint32_t count;
+    } retry[BBL_RETRY_MAX];
+
     dict *session_dict; /* hashtable for sessions */
 
     uint64_t flow_id;
 
     int ctrl_socket;
     char *ctrl_socket_path;
+    char *metrics_address; /* OpenMetrics listener */
+
+    struct bbl_replay_ *replay; /* PCAP replay (-R) */
+    struct bbl_recorder_ *recorder; /* flight recorder */
+    struct bbl_loss_ *loss; /* loss events */
+
+    /* Simulation using memory I/O and built-in responder */
+    struct {
+        struct responder_ctx_ *responder;
+        struct timer_ *job;
+        struct timer_ *end;
+    } simulation;
 
     /* Operational state */
     struct {
@@ -359,12 +494,14 @@ typedef struct bbl_ctx_
 
     /* PCAP */
     struct {
-        int fd;
         char *filename;
-        uint8_t *write_buf;
+        uint8_t *write_buf; /* current buffer of the writer ring */
         uint write_idx;
         bool wrote_header;
         uint32_t index; /* next to be allocated interface index */
+        struct pcapng_ring_ *ring;
+        bool filter; /* any capture filter configured */
+        uint32_t sample_count;
     } pcap;
 
     /* Global Stats */
@@ -381,6 +518,9 @@ typedef struct bbl_ctx_
         uint32_t sessions_established_max;
         uint32_t session_traffic_flows;
         uint32_t session_traffic_flows_verified;
+        bbl_setup_latency_s setup_latency[BBL_SETUP_PHASE_MAX];
+        bbl_setup_latency_s igmp_join_delay; // IGMP zapping join delay of all sessions
+        bbl_setup_latency_s igmp_leave_delay; // IGMP zapping leave delay of all sessions
     } stats;
 
     bool multicast_traffic;
@@ -391,6 +531,7 @@ typedef struct bbl_ctx_
         uint16_t rx_interval;
 
         char *json_report_filename;
+        char *replay_filename;
 
         /* Network Interface */
         char network_if[IFNAMSIZ];
@@ -408,6 +549,46 @@ typedef struct bbl_ctx_
         uint32_t sessions_max_outstanding;
         uint16_t sessions_start_rate;
         uint16_t sessions_stop_rate;
+        bool sessions_lazy;
+
+        /* Memory */
+        bool memory_hugepages;
+        bool memory_numa;
+
+        /* PCAP */
+        uint32_t pcap_buffers;
+        bool pcap_io_uring;
+        bool pcap_control_only;
+        char pcap_interfaces[PCAP_INTERFACES_MAX][IFNAMSIZ];
+        uint8_t pcap_interface_count;
+        uint16_t pcap_outer_vlan;
+        uint16_t pcap_inner_vlan;
+        uint32_t pcap_snaplen;
+        uint32_t pcap_sampling;
+        uint64_t pcap_rotate_size;
+        uint32_t pcap_rotate_interval;
+        uint32_t pcap_rotate_files;
+        bool pcap_nsec;
+        bool recorder;
+        uint32_t recorder_bytes;
+        uint32_t recorder_seconds;
+        uint32_t recorder_max_files;
+        char *recorder_filename;
+        bool recorder_loss;
+        bool recorder_session_down;
+
+        /* Loss Events */
+        uint32_t loss_hold_time; /* seconds */
+        uint32_t loss_rate; /* events per second */
+        uint32_t loss_history;
+
+        /* Simulation */
+        bool simulation;
+        bool simulation_virtual_time;
+        uint32_t simulation_duration; /* seconds */
+        uint32_t simulation_delay; /* msec */
+        double simulation_loss; /* percent */
+        double simulation_traffic_loss; /* percent */
 
         /* Static */
         uint32_t static_ip;
@@ -493,6 +674,7 @@ typedef struct bbl_ctx_
         uint16_t session_traffic_ipv4_pps;
         uint16_t session_traffic_ipv6_pps;
         uint16_t session_traffic_ipv6pd_pps;
+        bool session_traffic_ipv4_udp_checksum;
     } config;
 } bbl_ctx_s;
 
@@ -550,8 +732,8 @@ typedef struct bbl_session_
     uint32_t network_send_requests;
 
     CIRCLEQ_ENTRY(bbl_session_) session_tx_qnode;
-    CIRCLEQ_ENTRY(bbl_session_) session_idle_qnode;
-    CIRCLEQ_ENTRY(bbl_session_) session_teardown_qnode;
+    CIRCLEQ_ENTRY(bbl_session_) session_state_qnode;
+    bbl_session_list_t session_list;
     CIRCLEQ_ENTRY(bbl_session_) session_network_tx_qnode;
 
     /* Key in the hashtable */
@@ -567,24 +749,24 @@ typedef struct bbl_session_
     u_char *write_buf; /* pointer to the slot in the tx_ring */
     uint write_idx;
 
+    /* Retransmission lists (see bbl_retry.c) */
+    struct {
+        CIRCLEQ_ENTRY(bbl_session_) qnode;
+        uint64_t expire; /* msec (monotonic) */
+    } retry[BBL_RETRY_MAX];
+
     /* Session timer */
-    struct timer_ *timer_arp;
-    struct timer_ *timer_padi;
-    struct timer_ *timer_padr;
-    struct timer_ *timer_lcp;
     struct timer_ *timer_lcp_echo;
-    struct timer_ *timer_auth;
-    struct timer_ *timer_ipcp;
-    struct timer_ *timer_ip6cp;
-    struct timer_ *timer_dhcpv6;
     struct timer_ *timer_igmp;
     struct timer_ *timer_zapping;
-    struct timer_ *timer_icmpv6;
     struct timer_ *timer_session;
     struct timer_ *timer_session_traffic_ipv4;
     struct timer_ *timer_session_traffic_ipv6;
     struct timer_ *timer_session_traffic_ipv6pd;
 
+    /* Setup phase start timestamps in usec (monotonic) */
+    uint64_t setup_phase_start[BBL_SETUP_PHASE_MAX];
+
     bbl_access_type_t access_type;
     uint16_t access_third_vlan;
     
@@ -626,6 +808,11 @@ typedef struct bbl_session_
     uint16_t    auth_protocol; /* PAP or CHAP */
     uint8_t     auth_retries;
 
+    /* Pre-encoded LCP echo request/reply, built with
+     * the first echo after PADS and patched per packet. */
+    uint8_t     lcp_echo_template[LCP_ECHO_TEMPLATE_LEN];
+    uint8_t     lcp_echo_template_len;
+
     /* IPCP */
     ppp_state_t ipcp_state;
     uint8_t     ipcp_response_code;
@@ -744,6 +931,8 @@ typedef struct bbl_session_
     uint64_t network_ipv6pd_rx_first_seq;
     uint64_t network_ipv6pd_rx_last_seq;
 
+    struct bbl_loss_event_ *loss_event[BBL_LOSS_FLOW_MAX]; /* open loss events */
+
     struct {
         uint32_t igmp_rx;
         uint32_t igmp_tx;
@@ -801,6 +990,14 @@ void bbl_session_network_tx_qnode_insert(struct bbl_session_ *session);
 void bbl_session_network_tx_qnode_remove(struct bbl_session_ *session);
 void bbl_session_update_state(bbl_ctx_s *ctx, bbl_session_s *session, session_state_t state);
 void bbl_session_clear(bbl_ctx_s *ctx, bbl_session_s *session);
+void bbl_session_start(bbl_ctx_s *ctx, bbl_session_s *session);
+bbl_session_s *bbl_session_pending_next(bbl_ctx_s *ctx);
+
+static inline void
+bbl_session_log_scope (bbl_session_s *session)
+{
+    log_scope_set(session->key.ifindex, session->key.outer_vlan_id, session->key.inner_vlan_id);
+}
 
 WINDOW *log_win;
 WINDOW *stats_win;
@@ -9,6 +9,8 @@
 
 #include "bbl.h"
 #include "bbl_config.h"
+#include "bbl_pcap.h"
+#include "bbl_recorder.h"
 #include <jansson.h>
 #include <sys/stat.h>
 
@@ -250,6 +252,157 @@ json_parse_config (json_t *root, bbl_ctx_s *ctx) {
         if (json_is_number(value)) {
             ctx->config.sessions_stop_rate = json_number_value(value);
         }
+        value = json_object_get(section, "lazy");
+        if (json_is_boolean(value)) {
+            ctx->config.sessions_lazy = json_boolean_value(value);
+        }
+    }
+
+    /* Memory Configuration */
+    section = json_object_get(root, "memory");
+    if (json_is_object(section)) {
+        value = json_object_get(section, "hugepages");
+        if (json_is_boolean(value)) {
+            ctx->config.memory_hugepages = json_boolean_value(value);
+        }
+        value = json_object_get(section, "numa");
+        if (json_is_boolean(value)) {
+            ctx->config.memory_numa = json_boolean_value(value);
+        }
+    }
+
+    /* PCAP Configuration */
+    section = json_object_get(root, "pcap");
+    if (json_is_object(section)) {
+        value = json_object_get(section, "buffers");
+        if (json_is_number(value)) {
+            ctx->config.pcap_buffers = json_number_value(value);
+            if(ctx->config.pcap_buffers < PCAPNG_BUFFERS_MIN) {
+                fprintf(stderr, "JSON config error: Invalid value for pcap->buffers (min %u)\n", PCAPNG_BUFFERS_MIN);
+                return false;
+            }
+        }
+        value = json_object_get(section, "io-uring");
+        if (json_is_boolean(value)) {
+            ctx->config.pcap_io_uring = json_boolean_value(value);
+        }
+        value = json_object_get(section, "control-only");
+        if (json_is_boolean(value)) {
+            ctx->config.pcap_control_only = json_boolean_value(value);
+        }
+        sub = json_object_get(section, "interfaces");
+        if (json_is_array(sub)) {
+            size = json_array_size(sub);
+            if(size > PCAP_INTERFACES_MAX) {
+                fprintf(stderr, "JSON config error: Too many values for pcap->interfaces (max %u)\n", PCAP_INTERFACES_MAX);
+                return false;
+            }
+            for (i = 0; i < size; i++) {
+                value = json_array_get(sub, i);
+                if (!json_is_string(value)) {
+                    fprintf(stderr, "JSON config error: Invalid value for pcap->interfaces\n");
+                    return false;
+                }
+                snprintf(ctx->config.pcap_interfaces[i], IFNAMSIZ, "%s", json_string_value(value));
+            }
+            ctx->config.pcap_interface_count = size;
+        }
+        value = json_object_get(section, "outer-vlan");
+        if (json_is_number(value)) {
+            ctx->config.pcap_outer_vlan = json_number_value(value);
+            ctx->config.pcap_outer_vlan &= 4095;
+        }
+        value = json_object_get(section, "inner-vlan");
+        if (json_is_number(value)) {
+            ctx->config.pcap_inner_vlan = json_number_value(value);
+            ctx->config.pcap_inner_vlan &= 4095;
+        }
+        value = json_object_get(section, "snaplen");
+        if (json_is_number(value)) {
+            ctx->config.pcap_snaplen = json_number_value(value);
+        }
+        value = json_object_get(section, "sampling");
+        if (json_is_number(value)) {
+            ctx->config.pcap_sampling = json_number_value(value);
+        }
+        value = json_object_get(section, "rotate-size");
+        if (json_is_number(value)) {
+            ctx->config.pcap_rotate_size = json_number_value(value);
+        }
+        value = json_object_get(section, "rotate-interval");
+        if (json_is_number(value)) {
+            ctx->config.pcap_rotate_interval = json_number_value(value);
+        }
+        value = json_object_get(section, "rotate-files");
+        if (json_is_number(value)) {
+            ctx->config.pcap_rotate_files = json_number_value(value);
+            if(ctx->config.pcap_rotate_files < 1) {
+                fprintf(stderr, "JSON config error: Invalid value for pcap->rotate-files (min 1)\n");
+                return false;
+            }
+        }
+        value = json_object_get(section, "timestamp-nsec");
+        if (json_is_boolean(value)) {
+            ctx->config.pcap_nsec = json_boolean_value(value);
+        }
+        sub = json_object_get(section, "recorder");
+        if (json_is_object(sub)) {
+            ctx->config.recorder = true;
+            value = json_object_get(sub, "bytes");
+            if (json_is_number(value)) {
+                ctx->config.recorder_bytes = json_number_value(value);
+                if(ctx->config.recorder_bytes < BBL_RECORDER_BYTES_MIN) {
+                    fprintf(stderr, "JSON config error: Invalid value for pcap->recorder->bytes (min %u)\n", BBL_RECORDER_BYTES_MIN);
+                    return false;
+                }
+            }
+            value = json_object_get(sub, "seconds");
+            if (json_is_number(value)) {
+                ctx->config.recorder_seconds = json_number_value(value);
+            }
+            value = json_object_get(sub, "max-files");
+            if (json_is_number(value)) {
+                ctx->config.recorder_max_files = json_number_value(value);
+            }
+            if (json_unpack(sub, "{s:s}", "filename", &s) == 0) {
+                ctx->config.recorder_filename = strdup(s);
+            }
+            value = json_object_get(sub, "loss");
+            if (json_is_boolean(value)) {
+                ctx->config.recorder_loss = json_boolean_value(value);
+            }
+            value = json_object_get(sub, "session-down");
+            if (json_is_boolean(value)) {
+                ctx->config.recorder_session_down = json_boolean_value(value);
+            }
+        }
+    }
+
+    /* Simulation Configuration */
+    section = json_object_get(root, "simulation");
+    if (json_is_object(section)) {
+        ctx->config.simulation = true;
+        ctx->config.simulation_virtual_time = true;
+        value = json_object_get(section, "virtual-time");
+        if (json_is_boolean(value)) {
+            ctx->config.simulation_virtual_time = json_boolean_value(value);
+        }
+        value = json_object_get(section, "duration");
+        if (json_is_number(value)) {
+            ctx->config.simulation_duration = json_number_value(value);
+        }
+        value = json_object_get(section, "delay");
+        if (json_is_number(value)) {
+            ctx->config.simulation_delay = json_number_value(value);
+        }
+        value = json_object_get(section, "loss");
+        if (json_is_number(value)) {
+            ctx->config.simulation_loss = json_number_value(value);
+        }
+        value = json_object_get(section, "traffic-loss");
+        if (json_is_number(value)) {
+            ctx->config.simulation_traffic_loss = json_number_value(value);
+        }
     }
 
     /* IPoE Configuration */
@@ -540,6 +693,31 @@ json_parse_config (json_t *root, bbl_ctx_s *ctx) {
         if (json_is_number(value)) {
             ctx->config.session_traffic_ipv6pd_pps = json_number_value(value);
         }
+        value = json_object_get(section, "ipv4-udp-checksum");
+        if (json_is_boolean(value)) {
+            ctx->config.session_traffic_ipv4_udp_checksum = json_boolean_value(value);
+        }
+    }
+
+    /* Loss Events Configuration */
+    section = json_object_get(root, "loss-events");
+    if (json_is_object(section)) {
+        value = json_object_get(section, "hold-time");
+        if (json_is_number(value)) {
+            ctx->config.loss_hold_time = json_number_value(value);
+        }
+        value = json_object_get(section, "rate");
+        if (json_is_number(value)) {
+            ctx->config.loss_rate = json_number_value(value);
+            if(!ctx->config.loss_rate) {
+                fprintf(stderr, "JSON config error: Invalid value for loss-events->rate (min 1)\n");
+                return false;
+            }
+        }
+        value = json_object_get(section, "history");
+        if (json_is_number(value)) {
+            ctx->config.loss_history = json_number_value(value);
+        }
     }
 
     /* Interface Configuration */
@@ -663,6 +841,17 @@ bbl_config_init_defaults (bbl_ctx_s *ctx) {
     snprintf(ctx->config.agent_circuit_id, ACI_LEN, "%s", g_default_aci);
     ctx->config.tx_interval = 5;
     ctx->config.rx_interval = 5;
+    ctx->config.pcap_buffers = PCAPNG_BUFFERS;
+    ctx->config.pcap_rotate_files = PCAPNG_ROTATE_FILES;
+    ctx->config.recorder_bytes = BBL_RECORDER_BYTES;
+    ctx->config.recorder_seconds = BBL_RECORDER_SECONDS;
+    ctx->config.recorder_max_files = BBL_RECORDER_MAX_FILES;
+    ctx->config.recorder_filename = BBL_RECORDER_FILENAME;
+    ctx->config.recorder_loss = true;
+    ctx->config.recorder_session_down = true;
+    ctx->config.loss_hold_time = BBL_LOSS_HOLD_TIME;
+    ctx->config.loss_rate = BBL_LOSS_RATE;
+    ctx->config.loss_history = BBL_LOSS_HISTORY;
     ctx->config.sessions = 1;
     ctx->config.sessions_max_outstanding = 800;
     ctx->config.sessions_start_rate = 400,
@@ -0,0 +1,165 @@
+/*
+ * BNG Blaster (BBL) - Counters
+ *
+ * All counters are written by the event loop only. Interface
+ * counters are kept in a cache line aligned block per interface
+ * (bbl_interface_s.stats) and global counters in bbl_ctx_s, such
+ * that the event loop can read them directly.
+ *
+ * Readers in other threads (e.g. the interactive UI) must not
+ * access these counters. Instead, the event loop periodically
+ * aggregates all counters into a snapshot which is published
+ * with a sequence lock. This snapshot is consistent, because it
+ * is taken between two event loop callbacks, and readers never
+ * block the event loop.
+ *
+ * Copyright (C) 2020-2021, RtBrick, Inc.
+ */
+
+#include "bbl.h"
+#include "bbl_counters.h"
+#include <sched.h>
+
+/*
+ * The sequence is odd while the snapshot is updated.
+ */
+static struct {
+    uint32_t seq __attribute__((aligned(BBL_CACHE_LINE)));
+    bbl_counters_snapshot_s snapshot __attribute__((aligned(BBL_CACHE_LINE)));
+} counters;
+
+static void
+bbl_counters_interface (bbl_counters_interface_s *counters_if, bbl_interface_s *interface)
+{
+    counters_if->name = interface->name;
+    counters_if->stats = interface->stats;
+    counters_if->rate = interface->rate;
+}
+
+_Static_assert(sizeof(struct bbl_interface_stats_) % sizeof(uint64_t) == 0,
+               "interface counters must be uint64_t only");
+
+/*
+ * Add all counters of the interface block,
+ * which consists of 64 bit counters only.
+ */
+static void
+bbl_counters_interface_add (struct bbl_interface_stats_ *total, struct bbl_interface_stats_ *stats)
+{
+    uint64_t *dst = (uint64_t*)total;
+    uint64_t *src = (uint64_t*)stats;
+    uint i;
+
+    for(i = 0; i < sizeof(struct bbl_interface_stats_) / sizeof(uint64_t); i++) {
+        dst[i] += src[i];
+    }
+}
+
+/*
+ * Aggregate all counters and publish a new snapshot.
+ * This must be called by the event loop only.
+ */
+void
+bbl_counters_update (bbl_ctx_s *ctx)
+{
+    bbl_counters_snapshot_s *snapshot = &counters.snapshot;
+    uint32_t seq;
+    int i;
+
+    seq = counters.seq;
+    __atomic_store_n(&counters.seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    timer_clock_gettime(&ctx->timer_root, CLOCK_REALTIME, &snapshot->timestamp);
+
+    snapshot->sessions = ctx->sessions;
+    snapshot->sessions_pppoe = ctx->sessions_pppoe;
+    snapshot->sessions_ipoe = ctx->sessions_ipoe;
+    snapshot->sessions_established = ctx->sessions_established;
+    snapshot->sessions_established_max = ctx->stats.sessions_established_max;
+    snapshot->sessions_outstanding = ctx->sessions_outstanding;
+    snapshot->sessions_terminated = ctx->sessions_terminated;
+    snapshot->sessions_flapped = ctx->sessions_flapped;
+    snapshot->dhcpv6_requested = ctx->dhcpv6_requested;
+    snapshot->dhcpv6_established = ctx->dhcpv6_established;
+    for(i = 0; i < BBL_SESSIONS_MAX; i++) {
+        snapshot->sessions_count[i] = ctx->sessions_count[i];
+    }
+
+    snapshot->setup_time = ctx->stats.setup_time;
+    snapshot->cps = ctx->stats.cps;
+    snapshot->cps_min = ctx->stats.cps_min;
+    snapshot->cps_avg = ctx->stats.cps_avg;
+    snapshot->cps_max = ctx->stats.cps_max;
+    snapshot->session_traffic_flows = ctx->stats.session_traffic_flows;
+    snapshot->session_traffic_flows_verified = ctx->stats.session_traffic_flows_verified;
+    memcpy(snapshot->setup_latency, ctx->stats.setup_latency, sizeof(snapshot->setup_latency));
+    snapshot->igmp_join_delay = ctx->stats.igmp_join_delay;
+    snapshot->igmp_leave_delay = ctx->stats.igmp_leave_delay;
+
+    if(ctx->loss) {
+        snapshot->loss.events = ctx->loss->stats.events;
+        snapshot->loss.open = ctx->loss->open;
+        snapshot->loss.lost = ctx->loss->stats.lost;
+        snapshot->loss.gaps = ctx->loss->stats.gaps;
+        snapshot->loss.suppressed = ctx->loss->stats.suppressed;
+    }
+
+    if(ctx->op.network_if) {
+        bbl_counters_interface(&snapshot->network_if, ctx->op.network_if);
+    } else {
+        snapshot->network_if.name = NULL;
+    }
+
+    memset(&snapshot->access_total, 0x0, sizeof(snapshot->access_total));
+    snapshot->access_if_count = ctx->op.access_if_count;
+    for(i = 0; i < ctx->op.access_if_count; i++) {
+        bbl_counters_interface(&snapshot->access_if[i], ctx->op.access_if[i]);
+        bbl_counters_interface_add(&snapshot->access_total, &ctx->op.access_if[i]->stats);
+    }
+
+    __atomic_store_n(&counters.seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/*
+ * Copy the last published snapshot. This
+ * can be called by any thread.
+ */
+void
+bbl_counters_snapshot (bbl_counters_snapshot_s *snapshot)
+{
+    uint32_t seq;
+
+    while(true) {
+        seq = __atomic_load_n(&counters.seq, __ATOMIC_ACQUIRE);
+        if(seq & 1) {
+            sched_yield();
+            continue;
+        }
+        memcpy(snapshot, &counters.snapshot, sizeof(bbl_counters_snapshot_s));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if(__atomic_load_n(&counters.seq, __ATOMIC_RELAXED) == seq) {
+            break;
+        }
+    }
+}
+
+static void
+bbl_counters_job (timer_s *timer)
+{
+    bbl_counters_update(timer->data);
+}
+
+/*
+ * Start publishing snapshots, this is
+ * required for readers in other threads.
+ */
+void
+bbl_counters_init (bbl_ctx_s *ctx)
+{
+    if(ctx->counters_timer) {
+        return;
+    }
+    timer_add_periodic(&ctx->timer_root, &ctx->counters_timer, "Counters",
+                       0, BBL_COUNTERS_INTERVAL * MSEC, ctx, bbl_counters_job);
+}
@@ -0,0 +1,74 @@
+/*
+ * BNG Blaster (BBL) - Counters
+ *
+ * Consistent counter snapshots for readers
+ * outside of the event loop.
+ *
+ * Copyright (C) 2020-2021, RtBrick, Inc.
+ */
+
+#ifndef __BBL_COUNTERS_H__
+#define __BBL_COUNTERS_H__
+
+#define BBL_COUNTERS_INTERVAL       100 /* milliseconds */
+
+typedef struct bbl_counters_interface_ {
+    char *name;
+    struct bbl_interface_stats_ stats;
+    struct bbl_interface_rates_ rate;
+} bbl_counters_interface_s;
+
+typedef struct bbl_counters_snapshot_ {
+    struct timespec timestamp;
+
+    /* Sessions */
+    uint64_t sessions;
+    uint64_t sessions_pppoe;
+    uint64_t sessions_ipoe;
+    uint64_t sessions_established;
+    uint64_t sessions_established_max;
+    uint64_t sessions_outstanding;
+    uint64_t sessions_terminated;
+    uint64_t sessions_flapped;
+    uint64_t dhcpv6_requested;
+    uint64_t dhcpv6_established;
+    uint64_t sessions_count[BBL_SESSIONS_MAX]; /* per session list */
+
+    uint64_t setup_time;
+    double cps;
+    double cps_min;
+    double cps_avg;
+    double cps_max;
+    uint64_t session_traffic_flows;
+    uint64_t session_traffic_flows_verified;
+    bbl_setup_latency_s setup_latency[BBL_SETUP_PHASE_MAX];
+    bbl_setup_latency_s igmp_join_delay;
+    bbl_setup_latency_s igmp_leave_delay;
+
+    /* Loss events */
+    struct {
+        uint64_t events;
+        uint64_t open;
+        uint64_t lost;
+        uint64_t gaps;
+        uint64_t suppressed;
+    } loss;
+
+    /* Interfaces, the network interface name
+     * is NULL without network interface. */
+    bbl_counters_interface_s network_if;
+    uint8_t access_if_count;
+    bbl_counters_interface_s access_if[BBL_MAX_ACCESS_INTERFACES];
+    struct bbl_interface_stats_ access_total; /* sum of all access interfaces */
+} bbl_counters_snapshot_s;
+
+void
+bbl_counters_init (bbl_ctx_s *ctx);
+
+void
+bbl_counters_update (bbl_ctx_s *ctx);
+
+void
+bbl_counters_snapshot (bbl_counters_snapshot_s *snapshot);
+
+#endif
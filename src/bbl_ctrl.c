@@ -23,6 +23,8 @@
 #include "bbl.h"
 #include "bbl_ctrl.h"
 #include "bbl_logging.h"
+#include "bbl_stats.h"
+#include "bbl_recorder.h"
 
 #define BACKLOG 4
 #define INPUT_BUFFER 1024
@@ -86,6 +88,115 @@ bbl_ctrl_multicast_traffic_stop(int fd, bbl_ctx_s *ctx, session_key_t *key __att
     return bbl_ctrl_status(fd, "ok", 200, NULL);
 }
 
+ssize_t
+bbl_ctrl_recorder_dump(int fd, bbl_ctx_s *ctx, session_key_t *key __attribute__((unused)), json_t* arguments __attribute__((unused))) {
+    if(!ctx->recorder) {
+        return bbl_ctrl_status(fd, "warning", 404, "flight recorder not enabled");
+    }
+    bbl_recorder_trigger(ctx, BBL_RECORDER_TRIGGER_CTRL);
+    return bbl_ctrl_status(fd, "ok", 200, NULL);
+}
+
+ssize_t
+bbl_ctrl_log_filters(int fd, bbl_ctx_s *ctx __attribute__((unused)), session_key_t *key __attribute__((unused)), json_t* arguments __attribute__((unused))) {
+    ssize_t result = 0;
+    json_t *root, *filters, *filter;
+    uint i;
+
+    filters = json_array();
+    for(i = 0; i < g_log_filter_count; i++) {
+        filter = json_pack("{si si si si si}",
+                           "ifindex", g_log_filters[i].ifindex,
+                           "outer-vlan-min", g_log_filters[i].outer_vlan_min,
+                           "outer-vlan-max", g_log_filters[i].outer_vlan_max,
+                           "inner-vlan-min", g_log_filters[i].inner_vlan_min,
+                           "inner-vlan-max", g_log_filters[i].inner_vlan_max);
+        json_array_append_new(filters, filter);
+    }
+    root = json_pack("{ss si so}",
+                     "status", "ok",
+                     "code", 200,
+                     "log-filters", filters);
+    if(root) {
+        result = json_dumpfd(root, fd, 0);
+        json_decref(root);
+    } else {
+        bbl_ctrl_status(fd, "error", 500, "internal error");
+        json_decref(filters);
+    }
+    return result;
+}
+
+/*
+ * Add a log filter for the session given by ifindex, outer-vlan
+ * and inner-vlan. Missing VLAN arguments match any VLAN and ranges
+ * are added with the optional arguments outer-vlan-max and
+ * inner-vlan-max. Without ifindex all interfaces are matched.
+ */
+ssize_t
+bbl_ctrl_log_filter_add(int fd, bbl_ctx_s *ctx __attribute__((unused)), session_key_t *key, json_t* arguments) {
+    log_filter_s filter = {0};
+    json_t *value;
+
+    if(!arguments) {
+        return bbl_ctrl_status(fd, "error", 400, "missing arguments");
+    }
+    if(json_object_get(arguments, "ifindex")) {
+        filter.ifindex = key->ifindex;
+    }
+    filter.outer_vlan_max = ETH_VLAN_ID_MAX;
+    if(json_object_get(arguments, "outer-vlan")) {
+        filter.outer_vlan_min = filter.outer_vlan_max = key->outer_vlan_id;
+    }
+    filter.inner_vlan_max = ETH_VLAN_ID_MAX;
+    if(json_object_get(arguments, "inner-vlan")) {
+        filter.inner_vlan_min = filter.inner_vlan_max = key->inner_vlan_id;
+    }
+    value = json_object_get(arguments, "outer-vlan-max");
+    if(json_is_number(value)) {
+        if(json_number_value(value) < filter.outer_vlan_min || json_number_value(value) > ETH_VLAN_ID_MAX) {
+            return bbl_ctrl_status(fd, "error", 400, "invalid outer-vlan-max");
+        }
+        filter.outer_vlan_max = json_number_value(value);
+    }
+    value = json_object_get(arguments, "inner-vlan-max");
+    if(json_is_number(value)) {
+        if(json_number_value(value) < filter.inner_vlan_min || json_number_value(value) > ETH_VLAN_ID_MAX) {
+            return bbl_ctrl_status(fd, "error", 400, "invalid inner-vlan-max");
+        }
+        filter.inner_vlan_max = json_number_value(value);
+    }
+    if(!log_filter_add(&filter)) {
+        return bbl_ctrl_status(fd, "warning", 409, "too many log filters");
+    }
+    return bbl_ctrl_status(fd, "ok", 200, NULL);
+}
+
+ssize_t
+bbl_ctrl_log_filter_clear(int fd, bbl_ctx_s *ctx __attribute__((unused)), session_key_t *key __attribute__((unused)), json_t* arguments __attribute__((unused))) {
+    log_filter_clear();
+    return bbl_ctrl_status(fd, "ok", 200, NULL);
+}
+
+ssize_t
+bbl_ctrl_loss_events(int fd, bbl_ctx_s *ctx, session_key_t *key __attribute__((unused)), json_t* arguments __attribute__((unused))) {
+    ssize_t result = 0;
+    json_t *root;
+
+    if(!ctx->loss) {
+        return bbl_ctrl_status(fd, "warning", 404, "loss events not enabled");
+    }
+    root = json_pack("{ss si so}",
+                     "status", "ok",
+                     "code", 200,
+                     "loss-events", bbl_loss_json(ctx));
+    if(root) {
+        result = json_dumpfd(root, fd, 0);
+        json_decref(root);
+    }
+    return result;
+}
+
 ssize_t
 bbl_ctrl_session_traffic(int fd, bbl_ctx_s *ctx, session_key_t *key, bool status) {
     struct dict_itor *itor;
@@ -370,6 +481,20 @@ bbl_ctrl_session_counters(int fd, bbl_ctx_s *ctx, session_key_t *key __attribute
     return result;
 }
 
+ssize_t
+bbl_ctrl_session_setup_latency(int fd, bbl_ctx_s *ctx, session_key_t *key __attribute__((unused)), json_t* arguments __attribute__((unused))) {
+    ssize_t result = 0;
+    json_t *root = json_pack("{ss si so}",
+                             "status", "ok",
+                             "code", 200,
+                             "session-setup-latency", bbl_stats_setup_latency_json(ctx));
+    if(root) {
+        result = json_dumpfd(root, fd, 0);
+        json_decref(root);
+    }
+    return result;
+}
+
 ssize_t
 bbl_ctrl_session_info(int fd, bbl_ctx_s *ctx, session_key_t *key, json_t* arguments __attribute__((unused))) {
     ssize_t result = 0;
@@ -663,6 +788,7 @@ struct action actions[] = {
     {"ip6cp-open", bbl_ctrl_session_ip6cp_open},
     {"ip6cp-close", bbl_ctrl_session_ip6cp_close},
     {"session-counters", bbl_ctrl_session_counters},
+    {"session-setup-latency", bbl_ctrl_session_setup_latency},
     {"session-info", bbl_ctrl_session_info},
     {"session-traffic-enabled", bbl_ctrl_session_traffic_start},
     {"session-traffic-start", bbl_ctrl_session_traffic_start},
@@ -673,6 +799,11 @@ struct action actions[] = {
     {"igmp-join", bbl_ctrl_igmp_join},
     {"igmp-leave", bbl_ctrl_igmp_leave},
     {"igmp-info", bbl_ctrl_igmp_info},
+    {"recorder-dump", bbl_ctrl_recorder_dump},
+    {"loss-events", bbl_ctrl_loss_events},
+    {"log-filters", bbl_ctrl_log_filters},
+    {"log-filter-add", bbl_ctrl_log_filter_add},
+    {"log-filter-clear", bbl_ctrl_log_filter_clear},
     {NULL, NULL},
 };
 
@@ -762,7 +893,11 @@ bbl_ctrl_socket_job (timer_s *timer) {
                                 bbl_ctrl_status(fd, "error", 400, "unknown command");
                                 break;
                             } else if(strcmp(actions[i].name, command) == 0) {
+                                if(arguments) {
+                                    log_scope_set(key.ifindex, key.outer_vlan_id, key.inner_vlan_id);
+                                }
                                 actions[i].fn(fd, ctx, &key, arguments);
+                                log_scope_clear();
                                 break;
                             }
                         }
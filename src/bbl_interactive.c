@@ -10,9 +10,12 @@
 #include "bbl.h"
 #include "bbl_stats.h"
 #include "bbl_logging.h"
+#include "bbl_counters.h"
+#include <pthread.h>
 
 #define PROGRESS_BAR_SIZE   60
 #define STATS_WIN_SIZE      90
+#define UI_FRAME_INTERVAL   100 /* milliseconds */
 
 /* ncurses */
 WINDOW *stats_win = NULL;
@@ -24,6 +27,16 @@ extern uint8_t g_access_if_selected;
 
 extern const char banner[];
 
+static struct {
+    pthread_t thread;
+    bool thread_running;
+    bool stop;
+    int key; /* key pressed, processed by the main thread */
+
+    bbl_ctx_s *ctx;
+    bbl_counters_snapshot_s snapshot;
+} ui;
+
 static void
 enable_disable_session_traffic(bbl_ctx_s *ctx, bool status)
 {
@@ -42,7 +55,8 @@ enable_disable_session_traffic(bbl_ctx_s *ctx, bool status)
 }
 
 /*
- * Interactive keyboard reader
+ * Interactive keyboard reader, keys are
+ * read by the UI thread.
  */
 void
 bbl_read_key_job (timer_s *timer)
@@ -50,7 +64,11 @@ bbl_read_key_job (timer_s *timer)
     bbl_ctx_s *ctx = timer->data;
     int ch;
 
-    ch = getch();
+    if(ui.thread_running) {
+        ch = __atomic_exchange_n(&ui.key, 0, __ATOMIC_ACQUIRE);
+    } else {
+        ch = getch();
+    }
     switch (ch) {
         case KEY_F(6):
             g_access_if_selected++;
@@ -108,187 +126,205 @@ bbl_format_progress (uint complete, uint current)
 /*
  * Display meaningful stats in a curses window.
  */
-void
-bbl_stats_job (timer_s *timer)
+static void
+bbl_ui_render (bbl_ctx_s *ctx, bbl_counters_snapshot_s *snapshot)
 {
-    bbl_ctx_s *ctx = timer->data;
-    struct bbl_interface_ *access_if;    
+    bbl_counters_interface_s *access_if = NULL;
+    uint8_t selected;
     int max_x, max_y;
     int i; 
 
-    access_if = ctx->op.access_if[g_access_if_selected];
+    selected = __atomic_load_n(&g_access_if_selected, __ATOMIC_RELAXED);
+    if(selected < snapshot->access_if_count) {
+        access_if = &snapshot->access_if[selected];
+    }
 
     wmove(stats_win, 12, 0);
     getmaxyx(stats_win, max_y, max_x);
 
     (void)max_x;
 
-    if(ctx->sessions) {
-        wprintw(stats_win, "\nSessions      %10lu (%lu PPPoE / %lu IPoE)\n", ctx->sessions, ctx->sessions_pppoe, ctx->sessions_ipoe);
+    if(snapshot->sessions) {
+        wprintw(stats_win, "\nSessions      %10lu (%lu PPPoE / %lu IPoE)\n", snapshot->sessions, snapshot->sessions_pppoe, snapshot->sessions_ipoe);
 
         /* Progress bar established sessions */
-        wprintw(stats_win, "  Established %10lu [", ctx->sessions_established);
-        if(ctx->sessions == ctx->sessions_established) {
+        wprintw(stats_win, "  Established %10lu [", snapshot->sessions_established);
+        if(snapshot->sessions == snapshot->sessions_established) {
             wattron(stats_win, COLOR_PAIR(COLOR_GREEN));
-            wprintw(stats_win, "%s", bbl_format_progress(ctx->sessions, ctx->sessions_established));
+            wprintw(stats_win, "%s", bbl_format_progress(snapshot->sessions, snapshot->sessions_established));
             wattroff(stats_win, COLOR_PAIR(COLOR_GREEN));
         } else {
             wattron(stats_win, COLOR_PAIR(COLOR_BLACK));
-            wprintw(stats_win, "%s", bbl_format_progress(ctx->sessions, ctx->sessions_established));
+            wprintw(stats_win, "%s", bbl_format_progress(snapshot->sessions, snapshot->sessions_established));
             wattroff(stats_win, COLOR_PAIR(COLOR_BLACK));    
         }
         wprintw(stats_win, "]\n");
 
         /* Progress bar outstanding sessions */
-        wprintw(stats_win, "  Outstanding %10lu [", ctx->sessions_outstanding);
+        wprintw(stats_win, "  Outstanding %10lu [", snapshot->sessions_outstanding);
         wattron(stats_win, COLOR_PAIR(COLOR_BLACK));
-        wprintw(stats_win, "%s", bbl_format_progress(ctx->config.sessions_max_outstanding, ctx->sessions_outstanding));
+        wprintw(stats_win, "%s", bbl_format_progress(ctx->config.sessions_max_outstanding, snapshot->sessions_outstanding));
         wattroff(stats_win, COLOR_PAIR(COLOR_BLACK));
         wprintw(stats_win, "]\n");
 
         /* Progress bar terminated sessions */
-        wprintw(stats_win, "  Terminated  %10lu [", ctx->sessions_terminated);
+        wprintw(stats_win, "  Terminated  %10lu [", snapshot->sessions_terminated);
         wattron(stats_win, COLOR_PAIR(COLOR_RED));
-        wprintw(stats_win, "%s", bbl_format_progress(ctx->sessions, ctx->sessions_terminated));
+        wprintw(stats_win, "%s", bbl_format_progress(snapshot->sessions, snapshot->sessions_terminated));
         wattroff(stats_win, COLOR_PAIR(COLOR_RED));
         wprintw(stats_win, "]\n");
 
         /* Session stats */
-        wprintw(stats_win, "  Setup Time  %10lu ms\n", ctx->stats.setup_time);
+        wprintw(stats_win, "  Setup Time  %10lu ms\n", snapshot->setup_time);
         wprintw(stats_win, "  Setup Rate  %10.02lf CPS (MIN: %0.02lf AVG: %0.02lf MAX: %0.02lf)\n",
-                ctx->stats.cps, ctx->stats.cps_min, ctx->stats.cps_avg, ctx->stats.cps_max);
-        wprintw(stats_win, "  Flapped     %10lu\n", ctx->sessions_flapped);
+                snapshot->cps, snapshot->cps_min, snapshot->cps_avg, snapshot->cps_max);
+        wprintw(stats_win, "  Flapped     %10lu\n", snapshot->sessions_flapped);
 
         /* DHCPv6 */
         if(ctx->config.dhcpv6_enable) {
             wprintw(stats_win, "\nDHCPv6\n");
-            wprintw(stats_win, "  Sessions    %10lu\n", ctx->dhcpv6_requested);
-            wprintw(stats_win, "  Established %10lu [", ctx->dhcpv6_established);
-            if(ctx->dhcpv6_requested == ctx->dhcpv6_established) {
+            wprintw(stats_win, "  Sessions    %10lu\n", snapshot->dhcpv6_requested);
+            wprintw(stats_win, "  Established %10lu [", snapshot->dhcpv6_established);
+            if(snapshot->dhcpv6_requested == snapshot->dhcpv6_established) {
                 wattron(stats_win, COLOR_PAIR(COLOR_GREEN));
-                wprintw(stats_win, "%s", bbl_format_progress(ctx->dhcpv6_requested, ctx->dhcpv6_established));
+                wprintw(stats_win, "%s", bbl_format_progress(snapshot->dhcpv6_requested, snapshot->dhcpv6_established));
                 wattroff(stats_win, COLOR_PAIR(COLOR_GREEN));
             } else {
                 wattron(stats_win, COLOR_PAIR(COLOR_BLACK));
-                wprintw(stats_win, "%s", bbl_format_progress(ctx->dhcpv6_requested, ctx->dhcpv6_established));
+                wprintw(stats_win, "%s", bbl_format_progress(snapshot->dhcpv6_requested, snapshot->dhcpv6_established));
                 wattroff(stats_win, COLOR_PAIR(COLOR_BLACK));
             }
             wprintw(stats_win, "]\n");
         }
     }
     
-    if (ctx->op.network_if) {
-        if(access_if && ctx->stats.session_traffic_flows) {
+    if (snapshot->network_if.name) {
+        if(access_if && snapshot->session_traffic_flows) {
             wprintw(stats_win, "\nSession Traffic\n");
-            wprintw(stats_win, "  Flows       %10lu\n", ctx->stats.session_traffic_flows);
+            wprintw(stats_win, "  Flows       %10lu\n", snapshot->session_traffic_flows);
             /* Progress bar session traffic flows */
-            wprintw(stats_win, "  Verified    %10lu [", ctx->stats.session_traffic_flows_verified);
-            if(ctx->stats.session_traffic_flows == ctx->stats.session_traffic_flows_verified) {
+            wprintw(stats_win, "  Verified    %10lu [", snapshot->session_traffic_flows_verified);
+            if(snapshot->session_traffic_flows == snapshot->session_traffic_flows_verified) {
                 wattron(stats_win, COLOR_PAIR(COLOR_GREEN));
-                wprintw(stats_win, "%s", bbl_format_progress(ctx->stats.session_traffic_flows, ctx->stats.session_traffic_flows_verified));
+                wprintw(stats_win, "%s", bbl_format_progress(snapshot->session_traffic_flows, snapshot->session_traffic_flows_verified));
                 wattroff(stats_win, COLOR_PAIR(COLOR_GREEN));
             } else {
                 wattron(stats_win, COLOR_PAIR(COLOR_BLACK));
-                wprintw(stats_win, "%s", bbl_format_progress(ctx->stats.session_traffic_flows, ctx->stats.session_traffic_flows_verified));
+                wprintw(stats_win, "%s", bbl_format_progress(snapshot->session_traffic_flows, snapshot->session_traffic_flows_verified));
                 wattroff(stats_win, COLOR_PAIR(COLOR_BLACK));   
             }
             wprintw(stats_win, "]\n");
         }
         wprintw(stats_win, "\nNetwork Interface (");
         wattron(stats_win, COLOR_PAIR(COLOR_GREEN));
-        wprintw(stats_win, " %s", ctx->op.network_if->name);
+        wprintw(stats_win, " %s", snapshot->network_if.name);
         wattroff(stats_win, COLOR_PAIR(COLOR_GREEN));
         wprintw(stats_win, " )\n  Tx Packets                %10lu (%7lu PPS)\n",
-            ctx->op.network_if->stats.packets_tx, ctx->op.network_if->stats.rate_packets_tx.avg);
+            snapshot->network_if.stats.packets_tx, snapshot->network_if.rate.packets_tx.avg);
         wprintw(stats_win, "  Rx Packets                %10lu (%7lu PPS)\n",
-            ctx->op.network_if->stats.packets_rx, ctx->op.network_if->stats.rate_packets_rx.avg);
+            snapshot->network_if.stats.packets_rx, snapshot->network_if.rate.packets_rx.avg);
         wprintw(stats_win, "  Tx Session Packets        %10lu (%7lu PPS)\n",
-            ctx->op.network_if->stats.session_ipv4_tx, ctx->op.network_if->stats.rate_session_ipv4_tx.avg);
+            snapshot->network_if.stats.session_ipv4_tx, snapshot->network_if.rate.session_ipv4_tx.avg);
         wprintw(stats_win, "  Rx Session Packets        %10lu (%7lu PPS) Loss: %lu\n",
-            ctx->op.network_if->stats.session_ipv4_rx, ctx->op.network_if->stats.rate_session_ipv4_rx.avg,
-            ctx->op.network_if->stats.session_ipv4_loss);
+            snapshot->network_if.stats.session_ipv4_rx, snapshot->network_if.rate.session_ipv4_rx.avg,
+            snapshot->network_if.stats.session_ipv4_loss);
         wprintw(stats_win, "  Tx Session Packets IPv6   %10lu (%7lu PPS)\n",
-            ctx->op.network_if->stats.session_ipv6_tx, ctx->op.network_if->stats.rate_session_ipv6_tx.avg);
+            snapshot->network_if.stats.session_ipv6_tx, snapshot->network_if.rate.session_ipv6_tx.avg);
         wprintw(stats_win, "  Rx Session Packets IPv6   %10lu (%7lu PPS) Loss: %lu\n",
-            ctx->op.network_if->stats.session_ipv6_rx, ctx->op.network_if->stats.rate_session_ipv6_rx.avg,
-            ctx->op.network_if->stats.session_ipv6_loss);
+            snapshot->network_if.stats.session_ipv6_rx, snapshot->network_if.rate.session_ipv6_rx.avg,
+            snapshot->network_if.stats.session_ipv6_loss);
         wprintw(stats_win, "  Tx Session Packets IPv6PD %10lu (%7lu PPS)\n",
-            ctx->op.network_if->stats.session_ipv6pd_tx, ctx->op.network_if->stats.rate_session_ipv6pd_tx.avg);
+            snapshot->network_if.stats.session_ipv6pd_tx, snapshot->network_if.rate.session_ipv6pd_tx.avg);
         wprintw(stats_win, "  Rx Session Packets IPv6PD %10lu (%7lu PPS) Loss: %lu\n",
-            ctx->op.network_if->stats.session_ipv6pd_rx, ctx->op.network_if->stats.rate_session_ipv6pd_rx.avg,
-            ctx->op.network_if->stats.session_ipv6pd_loss);
+            snapshot->network_if.stats.session_ipv6pd_rx, snapshot->network_if.rate.session_ipv6pd_rx.avg,
+            snapshot->network_if.stats.session_ipv6pd_loss);
         wprintw(stats_win, "  Tx Multicast Packets      %10lu (%7lu PPS)\n",
-            ctx->op.network_if->stats.mc_tx, ctx->op.network_if->stats.rate_mc_tx.avg);
+            snapshot->network_if.stats.mc_tx, snapshot->network_if.rate.mc_tx.avg);
     }
 
     if(access_if) {
         wprintw(stats_win, "\nAccess Interface (");
-        for(i = 0; i < ctx->op.access_if_count; i++) {
-            if(i == g_access_if_selected) {
+        for(i = 0; i < snapshot->access_if_count; i++) {
+            if(i == selected) {
                 wattron(stats_win, COLOR_PAIR(COLOR_GREEN));
-                wprintw(stats_win, " %s", ctx->op.access_if[i]->name);
+                wprintw(stats_win, " %s", snapshot->access_if[i].name);
                 wattroff(stats_win, COLOR_PAIR(COLOR_GREEN));
             } else {
-                wprintw(stats_win, " %s", ctx->op.access_if[i]->name); 
+                wprintw(stats_win, " %s", snapshot->access_if[i].name); 
             }
         }
         wprintw(stats_win, " )\n  Tx Packets                %10lu (%7lu PPS)\n",
-            access_if->stats.packets_tx, access_if->stats.rate_packets_tx.avg);
+            access_if->stats.packets_tx, access_if->rate.packets_tx.avg);
         wprintw(stats_win, "  Rx Packets                %10lu (%7lu PPS)\n",
-            access_if->stats.packets_rx, access_if->stats.rate_packets_rx.avg);
+            access_if->stats.packets_rx, access_if->rate.packets_rx.avg);
         wprintw(stats_win, "  Tx Session Packets        %10lu (%7lu PPS)\n",
-            access_if->stats.session_ipv4_tx, access_if->stats.rate_session_ipv4_tx.avg);
+            access_if->stats.session_ipv4_tx, access_if->rate.session_ipv4_tx.avg);
         wprintw(stats_win, "  Rx Session Packets        %10lu (%7lu PPS) Loss: %lu Wrong Session: %lu\n",
-            access_if->stats.session_ipv4_rx, access_if->stats.rate_session_ipv4_rx.avg,
+            access_if->stats.session_ipv4_rx, access_if->rate.session_ipv4_rx.avg,
             access_if->stats.session_ipv4_loss, access_if->stats.session_ipv4_wrong_session);
         wprintw(stats_win, "  Tx Session Packets IPv6   %10lu (%7lu PPS)\n",
-            access_if->stats.session_ipv6_tx, access_if->stats.rate_session_ipv6_tx.avg);
+            access_if->stats.session_ipv6_tx, access_if->rate.session_ipv6_tx.avg);
         wprintw(stats_win, "  Rx Session Packets IPv6   %10lu (%7lu PPS) Loss: %lu Wrong Session: %lu\n",
-            access_if->stats.session_ipv6_rx, access_if->stats.rate_session_ipv6_rx.avg,
+            access_if->stats.session_ipv6_rx, access_if->rate.session_ipv6_rx.avg,
             access_if->stats.session_ipv6_loss, access_if->stats.session_ipv6_wrong_session);
         wprintw(stats_win, "  Tx Session Packets IPv6PD %10lu (%7lu PPS)\n",
-            access_if->stats.session_ipv6pd_tx, access_if->stats.rate_session_ipv6pd_tx.avg);
+            access_if->stats.session_ipv6pd_tx, access_if->rate.session_ipv6pd_tx.avg);
         wprintw(stats_win, "  Rx Session Packets IPv6PD %10lu (%7lu PPS) Loss: %lu Wrong Session: %lu\n",
-            access_if->stats.session_ipv6pd_rx, access_if->stats.rate_session_ipv6pd_rx.avg,
+            access_if->stats.session_ipv6pd_rx, access_if->rate.session_ipv6pd_rx.avg,
             access_if->stats.session_ipv6pd_loss, access_if->stats.session_ipv6pd_wrong_session);
         wprintw(stats_win, "  Rx Multicast Packets      %10lu (%7lu PPS) Loss: %lu\n",
-            access_if->stats.mc_rx, access_if->stats.rate_mc_rx.avg,
+            access_if->stats.mc_rx, access_if->rate.mc_rx.avg,
             access_if->stats.mc_loss);
 
         /* Protocol stats */
         if(max_y > 68) {
             wprintw(stats_win, "\nAccess Interface Protocol Packet Stats\n");
-            wprintw(stats_win, "  ARP    TX: %10u RX: %10u\n", access_if->stats.arp_tx, access_if->stats.arp_rx);
-            wprintw(stats_win, "  PADI   TX: %10u RX: %10u\n", access_if->stats.padi_tx, 0);
-            wprintw(stats_win, "  PADO   TX: %10u RX: %10u\n", 0, access_if->stats.pado_rx);
-            wprintw(stats_win, "  PADR   TX: %10u RX: %10u\n", access_if->stats.padr_tx, 0);
-            wprintw(stats_win, "  PADS   TX: %10u RX: %10u\n", 0, access_if->stats.pads_rx);
-            wprintw(stats_win, "  PADT   TX: %10u RX: %10u\n", access_if->stats.padt_tx, access_if->stats.padt_rx);
-            wprintw(stats_win, "  LCP    TX: %10u RX: %10u\n", access_if->stats.lcp_tx, access_if->stats.lcp_rx);
-            wprintw(stats_win, "  PAP    TX: %10u RX: %10u\n", access_if->stats.pap_tx, access_if->stats.pap_rx);
-            wprintw(stats_win, "  CHAP   TX: %10u RX: %10u\n", access_if->stats.chap_tx, access_if->stats.chap_rx);
-            wprintw(stats_win, "  IPCP   TX: %10u RX: %10u\n", access_if->stats.ipcp_tx, access_if->stats.ipcp_rx);
-            wprintw(stats_win, "  IP6CP  TX: %10u RX: %10u\n", access_if->stats.ip6cp_tx, access_if->stats.ip6cp_rx);
-            wprintw(stats_win, "  IGMP   TX: %10u RX: %10u\n", access_if->stats.igmp_tx, access_if->stats.igmp_rx);
-            wprintw(stats_win, "  ICMP   TX: %10u RX: %10u\n", access_if->stats.icmp_tx, access_if->stats.icmp_rx);
-            wprintw(stats_win, "  ICMPv6 TX: %10u RX: %10u\n", access_if->stats.icmpv6_tx, access_if->stats.icmpv6_rx);
-            wprintw(stats_win, "  DHCPv6 TX: %10u RX: %10u\n", access_if->stats.dhcpv6_tx, access_if->stats.dhcpv6_rx);
+            wprintw(stats_win, "  ARP    TX: %10lu RX: %10lu\n", access_if->stats.arp_tx, access_if->stats.arp_rx);
+            wprintw(stats_win, "  PADI   TX: %10lu RX: %10lu\n", access_if->stats.padi_tx, 0UL);
+            wprintw(stats_win, "  PADO   TX: %10lu RX: %10lu\n", 0UL, access_if->stats.pado_rx);
+            wprintw(stats_win, "  PADR   TX: %10lu RX: %10lu\n", access_if->stats.padr_tx, 0UL);
+            wprintw(stats_win, "  PADS   TX: %10lu RX: %10lu\n", 0UL, access_if->stats.pads_rx);
+            wprintw(stats_win, "  PADT   TX: %10lu RX: %10lu\n", access_if->stats.padt_tx, access_if->stats.padt_rx);
+            wprintw(stats_win, "  LCP    TX: %10lu RX: %10lu\n", access_if->stats.lcp_tx, access_if->stats.lcp_rx);
+            wprintw(stats_win, "  PAP    TX: %10lu RX: %10lu\n", access_if->stats.pap_tx, access_if->stats.pap_rx);
+            wprintw(stats_win, "  CHAP   TX: %10lu RX: %10lu\n", access_if->stats.chap_tx, access_if->stats.chap_rx);
+            wprintw(stats_win, "  IPCP   TX: %10lu RX: %10lu\n", access_if->stats.ipcp_tx, access_if->stats.ipcp_rx);
+            wprintw(stats_win, "  IP6CP  TX: %10lu RX: %10lu\n", access_if->stats.ip6cp_tx, access_if->stats.ip6cp_rx);
+            wprintw(stats_win, "  IGMP   TX: %10lu RX: %10lu\n", access_if->stats.igmp_tx, access_if->stats.igmp_rx);
+            wprintw(stats_win, "  ICMP   TX: %10lu RX: %10lu\n", access_if->stats.icmp_tx, access_if->stats.icmp_rx);
+            wprintw(stats_win, "  ICMPv6 TX: %10lu RX: %10lu\n", access_if->stats.icmpv6_tx, access_if->stats.icmpv6_rx);
+            wprintw(stats_win, "  DHCPv6 TX: %10lu RX: %10lu\n", access_if->stats.dhcpv6_tx, access_if->stats.dhcpv6_rx);
         }
         if(max_y > 78) {
             wprintw(stats_win, "\nAccess Interface Protocol Timeout Stats\n");
-            wprintw(stats_win, "  LCP Echo Request: %10u\n", access_if->stats.lcp_echo_timeout);
-            wprintw(stats_win, "  LCP Request:      %10u\n", access_if->stats.lcp_timeout);
-            wprintw(stats_win, "  IPCP Request:     %10u\n", access_if->stats.ipcp_timeout);
-            wprintw(stats_win, "  IP6CP Request:    %10u\n", access_if->stats.ip6cp_timeout);
-            wprintw(stats_win, "  PAP:              %10u\n", access_if->stats.pap_timeout);
-            wprintw(stats_win, "  CHAP:             %10u\n", access_if->stats.chap_timeout);
-            wprintw(stats_win, "  ICMPv6 RS:        %10u\n", access_if->stats.dhcpv6_timeout);
-            wprintw(stats_win, "  DHCPv6 Request:   %10u\n", access_if->stats.dhcpv6_timeout);
+            wprintw(stats_win, "  LCP Echo Request: %10lu\n", access_if->stats.lcp_echo_timeout);
+            wprintw(stats_win, "  LCP Request:      %10lu\n", access_if->stats.lcp_timeout);
+            wprintw(stats_win, "  IPCP Request:     %10lu\n", access_if->stats.ipcp_timeout);
+            wprintw(stats_win, "  IP6CP Request:    %10lu\n", access_if->stats.ip6cp_timeout);
+            wprintw(stats_win, "  PAP:              %10lu\n", access_if->stats.pap_timeout);
+            wprintw(stats_win, "  CHAP:             %10lu\n", access_if->stats.chap_timeout);
+            wprintw(stats_win, "  ICMPv6 RS:        %10lu\n", access_if->stats.dhcpv6_timeout);
+            wprintw(stats_win, "  DHCPv6 Request:   %10lu\n", access_if->stats.dhcpv6_timeout);
         }
     }
     wrefresh(stats_win);
 }
 
+/*
+ * Render stats in the main thread
+ * if the UI thread is not running.
+ */
+void
+bbl_stats_job (timer_s *timer)
+{
+    bbl_ctx_s *ctx = timer->data;
+
+    bbl_counters_update(ctx);
+    bbl_counters_snapshot(&ui.snapshot);
+    bbl_ui_render(ctx, &ui.snapshot);
+    log_window_flush();
+}
+
 /*
  * Curses init.
  */
@@ -323,10 +359,95 @@ bbl_init_curses (bbl_ctx_s *ctx)
     wprintw(stats_win, "%s", banner);
     wrefresh(stats_win);
 
-    timer_add_periodic(&ctx->timer_root, &ctx->stats_timer, "Statistics Timer",
-		               0, 100 * MSEC, ctx, bbl_stats_job);
+    ui.ctx = ctx;
+    bbl_counters_init(ctx);
     timer_add_periodic(&ctx->timer_root, &ctx->keyboard_timer, "Keyboard Reader",
 		               0, 100 * MSEC, ctx, bbl_read_key_job);
 
     g_interactive = true;
 }
+
+/*
+ * UI thread, the only thread using curses while
+ * the event loop is running. Counters and log lines
+ * are rendered with a fixed frame rate. Keys are passed
+ * to the main thread one by one (see bbl_read_key_job).
+ */
+static void *
+bbl_ui_thread (void *arg)
+{
+    sigset_t set;
+    int expected;
+    int key = 0;
+    int ch;
+    bool stop;
+
+    (void)arg;
+
+    /* Signals are handled by the main thread. */
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    while(true) {
+        stop = __atomic_load_n(&ui.stop, __ATOMIC_ACQUIRE);
+        if(!key) {
+            ch = getch();
+            if(ch >= KEY_F(6) && ch <= KEY_F(9)) {
+                key = ch;
+            }
+        }
+        if(key) {
+            expected = 0;
+            if(__atomic_compare_exchange_n(&ui.key, &expected, key, false,
+                                           __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+                key = 0;
+            }
+        }
+
+        bbl_counters_snapshot(&ui.snapshot);
+        bbl_ui_render(ui.ctx, &ui.snapshot);
+        log_window_flush();
+
+        if(stop) break;
+        usleep(UI_FRAME_INTERVAL * 1000);
+    }
+    return NULL;
+}
+
+/*
+ * Start UI thread with the event loop. If the thread
+ * can not be started, the main thread renders the
+ * statistics as before.
+ */
+void
+bbl_interactive_start (bbl_ctx_s *ctx)
+{
+    if(pthread_create(&ui.thread, NULL, bbl_ui_thread, NULL) != 0) {
+        LOG(ERROR, "Failed to start UI thread\n");
+        timer_add_periodic(&ctx->timer_root, &ctx->stats_timer, "Statistics Timer",
+                           0, UI_FRAME_INTERVAL * MSEC, ctx, bbl_stats_job);
+        return;
+    }
+    ui.thread_running = true;
+}
+
+/*
+ * Render the final counters, stop
+ * UI thread and curses.
+ */
+void
+bbl_interactive_stop (bbl_ctx_s *ctx)
+{
+    bbl_counters_update(ctx);
+    if(ui.thread_running) {
+        __atomic_store_n(&ui.stop, true, __ATOMIC_RELEASE);
+        pthread_join(ui.thread, NULL);
+        ui.thread_running = false;
+    } else {
+        bbl_counters_snapshot(&ui.snapshot);
+        bbl_ui_render(ctx, &ui.snapshot);
+        log_window_flush();
+    }
+    endwin();
+    __atomic_store_n(&g_interactive, false, __ATOMIC_RELEASE);
+}
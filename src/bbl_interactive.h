@@ -11,5 +11,7 @@
 #define __BBL_INTERACTIVE_H__
 
 void bbl_init_curses(bbl_ctx_s *ctx);
+void bbl_interactive_start(bbl_ctx_s *ctx);
+void bbl_interactive_stop(bbl_ctx_s *ctx);
 
 #endif
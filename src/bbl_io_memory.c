@@ -0,0 +1,282 @@
+/*
+ * BNG Blaster (BBL) - Memory I/O
+ *
+ * Simulation backend which connects the access and network
+ * interface to the built-in responder instead of sockets.
+ * The TX and RX rings are plain memory with the same layout
+ * as the kernel rings, such that the TX and RX jobs work
+ * unchanged. This backend takes the role of the kernel by
+ * handing frames requested for sending to the responder
+ * and writing the responses into the RX ring, with the
+ * outer VLAN stripped and passed as meta data.
+ *
+ * Together with virtual time, where the timer library jumps
+ * straight to the next expiry instead of sleeping, this allows
+ * to simulate long runs with many sessions in a fraction of
+ * the time and makes timer and state machine behavior
+ * reproducible.
+ *
+ * The responder supports one access interface and up to
+ * RESPONDER_MAX_SESSIONS sessions.
+ *
+ * Copyright (C) 2020-2021, RtBrick, Inc.
+ */
+
+#include "bbl.h"
+#include "bbl_io_memory.h"
+#include "bbl_responder.h"
+
+extern volatile bool g_teardown;
+extern volatile bool g_teardown_request;
+
+static void
+bbl_io_memory_now (bbl_ctx_s *ctx)
+{
+    struct timespec now;
+
+    timer_clock_gettime(&ctx->timer_root, CLOCK_MONOTONIC, &now);
+    ctx->simulation.responder->now_nsec = (uint64_t)now.tv_sec * NSEC + now.tv_nsec;
+}
+
+static bbl_interface_s *
+bbl_io_memory_interface (responder_ctx_s *responder, responder_side_t side)
+{
+    bbl_ctx_s *ctx = responder->io_data;
+
+    if(side == RESPONDER_ACCESS) {
+        return ctx->op.access_if[0];
+    }
+    return ctx->op.network_if;
+}
+
+/*
+ * Allocate TX and RX rings in memory instead of
+ * mapping kernel rings, with the same slot layout.
+ */
+bool
+bbl_io_memory_open_interface (bbl_ctx_s *ctx, bbl_interface_s *interface, int slots)
+{
+    interface->fd_tx = -1;
+    interface->fd_rx = -1;
+    interface->addr.sll_ifindex = ctx->pcap.index + 1; /* unique index used as session key */
+
+    /* Locally administered MAC address */
+    interface->mac[0] = 0x02;
+    interface->mac[5] = ctx->pcap.index + 1;
+
+    interface->req_tx.tp_block_size = sysconf(_SC_PAGESIZE); /* 4096 */
+    interface->req_tx.tp_frame_size = interface->req_tx.tp_block_size/2; /* 2048 */
+    interface->req_tx.tp_block_nr = slots/2;
+    interface->req_tx.tp_frame_nr = slots;
+    interface->ring_tx = calloc(interface->req_tx.tp_block_nr, interface->req_tx.tp_block_size);
+
+    slots <<= 1;
+    interface->req_rx.tp_block_size = sysconf(_SC_PAGESIZE); /* 4096 */
+    interface->req_rx.tp_frame_size = interface->req_rx.tp_block_size/2; /* 2048 */
+    interface->req_rx.tp_block_nr = slots/2;
+    interface->req_rx.tp_frame_nr = slots;
+    interface->ring_rx = calloc(interface->req_rx.tp_block_nr, interface->req_rx.tp_block_size);
+
+    if(!interface->ring_tx || !interface->ring_rx) {
+        LOG(ERROR, "No memory for rings of interface %s\n", interface->name);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Hand all frames requested for sending to the responder.
+ * This is called by the TX job instead of notifying the kernel.
+ */
+void
+bbl_io_memory_tx (bbl_interface_s *interface)
+{
+    bbl_ctx_s *ctx = interface->ctx;
+    responder_ctx_s *responder = ctx->simulation.responder;
+    struct tpacket2_hdr *tphdr;
+    uint8_t *buf;
+
+    bbl_io_memory_now(ctx);
+    while(true) {
+        tphdr = (struct tpacket2_hdr*)(interface->ring_tx + (interface->io_cursor_tx * interface->req_tx.tp_frame_size));
+        if(tphdr->tp_status != TP_STATUS_SEND_REQUEST) {
+            break;
+        }
+        buf = (uint8_t*)tphdr + TPACKET2_HDRLEN - sizeof(struct sockaddr_ll);
+        if(interface->access) {
+            responder->interface[RESPONDER_ACCESS].stats.packets_rx++;
+            responder_rx_access(responder, tphdr, buf, tphdr->tp_len);
+        } else {
+            responder->interface[RESPONDER_NETWORK].stats.packets_rx++;
+            responder_rx_network(responder, tphdr, buf, tphdr->tp_len);
+        }
+        tphdr->tp_status = TP_STATUS_AVAILABLE;
+        interface->io_cursor_tx = (interface->io_cursor_tx + 1) % interface->req_tx.tp_frame_nr;
+    }
+}
+
+/*
+ * Responder TX, which is BNG Blaster RX.
+ */
+uint8_t *
+responder_tx_buf (responder_ctx_s *responder, responder_side_t side)
+{
+    bbl_interface_s *interface = bbl_io_memory_interface(responder, side);
+    struct tpacket2_hdr *tphdr;
+
+    if(!interface) {
+        return NULL;
+    }
+    tphdr = (struct tpacket2_hdr*)(interface->ring_rx + (interface->io_cursor_rx * interface->req_rx.tp_frame_size));
+    if(tphdr->tp_status != TP_STATUS_KERNEL) {
+        /* RX ring is full. */
+        responder->interface[side].stats.tx_busy++;
+        return NULL;
+    }
+    return (uint8_t*)tphdr + BBL_IO_MEMORY_MAC_OFFSET;
+}
+
+void
+responder_tx_commit (responder_ctx_s *responder, responder_side_t side, uint8_t *buf, uint len)
+{
+    bbl_interface_s *interface = bbl_io_memory_interface(responder, side);
+    bbl_ctx_s *ctx = interface->ctx;
+    struct tpacket2_hdr *tphdr;
+    struct timespec now;
+    uint16_t type;
+
+    tphdr = (struct tpacket2_hdr*)(buf - BBL_IO_MEMORY_MAC_OFFSET);
+    tphdr->tp_mac = BBL_IO_MEMORY_MAC_OFFSET;
+    tphdr->tp_len = len;
+    tphdr->tp_vlan_tci = 0;
+    tphdr->tp_status = TP_STATUS_USER;
+
+    /* Strip the outer VLAN like done by the kernel. */
+    type = be16toh(*(uint16_t*)(buf + ETH_ADDR_LEN*2));
+    if(type == ETH_TYPE_VLAN || type == ETH_TYPE_QINQ) {
+        tphdr->tp_vlan_tci = be16toh(*(uint16_t*)(buf + ETH_ADDR_LEN*2 + 2));
+        tphdr->tp_vlan_tpid = type;
+        tphdr->tp_status |= TP_STATUS_VLAN_VALID;
+        memmove(buf + 4, buf, ETH_ADDR_LEN*2);
+        tphdr->tp_mac += 4;
+        tphdr->tp_len -= 4;
+    }
+    tphdr->tp_snaplen = tphdr->tp_len;
+
+    timer_clock_gettime(&ctx->timer_root, CLOCK_REALTIME, &now);
+    tphdr->tp_sec = now.tv_sec;
+    tphdr->tp_nsec = now.tv_nsec;
+
+    interface->io_cursor_rx = (interface->io_cursor_rx + 1) % interface->req_rx.tp_frame_nr;
+    responder->interface[side].stats.packets_tx++;
+}
+
+/*
+ * Send delayed responses and repeat unanswered requests.
+ */
+static void
+bbl_io_memory_job (timer_s *timer)
+{
+    bbl_ctx_s *ctx = timer->data;
+
+    bbl_io_memory_now(ctx);
+    responder_job(ctx->simulation.responder);
+}
+
+static void
+bbl_io_memory_end (timer_s *timer)
+{
+    bbl_ctx_s *ctx = timer->data;
+
+    LOG(NORMAL, "Simulation duration of %us reached, initiating teardown\n", ctx->config.simulation_duration);
+    g_teardown = true;
+    g_teardown_request = true;
+}
+
+/*
+ * Setup the built-in responder after all interfaces are added.
+ */
+bool
+bbl_io_memory_init (bbl_ctx_s *ctx)
+{
+    responder_ctx_s *responder;
+
+    if(ctx->op.access_if_count > 1) {
+        LOG(ERROR, "Simulation supports only one access interface\n");
+        return false;
+    }
+    if(ctx->config.sessions > RESPONDER_MAX_SESSIONS) {
+        LOG(ERROR, "Simulation supports only up to %u sessions\n", RESPONDER_MAX_SESSIONS);
+        return false;
+    }
+
+    responder = calloc(1, sizeof(responder_ctx_s));
+    if(!responder) {
+        return false;
+    }
+    ctx->simulation.responder = responder;
+    responder->io_data = ctx;
+    responder->config.max_sessions = ctx->config.sessions ? ctx->config.sessions : 1;
+    responder->config.auth = ctx->config.authentication_protocol ? ctx->config.authentication_protocol : PROTOCOL_PAP;
+    responder->config.delay_nsec = ctx->config.simulation_delay * 1000000ULL;
+    responder->config.loss = ctx->config.simulation_loss * 10000;
+    responder->config.traffic_loss = ctx->config.simulation_traffic_loss * 10000;
+
+    if(ctx->op.access_if_count) {
+        responder->interface[RESPONDER_ACCESS].name = ctx->op.access_if[0]->name;
+    }
+    if(ctx->op.network_if) {
+        responder->interface[RESPONDER_NETWORK].name = ctx->op.network_if->name;
+        responder->network_enabled = true;
+    }
+    responder->interface[RESPONDER_ACCESS].mac[0] = 0x02;
+    responder->interface[RESPONDER_ACCESS].mac[4] = 0xff;
+    responder->interface[RESPONDER_ACCESS].mac[5] = 0x01;
+    responder->interface[RESPONDER_NETWORK].mac[0] = 0x02;
+    responder->interface[RESPONDER_NETWORK].mac[4] = 0xff;
+    responder->interface[RESPONDER_NETWORK].mac[5] = 0x02;
+
+    if(ctx->config.simulation_virtual_time) {
+        /* Same start conditions result in the same run. */
+        responder->random = BBL_IO_MEMORY_SEED;
+        srand(BBL_IO_MEMORY_SEED);
+    }
+    bbl_io_memory_now(ctx);
+    if(!responder_init(responder)) {
+        LOG(ERROR, "No memory for simulation with %u sessions\n", responder->config.max_sessions);
+        return false;
+    }
+
+    timer_add_periodic(&ctx->timer_root, &ctx->simulation.job, "Simulation", 0,
+                       ctx->config.tx_interval * MSEC, ctx, bbl_io_memory_job);
+    if(ctx->config.simulation_duration) {
+        timer_add(&ctx->timer_root, &ctx->simulation.end, "Simulation End",
+                  ctx->config.simulation_duration, 0, ctx, bbl_io_memory_end);
+    }
+
+    LOG(NORMAL, "Simulation with %u sessions (%s time)\n", responder->config.max_sessions,
+        ctx->config.simulation_virtual_time ? "virtual" : "real");
+    return true;
+}
+
+void
+bbl_io_memory_stdout (bbl_ctx_s *ctx)
+{
+    if(!ctx->simulation.responder) return;
+    printf("\nSimulation Responder:");
+    responder_stats_stdout(ctx->simulation.responder);
+}
+
+void
+bbl_io_memory_free (bbl_ctx_s *ctx)
+{
+    responder_ctx_s *responder = ctx->simulation.responder;
+
+    if(!responder) return;
+    free(responder->sessions);
+    free(responder->session_hash.entries);
+    free(responder->ipv4_hash.entries);
+    free(responder->delay_queue);
+    free(responder);
+    ctx->simulation.responder = NULL;
+}
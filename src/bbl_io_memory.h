@@ -0,0 +1,31 @@
+/*
+ * BNG Blaster (BBL) - Memory I/O
+ *
+ * Simulation backend connecting all interfaces to the
+ * built-in responder instead of network interfaces.
+ *
+ * Copyright (C) 2020-2021, RtBrick, Inc.
+ */
+
+#ifndef __BBL_IO_MEMORY_H__
+#define __BBL_IO_MEMORY_H__
+
+#define BBL_IO_MEMORY_MAC_OFFSET    TPACKET_ALIGN(TPACKET2_HDRLEN)
+#define BBL_IO_MEMORY_SEED          1 /* pseudo random seed with virtual time */
+
+bool
+bbl_io_memory_open_interface (bbl_ctx_s *ctx, bbl_interface_s *interface, int slots);
+
+bool
+bbl_io_memory_init (bbl_ctx_s *ctx);
+
+void
+bbl_io_memory_tx (bbl_interface_s *interface);
+
+void
+bbl_io_memory_stdout (bbl_ctx_s *ctx);
+
+void
+bbl_io_memory_free (bbl_ctx_s *ctx);
+
+#endif
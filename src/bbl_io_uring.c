@@ -0,0 +1,230 @@
+/*
+ * BNG Blaster (BBL) - io_uring
+ *
+ * Minimal io_uring wrapper using the raw system calls
+ * for asynchronous file writes, no liburing required.
+ * Without kernel headers (BBL_IO_URING not defined)
+ * all functions fail, such that callers fall back
+ * to synchronous write().
+ *
+ * The wrapper is not thread safe and must be used
+ * by one thread only.
+ *
+ * Copyright (C) 2020-2021, RtBrick, Inc.
+ */
+
+#include "bbl.h"
+#include "bbl_io_uring.h"
+
+#ifdef BBL_IO_URING
+
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+static int
+bbl_io_uring_setup (uint entries, struct io_uring_params *params)
+{
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int
+bbl_io_uring_enter (int fd, uint to_submit, uint min_complete, uint flags)
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+bool
+bbl_io_uring_init (bbl_io_uring_s *ring, uint entries)
+{
+    struct io_uring_params params;
+
+    memset(ring, 0x0, sizeof(bbl_io_uring_s));
+    memset(&params, 0x0, sizeof(params));
+
+    ring->fd = bbl_io_uring_setup(entries, &params);
+    if(ring->fd < 0) {
+        ring->fd = -1;
+        return false;
+    }
+    ring->entries = params.sq_entries;
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if(params.features & IORING_FEAT_SINGLE_MMAP) {
+        if(ring->cq_ring_size > ring->sq_ring_size) {
+            ring->sq_ring_size = ring->cq_ring_size;
+        }
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    ring->sq_ring = mmap(0, ring->sq_ring_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+                         ring->fd, IORING_OFF_SQ_RING);
+    if(ring->sq_ring == MAP_FAILED) {
+        ring->sq_ring = NULL;
+        bbl_io_uring_free(ring);
+        return false;
+    }
+    if(params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ring = ring->sq_ring;
+    } else {
+        ring->cq_ring = mmap(0, ring->cq_ring_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+                             ring->fd, IORING_OFF_CQ_RING);
+        if(ring->cq_ring == MAP_FAILED) {
+            ring->cq_ring = NULL;
+            bbl_io_uring_free(ring);
+            return false;
+        }
+    }
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(0, ring->sqes_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+                      ring->fd, IORING_OFF_SQES);
+    if(ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        bbl_io_uring_free(ring);
+        return false;
+    }
+
+    ring->sq_head = (uint32_t*)(ring->sq_ring + params.sq_off.head);
+    ring->sq_tail = (uint32_t*)(ring->sq_ring + params.sq_off.tail);
+    ring->sq_mask = (uint32_t*)(ring->sq_ring + params.sq_off.ring_mask);
+    ring->sq_array = (uint32_t*)(ring->sq_ring + params.sq_off.array);
+    ring->cq_head = (uint32_t*)(ring->cq_ring + params.cq_off.head);
+    ring->cq_tail = (uint32_t*)(ring->cq_ring + params.cq_off.tail);
+    ring->cq_mask = (uint32_t*)(ring->cq_ring + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(ring->cq_ring + params.cq_off.cqes);
+    return true;
+}
+
+/*
+ * Queue a write request, which is passed to
+ * the kernel with the next bbl_io_uring_submit().
+ * Returns false if the ring is full.
+ */
+bool
+bbl_io_uring_write (bbl_io_uring_s *ring, int fd, void *buf, uint len, uint64_t offset, uint64_t user_data)
+{
+    struct io_uring_sqe *sqe;
+    uint32_t tail, index;
+
+    if(ring->inflight >= ring->entries) {
+        return false;
+    }
+    tail = *ring->sq_tail;
+    index = tail & *ring->sq_mask;
+    sqe = &ring->sqes[index];
+    memset(sqe, 0x0, sizeof(struct io_uring_sqe));
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = len;
+    sqe->off = offset;
+    sqe->user_data = user_data;
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->to_submit++;
+    ring->inflight++;
+    return true;
+}
+
+/*
+ * Submit all queued requests and optionally
+ * wait for the given number of completions.
+ */
+bool
+bbl_io_uring_submit (bbl_io_uring_s *ring, uint wait)
+{
+    int res;
+
+    if(wait > ring->inflight) {
+        wait = ring->inflight;
+    }
+    if(!ring->to_submit && !wait) {
+        return true;
+    }
+    res = bbl_io_uring_enter(ring->fd, ring->to_submit, wait, wait ? IORING_ENTER_GETEVENTS : 0);
+    if(res < 0) {
+        return errno == EINTR;
+    }
+    ring->to_submit -= res;
+    return true;
+}
+
+/*
+ * Consume one completion, returns false if none available.
+ */
+bool
+bbl_io_uring_complete (bbl_io_uring_s *ring, uint64_t *user_data, int *res)
+{
+    struct io_uring_cqe *cqe;
+    uint32_t head;
+
+    head = *ring->cq_head;
+    if(head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    cqe = &ring->cqes[head & *ring->cq_mask];
+    *user_data = cqe->user_data;
+    *res = cqe->res;
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    ring->inflight--;
+    return true;
+}
+
+void
+bbl_io_uring_free (bbl_io_uring_s *ring)
+{
+    if(ring->sqes) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if(ring->cq_ring && ring->cq_ring != ring->sq_ring) {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    if(ring->sq_ring) {
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    }
+    if(ring->fd >= 0) {
+        close(ring->fd);
+    }
+    memset(ring, 0x0, sizeof(bbl_io_uring_s));
+    ring->fd = -1;
+}
+
+#else
+
+bool
+bbl_io_uring_init (bbl_io_uring_s *ring, uint entries)
+{
+    (void)entries;
+    memset(ring, 0x0, sizeof(bbl_io_uring_s));
+    ring->fd = -1;
+    return false;
+}
+
+bool
+bbl_io_uring_write (bbl_io_uring_s *ring, int fd, void *buf, uint len, uint64_t offset, uint64_t user_data)
+{
+    (void)ring; (void)fd; (void)buf; (void)len; (void)offset; (void)user_data;
+    return false;
+}
+
+bool
+bbl_io_uring_submit (bbl_io_uring_s *ring, uint wait)
+{
+    (void)ring; (void)wait;
+    return false;
+}
+
+bool
+bbl_io_uring_complete (bbl_io_uring_s *ring, uint64_t *user_data, int *res)
+{
+    (void)ring; (void)user_data; (void)res;
+    return false;
+}
+
+void
+bbl_io_uring_free (bbl_io_uring_s *ring)
+{
+    (void)ring;
+}
+
+#endif
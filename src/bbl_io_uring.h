@@ -0,0 +1,54 @@
+/*
+ * BNG Blaster (BBL) - io_uring
+ *
+ * Minimal io_uring wrapper using the raw system calls
+ * for asynchronous file writes, no liburing required.
+ *
+ * Copyright (C) 2020-2021, RtBrick, Inc.
+ */
+
+#ifndef __BBL_IO_URING_H__
+#define __BBL_IO_URING_H__
+
+typedef struct bbl_io_uring_
+{
+    int fd;
+    uint entries;
+    uint inflight;
+
+    /* Submission queue */
+    uint32_t *sq_head;
+    uint32_t *sq_tail;
+    uint32_t *sq_mask;
+    uint32_t *sq_array;
+    struct io_uring_sqe *sqes;
+    uint8_t *sq_ring;
+    size_t sq_ring_size;
+    size_t sqes_size;
+    uint to_submit;
+
+    /* Completion queue */
+    uint32_t *cq_head;
+    uint32_t *cq_tail;
+    uint32_t *cq_mask;
+    struct io_uring_cqe *cqes;
+    uint8_t *cq_ring;
+    size_t cq_ring_size;
+} bbl_io_uring_s;
+
+bool
+bbl_io_uring_init (bbl_io_uring_s *ring, uint entries);
+
+bool
+bbl_io_uring_write (bbl_io_uring_s *ring, int fd, void *buf, uint len, uint64_t offset, uint64_t user_data);
+
+bool
+bbl_io_uring_submit (bbl_io_uring_s *ring, uint wait);
+
+bool
+bbl_io_uring_complete (bbl_io_uring_s *ring, uint64_t *user_data, int *res);
+
+void
+bbl_io_uring_free (bbl_io_uring_s *ring);
+
+#endif
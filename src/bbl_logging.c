@@ -8,12 +8,60 @@
  */
 
 #include "bbl.h"
+#include <pthread.h>
+#include <ctype.h>
 
 /* Globals */
 
 struct log_id_ log_id[LOG_ID_MAX];
 FILE *g_log_fp = NULL;
 
+log_scope_s g_log_scope;
+log_filter_s g_log_filters[LOG_FILTERS_MAX];
+uint g_log_filter_count = 0;
+
+/*
+ * Binary log record. String arguments are stored
+ * as offset into the strings area of the record.
+ */
+typedef struct log_record_ {
+    uint8_t id;
+    uint8_t argc;
+    uint16_t strings_len;
+    uint8_t types[LOG_ARGS_MAX];
+    struct timespec timestamp;
+    const char *fmt;
+    uint64_t args[LOG_ARGS_MAX];
+    char strings[LOG_STRINGS_LEN];
+} log_record_s;
+
+#define LOG_STRING_NULL UINT64_MAX
+
+/*
+ * Log ring with single producer (main thread)
+ * and single consumer (log thread). Head and tail
+ * are increasing record counters.
+ */
+static struct {
+    log_record_s *records;
+    uint64_t head __attribute__((aligned(64)));
+    uint64_t tail __attribute__((aligned(64)));
+    volatile sig_atomic_t busy; /* LOG() called from signal handler */
+    uint64_t dropped;
+
+    pthread_t thread;
+    bool thread_running;
+    bool stop;
+
+    /* Lines for the curses log window, which
+     * must be written by the UI thread. */
+    pthread_mutex_t window_mutex;
+    char window_buf[LOG_WINDOW_BUF];
+    uint window_len;
+} log_ring = {
+    .window_mutex = PTHREAD_MUTEX_INITIALIZER
+};
+
 struct keyval_ log_names[] = {
     { DEBUG,         "debug" },
     { ERROR,         "error" },
@@ -30,6 +78,18 @@ struct keyval_ log_names[] = {
     { 0, NULL}
 };
 
+static int
+log_format_time (struct timespec *ts, char *buf, int size)
+{
+    struct tm tm;
+    int len;
+
+    localtime_r(&ts->tv_sec, &tm);
+    len = strftime(buf, size, "%b %d %H:%M:%S", &tm);
+    len += snprintf(buf+len, size - len, ".%06lu", ts->tv_nsec / 1000);
+    return len;
+}
+
 /*
  * Format the logging timestamp.
  */
@@ -38,16 +98,283 @@ log_format_timestamp (void)
 {
     static char ts_str[sizeof("Jun 19 08:07:13.711541")];
     struct timespec now;
-    struct tm tm;
-    int len;
 
     clock_gettime(CLOCK_REALTIME, &now);
-    localtime_r(&now.tv_sec, &tm);
+    log_format_time(&now, ts_str, sizeof(ts_str));
+    return ts_str;
+}
 
-    len = strftime(ts_str, sizeof(ts_str), "%b %d %H:%M:%S", &tm);
-    snprintf(ts_str+len, sizeof(ts_str) - len, ".%06lu", now.tv_nsec / 1000);
+/*
+ * Format a log record using the printf format string
+ * of the LOG() call site. Every conversion consumes
+ * one argument, which is passed to snprintf with the
+ * type expected by the length modifier.
+ */
+static int
+log_format_message (log_record_s *record, char *buf, int size)
+{
+    const char *fmt = record->fmt;
+    const char *str;
+    char spec[32];
+    uint spec_len;
+    uint64_t value;
+    double d;
+    int len = 0, n, argi = 0, lmod;
+    char conv;
 
-    return ts_str;
+    while(*fmt && len < size - 1) {
+        if(*fmt != '%') {
+            buf[len++] = *fmt++;
+            continue;
+        }
+        if(fmt[1] == '%') {
+            buf[len++] = '%';
+            fmt += 2;
+            continue;
+        }
+        spec_len = 0;
+        spec[spec_len++] = *fmt++;
+        while(*fmt && strchr("-+ #0123456789.", *fmt) && spec_len < sizeof(spec) - 8) {
+            spec[spec_len++] = *fmt++;
+        }
+        lmod = 0;
+        while(*fmt && strchr("hlLqjzt", *fmt) && spec_len < sizeof(spec) - 2) {
+            if(*fmt == 'l' || *fmt == 'q') {
+                lmod++;
+            } else if(*fmt == 'j' || *fmt == 'z' || *fmt == 't') {
+                lmod = 1;
+            }
+            spec[spec_len++] = *fmt++;
+        }
+        conv = *fmt;
+        if(!conv) {
+            break;
+        }
+        spec[spec_len++] = *fmt++;
+        spec[spec_len] = 0;
+
+        if(argi >= record->argc) {
+            /* Missing argument. */
+            n = snprintf(buf+len, size-len, "%s", spec);
+        } else {
+            value = record->args[argi];
+            switch(conv) {
+                case 'd': case 'i': case 'u': case 'o':
+                case 'x': case 'X': case 'c':
+                    if(lmod >= 2) {
+                        n = snprintf(buf+len, size-len, spec, (long long)value);
+                    } else if(lmod == 1) {
+                        n = snprintf(buf+len, size-len, spec, (long)value);
+                    } else {
+                        n = snprintf(buf+len, size-len, spec, (int)value);
+                    }
+                    break;
+                case 'e': case 'E': case 'f': case 'F':
+                case 'g': case 'G': case 'a': case 'A':
+                    memcpy(&d, &value, sizeof(d));
+                    spec[spec_len-2] = spec[spec_len-2] == 'L' ? 'l' : spec[spec_len-2];
+                    n = snprintf(buf+len, size-len, spec, d);
+                    break;
+                case 's':
+                    if(record->types[argi] == LOG_ARG_STRING && value < record->strings_len) {
+                        str = record->strings + value;
+                    } else {
+                        str = "(null)";
+                    }
+                    n = snprintf(buf+len, size-len, spec, str);
+                    break;
+                case 'p':
+                    n = snprintf(buf+len, size-len, spec, (void*)(uintptr_t)value);
+                    break;
+                default:
+                    n = snprintf(buf+len, size-len, "%s", spec);
+                    break;
+            }
+            argi++;
+        }
+        if(n > 0) {
+            len += n;
+        }
+    }
+    if(len >= size) {
+        len = size - 1;
+    }
+    buf[len] = 0;
+    return len;
+}
+
+static int
+log_format_record (log_record_s *record, char *buf, int size)
+{
+    int len;
+
+    len = log_format_time(&record->timestamp, buf, size);
+    buf[len++] = ' ';
+    return len + log_format_message(record, buf + len, size - len);
+}
+
+/*
+ * Write a formatted log line to the log file and to
+ * stdout or the curses log window. Curses is not thread
+ * safe, therefore lines for the log window are passed
+ * to the UI thread (see log_window_flush).
+ */
+static void
+log_write_line (char *line, int len)
+{
+    if(g_log_fp) {
+        fwrite(line, 1, len, g_log_fp);
+    }
+    if(g_interactive) {
+        pthread_mutex_lock(&log_ring.window_mutex);
+        if(log_ring.window_len + len < LOG_WINDOW_BUF) {
+            memcpy(log_ring.window_buf + log_ring.window_len, line, len + 1);
+            log_ring.window_len += len;
+        } else {
+            __atomic_add_fetch(&log_ring.dropped, 1, __ATOMIC_RELAXED);
+        }
+        pthread_mutex_unlock(&log_ring.window_mutex);
+    } else {
+        fwrite(line, 1, len, stdout);
+    }
+}
+
+static void *
+log_thread (void *arg)
+{
+    log_record_s *record;
+    char line[LOG_LINE_LEN];
+    uint64_t tail;
+    bool flush = false;
+    sigset_t set;
+    int len;
+
+    (void)arg;
+
+    /* Signals are handled by the main thread. */
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    while(true) {
+        tail = log_ring.tail;
+        if(tail == __atomic_load_n(&log_ring.head, __ATOMIC_ACQUIRE)) {
+            if(flush) {
+                if(g_log_fp) fflush(g_log_fp);
+                if(!g_interactive) fflush(stdout);
+                flush = false;
+            }
+            if(__atomic_load_n(&log_ring.stop, __ATOMIC_ACQUIRE) &&
+               tail == __atomic_load_n(&log_ring.head, __ATOMIC_ACQUIRE)) {
+                break;
+            }
+            usleep(1000);
+            continue;
+        }
+        record = &log_ring.records[tail & (LOG_RING_RECORDS-1)];
+        len = log_format_record(record, line, sizeof(line));
+        log_write_line(line, len);
+        flush = true;
+        __atomic_store_n(&log_ring.tail, tail + 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+/*
+ * Store the format and arguments in the record.
+ */
+static void
+log_record_fill (log_record_s *record, const char *fmt, log_arg_s *args, int argc)
+{
+    size_t len;
+    int i;
+
+    record->fmt = fmt;
+    record->strings_len = 0;
+    if(argc > LOG_ARGS_MAX) {
+        argc = LOG_ARGS_MAX;
+    }
+    record->argc = argc;
+    for(i = 0; i < argc; i++) {
+        record->types[i] = args[i].type;
+        if(args[i].type == LOG_ARG_STRING) {
+            if(!args[i].s) {
+                record->args[i] = LOG_STRING_NULL;
+                continue;
+            }
+            if(record->strings_len >= LOG_STRINGS_LEN) {
+                /* Record is full, use the last terminator as empty string. */
+                record->args[i] = LOG_STRINGS_LEN - 1;
+                continue;
+            }
+            /* Copy string, truncated if the record is full. */
+            record->args[i] = record->strings_len;
+            len = strnlen(args[i].s, LOG_STRINGS_LEN - record->strings_len - 1);
+            memcpy(record->strings + record->strings_len, args[i].s, len);
+            record->strings[record->strings_len + len] = 0;
+            record->strings_len += len + 1;
+        } else if(args[i].type == LOG_ARG_DOUBLE) {
+            memcpy(&record->args[i], &args[i].d, sizeof(double));
+        } else {
+            record->args[i] = args[i].i;
+        }
+    }
+}
+
+/*
+ * Format a message from captured arguments the same
+ * way as the log thread, but without timestamp.
+ */
+int
+log_format (char *buf, int size, const char *fmt, log_arg_s *args, int argc)
+{
+    log_record_s record;
+
+    log_record_fill(&record, fmt, args, argc);
+    return log_format_message(&record, buf, size);
+}
+
+/*
+ * Add a log record to the ring. This is called by
+ * the LOG() macro for enabled log-ids only. Messages
+ * are formatted synchronously if the log thread is not
+ * running and dropped if the ring is full.
+ */
+void
+log_push (int id, const char *fmt, log_arg_s *args, int argc)
+{
+    log_record_s *record;
+    log_record_s local;
+    char line[LOG_LINE_LEN];
+    uint64_t head = 0;
+
+    if(log_ring.busy) {
+        __atomic_add_fetch(&log_ring.dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    log_ring.busy = 1;
+
+    if(log_ring.thread_running) {
+        head = log_ring.head;
+        if(head - __atomic_load_n(&log_ring.tail, __ATOMIC_ACQUIRE) >= LOG_RING_RECORDS) {
+            __atomic_add_fetch(&log_ring.dropped, 1, __ATOMIC_RELAXED);
+            log_ring.busy = 0;
+            return;
+        }
+        record = &log_ring.records[head & (LOG_RING_RECORDS-1)];
+    } else {
+        record = &local;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &record->timestamp);
+    record->id = id;
+    log_record_fill(record, fmt, args, argc);
+
+    if(log_ring.thread_running) {
+        __atomic_store_n(&log_ring.head, head + 1, __ATOMIC_RELEASE);
+    } else {
+        log_write_line(line, log_format_record(record, line, sizeof(line)));
+    }
+    log_ring.busy = 0;
 }
 
 /*
@@ -70,23 +397,235 @@ log_enable (char *log_name)
 }
 
 /*
- * Open log file.
+ * Log filter callback, which returns true if the current
+ * session scope matches one of the filters. Messages logged
+ * outside of a session scope are never filtered.
+ */
+static bool
+log_filter_scope (struct log_id_ *id, void *arg)
+{
+    log_filter_s *filter = arg;
+    uint i;
+
+    (void)id;
+
+    if(!g_log_scope.valid) {
+        return true;
+    }
+    for(i = 0; i < g_log_filter_count; i++, filter++) {
+        if((!filter->ifindex || filter->ifindex == g_log_scope.ifindex) &&
+           g_log_scope.outer_vlan_id >= filter->outer_vlan_min &&
+           g_log_scope.outer_vlan_id <= filter->outer_vlan_max &&
+           g_log_scope.inner_vlan_id >= filter->inner_vlan_min &&
+           g_log_scope.inner_vlan_id <= filter->inner_vlan_max) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Install the filter callback for all log-ids
+ * except errors, which are never filtered.
+ */
+static void
+log_filter_update ()
+{
+    int idx;
+
+    for(idx = LOG_ID_MIN; idx < LOG_ID_MAX; idx++) {
+        if(idx == ERROR) {
+            continue;
+        }
+        if(g_log_filter_count) {
+            log_id[idx].filter_cb = log_filter_scope;
+            log_id[idx].filter_arg = g_log_filters;
+        } else {
+            log_id[idx].filter_cb = NULL;
+            log_id[idx].filter_arg = NULL;
+        }
+    }
+}
+
+bool
+log_filter_add (log_filter_s *filter)
+{
+    if(g_log_filter_count >= LOG_FILTERS_MAX) {
+        return false;
+    }
+    g_log_filters[g_log_filter_count++] = *filter;
+    log_filter_update();
+    return true;
+}
+
+void
+log_filter_clear ()
+{
+    g_log_filter_count = 0;
+    log_filter_update();
+}
+
+/*
+ * Parse a decimal number without sign or leading
+ * white space as accepted by strtoul.
+ */
+static bool
+log_filter_parse_number (char **str, unsigned long max, unsigned long *value)
+{
+    char *end;
+
+    if(!isdigit((unsigned char)**str)) {
+        return false;
+    }
+    errno = 0;
+    *value = strtoul(*str, &end, 10);
+    if(errno || *value > max) {
+        return false;
+    }
+    *str = end;
+    return true;
+}
+
+static bool
+log_filter_parse_range (char **str, uint16_t *min, uint16_t *max)
+{
+    unsigned long value;
+
+    if(**str == '*') {
+        *min = 0;
+        *max = ETH_VLAN_ID_MAX;
+        (*str)++;
+        return true;
+    }
+    if(!log_filter_parse_number(str, ETH_VLAN_ID_MAX, &value)) {
+        return false;
+    }
+    *min = *max = value;
+    if(**str == '-') {
+        (*str)++;
+        if(!log_filter_parse_number(str, ETH_VLAN_ID_MAX, &value) || value < *min) {
+            return false;
+        }
+        *max = value;
+    }
+    return true;
+}
+
+/*
+ * Parse session filter [<ifindex>/]<outer-vlan>[-<max>][:<inner-vlan>[-<max>]]
+ * where * matches any VLAN, e.g. 1000:1 or 2/1000-1099:*.
+ */
+bool
+log_filter_parse (char *str, log_filter_s *filter)
+{
+    unsigned long value;
+
+    memset(filter, 0x0, sizeof(log_filter_s));
+    if(!str) {
+        return false;
+    }
+    if(strchr(str, '/')) {
+        if(!log_filter_parse_number(&str, UINT32_MAX, &value) || *str != '/') {
+            return false;
+        }
+        filter->ifindex = value;
+        str++;
+    }
+    if(!log_filter_parse_range(&str, &filter->outer_vlan_min, &filter->outer_vlan_max)) {
+        return false;
+    }
+    if(*str == ':') {
+        str++;
+        if(!log_filter_parse_range(&str, &filter->inner_vlan_min, &filter->inner_vlan_max)) {
+            return false;
+        }
+    } else {
+        filter->inner_vlan_max = ETH_VLAN_ID_MAX;
+    }
+    return *str == 0;
+}
+
+/*
+ * Open log file and start log thread.
  */
 void
 log_open ()
 {
-    if(!g_log_file) {
+    if(g_log_file) {
+        g_log_fp = fopen(g_log_file, "a");
+    }
+    log_ring.records = calloc(LOG_RING_RECORDS, sizeof(log_record_s));
+    if(!log_ring.records) {
+        return;
+    }
+    log_ring.stop = false;
+    if(pthread_create(&log_ring.thread, NULL, log_thread, NULL) != 0) {
+        free(log_ring.records);
+        log_ring.records = NULL;
+        return;
+    }
+    log_ring.thread_running = true;
+}
+
+/*
+ * Wait until all log records are written.
+ */
+void
+log_flush ()
+{
+    if(!log_ring.thread_running) {
         return;
     }
-    g_log_fp = fopen(g_log_file, "a");
+    while(__atomic_load_n(&log_ring.tail, __ATOMIC_ACQUIRE) != log_ring.head) {
+        usleep(1000);
+    }
 }
 
 /*
- * Close log file.
+ * Write pending lines to the curses log window.
+ * This is called by the UI thread only. The lines are
+ * copied out under the lock, such that writers are never
+ * blocked by a slow terminal.
+ */
+void
+log_window_flush ()
+{
+    static char buf[LOG_WINDOW_BUF];
+    uint len;
+
+    pthread_mutex_lock(&log_ring.window_mutex);
+    len = log_ring.window_len;
+    if(len) {
+        memcpy(buf, log_ring.window_buf, len + 1);
+        log_ring.window_len = 0;
+    }
+    pthread_mutex_unlock(&log_ring.window_mutex);
+
+    if(len) {
+        wprintw(log_win, "%s", buf);
+        wrefresh(log_win);
+    }
+}
+
+/*
+ * Stop log thread and close log file.
  */
 void
 log_close ()
 {
+    uint64_t dropped;
+
+    if(log_ring.thread_running) {
+        __atomic_store_n(&log_ring.stop, true, __ATOMIC_RELEASE);
+        pthread_join(log_ring.thread, NULL);
+        log_ring.thread_running = false;
+        free(log_ring.records);
+        log_ring.records = NULL;
+    }
+    dropped = __atomic_load_n(&log_ring.dropped, __ATOMIC_RELAXED);
+    if(dropped) {
+        LOG(ERROR, "Log ring full, %lu messages dropped\n", dropped);
+    }
     if(g_log_fp) {
         fclose(g_log_fp);
         g_log_fp = NULL;
@@ -43,39 +43,193 @@ struct keyval_ {
 struct __attribute__((__packed__)) log_id_
 {
     uint8_t enable;
-    void (*filter_cb)(struct log_id_ *, void *); /* Callback function for filtering */
+    bool (*filter_cb)(struct log_id_ *, void *); /* Callback function for filtering */
     void *filter_arg;
 };
 
+#define LOG_FILTERS_MAX     16
+
+/*
+ * Session scope of the code currently executed, set
+ * where processing of a session starts (RX, TX, timers
+ * and control commands). Messages logged within this
+ * scope are subject to the log filters.
+ */
+typedef struct log_scope_ {
+    bool valid;
+    uint32_t ifindex;
+    uint16_t outer_vlan_id;
+    uint16_t inner_vlan_id;
+} log_scope_s;
+
+/*
+ * Session filter, ifindex 0 matches all interfaces.
+ */
+typedef struct log_filter_ {
+    uint32_t ifindex;
+    uint16_t outer_vlan_min;
+    uint16_t outer_vlan_max;
+    uint16_t inner_vlan_min;
+    uint16_t inner_vlan_max;
+} log_filter_s;
+
+extern log_scope_s g_log_scope;
+extern log_filter_s g_log_filters[LOG_FILTERS_MAX];
+extern uint g_log_filter_count;
+
+static inline void
+log_scope_set (uint32_t ifindex, uint16_t outer_vlan_id, uint16_t inner_vlan_id)
+{
+    g_log_scope.valid = true;
+    g_log_scope.ifindex = ifindex;
+    g_log_scope.outer_vlan_id = outer_vlan_id;
+    g_log_scope.inner_vlan_id = inner_vlan_id;
+}
+
+static inline void
+log_scope_clear (void)
+{
+    g_log_scope.valid = false;
+}
+
+#define LOG_RING_RECORDS    8192 /* power of two */
+#define LOG_ARGS_MAX        16
+#define LOG_STRINGS_LEN     336
+#define LOG_LINE_LEN        1024
+#define LOG_WINDOW_BUF      65536
+
+typedef enum {
+    LOG_ARG_INT = 0,
+    LOG_ARG_DOUBLE,
+    LOG_ARG_STRING,
+    LOG_ARG_POINTER
+} log_arg_type_t;
+
+/*
+ * Log argument captured at the call site. Strings
+ * are copied into the log record by log_push(),
+ * all other arguments are stored by value.
+ */
+typedef struct log_arg_ {
+    uint8_t type;
+    union {
+        int64_t i;
+        double d;
+        const char *s;
+        const void *p;
+    };
+} log_arg_s;
+
+static inline log_arg_s
+log_arg_int (int64_t value)
+{
+    log_arg_s arg = { .type = LOG_ARG_INT, .i = value };
+    return arg;
+}
+
+static inline log_arg_s
+log_arg_double (double value)
+{
+    log_arg_s arg = { .type = LOG_ARG_DOUBLE, .d = value };
+    return arg;
+}
+
+static inline log_arg_s
+log_arg_string (const char *value)
+{
+    log_arg_s arg = { .type = LOG_ARG_STRING, .s = value };
+    return arg;
+}
+
+static inline log_arg_s
+log_arg_pointer (const void *value)
+{
+    log_arg_s arg = { .type = LOG_ARG_POINTER, .p = value };
+    return arg;
+}
+
+/*
+ * Only char pointers are captured as strings. Unsigned
+ * char pointers are packet buffers which are neither
+ * terminated nor copied, and are stored as pointers.
+ */
+#define LOG_ARG(x) _Generic((x), \
+    char *: log_arg_string, \
+    const char *: log_arg_string, \
+    unsigned char *: log_arg_pointer, \
+    const unsigned char *: log_arg_pointer, \
+    void *: log_arg_pointer, \
+    const void *: log_arg_pointer, \
+    float: log_arg_double, \
+    double: log_arg_double, \
+    default: log_arg_int)(x)
+
+#define LOG_MAP_0(_0)
+#define LOG_MAP_1(_0, a) LOG_ARG(a)
+#define LOG_MAP_2(_0, a, ...) LOG_ARG(a), LOG_MAP_1(_0, __VA_ARGS__)
+#define LOG_MAP_3(_0, a, ...) LOG_ARG(a), LOG_MAP_2(_0, __VA_ARGS__)
+#define LOG_MAP_4(_0, a, ...) LOG_ARG(a), LOG_MAP_3(_0, __VA_ARGS__)
+#define LOG_MAP_5(_0, a, ...) LOG_ARG(a), LOG_MAP_4(_0, __VA_ARGS__)
+#define LOG_MAP_6(_0, a, ...) LOG_ARG(a), LOG_MAP_5(_0, __VA_ARGS__)
+#define LOG_MAP_7(_0, a, ...) LOG_ARG(a), LOG_MAP_6(_0, __VA_ARGS__)
+#define LOG_MAP_8(_0, a, ...) LOG_ARG(a), LOG_MAP_7(_0, __VA_ARGS__)
+#define LOG_MAP_9(_0, a, ...) LOG_ARG(a), LOG_MAP_8(_0, __VA_ARGS__)
+#define LOG_MAP_10(_0, a, ...) LOG_ARG(a), LOG_MAP_9(_0, __VA_ARGS__)
+#define LOG_MAP_11(_0, a, ...) LOG_ARG(a), LOG_MAP_10(_0, __VA_ARGS__)
+#define LOG_MAP_12(_0, a, ...) LOG_ARG(a), LOG_MAP_11(_0, __VA_ARGS__)
+#define LOG_MAP_13(_0, a, ...) LOG_ARG(a), LOG_MAP_12(_0, __VA_ARGS__)
+#define LOG_MAP_14(_0, a, ...) LOG_ARG(a), LOG_MAP_13(_0, __VA_ARGS__)
+#define LOG_MAP_15(_0, a, ...) LOG_ARG(a), LOG_MAP_14(_0, __VA_ARGS__)
+#define LOG_MAP_16(_0, a, ...) LOG_ARG(a), LOG_MAP_15(_0, __VA_ARGS__)
+#define LOG_MAP_SELECT(_0, _1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, NAME, ...) NAME
+#define LOG_ARGS(...) LOG_MAP_SELECT(__VA_ARGS__, LOG_MAP_16, LOG_MAP_15, LOG_MAP_14, LOG_MAP_13, LOG_MAP_12, LOG_MAP_11, LOG_MAP_10, LOG_MAP_9, LOG_MAP_8, LOG_MAP_7, LOG_MAP_6, LOG_MAP_5, LOG_MAP_4, LOG_MAP_3, LOG_MAP_2, LOG_MAP_1, LOG_MAP_0)(__VA_ARGS__)
+
+/*
+ * LOG() does not format at the call site. The arguments
+ * are stored in a fixed size binary record of the log ring,
+ * which is formatted and written by the log thread. The
+ * optional filter callback is checked before the arguments
+ * are evaluated.
+ */
 #define LOG(log_id_, fmt_, ...) \
     do { \
-        if(g_log_fp) { \
-            if (log_id[log_id_].enable) { \
-                fprintf(g_log_fp, "%s "fmt_, log_format_timestamp(), ##__VA_ARGS__); \
-            }\
+        if (log_id[log_id_].enable && (!log_id[log_id_].filter_cb || \
+            log_id[log_id_].filter_cb(&log_id[log_id_], log_id[log_id_].filter_arg))) { \
+            log_arg_s _log_args[] = { LOG_ARGS(_, ##__VA_ARGS__) }; \
+            log_push(log_id_, fmt_, _log_args, sizeof(_log_args)/sizeof(log_arg_s)); \
         } \
-        if(g_interactive) { \
-            if (log_id[log_id_].enable) { \
-                wprintw(log_win, "%s "fmt_, log_format_timestamp(), ##__VA_ARGS__); \
-                wrefresh(log_win);  \
-            } \
-        } else { \
-            if (log_id[log_id_].enable) { \
-                fprintf(stdout, "%s "fmt_, log_format_timestamp(), ##__VA_ARGS__); \
-            } \
-        } \
-     } while (0) \
-
+    } while (0)
 
 extern struct log_id_ log_id[];
 extern char * log_format_timestamp(void);
 
+void
+log_push (int id, const char *fmt, log_arg_s *args, int argc);
+
+int
+log_format (char *buf, int size, const char *fmt, log_arg_s *args, int argc);
+
 void
 log_enable (char *log_name);
 
+bool
+log_filter_add (log_filter_s *filter);
+
+bool
+log_filter_parse (char *str, log_filter_s *filter);
+
+void
+log_filter_clear ();
+
 void
 log_open ();
 
+void
+log_flush ();
+
+void
+log_window_flush ();
+
 void
 log_close ();
 
@@ -0,0 +1,303 @@
+/*
+ * BNG Blaster (BBL) - Loss Events
+ *
+ * Sequence gaps of session and multicast traffic flows are
+ * coalesced per flow into loss events with start, end, gaps
+ * and packets lost. The RX path only updates the open event
+ * of the flow. An event is closed by the periodic loss job if
+ * no further gap was detected for the configured hold time.
+ * Closed events are emitted to the log (LOSS), the JSON report
+ * and the control socket with a bounded rate, such that heavy
+ * loss over many flows does not slow down the blaster itself.
+ * Events exceeding the rate are still counted but not emitted.
+ *
+ * Copyright (C) 2020-2021, RtBrick, Inc.
+ */
+
+#include "bbl.h"
+#include "bbl_loss.h"
+
+const char *loss_flow_names[BBL_LOSS_FLOW_MAX] = {
+    "access-ipv4",
+    "network-ipv4",
+    "access-ipv6",
+    "network-ipv6",
+    "access-ipv6pd",
+    "network-ipv6pd",
+    "multicast"
+};
+
+/*
+ * Milliseconds since test start.
+ */
+static uint64_t
+bbl_loss_msec (bbl_ctx_s *ctx, struct timespec *timestamp)
+{
+    struct timespec diff;
+
+    timespec_sub(&diff, timestamp, &ctx->timestamp_start);
+    return diff.tv_sec * 1000 + diff.tv_nsec / 1000000;
+}
+
+static void
+bbl_loss_event_close (bbl_ctx_s *ctx, bbl_loss_event_s *event)
+{
+    bbl_loss_s *loss = ctx->loss;
+
+    CIRCLEQ_REMOVE(&loss->open_qhead, event, event_qnode);
+    loss->open--;
+    event->session->loss_event[event->flow] = NULL;
+
+    loss->stats.events++;
+    loss->stats.lost += event->lost;
+    loss->stats.gaps += event->gaps;
+    if (loss->pending >= BBL_LOSS_PENDING_MAX) {
+        loss->stats.suppressed++;
+        free(event);
+        return;
+    }
+    CIRCLEQ_INSERT_TAIL(&loss->pending_qhead, event, event_qnode);
+    loss->pending++;
+}
+
+static void
+bbl_loss_event_emit (bbl_ctx_s *ctx, bbl_loss_event_s *event)
+{
+    bbl_loss_s *loss = ctx->loss;
+    uint64_t start, end;
+
+    start = bbl_loss_msec(ctx, &event->start);
+    end = bbl_loss_msec(ctx, &event->end);
+    log_scope_set(event->ifindex, event->outer_vlan_id, event->inner_vlan_id);
+    LOG(LOSS, "LOSS (Q-in-Q %u:%u) flow: %lu (%s) lost: %lu packets in %u gaps from %lu.%03lus to %lu.%03lus\n",
+        event->outer_vlan_id, event->inner_vlan_id,
+        event->flow_id, loss_flow_names[event->flow], event->lost, event->gaps,
+        start / 1000, start % 1000, end / 1000, end % 1000);
+    log_scope_clear();
+
+    if (ctx->config.loss_history) {
+        loss->history[loss->history_next] = *event;
+        loss->history_next = (loss->history_next + 1) % ctx->config.loss_history;
+        if (loss->history_count < ctx->config.loss_history) {
+            loss->history_count++;
+        }
+    }
+}
+
+/*
+ * Emit up to rate pending events.
+ */
+static void
+bbl_loss_emit (bbl_ctx_s *ctx)
+{
+    bbl_loss_s *loss = ctx->loss;
+    bbl_loss_event_s *event;
+    uint32_t budget = ctx->config.loss_rate;
+
+    while (!CIRCLEQ_EMPTY(&loss->pending_qhead)) {
+        event = CIRCLEQ_FIRST(&loss->pending_qhead);
+        CIRCLEQ_REMOVE(&loss->pending_qhead, event, event_qnode);
+        loss->pending--;
+        if (budget) {
+            bbl_loss_event_emit(ctx, event);
+            budget--;
+        } else if (loss->pending >= BBL_LOSS_PENDING_MAX / 2) {
+            /* Drop oldest events if the backlog keeps growing. */
+            loss->stats.suppressed++;
+        } else {
+            CIRCLEQ_INSERT_HEAD(&loss->pending_qhead, event, event_qnode);
+            loss->pending++;
+            break;
+        }
+        free(event);
+    }
+}
+
+/*
+ * Add a sequence gap to the open loss event of the flow.
+ * This is called from the RX path for every gap.
+ */
+void
+bbl_loss_gap (bbl_ctx_s *ctx, bbl_session_s *session, bbl_loss_flow_t flow,
+              uint64_t flow_id, uint64_t expected, uint64_t seq, struct timespec *timestamp)
+{
+    bbl_loss_s *loss = ctx->loss;
+    bbl_loss_event_s *event;
+
+    if (!loss || seq <= expected) {
+        /* Reordered or duplicate packet. */
+        return;
+    }
+
+    event = session->loss_event[flow];
+    if (event && event->flow_id != flow_id) {
+        bbl_loss_event_close(ctx, event);
+        event = NULL;
+    }
+    if (!event) {
+        event = calloc(1, sizeof(bbl_loss_event_s));
+        if (!event) {
+            return;
+        }
+        event->session = session;
+        event->flow = flow;
+        event->flow_id = flow_id;
+        event->ifindex = session->key.ifindex;
+        event->outer_vlan_id = session->key.outer_vlan_id;
+        event->inner_vlan_id = session->key.inner_vlan_id;
+        event->start = *timestamp;
+        loss->open++;
+        session->loss_event[flow] = event;
+    } else {
+        CIRCLEQ_REMOVE(&loss->open_qhead, event, event_qnode);
+    }
+    /* Open events are ordered by last gap. */
+    CIRCLEQ_INSERT_TAIL(&loss->open_qhead, event, event_qnode);
+    event->end = *timestamp;
+    event->lost += seq - expected;
+    event->gaps++;
+}
+
+/*
+ * Close events without gap for the hold time
+ * and emit pending events.
+ */
+static void
+bbl_loss_job (timer_s *timer)
+{
+    bbl_ctx_s *ctx = timer->data;
+    bbl_loss_s *loss = ctx->loss;
+    bbl_loss_event_s *event;
+    struct timespec now, idle;
+
+    timer_clock_gettime(&ctx->timer_root, CLOCK_REALTIME, &now);
+
+    while (!CIRCLEQ_EMPTY(&loss->open_qhead)) {
+        event = CIRCLEQ_FIRST(&loss->open_qhead);
+        timespec_sub(&idle, &now, &event->end);
+        if (idle.tv_sec < ctx->config.loss_hold_time) {
+            break;
+        }
+        bbl_loss_event_close(ctx, event);
+    }
+    bbl_loss_emit(ctx);
+}
+
+bool
+bbl_loss_init (bbl_ctx_s *ctx)
+{
+    bbl_loss_s *loss;
+
+    loss = calloc(1, sizeof(bbl_loss_s));
+    if (!loss) {
+        return false;
+    }
+    ctx->loss = loss;
+    CIRCLEQ_INIT(&loss->open_qhead);
+    CIRCLEQ_INIT(&loss->pending_qhead);
+    if (ctx->config.loss_history) {
+        loss->history = calloc(ctx->config.loss_history, sizeof(bbl_loss_event_s));
+        if (!loss->history) {
+            return false;
+        }
+    }
+    timer_add_periodic(&ctx->timer_root, &loss->job, "Loss Events", 1, 0, ctx, bbl_loss_job);
+    return true;
+}
+
+/*
+ * Close all open events at the end of the test
+ * and emit pending events once more, all events
+ * exceeding the rate are suppressed.
+ */
+void
+bbl_loss_close (bbl_ctx_s *ctx)
+{
+    bbl_loss_s *loss = ctx->loss;
+    bbl_loss_event_s *event;
+
+    if (!loss) return;
+
+    while (!CIRCLEQ_EMPTY(&loss->open_qhead)) {
+        bbl_loss_event_close(ctx, CIRCLEQ_FIRST(&loss->open_qhead));
+    }
+    bbl_loss_emit(ctx);
+    while (!CIRCLEQ_EMPTY(&loss->pending_qhead)) {
+        event = CIRCLEQ_FIRST(&loss->pending_qhead);
+        CIRCLEQ_REMOVE(&loss->pending_qhead, event, event_qnode);
+        loss->pending--;
+        loss->stats.suppressed++;
+        free(event);
+    }
+}
+
+void
+bbl_loss_stdout (bbl_ctx_s *ctx)
+{
+    bbl_loss_s *loss = ctx->loss;
+
+    if (!(loss && loss->stats.events)) return;
+
+    printf("\nLoss Events:\n");
+    printf("  Events:            %10lu (%lu suppressed)\n", loss->stats.events, loss->stats.suppressed);
+    printf("  Gaps:              %10lu\n", loss->stats.gaps);
+    printf("  Packets Lost:      %10lu\n", loss->stats.lost);
+}
+
+json_t *
+bbl_loss_json (bbl_ctx_s *ctx)
+{
+    bbl_loss_s *loss = ctx->loss;
+    bbl_loss_event_s *event;
+    json_t *jobj, *jobj_events;
+    uint32_t i, idx;
+
+    jobj = json_object();
+    json_object_set(jobj, "events", json_integer(loss->stats.events));
+    json_object_set(jobj, "events-open", json_integer(loss->open));
+    json_object_set(jobj, "events-suppressed", json_integer(loss->stats.suppressed));
+    json_object_set(jobj, "gaps", json_integer(loss->stats.gaps));
+    json_object_set(jobj, "packets-lost", json_integer(loss->stats.lost));
+
+    /* Oldest event first. */
+    jobj_events = json_array();
+    idx = loss->history_count < ctx->config.loss_history ? 0 : loss->history_next;
+    for (i = 0; i < loss->history_count; i++) {
+        event = &loss->history[(idx + i) % ctx->config.loss_history];
+        json_array_append_new(jobj_events, json_pack("{sI si ss si si sI sI sI si}",
+            "flow-id", event->flow_id,
+            "ifindex", event->ifindex,
+            "type", loss_flow_names[event->flow],
+            "outer-vlan", event->outer_vlan_id,
+            "inner-vlan", event->inner_vlan_id,
+            "start-ms", bbl_loss_msec(ctx, &event->start),
+            "end-ms", bbl_loss_msec(ctx, &event->end),
+            "packets-lost", event->lost,
+            "gaps", event->gaps));
+    }
+    json_object_set_new(jobj, "history", jobj_events);
+    return jobj;
+}
+
+void
+bbl_loss_free (bbl_ctx_s *ctx)
+{
+    bbl_loss_s *loss = ctx->loss;
+    bbl_loss_event_s *event;
+
+    if (!loss) return;
+
+    while (!CIRCLEQ_EMPTY(&loss->open_qhead)) {
+        event = CIRCLEQ_FIRST(&loss->open_qhead);
+        CIRCLEQ_REMOVE(&loss->open_qhead, event, event_qnode);
+        free(event);
+    }
+    while (!CIRCLEQ_EMPTY(&loss->pending_qhead)) {
+        event = CIRCLEQ_FIRST(&loss->pending_qhead);
+        CIRCLEQ_REMOVE(&loss->pending_qhead, event, event_qnode);
+        free(event);
+    }
+    free(loss->history);
+    free(loss);
+    ctx->loss = NULL;
+}
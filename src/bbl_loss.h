@@ -0,0 +1,90 @@
+/*
+ * BNG Blaster (BBL) - Loss Events
+ *
+ * Coalesce traffic loss per flow into loss events.
+ *
+ * Copyright (C) 2020-2021, RtBrick, Inc.
+ */
+
+#ifndef __BBL_LOSS_H__
+#define __BBL_LOSS_H__
+
+#include <jansson.h>
+
+#define BBL_LOSS_HOLD_TIME          1 /* seconds without gap until an event is closed */
+#define BBL_LOSS_RATE               100 /* events per second */
+#define BBL_LOSS_HISTORY            1000 /* events kept for reports */
+#define BBL_LOSS_PENDING_MAX        65536
+
+struct bbl_ctx_;
+struct bbl_session_;
+
+typedef enum {
+    BBL_LOSS_ACCESS_IPV4 = 0,
+    BBL_LOSS_NETWORK_IPV4,
+    BBL_LOSS_ACCESS_IPV6,
+    BBL_LOSS_NETWORK_IPV6,
+    BBL_LOSS_ACCESS_IPV6PD,
+    BBL_LOSS_NETWORK_IPV6PD,
+    BBL_LOSS_MULTICAST,
+    BBL_LOSS_FLOW_MAX
+} bbl_loss_flow_t;
+
+typedef struct bbl_loss_event_ {
+    CIRCLEQ_ENTRY(bbl_loss_event_) event_qnode;
+    struct bbl_session_ *session;
+    bbl_loss_flow_t flow;
+    uint64_t flow_id;
+    uint32_t ifindex;
+    uint16_t outer_vlan_id;
+    uint16_t inner_vlan_id;
+    struct timespec start; /* first gap */
+    struct timespec end; /* last gap */
+    uint64_t lost; /* packets */
+    uint32_t gaps;
+} bbl_loss_event_s;
+
+typedef struct bbl_loss_ {
+    struct timer_ *job;
+
+    /* Events with recent gaps */
+    CIRCLEQ_HEAD(bbl_loss_open_, bbl_loss_event_) open_qhead;
+    uint32_t open;
+
+    /* Closed events waiting to be emitted */
+    CIRCLEQ_HEAD(bbl_loss_pending_, bbl_loss_event_) pending_qhead;
+    uint32_t pending;
+
+    /* Last emitted events */
+    bbl_loss_event_s *history;
+    uint32_t history_next;
+    uint32_t history_count;
+
+    struct {
+        uint64_t events;
+        uint64_t lost;
+        uint64_t gaps;
+        uint64_t suppressed; /* events not emitted */
+    } stats;
+} bbl_loss_s;
+
+bool
+bbl_loss_init (struct bbl_ctx_ *ctx);
+
+void
+bbl_loss_gap (struct bbl_ctx_ *ctx, struct bbl_session_ *session, bbl_loss_flow_t flow,
+              uint64_t flow_id, uint64_t expected, uint64_t seq, struct timespec *timestamp);
+
+void
+bbl_loss_close (struct bbl_ctx_ *ctx);
+
+void
+bbl_loss_stdout (struct bbl_ctx_ *ctx);
+
+json_t *
+bbl_loss_json (struct bbl_ctx_ *ctx);
+
+void
+bbl_loss_free (struct bbl_ctx_ *ctx);
+
+#endif
@@ -0,0 +1,546 @@
+/*
+ * BNG Blaster (BBL) - Metrics
+ *
+ * Optional HTTP listener (TCP or UDS) serving OpenMetrics
+ * text for time series of long running tests. Requests are
+ * served by a separate thread from the counter snapshot (see
+ * bbl_counters.c), such that a scrape neither blocks the event
+ * loop nor walks the session dictionary.
+ *
+ * Copyright (C) 2020-2021, RtBrick, Inc.
+ */
+
+#include "bbl.h"
+#include "bbl_stats.h"
+#include "bbl_counters.h"
+#include "bbl_metrics.h"
+#include <stddef.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sys/un.h>
+
+#define BBL_METRICS_PREFIX          "bngblaster_"
+#define BBL_METRICS_BACKLOG         16
+#define BBL_METRICS_CONTENT_TYPE    "application/openmetrics-text; version=1.0.0; charset=utf-8"
+
+static const char *session_list_names[BBL_SESSIONS_MAX] = {
+    "idle", "setup", "established", "terminating", "terminated"
+};
+
+#define METRICS_IF_COUNTER(_field) { #_field, offsetof(struct bbl_interface_stats_, _field) }
+
+static const struct {
+    const char *name;
+    size_t offset;
+} interface_counters[] = {
+    METRICS_IF_COUNTER(packets_tx),
+    METRICS_IF_COUNTER(packets_rx),
+    METRICS_IF_COUNTER(packets_rx_drop_unknown),
+    METRICS_IF_COUNTER(packets_rx_drop_decode_error),
+    METRICS_IF_COUNTER(sendto_failed),
+    METRICS_IF_COUNTER(no_tx_buffer),
+    METRICS_IF_COUNTER(poll_tx),
+    METRICS_IF_COUNTER(poll_rx),
+    METRICS_IF_COUNTER(encode_errors),
+    METRICS_IF_COUNTER(mc_tx),
+    METRICS_IF_COUNTER(mc_rx),
+    METRICS_IF_COUNTER(mc_loss),
+    METRICS_IF_COUNTER(session_ipv4_tx),
+    METRICS_IF_COUNTER(session_ipv4_rx),
+    METRICS_IF_COUNTER(session_ipv4_loss),
+    METRICS_IF_COUNTER(session_ipv6_tx),
+    METRICS_IF_COUNTER(session_ipv6_rx),
+    METRICS_IF_COUNTER(session_ipv6_loss),
+    METRICS_IF_COUNTER(session_ipv6pd_tx),
+    METRICS_IF_COUNTER(session_ipv6pd_rx),
+    METRICS_IF_COUNTER(session_ipv6pd_loss),
+    METRICS_IF_COUNTER(session_ipv4_wrong_session),
+    METRICS_IF_COUNTER(session_ipv6_wrong_session),
+    METRICS_IF_COUNTER(session_ipv6pd_wrong_session),
+    METRICS_IF_COUNTER(arp_tx),
+    METRICS_IF_COUNTER(arp_rx),
+    METRICS_IF_COUNTER(padi_tx),
+    METRICS_IF_COUNTER(pado_rx),
+    METRICS_IF_COUNTER(padr_tx),
+    METRICS_IF_COUNTER(pads_rx),
+    METRICS_IF_COUNTER(padt_tx),
+    METRICS_IF_COUNTER(padt_rx),
+    METRICS_IF_COUNTER(lcp_tx),
+    METRICS_IF_COUNTER(lcp_rx),
+    METRICS_IF_COUNTER(lcp_timeout),
+    METRICS_IF_COUNTER(lcp_echo_timeout),
+    METRICS_IF_COUNTER(pap_tx),
+    METRICS_IF_COUNTER(pap_rx),
+    METRICS_IF_COUNTER(pap_timeout),
+    METRICS_IF_COUNTER(chap_tx),
+    METRICS_IF_COUNTER(chap_rx),
+    METRICS_IF_COUNTER(chap_timeout),
+    METRICS_IF_COUNTER(ipcp_tx),
+    METRICS_IF_COUNTER(ipcp_rx),
+    METRICS_IF_COUNTER(ipcp_timeout),
+    METRICS_IF_COUNTER(ip6cp_tx),
+    METRICS_IF_COUNTER(ip6cp_rx),
+    METRICS_IF_COUNTER(ip6cp_timeout),
+    METRICS_IF_COUNTER(igmp_rx),
+    METRICS_IF_COUNTER(igmp_tx),
+    METRICS_IF_COUNTER(icmp_tx),
+    METRICS_IF_COUNTER(icmp_rx),
+    METRICS_IF_COUNTER(icmpv6_tx),
+    METRICS_IF_COUNTER(icmpv6_rx),
+    METRICS_IF_COUNTER(icmpv6_rs_timeout),
+    METRICS_IF_COUNTER(dhcpv6_tx),
+    METRICS_IF_COUNTER(dhcpv6_rx),
+    METRICS_IF_COUNTER(dhcpv6_timeout),
+};
+
+#define METRICS_IF_RATE(_field) { #_field, offsetof(struct bbl_interface_rates_, _field) }
+
+static const struct {
+    const char *name;
+    size_t offset;
+} interface_rates[] = {
+    METRICS_IF_RATE(packets_tx),
+    METRICS_IF_RATE(packets_rx),
+    METRICS_IF_RATE(mc_tx),
+    METRICS_IF_RATE(mc_rx),
+    METRICS_IF_RATE(session_ipv4_tx),
+    METRICS_IF_RATE(session_ipv4_rx),
+    METRICS_IF_RATE(session_ipv6_tx),
+    METRICS_IF_RATE(session_ipv6_rx),
+    METRICS_IF_RATE(session_ipv6pd_tx),
+    METRICS_IF_RATE(session_ipv6pd_rx),
+};
+
+static struct {
+    int fd;
+    char *path; /* UDS path */
+    pthread_t thread;
+    bool thread_running;
+    bool stop;
+    bbl_counters_snapshot_s snapshot;
+} metrics = {
+    .fd = -1
+};
+
+static void
+bbl_metrics_family (FILE *out, const char *name, const char *type, const char *help)
+{
+    fprintf(out, "# TYPE " BBL_METRICS_PREFIX "%s %s\n", name, type);
+    fprintf(out, "# HELP " BBL_METRICS_PREFIX "%s %s\n", name, help);
+}
+
+static void
+bbl_metrics_gauge (FILE *out, const char *name, const char *help, double value)
+{
+    bbl_metrics_family(out, name, "gauge", help);
+    fprintf(out, BBL_METRICS_PREFIX "%s %.15g\n", name, value);
+}
+
+static void
+bbl_metrics_counter (FILE *out, const char *name, const char *help, uint64_t value)
+{
+    bbl_metrics_family(out, name, "counter", help);
+    fprintf(out, BBL_METRICS_PREFIX "%s_total %lu\n", name, value);
+}
+
+/*
+ * Latency histogram, bucket N counts latencies
+ * below 2^N ms, the last bucket all others.
+ */
+static void
+bbl_metrics_histogram (FILE *out, const char *name, const char *labels, bbl_setup_latency_s *latency)
+{
+    char braces[128] = "";
+    uint64_t count = 0;
+    const char *sep = *labels ? "," : "";
+    int i;
+
+    if(*labels) {
+        snprintf(braces, sizeof(braces), "{%s}", labels);
+    }
+
+    for(i = 0; i < BBL_SETUP_LATENCY_BUCKETS - 1; i++) {
+        count += latency->bucket[i];
+        fprintf(out, BBL_METRICS_PREFIX "%s_bucket{%s%sle=\"%g\"} %lu\n",
+                name, labels, sep, (1 << i) / 1000.0, count);
+    }
+    count += latency->bucket[i];
+    fprintf(out, BBL_METRICS_PREFIX "%s_bucket{%s%sle=\"+Inf\"} %lu\n", name, labels, sep, count);
+    fprintf(out, BBL_METRICS_PREFIX "%s_count%s %u\n", name, braces, latency->count);
+    fprintf(out, BBL_METRICS_PREFIX "%s_sum%s %.6f\n", name, braces, latency->sum_us / 1.0e6);
+}
+
+/*
+ * Write a label value, escaping backslash,
+ * double quote and line feed as required.
+ */
+static void
+bbl_metrics_label_value (FILE *out, const char *value)
+{
+    for(; *value; value++) {
+        switch(*value) {
+            case '\\':
+                fputs("\\\\", out);
+                break;
+            case '"':
+                fputs("\\\"", out);
+                break;
+            case '\n':
+                fputs("\\n", out);
+                break;
+            default:
+                fputc(*value, out);
+                break;
+        }
+    }
+}
+
+static void
+bbl_metrics_interface_labels (FILE *out, bbl_counters_interface_s *counters_if, const char *type)
+{
+    fputs("{interface=\"", out);
+    bbl_metrics_label_value(out, counters_if->name);
+    fprintf(out, "\",type=\"%s\"}", type);
+}
+
+static void
+bbl_metrics_interfaces (FILE *out, bbl_counters_snapshot_s *snapshot)
+{
+    bbl_counters_interface_s *counters_if;
+    char name[128];
+    uint i;
+    int j;
+
+    for(i = 0; i < sizeof(interface_counters) / sizeof(interface_counters[0]); i++) {
+        snprintf(name, sizeof(name), "interface_%s", interface_counters[i].name);
+        bbl_metrics_family(out, name, "counter", "Interface counter");
+        for(j = -1; j < snapshot->access_if_count; j++) {
+            counters_if = j < 0 ? &snapshot->network_if : &snapshot->access_if[j];
+            if(!counters_if->name) continue;
+            fprintf(out, BBL_METRICS_PREFIX "%s_total", name);
+            bbl_metrics_interface_labels(out, counters_if, j < 0 ? "network" : "access");
+            fprintf(out, " %lu\n", *(uint64_t*)((uint8_t*)&counters_if->stats + interface_counters[i].offset));
+        }
+    }
+    for(i = 0; i < sizeof(interface_rates) / sizeof(interface_rates[0]); i++) {
+        snprintf(name, sizeof(name), "interface_%s_pps", interface_rates[i].name);
+        bbl_metrics_family(out, name, "gauge", "Interface rate in packets per second");
+        for(j = -1; j < snapshot->access_if_count; j++) {
+            counters_if = j < 0 ? &snapshot->network_if : &snapshot->access_if[j];
+            if(!counters_if->name) continue;
+            fprintf(out, BBL_METRICS_PREFIX "%s", name);
+            bbl_metrics_interface_labels(out, counters_if, j < 0 ? "network" : "access");
+            fprintf(out, " %lu\n", ((bbl_rate_s*)((uint8_t*)&counters_if->rate + interface_rates[i].offset))->avg);
+        }
+    }
+}
+
+/*
+ * Write all metrics of the snapshot.
+ */
+void
+bbl_metrics_write (FILE *out, bbl_counters_snapshot_s *snapshot)
+{
+    char labels[64];
+    int i;
+
+    /* Sessions */
+    bbl_metrics_gauge(out, "sessions", "Sessions", snapshot->sessions);
+    bbl_metrics_family(out, "sessions_state", "gauge", "Sessions per state");
+    for(i = 0; i < BBL_SESSIONS_MAX; i++) {
+        fprintf(out, BBL_METRICS_PREFIX "sessions_state{state=\"%s\"} %lu\n",
+                session_list_names[i], snapshot->sessions_count[i]);
+    }
+    bbl_metrics_gauge(out, "sessions_established", "Established sessions", snapshot->sessions_established);
+    bbl_metrics_gauge(out, "sessions_established_max", "Maximum established sessions", snapshot->sessions_established_max);
+    bbl_metrics_gauge(out, "sessions_outstanding", "Outstanding sessions", snapshot->sessions_outstanding);
+    bbl_metrics_gauge(out, "sessions_terminated", "Terminated sessions", snapshot->sessions_terminated);
+    bbl_metrics_counter(out, "sessions_flapped", "Flapped sessions", snapshot->sessions_flapped);
+    bbl_metrics_gauge(out, "dhcpv6_sessions", "DHCPv6 sessions", snapshot->dhcpv6_requested);
+    bbl_metrics_gauge(out, "dhcpv6_sessions_established", "DHCPv6 established sessions", snapshot->dhcpv6_established);
+
+    /* Setup rate */
+    bbl_metrics_gauge(out, "setup_time_seconds", "Time between first session started and last session established",
+                      snapshot->setup_time / 1000.0);
+    bbl_metrics_family(out, "setup_rate_cps", "gauge", "Session setup rate in calls per second");
+    fprintf(out, BBL_METRICS_PREFIX "setup_rate_cps{stat=\"current\"} %.2f\n", snapshot->cps);
+    fprintf(out, BBL_METRICS_PREFIX "setup_rate_cps{stat=\"min\"} %.2f\n", snapshot->cps_min);
+    fprintf(out, BBL_METRICS_PREFIX "setup_rate_cps{stat=\"avg\"} %.2f\n", snapshot->cps_avg);
+    fprintf(out, BBL_METRICS_PREFIX "setup_rate_cps{stat=\"max\"} %.2f\n", snapshot->cps_max);
+
+    /* Setup latency */
+    bbl_metrics_family(out, "setup_latency_seconds", "histogram", "Session setup latency per phase");
+    for(i = 0; i < BBL_SETUP_PHASE_MAX; i++) {
+        snprintf(labels, sizeof(labels), "phase=\"%s\"", setup_phase_names[i]);
+        bbl_metrics_histogram(out, "setup_latency_seconds", labels, &snapshot->setup_latency[i]);
+    }
+
+    /* Session traffic */
+    bbl_metrics_gauge(out, "session_traffic_flows", "Session traffic flows", snapshot->session_traffic_flows);
+    bbl_metrics_gauge(out, "session_traffic_flows_verified", "Verified session traffic flows",
+                      snapshot->session_traffic_flows_verified);
+
+    /* Loss events */
+    bbl_metrics_counter(out, "loss_events", "Closed loss events", snapshot->loss.events);
+    bbl_metrics_gauge(out, "loss_events_open", "Open loss events", snapshot->loss.open);
+    bbl_metrics_counter(out, "loss_events_suppressed", "Loss events not emitted", snapshot->loss.suppressed);
+    bbl_metrics_counter(out, "loss_gaps", "Sequence gaps of closed loss events", snapshot->loss.gaps);
+    bbl_metrics_counter(out, "loss_packets", "Packets lost in closed loss events", snapshot->loss.lost);
+
+    /* IGMP */
+    bbl_metrics_family(out, "igmp_join_delay_seconds", "histogram", "IGMP zapping join delay");
+    bbl_metrics_histogram(out, "igmp_join_delay_seconds", "", &snapshot->igmp_join_delay);
+    bbl_metrics_family(out, "igmp_leave_delay_seconds", "histogram", "IGMP zapping leave delay");
+    bbl_metrics_histogram(out, "igmp_leave_delay_seconds", "", &snapshot->igmp_leave_delay);
+
+    /* Interfaces */
+    bbl_metrics_interfaces(out, snapshot);
+
+    fprintf(out, "# EOF\n");
+}
+
+static bool
+bbl_metrics_send (int fd, char *buf, size_t len)
+{
+    ssize_t rc;
+
+    while(len) {
+        rc = send(fd, buf, len, MSG_NOSIGNAL);
+        if(rc < 0) {
+            if(errno == EINTR) continue;
+            return false;
+        }
+        buf += rc;
+        len -= rc;
+    }
+    return true;
+}
+
+/*
+ * Serve a single HTTP request, only GET of the
+ * metrics path is supported.
+ */
+static void
+bbl_metrics_request (int fd)
+{
+    char request[BBL_METRICS_REQUEST_LEN];
+    char header[256];
+    struct timeval timeout = { BBL_METRICS_TIMEOUT, 0 };
+    char *body = NULL;
+    size_t body_len = 0;
+    size_t len = 0;
+    ssize_t rc;
+    FILE *out;
+    int header_len;
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    /* Read request header. */
+    while(len < sizeof(request) - 1) {
+        rc = recv(fd, request + len, sizeof(request) - 1 - len, 0);
+        if(rc <= 0) {
+            if(rc < 0 && errno == EINTR) continue;
+            return;
+        }
+        len += rc;
+        request[len] = 0;
+        if(strstr(request, "\r\n\r\n") || strstr(request, "\n\n")) break;
+    }
+    request[len] = 0;
+
+    if(strncmp(request, "GET ", 4) != 0) {
+        header_len = snprintf(header, sizeof(header),
+                              "HTTP/1.1 405 Method Not Allowed\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+        bbl_metrics_send(fd, header, header_len);
+        return;
+    }
+    if(!(strncmp(request + 4, BBL_METRICS_PATH, sizeof(BBL_METRICS_PATH) - 1) == 0 &&
+         (request[4 + sizeof(BBL_METRICS_PATH) - 1] == ' ' || request[4 + sizeof(BBL_METRICS_PATH) - 1] == '?'))) {
+        header_len = snprintf(header, sizeof(header),
+                              "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+        bbl_metrics_send(fd, header, header_len);
+        return;
+    }
+
+    out = open_memstream(&body, &body_len);
+    if(!out) {
+        return;
+    }
+    bbl_counters_snapshot(&metrics.snapshot);
+    bbl_metrics_write(out, &metrics.snapshot);
+    fclose(out);
+
+    header_len = snprintf(header, sizeof(header),
+                          "HTTP/1.1 200 OK\r\nContent-Type: " BBL_METRICS_CONTENT_TYPE "\r\n"
+                          "Content-Length: %lu\r\nConnection: close\r\n\r\n", body_len);
+    if(bbl_metrics_send(fd, header, header_len)) {
+        bbl_metrics_send(fd, body, body_len);
+    }
+    free(body);
+}
+
+static void *
+bbl_metrics_thread (void *arg)
+{
+    struct pollfd pfd;
+    sigset_t set;
+    int fd;
+
+    (void)arg;
+
+    /* Signals are handled by the main thread. */
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    pfd.fd = metrics.fd;
+    pfd.events = POLLIN;
+    while(!__atomic_load_n(&metrics.stop, __ATOMIC_ACQUIRE)) {
+        if(poll(&pfd, 1, BBL_METRICS_POLL_INTERVAL) <= 0) {
+            continue;
+        }
+        fd = accept(metrics.fd, NULL, NULL);
+        if(fd < 0) {
+            continue;
+        }
+        bbl_metrics_request(fd);
+        close(fd);
+    }
+    return NULL;
+}
+
+static int
+bbl_metrics_listen_uds (char *path)
+{
+    struct sockaddr_un addr = {0};
+    int fd;
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0) {
+        return -1;
+    }
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path)-1);
+    unlink(path);
+    if(bind(fd, (struct sockaddr *)&addr, SUN_LEN(&addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    metrics.path = path;
+    return fd;
+}
+
+/*
+ * Listen on [<host>]:<port>, the host defaults
+ * to the IPv4 loopback address.
+ */
+static int
+bbl_metrics_listen_tcp (char *address)
+{
+    struct addrinfo hints = {0};
+    struct addrinfo *result, *ai;
+    char host[NI_MAXHOST];
+    char *port;
+    size_t len;
+    int fd = -1;
+    int on = 1;
+
+    port = strrchr(address, ':');
+    if(!port) {
+        errno = EINVAL;
+        return -1;
+    }
+    len = port - address;
+    port++;
+    if(address[0] == '[' && len > 1 && address[len-1] == ']') {
+        address++;
+        len -= 2;
+    }
+    if(len >= sizeof(host)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if(len) {
+        memcpy(host, address, len);
+        host[len] = 0;
+    } else {
+        strcpy(host, BBL_METRICS_HOST);
+    }
+
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    if(getaddrinfo(host, port, &hints, &result) != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    for(ai = result; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if(fd < 0) continue;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if(bind(fd, ai->ai_addr, ai->ai_addrlen) == 0) break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(result);
+    return fd;
+}
+
+/*
+ * Open metrics listener, addresses containing
+ * a slash are UDS paths, all others TCP.
+ */
+bool
+bbl_metrics_open (bbl_ctx_s *ctx)
+{
+    char *address = ctx->metrics_address;
+
+    if(strchr(address, '/')) {
+        metrics.fd = bbl_metrics_listen_uds(address);
+    } else {
+        metrics.fd = bbl_metrics_listen_tcp(address);
+    }
+    if(metrics.fd < 0) {
+        fprintf(stderr, "Error: Failed to bind metrics listener %s (error %d)\n", address, errno);
+        return false;
+    }
+    if(listen(metrics.fd, BBL_METRICS_BACKLOG) != 0) {
+        fprintf(stderr, "Error: Failed to listen on metrics listener %s (error %d)\n", address, errno);
+        bbl_metrics_close(ctx);
+        return false;
+    }
+
+    bbl_counters_init(ctx);
+    if(pthread_create(&metrics.thread, NULL, bbl_metrics_thread, NULL) != 0) {
+        fprintf(stderr, "Error: Failed to start metrics thread\n");
+        bbl_metrics_close(ctx);
+        return false;
+    }
+    metrics.thread_running = true;
+    LOG(NORMAL, "Opened metrics listener %s\n", address);
+    return true;
+}
+
+/*
+ * Stop metrics thread and close listener, this must be
+ * called before interfaces are deleted.
+ */
+void
+bbl_metrics_close (bbl_ctx_s *ctx)
+{
+    (void)ctx;
+
+    if(metrics.thread_running) {
+        __atomic_store_n(&metrics.stop, true, __ATOMIC_RELEASE);
+        pthread_join(metrics.thread, NULL);
+        metrics.thread_running = false;
+    }
+    if(metrics.fd >= 0) {
+        close(metrics.fd);
+        metrics.fd = -1;
+    }
+    if(metrics.path) {
+        unlink(metrics.path);
+        metrics.path = NULL;
+    }
+}
@@ -0,0 +1,27 @@
+/*
+ * BNG Blaster (BBL) - Metrics
+ *
+ * OpenMetrics (Prometheus) HTTP exporter.
+ *
+ * Copyright (C) 2020-2021, RtBrick, Inc.
+ */
+
+#ifndef __BBL_METRICS_H__
+#define __BBL_METRICS_H__
+
+#define BBL_METRICS_PATH            "/metrics"
+#define BBL_METRICS_HOST            "127.0.0.1" /* default listen address */
+#define BBL_METRICS_REQUEST_LEN     4096
+#define BBL_METRICS_TIMEOUT         1 /* seconds per request */
+#define BBL_METRICS_POLL_INTERVAL   100 /* milliseconds */
+
+void
+bbl_metrics_write (FILE *out, bbl_counters_snapshot_s *snapshot);
+
+bool
+bbl_metrics_open (bbl_ctx_s *ctx);
+
+void
+bbl_metrics_close (bbl_ctx_s *ctx);
+
+#endif
@@ -21,190 +21,569 @@
 #include "bbl_pcap.h"
 #include "bbl_logging.h"
 
+/*
+ * Captured packets are written into a ring of large buffers
+ * by the main thread. Full buffers are handed over to a writer
+ * thread, such that slow disks or FIFO readers never block the
+ * TX and RX jobs. If all buffers are busy, packets are dropped
+ * and counted instead.
+ */
+
 /*
  * Prototypes
  */
-void pcapng_open(bbl_ctx_s *);
 void write_le_uint(u_char *, uint , unsigned long long);
 
 /*
- * Flush the write buffer
+ * Quick'n dirty little endian writer.
  */
 void
-pcapng_fflush (bbl_ctx_s *ctx)
+write_le_uint (u_char *data, uint length, unsigned long long value)
 {
-    int res;
+    uint idx;
 
-    if (!ctx->pcap.write_buf) {
+    if (!length || length > 8) {
 	    return;
     }
 
-    if (!ctx->pcap.write_idx) {
-        return;
+    for (idx = 0; idx < length; idx++) {
+        data[idx] =  value & 0xff;
+        value >>= 8;
     }
+}
 
-    if (ctx->pcap.fd == -1) {
-        /*
-         * File is not yet opened, try to open it.
-         */
-        pcapng_open(ctx);
-        if (ctx->pcap.fd == -1) {
-            /*
-             * Darn, still closed.
-             */
-
-            /*
-             * We may have buffered for too long.
-             * Reset the buffer before it is running full.
-             */
-            if (ctx->pcap.write_idx >= (PCAPNG_WRITEBUFSIZE/16)*15) {
-                ctx->pcap.write_idx = 0;
-                ctx->pcap.wrote_header = false;
-            }
-            return;
-        }
+/*
+ * Push data to the write buffer and update the cursor.
+ */
+void
+push_le_uint (bbl_ctx_s *ctx, uint length, unsigned long long value)
+{
+    /*
+     * Buffer overrun protection.
+     */
+    if ((ctx->pcap.write_idx + length) >= PCAPNG_WRITEBUFSIZE) {
+	    return;
     }
 
-    res = write(ctx->pcap.fd, ctx->pcap.write_buf, ctx->pcap.write_idx);
+    /*
+     * Write the data.
+     */
+    write_le_uint(ctx->pcap.write_buf + ctx->pcap.write_idx, length, value);
 
     /*
-     * Blocked?
+     * Adjust the cursor.
      */
-    if (res == -1) {
-        switch (errno) {
-            case EPIPE:
-                /*
-                 * Our listener just went away.
-                 * Restart the fifo and write a PCAP header for the next listener.
-                 */
-                close(ctx->pcap.fd);
-                pcapng_init(ctx);
-                break;
-            case EAGAIN:
-            default:
+    ctx->pcap.write_idx += length;
+}
+
+static void
+pcapng_writer_close (pcapng_ring_s *ring)
+{
+    if (ring->fd != -1) {
+        close(ring->fd);
+        ring->fd = -1;
+    }
+}
+
+/*
+ * Writer thread: write the complete buffer. Regular files
+ * are always written at the given offset, such that the file
+ * position does not matter after falling back from io_uring.
+ */
+static bool
+pcapng_writer_write (pcapng_ring_s *ring, uint8_t *data, uint len, uint64_t offset)
+{
+    ssize_t res;
+
+    while (len) {
+        if (ring->seekable) {
+            res = pwrite(ring->fd, data, len, offset);
+        } else {
+            res = write(ring->fd, data, len);
+        }
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            __atomic_store_n(&ring->error, errno, __ATOMIC_RELAXED);
+            if (errno == EPIPE) {
                 /*
-                 * Reset the buffer for unresponsive callers.
+                 * Our listener just went away. Reopen the FIFO
+                 * and write a new header for the next listener.
                  */
-                pcapng_init(ctx);
-                break;
+                pcapng_writer_close(ring);
+            }
+            return false;
         }
+        data += res;
+        len -= res;
+        offset += res;
+    }
+    return true;
+}
+
+/*
+ * Writer thread: drop a partially written block after a
+ * failed write, such that the file ends with the last
+ * complete block and the next block is written there.
+ */
+static void
+pcapng_writer_discard (pcapng_ring_s *ring)
+{
+    if (ring->fd == -1 || !ring->seekable) {
         return;
     }
+    if (ftruncate(ring->fd, ring->offset) == -1) {
+        __atomic_store_n(&ring->error, errno, __ATOMIC_RELAXED);
+    }
+}
+
+/*
+ * Writer thread: try to open the file and write
+ * the section and interface headers.
+ */
+static bool
+pcapng_writer_open (pcapng_ring_s *ring)
+{
+    struct stat st;
+    int flags;
 
     /*
-     * Full write ?
+     * Open non-blocking such that a FIFO without reader fails
+     * with ENXIO instead of blocking, then switch to blocking
+     * writes which are fine in the writer thread.
      */
-    if (res == (int)ctx->pcap.write_idx) {
-        LOG(PCAP, "drained %u bytes buffer to pcap file %s\n",
-            ctx->pcap.write_idx, ctx->pcap.filename);
+    if (ring->files) {
+        snprintf(ring->path, sizeof(ring->path), "%s.%u", ring->filename, ring->file_index % ring->files);
+    } else {
+        snprintf(ring->path, sizeof(ring->path), "%s", ring->filename);
+    }
+    ring->fd = open(ring->path, O_WRONLY | O_CREAT | O_TRUNC | O_NONBLOCK, PCAPNG_PERMS);
+    if (ring->fd == -1) {
+        __atomic_store_n(&ring->error, errno, __ATOMIC_RELAXED);
+        return false;
+    }
+    flags = fcntl(ring->fd, F_GETFL);
+    fcntl(ring->fd, F_SETFL, flags & ~O_NONBLOCK);
 
-        ctx->pcap.write_idx = 0;
-        return;
+    /*
+     * Writes at explicit offsets, including asynchronous
+     * writes, are used for regular files only.
+     */
+    ring->seekable = fstat(ring->fd, &st) == 0 && S_ISREG(st.st_mode);
+    ring->io_uring = ring->seekable && ring->uring.fd >= 0;
+
+    if (!pcapng_writer_write(ring, ring->header, ring->header_len, 0)) {
+        pcapng_writer_close(ring);
+        return false;
+    }
+    ring->offset = ring->header_len;
+    __atomic_add_fetch(&ring->opens, 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+static void
+pcapng_writer_done (pcapng_ring_s *ring, pcapng_buffer_s *buffer, bool success)
+{
+    if (success) {
+        __atomic_add_fetch(&ring->stats.bytes_written, buffer->len, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&ring->stats.buffers_written, 1, __ATOMIC_RELAXED);
+    } else {
+        __atomic_add_fetch(&ring->stats.packets_write_failed, buffer->packets, __ATOMIC_RELAXED);
     }
+    buffer->len = 0;
+    buffer->packets = 0;
+    buffer->rotate = false;
+}
+
+/*
+ * Writer thread: write up to PCAPNG_IO_URING_ENTRIES
+ * buffers with one system call and wait for all of them.
+ * Returns the number of buffers processed.
+ */
+static uint32_t
+pcapng_writer_io_uring (pcapng_ring_s *ring, uint32_t tail, uint32_t head)
+{
+    pcapng_buffer_s *buffer;
+    uint64_t offset[PCAPNG_IO_URING_ENTRIES];
+    bool success[PCAPNG_IO_URING_ENTRIES];
+    uint64_t idx;
+    uint32_t n, i;
+    bool failed;
+    int res;
 
+    for (n = 0; tail + n != head && n < PCAPNG_IO_URING_ENTRIES; n++) {
+        buffer = &ring->buffers[(tail + n) % ring->count];
+        if (n && buffer->rotate) {
+            break;
+        }
+        offset[n] = n ? offset[n-1] + ring->buffers[(tail + n - 1) % ring->count].len : ring->offset;
+        if (!bbl_io_uring_write(&ring->uring, ring->fd, buffer->data, buffer->len, offset[n], n)) {
+            break;
+        }
+        success[n] = false;
+    }
+    if (!n || !bbl_io_uring_submit(&ring->uring, n)) {
+        /* Fallback to synchronous writes. */
+        ring->io_uring = false;
+        bbl_io_uring_free(&ring->uring);
+        return 0;
+    }
+    for (i = 0; i < n; i++) {
+        while (!bbl_io_uring_complete(&ring->uring, &idx, &res)) {
+            bbl_io_uring_submit(&ring->uring, 1);
+        }
+        buffer = &ring->buffers[(tail + idx) % ring->count];
+        if (res < 0) {
+            __atomic_store_n(&ring->error, -res, __ATOMIC_RELAXED);
+            res = 0;
+        }
+        /* Complete short and failed writes synchronously. */
+        success[idx] = true;
+        if ((uint)res < buffer->len) {
+            success[idx] = pcapng_writer_write(ring, buffer->data + res, buffer->len - res,
+                                               offset[idx] + res);
+        }
+    }
     /*
-     * Partial write ?
+     * Buffers after a failed one were written behind a hole,
+     * so they are discarded with the failed one.
      */
-    if (res && res < (int)ctx->pcap.write_idx) {
+    failed = false;
+    for (i = 0; i < n; i++) {
+        buffer = &ring->buffers[(tail + i) % ring->count];
+        if (!success[i] && !failed) {
+            failed = true;
+            pcapng_writer_discard(ring);
+        }
+        if (failed) {
+            success[i] = false;
+        } else {
+            ring->offset += buffer->len;
+        }
+        pcapng_writer_done(ring, buffer, success[i]);
+    }
+    return n;
+}
+/*
+ * Writer thread main loop, sleeping while there is nothing to write.
+ */
+static void *
+pcapng_writer_thread (void *arg)
+{
+    pcapng_ring_s *ring = arg;
+    pcapng_buffer_s *buffer;
+    struct timespec idle = { .tv_sec = 0, .tv_nsec = MSEC };
+    uint32_t tail, head, n;
+    sigset_t set;
+    bool success;
+
+    /* Signals are handled by the main thread. */
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    while (true) {
+        tail = ring->tail;
+        head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (tail == head) {
+            if (__atomic_load_n(&ring->stop, __ATOMIC_ACQUIRE)) {
+                break;
+            }
+            nanosleep(&idle, NULL);
+            continue;
+        }
 
-        /*
-         * Rebase the buffer.
-         */
-        memmove(ctx->pcap.write_buf, ctx->pcap.write_buf+res, ctx->pcap.write_idx - res);
-        ctx->pcap.write_idx -= res;
+        buffer = &ring->buffers[tail % ring->count];
+        if (buffer->rotate) {
+            pcapng_writer_close(ring);
+            __atomic_add_fetch(&ring->file_index, 1, __ATOMIC_RELAXED);
+            buffer->rotate = false;
+        }
+        if (ring->fd == -1) {
+            pcapng_writer_open(ring);
+        }
+        if (ring->fd != -1 && ring->io_uring) {
+            n = pcapng_writer_io_uring(ring, tail, head);
+            if (n) {
+                __atomic_store_n(&ring->tail, tail + n, __ATOMIC_RELEASE);
+                continue;
+            }
+        }
+
+        success = false;
+        if (ring->fd != -1) {
+            success = pcapng_writer_write(ring, buffer->data, buffer->len, ring->offset);
+            if (success) {
+                ring->offset += buffer->len;
+            } else {
+                pcapng_writer_discard(ring);
+            }
+        }
+        pcapng_writer_done(ring, buffer, success);
+        __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
     }
+    return NULL;
 }
 
 /*
- * Quick'n dirty little endian writer.
+ * Hand the current buffer over to the writer thread and
+ * continue with the next one. Returns false if the writer
+ * thread owns all other buffers.
  */
-void
-write_le_uint (u_char *data, uint length, unsigned long long value)
+static bool
+pcapng_handoff (bbl_ctx_s *ctx)
 {
-    uint idx;
+    pcapng_ring_s *ring = ctx->pcap.ring;
+    uint32_t head;
 
-    if (!length || length > 8) {
-	    return;
+    if (!ctx->pcap.write_idx) {
+        return true;
+    }
+    head = ring->head;
+    if (head + 1 - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= ring->count) {
+        return false;
     }
+    ring->buffers[head % ring->count].len = ctx->pcap.write_idx;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
 
-    for (idx = 0; idx < length; idx++) {
-        data[idx] =  value & 0xff;
-        value >>= 8;
+    ctx->pcap.write_buf = ring->buffers[(head + 1) % ring->count].data;
+    ctx->pcap.write_idx = 0;
+    return true;
+}
+
+/*
+ * Check if the packet exceeds the size or interval
+ * of the current file.
+ */
+static bool
+pcapng_rotate_due (bbl_ctx_s *ctx, struct timespec *ts, uint captured_length)
+{
+    pcapng_ring_s *ring = ctx->pcap.ring;
+
+    if (!ring->file_packets) {
+        ring->file_start = *ts;
+        return false;
+    }
+    if (ctx->config.pcap_rotate_size &&
+        ring->header_len + ring->file_bytes + captured_length + PCAPNG_MAX_BLOCK_OVERHEAD > ctx->config.pcap_rotate_size) {
+        return true;
     }
+    if (ctx->config.pcap_rotate_interval &&
+        ts->tv_sec - ring->file_start.tv_sec >= ctx->config.pcap_rotate_interval) {
+        return true;
+    }
+    return false;
 }
 
 /*
- * Push data to the write buffer and update the cursor.
+ * Hand over the current buffer and let the writer
+ * thread start a new file before the next one.
+ */
+static bool
+pcapng_rotate (bbl_ctx_s *ctx)
+{
+    pcapng_ring_s *ring = ctx->pcap.ring;
+
+    if (!pcapng_handoff(ctx)) {
+        return false;
+    }
+    ring->buffers[ring->head % ring->count].rotate = true;
+    ring->file_bytes = 0;
+    ring->file_packets = 0;
+    return true;
+}
+
+/*
+ * Log events reported by the writer thread.
+ */
+static void
+pcapng_log (bbl_ctx_s *ctx)
+{
+    pcapng_ring_s *ring = ctx->pcap.ring;
+    uint32_t opens;
+    int error;
+
+    opens = __atomic_load_n(&ring->opens, __ATOMIC_RELAXED);
+    if (opens != ring->opens_logged) {
+        ring->opens_logged = opens;
+        ring->error_logged = 0;
+        if (ring->files) {
+            LOG(NORMAL, "opened pcap-file %s.%u\n", ctx->pcap.filename,
+                __atomic_load_n(&ring->file_index, __ATOMIC_RELAXED) % ring->files);
+        } else {
+            LOG(NORMAL, "opened pcap-file %s\n", ctx->pcap.filename);
+        }
+    }
+    /* Log repeated errors, like a FIFO without reader, only once. */
+    error = __atomic_exchange_n(&ring->error, 0, __ATOMIC_RELAXED);
+    if (error && error != ring->error_logged) {
+        ring->error_logged = error;
+        LOG(ERROR, "got ERROR %d (%s) when writing pcap-file %s\n",
+            error, strerror(error), ctx->pcap.filename);
+    }
+}
+
+/*
+ * Flush the write buffer if the writer thread is idle. Under
+ * load buffers are handed over when full, which keeps the
+ * number of write system calls low.
  */
 void
-push_le_uint (bbl_ctx_s *ctx, uint length, unsigned long long value)
+pcapng_fflush (bbl_ctx_s *ctx)
 {
-    /*
-     * Buffer overrun protection.
-     */
-    if ((ctx->pcap.write_idx + length) >= PCAPNG_WRITEBUFSIZE) {
+    pcapng_ring_s *ring = ctx->pcap.ring;
+
+    if (!ring) {
 	    return;
     }
 
-    /*
-     * Write the data.
-     */
-    write_le_uint(ctx->pcap.write_buf + ctx->pcap.write_idx, length, value);
+    pcapng_log(ctx);
 
-    /*
-     * Adjust the cursor.
-     */
-    ctx->pcap.write_idx += length;
+    if (!ctx->pcap.write_idx) {
+        return;
+    }
+
+    if (ring->head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) {
+        pcapng_handoff(ctx);
+        LOG(PCAP, "handed over %u bytes buffer to pcap writer\n",
+            ring->buffers[(ring->head - 1) % ring->count].len);
+    }
 }
 
 /*
- * Try to open the file.
+ * Resolve the interface selection and check
+ * if any filter needs to be applied at all.
  */
-void
-pcapng_open (bbl_ctx_s *ctx)
+static void
+pcapng_init_filter (bbl_ctx_s *ctx, pcapng_ring_s *ring)
 {
-    /*
-     * Open the file.
-     */
-    ctx->pcap.fd = open(ctx->pcap.filename, O_WRONLY | O_CREAT | O_TRUNC | O_NONBLOCK, PCAPNG_PERMS);
-    if (ctx->pcap.fd == -1) {
-        switch (errno) {
-            default:
-                LOG(ERROR, "got ERROR %d when opening pcap-file %s\n", errno, ctx->pcap.filename);
-                return;
+    bbl_interface_s *interface;
+    bool found;
+    uint8_t i;
+
+    for (i = 0; i < ctx->config.pcap_interface_count; i++) {
+        found = false;
+        CIRCLEQ_FOREACH(interface, &ctx->interface_qhead, interface_qnode) {
+            if (strcmp(interface->name, ctx->config.pcap_interfaces[i]) == 0) {
+                found = true;
+            }
+        }
+        if (!found) {
+            LOG(ERROR, "pcap interface %s not found\n", ctx->config.pcap_interfaces[i]);
         }
-    } else {
-        LOG(NORMAL, "opened pcap-file %s\n", ctx->pcap.filename);
     }
+    CIRCLEQ_FOREACH(interface, &ctx->interface_qhead, interface_qnode) {
+        interface->pcap_exclude = false;
+        if (ctx->config.pcap_interface_count) {
+            interface->pcap_exclude = true;
+            for (i = 0; i < ctx->config.pcap_interface_count; i++) {
+                if (strcmp(interface->name, ctx->config.pcap_interfaces[i]) == 0) {
+                    interface->pcap_exclude = false;
+                }
+            }
+        }
+    }
+    ctx->pcap.filter = ctx->config.pcap_control_only ||
+                       ctx->config.pcap_interface_count ||
+                       ctx->config.pcap_outer_vlan ||
+                       ctx->config.pcap_inner_vlan ||
+                       ring->sampling > 1;
+    ctx->pcap.sample_count = 0;
 }
 
 /*
- * Initialize a fresh pcap fifo writing context.
+ * Initialize the buffer ring and start the writer thread.
  */
 void
 pcapng_init (bbl_ctx_s *ctx)
 {
+    pcapng_ring_s *ring;
+    uint32_t i;
+
     if (!ctx) {
         return;
     }
 
-    if (!ctx->pcap.filename) {
+    if (!ctx->pcap.filename || ctx->pcap.ring) {
 	    return;
     }
 
-    /*
-     * Write buffer for I/O.
-     */
-    if (!ctx->pcap.write_buf) {
-	    ctx->pcap.write_buf = calloc(1, PCAPNG_WRITEBUFSIZE);
-    } else {
-	    ctx->pcap.write_idx = 0;
+    ring = calloc(1, sizeof(pcapng_ring_s));
+    if (!ring) {
+        LOG(ERROR, "No memory for pcap buffers\n");
+        return;
     }
+    ring->count = ctx->config.pcap_buffers ? ctx->config.pcap_buffers : PCAPNG_BUFFERS;
+    if (ring->count < PCAPNG_BUFFERS_MIN) {
+        ring->count = PCAPNG_BUFFERS_MIN;
+    }
+    ring->buffers = calloc(ring->count, sizeof(pcapng_buffer_s));
+    if (!ring->buffers) {
+        free(ring);
+        LOG(ERROR, "No memory for pcap buffers\n");
+        return;
+    }
+    for (i = 0; i < ring->count; i++) {
+        ring->buffers[i].data = malloc(PCAPNG_WRITEBUFSIZE);
+        if (!ring->buffers[i].data) {
+            LOG(ERROR, "No memory for pcap buffers\n");
+            ctx->pcap.ring = ring;
+            pcapng_free(ctx);
+            return;
+        }
+    }
+    ring->filename = ctx->pcap.filename;
+    ring->fd = -1;
+    ring->uring.fd = -1;
+    if (ctx->config.pcap_io_uring) {
+        if (bbl_io_uring_init(&ring->uring, PCAPNG_IO_URING_ENTRIES)) {
+            LOG(NORMAL, "pcap-file %s written using io_uring\n", ctx->pcap.filename);
+        } else {
+            LOG(ERROR, "io_uring not available, pcap-file %s written synchronously\n", ctx->pcap.filename);
+        }
+    }
+    ring->snaplen = ctx->config.pcap_snaplen ? ctx->config.pcap_snaplen : PCAPNG_SNAPLEN;
+    if (ctx->config.pcap_rotate_size || ctx->config.pcap_rotate_interval) {
+        ring->rotate = true;
+        ring->files = ctx->config.pcap_rotate_files ? ctx->config.pcap_rotate_files : PCAPNG_ROTATE_FILES;
+    }
+    ring->sampling = ctx->config.pcap_sampling ? ctx->config.pcap_sampling : 1;
+    pcapng_init_filter(ctx, ring);
 
-    /*
-     * Open the file.
-     */
-    pcapng_open(ctx);
+    ctx->pcap.ring = ring;
+    ctx->pcap.write_buf = ring->buffers[0].data;
+    ctx->pcap.write_idx = 0;
+    ctx->pcap.wrote_header = false;
+
+    if (pthread_create(&ring->thread, NULL, pcapng_writer_thread, ring) != 0) {
+        LOG(ERROR, "Failed to start pcap writer thread\n");
+        pcapng_free(ctx);
+        return;
+    }
+    ring->thread_running = true;
+}
+
+/*
+ * Write all remaining packets and stop the writer thread.
+ */
+void
+pcapng_close (bbl_ctx_s *ctx)
+{
+    pcapng_ring_s *ring = ctx->pcap.ring;
+    struct timespec idle = { .tv_sec = 0, .tv_nsec = MSEC };
+
+    if (!ring || !ring->thread_running) {
+	    return;
+    }
+
+    while (!pcapng_handoff(ctx)) {
+        nanosleep(&idle, NULL);
+    }
+    __atomic_store_n(&ring->stop, true, __ATOMIC_RELEASE);
+    pthread_join(ring->thread, NULL);
+    ring->thread_running = false;
+    pcapng_writer_close(ring);
+    pcapng_log(ctx);
 }
 
 /*
@@ -213,22 +592,71 @@ pcapng_init (bbl_ctx_s *ctx)
 void
 pcapng_free (bbl_ctx_s *ctx)
 {
+    pcapng_ring_s *ring;
+    uint32_t i;
+
     if (!ctx) {
 	    return;
     }
 
-    pcapng_fflush(ctx);
+    ring = ctx->pcap.ring;
+    if (!ring) {
+        return;
+    }
+    pcapng_close(ctx);
+    bbl_io_uring_free(&ring->uring);
+    for (i = 0; i < ring->count; i++) {
+        free(ring->buffers[i].data);
+    }
+    free(ring->buffers);
+    free(ring);
+    ctx->pcap.ring = NULL;
+    ctx->pcap.write_buf = NULL;
+    ctx->pcap.write_idx = 0;
+}
 
-    if (ctx->pcap.fd != -1) {
-	    close(ctx->pcap.fd);
-	    ctx->pcap.fd = -1;
-	    return;
+void
+pcapng_stdout (bbl_ctx_s *ctx)
+{
+    pcapng_ring_s *ring = ctx->pcap.ring;
+
+    if (!ring) return;
+
+    printf("\nPCAP ( %s ):\n", ctx->pcap.filename);
+    printf("  Captured Packets:  %10lu\n", ring->stats.packets);
+    if (ctx->pcap.filter) {
+        printf("  Filtered Packets:  %10lu\n", ring->stats.packets_filtered);
+    }
+    printf("  Dropped Packets:   %10lu (%u buffers of %u KB)\n", ring->stats.packets_dropped,
+           ring->count, PCAPNG_WRITEBUFSIZE / 1024);
+    printf("  Failed Packets:    %10lu (file not open or write error)\n",
+           __atomic_load_n(&ring->stats.packets_write_failed, __ATOMIC_RELAXED));
+    if (ring->files) {
+        printf("  Files:             %10u (ring of %u)\n", __atomic_load_n(&ring->file_index, __ATOMIC_RELAXED) + 1, ring->files);
     }
+    printf("  Written Bytes:     %10lu (%lu buffers%s)\n", __atomic_load_n(&ring->stats.bytes_written, __ATOMIC_RELAXED),
+           __atomic_load_n(&ring->stats.buffers_written, __ATOMIC_RELAXED), ring->io_uring ? ", io_uring" : "");
+}
 
-    if (ctx->pcap.write_buf) {
-	    free(ctx->pcap.write_buf);
-	    ctx->pcap.write_buf = NULL;
+json_t *
+pcapng_json (bbl_ctx_s *ctx)
+{
+    pcapng_ring_s *ring = ctx->pcap.ring;
+    json_t *jobj;
+
+    jobj = json_object();
+    json_object_set(jobj, "filename", json_string(ctx->pcap.filename));
+    json_object_set(jobj, "buffers", json_integer(ring->count));
+    json_object_set(jobj, "buffer-size", json_integer(PCAPNG_WRITEBUFSIZE));
+    json_object_set(jobj, "packets", json_integer(ring->stats.packets));
+    json_object_set(jobj, "packets-filtered", json_integer(ring->stats.packets_filtered));
+    json_object_set(jobj, "packets-dropped", json_integer(ring->stats.packets_dropped));
+    json_object_set(jobj, "packets-write-failed", json_integer(__atomic_load_n(&ring->stats.packets_write_failed, __ATOMIC_RELAXED)));
+    json_object_set(jobj, "bytes-written", json_integer(__atomic_load_n(&ring->stats.bytes_written, __ATOMIC_RELAXED)));
+    if (ring->files) {
+        json_object_set(jobj, "files", json_integer(__atomic_load_n(&ring->file_index, __ATOMIC_RELAXED) + 1));
     }
+    return jobj;
 }
 
 /*
@@ -300,7 +728,7 @@ pcapng_push_interface_header (bbl_ctx_s *ctx, uint dlt, const char *if_name)
     push_le_uint(ctx, 4, 0); /* block total_length */
     push_le_uint(ctx, 2, dlt); /* link_type */
     push_le_uint(ctx, 2, 0); /* reserved */
-    push_le_uint(ctx, 4, 9*1024); /* snaplen */
+    push_le_uint(ctx, 4, ctx->pcap.ring ? ctx->pcap.ring->snaplen : PCAPNG_SNAPLEN); /* snaplen */
 
     /*
      * Write idb_ifname option
@@ -313,6 +741,17 @@ pcapng_push_interface_header (bbl_ctx_s *ctx, uint dlt, const char *if_name)
     ctx->pcap.write_idx += option_length;
     push_le_uint(ctx, calc_pad(option_length), 0);
 
+    /*
+     * Write if_tsresol option for nanosecond timestamps,
+     * microseconds are the default.
+     */
+    if (ctx->config.pcap_nsec) {
+        push_le_uint(ctx, 2, PCAPNG_IDB_TSRESOL_OPTION); /* option_type */
+        push_le_uint(ctx, 2, 1); /* option_length */
+        push_le_uint(ctx, 1, PCAPNG_TSRESOL_NSEC); /* 10^-9 */
+        push_le_uint(ctx, calc_pad(1), 0);
+    }
+
     /*
      * Calculate total length field. It occurs twice. Overwrite and append.
      */
@@ -322,27 +761,29 @@ pcapng_push_interface_header (bbl_ctx_s *ctx, uint dlt, const char *if_name)
 }
 
 /*
- * Write a pcapng enhanced packet block.
+ * Write the section header block followed
+ * by the list of interfaces.
  */
 void
-pcapng_push_packet_header (bbl_ctx_s *ctx, struct timespec *ts, u_char *data, uint packet_length,
-			   uint ifindex, uint direction)
+pcapng_push_file_header (bbl_ctx_s *ctx)
 {
     bbl_interface_s *interface;
-    uint start_idx, total_length;
-    uint64_t ts_usec;
 
-    if (!ctx->pcap.wrote_header) {
-	    pcapng_push_section_header(ctx);
-
-        /*
-        * Push a list of interfaces.
-        */
-        CIRCLEQ_FOREACH(interface, &ctx->interface_qhead, interface_qnode) {
-            pcapng_push_interface_header(ctx, DLT_EN10MB, interface->name);
-        }
-        ctx->pcap.wrote_header = true;
+    pcapng_push_section_header(ctx);
+    CIRCLEQ_FOREACH(interface, &ctx->interface_qhead, interface_qnode) {
+        pcapng_push_interface_header(ctx, DLT_EN10MB, interface->name);
     }
+}
+
+/*
+ * Write a pcapng enhanced packet block at the cursor.
+ */
+void
+pcapng_push_enhanced_packet_block (bbl_ctx_s *ctx, struct timespec *ts, u_char *data, uint captured_length,
+                                   uint packet_length, uint ifindex, uint direction)
+{
+    uint start_idx, total_length;
+    uint64_t ts_value;
 
     start_idx = ctx->pcap.write_idx;
 
@@ -350,19 +791,23 @@ pcapng_push_packet_header (bbl_ctx_s *ctx, struct timespec *ts, u_char *data, ui
     push_le_uint(ctx, 4, 0); /* block total_length */
     push_le_uint(ctx, 4, ifindex); /* interface_id */
 
-    ts_usec = ts->tv_sec * 1000000 + ts->tv_nsec/1000;
-    push_le_uint(ctx, 4, ts_usec>>32); /* timestamp usec msb */
-    push_le_uint(ctx, 4, ts_usec & 0xffffffff); /* timestamp usec lsb */
+    if (ctx->config.pcap_nsec) {
+        ts_value = ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+    } else {
+        ts_value = ts->tv_sec * 1000000ULL + ts->tv_nsec/1000;
+    }
+    push_le_uint(ctx, 4, ts_value>>32); /* timestamp msb */
+    push_le_uint(ctx, 4, ts_value & 0xffffffff); /* timestamp lsb */
 
-    push_le_uint(ctx, 4, packet_length); /* captured packet length */
+    push_le_uint(ctx, 4, captured_length); /* captured packet length */
     push_le_uint(ctx, 4, packet_length); /* original packet length */
 
     /*
      * Copy packet
      */
-    memcpy(&ctx->pcap.write_buf[ctx->pcap.write_idx], data, packet_length);
-    ctx->pcap.write_idx += packet_length;
-    push_le_uint(ctx, calc_pad(packet_length), 0); /* write pad bytes */
+    memcpy(&ctx->pcap.write_buf[ctx->pcap.write_idx], data, captured_length);
+    ctx->pcap.write_idx += captured_length;
+    push_le_uint(ctx, calc_pad(captured_length), 0); /* write pad bytes */
 
     /*
      * Write epb_flags option for storing packet direction
@@ -377,14 +822,155 @@ pcapng_push_packet_header (bbl_ctx_s *ctx, struct timespec *ts, u_char *data, ui
     total_length = ctx->pcap.write_idx - start_idx + 4;
     write_le_uint(ctx->pcap.write_buf+start_idx+4, 4, total_length); /* block total_length */
     push_le_uint(ctx, 4, total_length); /* block total_length */
+}
 
-    LOG(PCAP, "wrote %u bytes pcap packet data, buffer fill %u/%u\n",
-	    packet_length, ctx->pcap.write_idx, PCAPNG_WRITEBUFSIZE);
+/*
+ * Apply the capture filters before anything is copied.
+ *
+ * The outer VLAN of received frames is stripped by the
+ * kernel and passed as outer_vlan, otherwise (zero) the
+ * VLAN tags are taken from the frame. Returns true if the
+ * packet should be captured.
+ */
+bool
+pcapng_capture (bbl_ctx_s *ctx, bbl_interface_s *interface, u_char *data, uint packet_length, uint16_t outer_vlan)
+{
+    uint16_t inner_vlan = 0;
+    uint16_t type;
+    uint offset;
+
+    if (!ctx->pcap.filter) {
+        return true;
+    }
+
+    if (interface->pcap_exclude) {
+        goto FILTERED;
+    }
+
+    /*
+     * BBL data packets carry the BBL header on the last
+     * 48 bytes, same as checked by the RX fast path.
+     */
+    if (ctx->config.pcap_control_only &&
+        packet_length >= sizeof(struct ether_header) + BBL_HEADER_LEN &&
+        *(uint64_t*)(data + packet_length - BBL_HEADER_LEN) == BBL_MAGIC_NUMBER) {
+        goto FILTERED;
+    }
 
     /*
-     * Buffer about to be overrun ?
+     * Session selection on access interfaces.
      */
-    if (ctx->pcap.write_idx >= (PCAPNG_WRITEBUFSIZE/16)*15) {
-	    pcapng_fflush(ctx);
+    if (interface->access && (ctx->config.pcap_outer_vlan || ctx->config.pcap_inner_vlan)) {
+        offset = ETH_ADDR_LEN * 2;
+        if (packet_length < offset + 6) {
+            goto FILTERED;
+        }
+        type = be16toh(*(uint16_t*)(data + offset));
+        if (type == ETH_TYPE_VLAN || type == ETH_TYPE_QINQ) {
+            if (outer_vlan) {
+                inner_vlan = be16toh(*(uint16_t*)(data + offset + 2)) & ETH_VLAN_ID_MAX;
+            } else {
+                outer_vlan = be16toh(*(uint16_t*)(data + offset + 2)) & ETH_VLAN_ID_MAX;
+                offset += 4;
+                if (packet_length >= offset + 6) {
+                    type = be16toh(*(uint16_t*)(data + offset));
+                    if (type == ETH_TYPE_VLAN) {
+                        inner_vlan = be16toh(*(uint16_t*)(data + offset + 2)) & ETH_VLAN_ID_MAX;
+                    }
+                }
+            }
+        }
+        if (ctx->config.pcap_outer_vlan && ctx->config.pcap_outer_vlan != outer_vlan) {
+            goto FILTERED;
+        }
+        if (ctx->config.pcap_inner_vlan && ctx->config.pcap_inner_vlan != inner_vlan) {
+            goto FILTERED;
+        }
     }
+
+    /*
+     * 1-in-N sampling of the remaining packets.
+     */
+    if (ctx->pcap.ring->sampling > 1) {
+        if (++ctx->pcap.sample_count < ctx->pcap.ring->sampling) {
+            goto FILTERED;
+        }
+        ctx->pcap.sample_count = 0;
+    }
+    return true;
+
+FILTERED:
+    ctx->pcap.ring->stats.packets_filtered++;
+    return false;
+}
+
+/*
+ * Write a pcapng enhanced packet block.
+ */
+void
+pcapng_push_packet_header (bbl_ctx_s *ctx, struct timespec *ts, u_char *data, uint packet_length,
+			   uint ifindex, uint direction)
+{
+    uint captured_length, start_idx;
+
+    if (!ctx->pcap.ring) {
+        return;
+    }
+
+    /*
+     * Truncate to snaplen.
+     */
+    captured_length = packet_length;
+    if (captured_length > ctx->pcap.ring->snaplen) {
+        captured_length = ctx->pcap.ring->snaplen;
+    }
+
+    if (!ctx->pcap.wrote_header) {
+        /*
+         * The headers are kept aside and written by
+         * the writer thread after each open.
+         */
+        pcapng_push_file_header(ctx);
+        if (ctx->pcap.write_idx > PCAPNG_HEADERBUFSIZE) {
+            LOG(ERROR, "pcap headers exceed %u bytes\n", PCAPNG_HEADERBUFSIZE);
+            ctx->pcap.write_idx = PCAPNG_HEADERBUFSIZE;
+        }
+        memcpy(ctx->pcap.ring->header, ctx->pcap.write_buf, ctx->pcap.write_idx);
+        ctx->pcap.ring->header_len = ctx->pcap.write_idx;
+        ctx->pcap.write_idx = 0;
+        ctx->pcap.wrote_header = true;
+    }
+
+    /*
+     * Continue with the next file if size or interval is exceeded.
+     */
+    if (ctx->pcap.ring->rotate && pcapng_rotate_due(ctx, ts, captured_length)) {
+        if (!pcapng_rotate(ctx)) {
+            ctx->pcap.ring->stats.packets_dropped++;
+            return;
+        }
+        ctx->pcap.ring->file_start = *ts;
+    }
+
+    /*
+     * Buffer full? Hand it over to the writer thread
+     * or drop the packet if there is no free buffer.
+     */
+    if (ctx->pcap.write_idx + captured_length + PCAPNG_MAX_BLOCK_OVERHEAD > PCAPNG_WRITEBUFSIZE) {
+        if (!pcapng_handoff(ctx)) {
+            ctx->pcap.ring->stats.packets_dropped++;
+            return;
+        }
+    }
+
+    start_idx = ctx->pcap.write_idx;
+    pcapng_push_enhanced_packet_block(ctx, ts, data, captured_length, packet_length, ifindex, direction);
+    ctx->pcap.ring->file_bytes += ctx->pcap.write_idx - start_idx;
+    ctx->pcap.ring->file_packets++;
+
+    ctx->pcap.ring->buffers[ctx->pcap.ring->head % ctx->pcap.ring->count].packets++;
+    ctx->pcap.ring->stats.packets++;
+
+    LOG(PCAP, "wrote %u bytes pcap packet data, buffer fill %u/%u\n",
+	    captured_length, ctx->pcap.write_idx, PCAPNG_WRITEBUFSIZE);
 }
@@ -10,8 +10,21 @@
 #ifndef __BBL_PCAP_H__
 #define __BBL_PCAP_H__
 
-#define PCAPNG_WRITEBUFSIZE 65536
+#include <pthread.h>
+#include <limits.h>
+#include <jansson.h>
+
+#include "bbl_io_uring.h"
+
+#define PCAPNG_WRITEBUFSIZE 1048576 /* size of each buffer handed over to the writer thread */
+#define PCAPNG_HEADERBUFSIZE 65536
+#define PCAPNG_BUFFERS 16 /* default number of buffers */
+#define PCAPNG_BUFFERS_MIN 2
+#define PCAPNG_IO_URING_ENTRIES 8 /* max writes in flight */
+#define PCAPNG_MAX_BLOCK_OVERHEAD 64 /* enhanced packet block without packet data */
 #define PCAPNG_PERMS 0644
+#define PCAPNG_SNAPLEN 9216 /* default snaplen */
+#define PCAPNG_ROTATE_FILES 10 /* default number of files */
 
 #define PCAPNG_SHB 0x0a0d0d0a
 #define PCAPNG_SHB_USERAPPL_OPTION 4
@@ -19,6 +32,8 @@
 
 #define PCAPNG_IDB 0x00000001
 #define PCAPNG_IDB_IFNAME_OPTION 2
+#define PCAPNG_IDB_TSRESOL_OPTION 9
+#define PCAPNG_TSRESOL_NSEC 9 /* 10^-9 */
 
 #define PCAPNG_EPB 0x00000006
 #define PCAPNG_EPB_FLAGS_OPTION 2
@@ -30,14 +45,88 @@
 #define DLT_EN10MB        1 /* Ethernet (10Mb) */
 #define DLT_NULL          0 /* RAW IP */
 
+/*
+ * Buffer filled by the main thread and written to
+ * file by the writer thread.
+ */
+typedef struct pcapng_buffer_
+{
+    uint8_t *data;
+    uint len;
+    uint packets;
+    bool rotate; /* continue with next file before writing this buffer */
+} pcapng_buffer_s;
+
+/*
+ * Single producer single consumer ring of buffers. Buffer
+ * head % count is filled by the main thread, buffers from
+ * tail up to head are owned by the writer thread. The main
+ * thread only writes head, the writer thread only writes tail.
+ */
+typedef struct pcapng_ring_
+{
+    pcapng_buffer_s *buffers;
+    uint32_t count;
+    uint32_t head;
+    uint32_t tail;
+
+    /* Section and interface headers written after each open. */
+    uint8_t header[PCAPNG_HEADERBUFSIZE];
+    uint header_len;
+
+    uint32_t snaplen;
+    uint32_t sampling;
+
+    /* File rotation, owned by the main thread. */
+    bool rotate;
+    uint64_t file_bytes;
+    uint64_t file_packets;
+    struct timespec file_start;
+
+    /* Owned by the writer thread. */
+    const char *filename;
+    char path[PATH_MAX]; /* current file if rotated */
+    uint32_t file_index;
+    uint32_t files;
+    int fd;
+    uint64_t offset; /* end of the last complete block */
+    bool seekable; /* regular file written at explicit offsets */
+    bool io_uring;
+    bbl_io_uring_s uring;
+
+    pthread_t thread;
+    bool thread_running;
+    bool stop;
+
+    int error; /* last errno of the writer thread, reset by the main thread */
+    int error_logged;
+    uint32_t opens;
+    uint32_t opens_logged;
+
+    struct {
+        uint64_t packets; /* captured */
+        uint64_t packets_filtered; /* not selected by capture filters */
+        uint64_t packets_dropped; /* all buffers busy */
+        uint64_t packets_write_failed; /* file not open or write error */
+        uint64_t bytes_written;
+        uint64_t buffers_written;
+    } stats;
+} pcapng_ring_s;
+
 /*
  * APIs
  */
 void pcapng_init(bbl_ctx_s *);
+void pcapng_close(bbl_ctx_s *);
 void pcapng_free(bbl_ctx_s *);
 void pcapng_push_section_header(bbl_ctx_s *);
 void pcapng_push_interface_header(bbl_ctx_s *, uint, const char *);
+bool pcapng_capture(bbl_ctx_s *, bbl_interface_s *, u_char *, uint, uint16_t);
+void pcapng_push_file_header(bbl_ctx_s *);
+void pcapng_push_enhanced_packet_block(bbl_ctx_s *, struct timespec *, u_char *, uint, uint, uint, uint);
 void pcapng_push_packet_header(bbl_ctx_s *, struct timespec *, u_char *, uint, uint, uint);
 void pcapng_fflush(bbl_ctx_s *);
+void pcapng_stdout(bbl_ctx_s *);
+json_t *pcapng_json(bbl_ctx_s *);
 
 #endif
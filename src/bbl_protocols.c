@@ -7,90 +7,308 @@
  */
 #include "bbl_protocols.h"
 
-uint16_t
-checksum(uint16_t *buf, uint16_t len) {
-         uint32_t sum = 0;
-         uint16_t checksum = 0;
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+/*
+ * CHECKSUM
+ * ------------------------------------------------------------------------
+ *
+ * The one's complement sum is independent of byte order (RFC 1071),
+ * therefore all kernels sum the buffer as native 16 bit words and
+ * return the partial sum folded to 16 bits in network byte order.
+ * The SIMD kernels widen 16 bit words to 32 bit lanes, flushing the
+ * lanes every CHECKSUM_SIMD_BLOCK bytes so that they can't overflow.
+ */
+
+#define CHECKSUM_SIMD_BLOCK 65536
+
+static inline uint32_t
+checksum_fold(uint64_t sum) {
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    return sum;
+}
+
+static inline uint64_t
+checksum_sum_tail(const uint8_t *buf, uint len, uint64_t sum) {
+    uint64_t word64;
+    uint32_t word32;
+    uint16_t word16 = 0;
+
+    while(len >= sizeof(uint64_t)) {
+        memcpy(&word64, buf, sizeof(uint64_t));
+        sum += (word64 & 0xffffffff) + (word64 >> 32);
+        buf += sizeof(uint64_t);
+        len -= sizeof(uint64_t);
+    }
+    if(len >= sizeof(uint32_t)) {
+        memcpy(&word32, buf, sizeof(uint32_t));
+        sum += word32;
+        buf += sizeof(uint32_t);
+        len -= sizeof(uint32_t);
+    }
+    if(len >= sizeof(uint16_t)) {
+        memcpy(&word16, buf, sizeof(uint16_t));
+        sum += word16;
+        buf += sizeof(uint16_t);
+        len -= sizeof(uint16_t);
+    }
+    if(len) {
+        /* Pad last byte with zero */
+        word16 = 0;
+        memcpy(&word16, buf, 1);
+        sum += word16;
+    }
+    return sum;
+}
+
+static uint32_t
+checksum_sum_scalar(const uint8_t *buf, uint len) {
+    return checksum_fold(checksum_sum_tail(buf, len, 0));
+}
+
+#if defined(__x86_64__)
+static uint32_t
+checksum_sum_sse2(const uint8_t *buf, uint len) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i acc_lo, acc_hi;
+    __m128i v;
+    uint32_t lanes[4];
+    uint64_t sum = 0;
+    uint block;
+
+    while(len >= 16) {
+        block = len < CHECKSUM_SIMD_BLOCK ? len : CHECKSUM_SIMD_BLOCK;
+        len -= block & ~15;
+        acc_lo = zero;
+        acc_hi = zero;
+        while(block >= 16) {
+            v = _mm_loadu_si128((const __m128i*)buf);
+            acc_lo = _mm_add_epi32(acc_lo, _mm_unpacklo_epi16(v, zero));
+            acc_hi = _mm_add_epi32(acc_hi, _mm_unpackhi_epi16(v, zero));
+            buf += 16;
+            block -= 16;
+        }
+        _mm_storeu_si128((__m128i*)lanes, _mm_add_epi32(acc_lo, acc_hi));
+        sum += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+    return checksum_fold(checksum_sum_tail(buf, len, sum));
+}
+
+__attribute__((target("avx2")))
+static uint32_t
+checksum_sum_avx2(const uint8_t *buf, uint len) {
+    __m256i zero = _mm256_setzero_si256();
+    __m256i acc_lo, acc_hi;
+    __m256i v;
+    uint32_t lanes[8];
+    uint64_t sum = 0;
+    uint block;
+    int i;
 
-    while (len > 1) {
-        sum += *buf++;
-        len -= 2;
+    while(len >= 32) {
+        block = len < CHECKSUM_SIMD_BLOCK ? len : CHECKSUM_SIMD_BLOCK;
+        len -= block & ~31;
+        acc_lo = zero;
+        acc_hi = zero;
+        while(block >= 32) {
+            v = _mm256_loadu_si256((const __m256i*)buf);
+            acc_lo = _mm256_add_epi32(acc_lo, _mm256_unpacklo_epi16(v, zero));
+            acc_hi = _mm256_add_epi32(acc_hi, _mm256_unpackhi_epi16(v, zero));
+            buf += 32;
+            block -= 32;
+        }
+        _mm256_storeu_si256((__m256i*)lanes, _mm256_add_epi32(acc_lo, acc_hi));
+        for(i = 0; i < 8; i++) {
+            sum += lanes[i];
+        }
+    }
+    return checksum_fold(checksum_sum_tail(buf, len, sum));
+}
+#endif
+
+bool
+checksum_kernel_supported(checksum_kernel_t kernel) {
+    switch(kernel) {
+        case CHECKSUM_KERNEL_SCALAR:
+            return true;
+#if defined(__x86_64__)
+        case CHECKSUM_KERNEL_SSE2:
+            return true;
+        case CHECKSUM_KERNEL_AVX2:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2");
+#endif
+        default:
+            return false;
+    }
+}
+
+const char *
+checksum_kernel_name(checksum_kernel_t kernel) {
+    switch(kernel) {
+        case CHECKSUM_KERNEL_SCALAR: return "scalar";
+        case CHECKSUM_KERNEL_SSE2: return "sse2";
+        case CHECKSUM_KERNEL_AVX2: return "avx2";
+        default: return "unknown";
+    }
+}
+
+/*
+ * checksum_sum_kernel
+ *
+ * Returns the folded partial sum calculated with the
+ * given kernel or with the scalar kernel if the
+ * requested one is not supported.
+ */
+uint32_t
+checksum_sum_kernel(checksum_kernel_t kernel, const uint8_t *buf, uint len) {
+    if(!checksum_kernel_supported(kernel)) {
+        return checksum_sum_scalar(buf, len);
+    }
+    switch(kernel) {
+#if defined(__x86_64__)
+        case CHECKSUM_KERNEL_SSE2:
+            return checksum_sum_sse2(buf, len);
+        case CHECKSUM_KERNEL_AVX2:
+            return checksum_sum_avx2(buf, len);
+#endif
+        default:
+            return checksum_sum_scalar(buf, len);
     }
-    /* If any bytes left, pad the bytes and add */
-    if(len > 0) {
-        sum += ((*buf) & htobe16(0xFF00));
+}
+
+static uint32_t checksum_sum_resolve(const uint8_t *buf, uint len);
+static uint32_t (*checksum_sum_fn)(const uint8_t *buf, uint len) = checksum_sum_resolve;
+static checksum_kernel_t checksum_sum_selected = CHECKSUM_KERNEL_SCALAR;
+
+/* Select the best supported kernel with the first call. */
+static uint32_t
+checksum_sum_resolve(const uint8_t *buf, uint len) {
+#if defined(__x86_64__)
+    if(checksum_kernel_supported(CHECKSUM_KERNEL_AVX2)) {
+        checksum_sum_selected = CHECKSUM_KERNEL_AVX2;
+        checksum_sum_fn = checksum_sum_avx2;
+    } else {
+        checksum_sum_selected = CHECKSUM_KERNEL_SSE2;
+        checksum_sum_fn = checksum_sum_sse2;
     }
-    /* Fold sum to 16 bits: add carrier to result */
-    while (sum>>16) {
-        sum = (sum & 0xffff) + (sum >> 16);
+#else
+    checksum_sum_fn = checksum_sum_scalar;
+#endif
+    return checksum_sum_fn(buf, len);
+}
+
+checksum_kernel_t
+checksum_kernel(void) {
+    if(checksum_sum_fn == checksum_sum_resolve) {
+        checksum_sum_resolve(NULL, 0);
     }
-    /* Calculate one's complement */
-    checksum = ~sum;
-    return checksum;
+    return checksum_sum_selected;
+}
+
+/*
+ * checksum_sum
+ *
+ * Returns the folded partial one's complement sum
+ * of buf in network byte order.
+ */
+uint32_t
+checksum_sum(const uint8_t *buf, uint len) {
+    return checksum_sum_fn(buf, len);
+}
+
+uint16_t
+checksum(uint16_t *buf, uint16_t len) {
+    return ~checksum_sum((const uint8_t*)buf, len);
 }
 
 uint16_t
 bbl_ipv6_checksum(ipv6addr_t src, ipv6addr_t dst, uint8_t nh, uint8_t *buf, uint16_t len) {
 
-    int i;
-    uint32_t checksum = 0;
-    uint16_t word16;
-    bool padding = false;
+    uint64_t sum;
+    uint16_t offset;
 
     /* The following block ensures that checksum field is ignored */
     switch(nh) {
         case IPV6_NEXT_HEADER_UDP:
-            word16 = ((buf[0]<<8)&0xFF00) + (buf[1]&0xFF); checksum += word16;
-            word16 = ((buf[2]<<8)&0xFF00) + (buf[3]&0xFF); checksum += word16;
-            word16 = ((buf[4]<<8)&0xFF00) + (buf[5]&0xFF); checksum += word16;
-            i = 8;
+            offset = 6;
             break;
         case IPV6_NEXT_HEADER_ICMPV6:
-            word16 = ((buf[0]<<8)&0xFF00) + (buf[1]&0xFF); checksum += word16;
-            i = 4;
+            offset = 2;
             break;
         default:
-            i = 0;
+            offset = len;
             break;
     }
-    if (len % 2) {
-        padding = true;
-        len--;
-    }
-    /* Make 16 bit words out of every two adjacent 8 bit words and
-     * calculate the sum of all 16 bit words */
-    for (; i < len; i = i+2) {
-        word16 = ((buf[i]<<8)&0xFF00) + (buf[i+1]&0xFF);
-        checksum += word16;
+    if(offset > len) {
+        offset = len;
     }
-    if(padding) {
-        word16 = (buf[len]<<8)&0xFF00;
-        checksum += word16;
-        len++;
+    sum = checksum_sum(buf, offset);
+    if(offset + 2 < len) {
+        sum += checksum_sum(buf + offset + 2, len - offset - 2);
     }
 
-    /* Add the IPv6 pseudo header which contains the
-     * source and destinations addresses */
-    for (i = 0; i < IPV6_ADDR_LEN; i = i+2) {
-        word16 =((src[i]<<8)) + (src[i+1]);
-        checksum += word16;
-    }
-    for (i = 0; i<IPV6_ADDR_LEN; i = i+2) {
-        word16 = ((dst[i]<<8)) + (dst[i+1]);
-        checksum += word16;
-    }
+    /* Add the IPv6 pseudo header which contains the source and
+     * destinations addresses, the protocol number and the length */
+    sum += checksum_sum(src, IPV6_ADDR_LEN);
+    sum += checksum_sum(dst, IPV6_ADDR_LEN);
+    sum += htobe16(nh);
+    sum += htobe16(len);
 
-    /* Add the protocol number and the length of the UDP packet */
-    checksum += nh + len;
+    /* Take the one's complement of checksum */
+    return be16toh(~checksum_fold(sum));
+}
 
-    /* Keep only the last 16 bits of the 32 bit calculated sum and add the carries */
-    while (checksum >> 16)
-        checksum = (checksum & 0xffff) + (checksum >> 16);
+uint16_t
+bbl_ipv4_udp_checksum(uint32_t src, uint32_t dst, uint8_t *buf, uint16_t len) {
 
-    /* Take the one's complement of checksum */
-    checksum = ~checksum;
+    uint64_t sum;
 
-    return (uint16_t)checksum;
+    sum = checksum_sum(buf, len);
+    sum += checksum_sum((uint8_t*)&src, sizeof(uint32_t));
+    sum += checksum_sum((uint8_t*)&dst, sizeof(uint32_t));
+    sum += htobe16(PROTOCOL_IPV4_UDP);
+    sum += htobe16(len);
+    return be16toh(~checksum_fold(sum));
+}
+
+/*
+ * bbl_checksum_update_bbl
+ *
+ * Write sequence number and timestamp into the last 16 bytes
+ * of a BBL packet copied from a template and update the UDP
+ * checksum incrementally as described in RFC 1624
+ * (HC' = ~(~HC + ~m + m')). The templates are encoded with
+ * zero sequence and timestamp, so ~m is zero. A zero UDP
+ * checksum means no checksum (IPv4) and is left untouched.
+ */
+void
+bbl_checksum_update_bbl(uint8_t *buf, uint len, uint64_t seq, struct timespec *timestamp) {
+
+    uint16_t *udp_checksum = (uint16_t*)(buf + (len - BBL_HEADER_LEN - 2));
+    uint32_t sec = timestamp->tv_sec;
+    uint32_t nsec = timestamp->tv_nsec;
+    uint64_t sum;
+    uint16_t csum;
+
+    *(uint64_t*)(buf + (len - 16)) = seq;
+    *(uint32_t*)(buf + (len - 8)) = sec;
+    *(uint32_t*)(buf + (len - 4)) = nsec;
+
+    if(*udp_checksum) {
+        /* The sum of the native 32 bit halves folds
+         * to the sum of the 16 bit words written above. */
+        sum = (uint16_t)~*udp_checksum;
+        sum += (seq & 0xffffffff) + (seq >> 32) + sec + nsec;
+        csum = ~(uint16_t)checksum_fold(sum);
+        *udp_checksum = csum ? csum : 0xffff;
+    }
 }
 
 uint16_t
@@ -277,6 +495,33 @@ encode_icmpv6(uint8_t *buf, uint *len,
                 *(uint32_t*)buf = 0;
                 BUMP_WRITE_BUFFER(buf, len, sizeof(uint32_t));
                 break;
+            case IPV6_ICMPV6_ROUTER_ADVERTISEMENT:
+                *buf = 64; // hop limit
+                *(buf+1) = icmp->other ? ICMPV6_FLAGS_OTHER_CONFIG : 0;
+                *(uint16_t*)(buf+2) = htobe16(1800); // router lifetime
+                BUMP_WRITE_BUFFER(buf, len, sizeof(uint32_t));
+                *(uint64_t*)buf = 0; // reachable and retrans timer
+                BUMP_WRITE_BUFFER(buf, len, sizeof(uint64_t));
+                if(icmp->prefix.len) {
+                    *buf = ICMPV6_OPTION_PREFIX;
+                    *(buf+1) = 4;
+                    *(buf+2) = icmp->prefix.len;
+                    *(buf+3) = 0xc0; // on-link and autonomous
+                    *(uint32_t*)(buf+4) = 0xffffffff; // valid lifetime
+                    *(uint32_t*)(buf+8) = 0xffffffff; // preferred lifetime
+                    *(uint32_t*)(buf+12) = 0;
+                    memcpy(buf+16, icmp->prefix.address, IPV6_ADDR_LEN);
+                    BUMP_WRITE_BUFFER(buf, len, 32);
+                }
+                if(icmp->mac) {
+                    *(uint8_t*)buf = 1; // source link-layer address
+                    BUMP_WRITE_BUFFER(buf, len, sizeof(uint8_t));
+                    *(uint8_t*)buf = 1;
+                    BUMP_WRITE_BUFFER(buf, len, sizeof(uint8_t));
+                    memcpy(buf, icmp->mac, ETH_ADDR_LEN);
+                    BUMP_WRITE_BUFFER(buf, len, ETH_ADDR_LEN);
+                }
+                break;
             case IPV6_ICMPV6_NEIGHBOR_SOLICITATION:
                 *(uint32_t*)buf = 0;
                 BUMP_WRITE_BUFFER(buf, len, sizeof(uint32_t));
@@ -492,10 +737,9 @@ encode_ipv6(uint8_t *buf, uint *len,
             result = encode_udp(buf, len, (bbl_udp_t*)ipv6->next);
             ipv6_len = *len - ipv6_len;
             *(uint16_t*)(buf + 4) = htobe16(ipv6_len); // update UDP length
-            if(((bbl_udp_t*)ipv6->next)->protocol != UDP_PROTOCOL_BBL) {
-                checksum = bbl_ipv6_udp_checksum(ipv6->src, ipv6->dst, buf, ipv6_len);
-                *(uint16_t*)(buf + 6) = htobe16(checksum); // update UDP checksum
-            }
+            checksum = bbl_ipv6_udp_checksum(ipv6->src, ipv6->dst, buf, ipv6_len);
+            if(!checksum) checksum = 0xffff;
+            *(uint16_t*)(buf + 6) = htobe16(checksum); // update UDP checksum
             break;
         default:
             ipv6_len = 0;
@@ -518,6 +762,7 @@ encode_ipv4(uint8_t *buf, uint *len,
     uint8_t *start = buf;
     uint16_t ipv4_len = *len;
     uint16_t udp_len = *len;
+    uint16_t udp_checksum;
     uint8_t header_len = 5; // header length 20 (4 * 5)
 
     if(ipv4->router_alert_option) {
@@ -574,7 +819,13 @@ encode_ipv4(uint8_t *buf, uint *len,
         case PROTOCOL_IPV4_UDP:
             udp_len = *len;
             result = encode_udp(buf, len, (bbl_udp_t*)ipv4->next);
-            *(uint16_t*)(buf + 4) = htobe16(*len - udp_len); // update UDP length
+            udp_len = *len - udp_len;
+            *(uint16_t*)(buf + 4) = htobe16(udp_len); // update UDP length
+            if(((bbl_udp_t*)ipv4->next)->checksum) {
+                udp_checksum = bbl_ipv4_udp_checksum(ipv4->src, ipv4->dst, buf, udp_len);
+                if(!udp_checksum) udp_checksum = 0xffff;
+                *(uint16_t*)(buf + 6) = htobe16(udp_checksum); // update UDP checksum
+            }
             break;
         default:
             result = PROTOCOL_SUCCESS;
@@ -599,7 +850,17 @@ encode_ppp_pap(uint8_t *buf, uint *len,
     BUMP_WRITE_BUFFER(buf, len, sizeof(uint8_t));
     *buf = pap->identifier;
     BUMP_WRITE_BUFFER(buf, len, sizeof(uint8_t));
-    *buf = 6 + pap->username_len + pap->password_len;
+    if(pap->code != PAP_CODE_REQUEST) {
+        /* Authenticate-Ack/Nak carry the message in the username field */
+        *(uint16_t*)buf = htobe16(5 + pap->username_len);
+        BUMP_WRITE_BUFFER(buf, len, sizeof(uint16_t));
+        *buf = pap->username_len;
+        BUMP_WRITE_BUFFER(buf, len, sizeof(uint8_t));
+        memcpy(buf, pap->username, pap->username_len);
+        BUMP_WRITE_BUFFER(buf, len, pap->username_len);
+        return PROTOCOL_SUCCESS;
+    }
+    *(uint16_t*)buf = htobe16(6 + pap->username_len + pap->password_len);
     BUMP_WRITE_BUFFER(buf, len, sizeof(uint16_t));
     *buf = pap->username_len;
     BUMP_WRITE_BUFFER(buf, len, sizeof(uint8_t));
@@ -623,6 +884,14 @@ encode_ppp_chap(uint8_t *buf, uint *len,
     BUMP_WRITE_BUFFER(buf, len, sizeof(uint8_t));
     *buf = chap->identifier;
     BUMP_WRITE_BUFFER(buf, len, sizeof(uint8_t));
+    if(chap->code == CHAP_CODE_SUCCESS || chap->code == CHAP_CODE_FAILURE) {
+        /* Success/Failure carry the message in the name field */
+        *(uint16_t*)buf = htobe16(4 + chap->name_len);
+        BUMP_WRITE_BUFFER(buf, len, sizeof(uint16_t));
+        memcpy(buf, chap->name, chap->name_len);
+        BUMP_WRITE_BUFFER(buf, len, chap->name_len);
+        return PROTOCOL_SUCCESS;
+    }
     *(uint16_t*)buf = htobe16(chap_len);
     BUMP_WRITE_BUFFER(buf, len, sizeof(uint16_t));
     *buf = chap->challenge_len;
@@ -1010,6 +1279,202 @@ encode_ethernet(uint8_t *buf, uint *len,
     }
 }
 
+/*
+ * FAST ENCODE
+ * ------------------------------------------------------------------------
+ *
+ * Specialized encoders for the high volume control packets (LCP echo,
+ * ARP and IGMP) which are sent periodically for all sessions. The generic
+ * encoders above walk the protocol stack with a branch per header field.
+ * The functions below are inlined per VLAN depth, so that each of the
+ * resulting variants writes a fixed size header followed by the few
+ * fields which actually change between packets.
+ */
+
+#define ETH_VLAN_DEPTH(_eth) \
+    ((_eth)->vlan_outer ? ((_eth)->vlan_inner ? ((_eth)->vlan_three ? 3 : 2) : 1) : 0)
+
+static inline __attribute__((always_inline)) uint8_t *
+encode_ethernet_fast_header(uint8_t *buf, bbl_ethernet_header_t *eth, const uint8_t vlans) {
+    if(eth->dst) {
+        memcpy(buf, eth->dst, ETH_ADDR_LEN);
+    } else {
+        memset(buf, 0xff, ETH_ADDR_LEN);
+    }
+    memcpy(buf+ETH_ADDR_LEN, eth->src, ETH_ADDR_LEN);
+    buf += ETH_ADDR_LEN * 2;
+    if(vlans > 0) {
+        *(uint16_t*)buf = htobe16(ETH_TYPE_VLAN);
+        *(uint16_t*)(buf+2) = htobe16(eth->vlan_outer);
+        buf += 4;
+    }
+    if(vlans > 1) {
+        *(uint16_t*)buf = htobe16(ETH_TYPE_VLAN);
+        *(uint16_t*)(buf+2) = htobe16(eth->vlan_inner);
+        buf += 4;
+    }
+    if(vlans > 2) {
+        *(uint16_t*)buf = htobe16(ETH_TYPE_VLAN);
+        *(uint16_t*)(buf+2) = htobe16(eth->vlan_three);
+        buf += 4;
+    }
+    *(uint16_t*)buf = htobe16(eth->type);
+    return buf + sizeof(uint16_t);
+}
+
+static inline __attribute__((always_inline)) uint8_t *
+encode_pppoe_session_fast_header(uint8_t *buf, uint16_t session_id, uint16_t protocol, uint16_t ppp_len) {
+    /* Version and type 1, code 0 */
+    *(uint16_t*)buf = htobe16(0x1100);
+    *(uint16_t*)(buf+2) = htobe16(session_id);
+    *(uint16_t*)(buf+4) = htobe16(ppp_len + 2);
+    *(uint16_t*)(buf+6) = htobe16(protocol);
+    return buf + 8;
+}
+
+static inline __attribute__((always_inline)) protocol_error_t
+encode_lcp_echo_fast(uint8_t *buf, uint *len,
+                     bbl_ethernet_header_t *eth, const uint8_t vlans) {
+    bbl_pppoe_session_t *pppoe = (bbl_pppoe_session_t*)eth->next;
+    bbl_lcp_t *lcp = (bbl_lcp_t*)pppoe->next;
+    uint8_t *start = buf;
+
+    buf = encode_ethernet_fast_header(buf, eth, vlans);
+    buf = encode_pppoe_session_fast_header(buf, pppoe->session_id, PROTOCOL_LCP, 8);
+    *buf = lcp->code;
+    *(buf+1) = lcp->identifier;
+    *(uint16_t*)(buf+2) = htobe16(8);
+    *(uint32_t*)(buf+4) = lcp->magic;
+    *len += (buf - start) + 8;
+    return PROTOCOL_SUCCESS;
+}
+
+static inline __attribute__((always_inline)) protocol_error_t
+encode_arp_fast(uint8_t *buf, uint *len,
+                bbl_ethernet_header_t *eth, const uint8_t vlans) {
+    bbl_arp_t *arp = (bbl_arp_t*)eth->next;
+    uint8_t *start = buf;
+
+    buf = encode_ethernet_fast_header(buf, eth, vlans);
+    /* Hardware type ethernet, protocol type IPv4,
+     * hardware size 6 and protocol size 4 */
+    *(uint16_t*)buf = htobe16(0x0001);
+    *(uint16_t*)(buf+2) = htobe16(ETH_TYPE_IPV4);
+    *(uint16_t*)(buf+4) = htobe16(0x0604);
+    *(uint16_t*)(buf+6) = htobe16(arp->code);
+    if(arp->sender) {
+        memcpy(buf+8, arp->sender, ETH_ADDR_LEN);
+    } else {
+        memset(buf+8, 0x0, ETH_ADDR_LEN);
+    }
+    *(uint32_t*)(buf+14) = arp->sender_ip;
+    if(arp->target) {
+        memcpy(buf+18, arp->target, ETH_ADDR_LEN);
+    } else {
+        memset(buf+18, 0x0, ETH_ADDR_LEN);
+    }
+    *(uint32_t*)(buf+24) = arp->target_ip;
+    *len += (buf - start) + 28;
+    return PROTOCOL_SUCCESS;
+}
+
+/*
+ * The IPv4 header for IGMP is fixed to 24 bytes
+ * including the router alert option.
+ */
+static inline __attribute__((always_inline)) protocol_error_t
+encode_igmp_fast(uint8_t *buf, uint *len,
+                 bbl_ethernet_header_t *eth, bbl_pppoe_session_t *pppoe,
+                 bbl_ipv4_t *ipv4, const uint8_t vlans) {
+    protocol_error_t result;
+    uint8_t *start = buf;
+    uint8_t *ip;
+    uint igmp_len = 0;
+
+    buf = encode_ethernet_fast_header(buf, eth, vlans);
+    if(pppoe) {
+        /* PPPoE length is updated after the IGMP payload is known */
+        buf = encode_pppoe_session_fast_header(buf, pppoe->session_id, PROTOCOL_IPV4, 0);
+    }
+    ip = buf;
+    *(uint16_t*)ip = htobe16(0x4600 | ipv4->tos);
+    *(uint32_t*)(ip+4) = 0;
+    *(ip+8) = ipv4->ttl;
+    *(ip+9) = PROTOCOL_IPV4_IGMP;
+    *(uint16_t*)(ip+10) = 0;
+    *(uint32_t*)(ip+12) = ipv4->src;
+    *(uint32_t*)(ip+16) = ipv4->dst;
+    *(uint32_t*)(ip+20) = htobe32(0x94040000);
+
+    result = encode_igmp(ip+24, &igmp_len, (bbl_igmp_t*)ipv4->next);
+    *(uint16_t*)(ip+2) = htobe16(igmp_len + 24);
+    *(uint16_t*)(ip+10) = checksum((uint16_t*)ip, 24);
+    if(pppoe) {
+        *(uint16_t*)(ip-4) = htobe16(igmp_len + 24 + 2);
+    }
+    *len += (ip - start) + 24 + igmp_len;
+    return result;
+}
+
+static inline __attribute__((always_inline)) protocol_error_t
+encode_ethernet_fast_vlans(uint8_t *buf, uint *len,
+                           bbl_ethernet_header_t *eth, const uint8_t vlans) {
+    bbl_pppoe_session_t *pppoe;
+    bbl_ipv4_t *ipv4;
+    bbl_lcp_t *lcp;
+
+    switch(eth->type) {
+        case ETH_TYPE_PPPOE_SESSION:
+            pppoe = (bbl_pppoe_session_t*)eth->next;
+            if(pppoe->protocol == PROTOCOL_LCP) {
+                lcp = (bbl_lcp_t*)pppoe->next;
+                if(lcp->code == PPP_CODE_ECHO_REQUEST || lcp->code == PPP_CODE_ECHO_REPLY) {
+                    return encode_lcp_echo_fast(buf, len, eth, vlans);
+                }
+            } else if(pppoe->protocol == PROTOCOL_IPV4) {
+                ipv4 = (bbl_ipv4_t*)pppoe->next;
+                if(ipv4->protocol == PROTOCOL_IPV4_IGMP && ipv4->router_alert_option) {
+                    return encode_igmp_fast(buf, len, eth, pppoe, ipv4, vlans);
+                }
+            }
+            break;
+        case ETH_TYPE_IPV4:
+            ipv4 = (bbl_ipv4_t*)eth->next;
+            if(ipv4->protocol == PROTOCOL_IPV4_IGMP && ipv4->router_alert_option) {
+                return encode_igmp_fast(buf, len, eth, NULL, ipv4, vlans);
+            }
+            break;
+        case ETH_TYPE_ARP:
+            return encode_arp_fast(buf, len, eth, vlans);
+        default:
+            break;
+    }
+    /* Fallback to generic encoder for all other packets */
+    return encode_ethernet(buf, len, eth);
+}
+
+/*
+ * encode_ethernet_fast
+ *
+ * Same result as encode_ethernet but with specialized encoders
+ * for LCP echo request/reply, ARP and IGMP.
+ */
+protocol_error_t
+encode_ethernet_fast(uint8_t *buf, uint *len,
+                     bbl_ethernet_header_t *eth) {
+
+    switch(ETH_VLAN_DEPTH(eth)) {
+        case 0:
+            return encode_ethernet_fast_vlans(buf, len, eth, 0);
+        case 1:
+            return encode_ethernet_fast_vlans(buf, len, eth, 1);
+        case 2:
+            return encode_ethernet_fast_vlans(buf, len, eth, 2);
+        default:
+            return encode_ethernet_fast_vlans(buf, len, eth, 3);
+    }
+}
+
 /*
  * DECODE
  * ------------------------------------------------------------------------*/
@@ -1503,6 +1968,7 @@ decode_ppp_pap(uint8_t *buf, uint len,
     memset(pap, 0x0, sizeof(bbl_pap_t));
 
     pap->code = *buf;
+    pap->identifier = *(buf+1);
 
     *ppp_pap = pap;
     return PROTOCOL_SUCCESS;
@@ -1975,6 +2441,217 @@ decode_arp(uint8_t *buf, uint len,
     return PROTOCOL_SUCCESS;
 }
 
+static protocol_error_t
+parse_ip(uint8_t *buf, uint len, uint offset, uint l3_len,
+         bbl_parse_t *parse) {
+
+    const struct ip* header;
+    uint16_t header_len;
+
+    if(parse->l3_type == ETH_TYPE_IPV4) {
+        if(l3_len < 20) {
+            return DECODE_ERROR;
+        }
+        header = (struct ip*)(buf + offset);
+        header_len = header->ip_hl * 4;
+        if(header->ip_v != 4 || header_len < 20 ||
+           header_len > be16toh(header->ip_len) ||
+           be16toh(header->ip_len) > l3_len) {
+            return DECODE_ERROR;
+        }
+        parse->ip_protocol = header->ip_p;
+        parse->l4_len = be16toh(header->ip_len) - header_len;
+    } else {
+        if(l3_len < 40) {
+            return DECODE_ERROR;
+        }
+        header_len = 40;
+        parse->ip_protocol = *(buf + offset + 6);
+        parse->l4_len = be16toh(*(uint16_t*)(buf + offset + 4));
+        if(parse->l4_len + header_len > l3_len) {
+            return DECODE_ERROR;
+        }
+    }
+    offset += header_len;
+    parse->l4_offset = offset;
+
+    if(parse->ip_protocol == PROTOCOL_IPV4_UDP) { /* same for IPv6 */
+        if(parse->l4_len < 8 || offset + 8 > len) {
+            return DECODE_ERROR;
+        }
+        parse->src_port = be16toh(*(uint16_t*)(buf + offset));
+        parse->dst_port = be16toh(*(uint16_t*)(buf + offset + 2));
+        parse->payload_offset = offset + 8;
+    }
+    return PROTOCOL_SUCCESS;
+}
+
+/*
+ * parse_ethernet
+ *
+ * Single pass over all headers up to UDP without using
+ * the scratchpad, see bbl_parse_t.
+ */
+protocol_error_t
+parse_ethernet(uint8_t *buf, uint len,
+               bbl_parse_t *parse) {
+
+    uint offset = sizeof(struct ether_header);
+    uint pppoe_len;
+    uint16_t type;
+
+    memset(parse, 0x0, sizeof(bbl_parse_t));
+    if(len < sizeof(struct ether_header) || len > UINT16_MAX) {
+        return DECODE_ERROR;
+    }
+    parse->len = len;
+    type = be16toh(*(uint16_t*)(buf + 12));
+
+    /* Nested like decode_ethernet, a loop over the
+     * VLAN tags is significantly slower. */
+    if(type == ETH_TYPE_VLAN || type == ETH_TYPE_QINQ) {
+        if(offset + 4 > len) {
+            return DECODE_ERROR;
+        }
+        parse->vlan_outer = be16toh(*(uint16_t*)(buf + offset)) & ETH_VLAN_ID_MAX;
+        type = be16toh(*(uint16_t*)(buf + offset + 2));
+        offset += 4;
+        if(type == ETH_TYPE_VLAN || type == ETH_TYPE_QINQ) {
+            if(offset + 4 > len) {
+                return DECODE_ERROR;
+            }
+            parse->vlan_inner = be16toh(*(uint16_t*)(buf + offset)) & ETH_VLAN_ID_MAX;
+            type = be16toh(*(uint16_t*)(buf + offset + 2));
+            offset += 4;
+            if(type == ETH_TYPE_VLAN || type == ETH_TYPE_QINQ) {
+                if(offset + 4 > len) {
+                    return DECODE_ERROR;
+                }
+                parse->vlan_three = be16toh(*(uint16_t*)(buf + offset)) & ETH_VLAN_ID_MAX;
+                type = be16toh(*(uint16_t*)(buf + offset + 2));
+                offset += 4;
+            }
+        }
+    }
+    parse->eth_type = type;
+    parse->l3_offset = offset;
+
+    switch(type) {
+        case ETH_TYPE_PPPOE_SESSION:
+            if(offset + 8 > len || *(buf + offset) != 17) {
+                return DECODE_ERROR;
+            }
+            pppoe_len = be16toh(*(uint16_t*)(buf + offset + 4));
+            parse->ppp_protocol = be16toh(*(uint16_t*)(buf + offset + 6));
+            offset += 8;
+            if(pppoe_len < 2 || pppoe_len - 2 > len - offset) {
+                return DECODE_ERROR;
+            }
+            if(parse->ppp_protocol == PROTOCOL_IPV4) {
+                parse->l3_type = ETH_TYPE_IPV4;
+            } else if(parse->ppp_protocol == PROTOCOL_IPV6) {
+                parse->l3_type = ETH_TYPE_IPV6;
+            } else {
+                /* PPP control protocols */
+                return PROTOCOL_SUCCESS;
+            }
+            return parse_ip(buf, len, offset, pppoe_len - 2, parse);
+        case ETH_TYPE_IPV4:
+        case ETH_TYPE_IPV6:
+            parse->l3_type = type;
+            return parse_ip(buf, len, offset, len - offset, parse);
+        case ETH_TYPE_PPPOE_DISCOVERY:
+        case ETH_TYPE_ARP:
+            return PROTOCOL_SUCCESS;
+        default:
+            return UNKNOWN_PROTOCOL;
+    }
+}
+
+/*
+ * Decode the payload after the Ethernet and VLAN headers.
+ */
+static protocol_error_t
+decode_ethernet_payload(uint8_t *buf, uint len,
+                        uint8_t *sp, uint sp_len,
+                        bbl_ethernet_header_t *eth) {
+
+    if(eth->type == ETH_TYPE_PPPOE_SESSION) {
+        return decode_pppoe_session(buf, len, sp, sp_len, (bbl_pppoe_session_t**)&eth->next);
+    } else if(eth->type == ETH_TYPE_PPPOE_DISCOVERY) {
+        return decode_pppoe_discovery(buf, len, sp, sp_len, (bbl_pppoe_discovery_t**)&eth->next);
+    } else if(eth->type == ETH_TYPE_ARP) {
+        return decode_arp(buf, len, sp, sp_len, (bbl_arp_t**)&eth->next);
+    } else if(eth->type == ETH_TYPE_IPV4) {
+        return decode_ipv4(buf, len, sp, sp_len, (bbl_ipv4_t**)&eth->next);
+    } else if(eth->type == ETH_TYPE_IPV6) {
+        return decode_ipv6(buf, len, sp, sp_len, (bbl_ipv6_t**)&eth->next);
+    }
+
+    return UNKNOWN_PROTOCOL;
+}
+
+/*
+ * decode_ethernet_parsed
+ *
+ * Decode a frame already parsed by parse_ethernet, starting
+ * at the L3 header without walking the Ethernet and VLAN
+ * headers again.
+ */
+protocol_error_t
+decode_ethernet_parsed(uint8_t *buf, uint len,
+                       uint8_t *sp, uint sp_len,
+                       bbl_parse_t *parse,
+                       bbl_ethernet_header_t **ethernet) {
+
+    bbl_ethernet_header_t *eth;
+    const struct ether_header *header;
+
+    if(len != parse->len || sp_len < sizeof(bbl_ethernet_header_t)) {
+        return DECODE_ERROR;
+    }
+
+    /* Init ethernet header */
+    eth = (bbl_ethernet_header_t*)sp; BUMP_BUFFER(sp, sp_len, sizeof(bbl_ethernet_header_t));
+    memset(eth, 0x0, sizeof(bbl_ethernet_header_t));
+    *ethernet = eth;
+
+    header = (struct ether_header*)buf;
+    eth->dst = (uint8_t*)header->ether_dhost;
+    eth->src = (uint8_t*)header->ether_shost;
+    eth->type = parse->eth_type;
+    eth->vlan_outer = parse->vlan_outer;
+    eth->vlan_inner = parse->vlan_inner;
+    eth->vlan_three = parse->vlan_three;
+
+    BUMP_BUFFER(buf, len, parse->l3_offset);
+    return decode_ethernet_payload(buf, len, sp, sp_len, eth);
+}
+
+/*
+ * decode_bbl_parsed
+ *
+ * Decode only the BBL header from the UDP payload
+ * of a frame already parsed by parse_ethernet.
+ */
+protocol_error_t
+decode_bbl_parsed(uint8_t *buf, uint len,
+                  uint8_t *sp, uint sp_len,
+                  bbl_parse_t *parse,
+                  bbl_bbl_t **bbl) {
+
+    uint udp_len;
+
+    if(len != parse->len || !parse->payload_offset) {
+        return DECODE_ERROR;
+    }
+    udp_len = be16toh(*(uint16_t*)(buf + parse->l4_offset + 4));
+    if(udp_len < 8 || udp_len - 8 > len - parse->payload_offset) {
+        return DECODE_ERROR;
+    }
+    return decode_bbl(buf + parse->payload_offset, udp_len - 8, sp, sp_len, bbl);
+}
+
 protocol_error_t
 decode_ethernet(uint8_t *buf, uint len,
                 uint8_t *sp, uint sp_len,
@@ -2031,17 +2708,5 @@ decode_ethernet(uint8_t *buf, uint len,
         }
     }
 
-    if(eth->type == ETH_TYPE_PPPOE_SESSION) {
-        return decode_pppoe_session(buf, len, sp, sp_len, (bbl_pppoe_session_t**)&eth->next);
-    } else if(eth->type == ETH_TYPE_PPPOE_DISCOVERY) {
-        return decode_pppoe_discovery(buf, len, sp, sp_len, (bbl_pppoe_discovery_t**)&eth->next);
-    } else if(eth->type == ETH_TYPE_ARP) {
-        return decode_arp(buf, len, sp, sp_len, (bbl_arp_t**)&eth->next);
-    } else if(eth->type == ETH_TYPE_IPV4) {
-        return decode_ipv4(buf, len, sp, sp_len, (bbl_ipv4_t**)&eth->next);
-    } else if(eth->type == ETH_TYPE_IPV6) {
-        return decode_ipv6(buf, len, sp, sp_len, (bbl_ipv6_t**)&eth->next);
-    }
-
-    return UNKNOWN_PROTOCOL;
+    return decode_ethernet_payload(buf, len, sp, sp_len, eth);
 }
\ No newline at end of file
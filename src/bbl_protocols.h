@@ -15,6 +15,7 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <time.h>
 #include <netinet/if_ether.h>
 #include <netinet/ip.h>
 
@@ -91,6 +92,7 @@
 #define CHAP_CODE_FAILURE               4
 
 #define PPP_OPTIONS_BUFFER              64
+#define LCP_ECHO_TEMPLATE_LEN           48
 
 #define PPP_LCP_OPTION_MRU              1
 #define PPP_LCP_OPTION_AUTH             3
@@ -186,6 +188,13 @@ typedef enum protocol_error_ {
     IGNORED
 } protocol_error_t;
 
+typedef enum checksum_kernel_ {
+    CHECKSUM_KERNEL_SCALAR = 0,
+    CHECKSUM_KERNEL_SSE2,
+    CHECKSUM_KERNEL_AVX2,
+    CHECKSUM_KERNEL_MAX
+} checksum_kernel_t;
+
 typedef enum icmpv6_message_type_ {
     IPV6_ICMPV6_ECHO_REQUEST           = 128,
     IPV6_ICMPV6_ECHO_REPLY             = 129,
@@ -299,6 +308,31 @@ typedef struct bbl_ethernet_header_ {
     uint32_t  rx_nsec;
 } bbl_ethernet_header_t;
 
+/*
+ * Flat Parse Result
+ *
+ * Layer offsets and key fields relative to the start of the
+ * frame, produced in one pass without scratchpad. Protocol
+ * bodies (PPP control, DHCPv6, IGMP, ...) are not parsed and
+ * can be decoded on demand using the decode_* functions.
+ */
+typedef struct bbl_parse_ {
+    uint16_t  len; // frame length
+    uint16_t  vlan_outer; // outer VLAN identifier
+    uint16_t  vlan_inner; // inner VLAN identifier
+    uint16_t  vlan_three; // third VLAN
+    uint16_t  eth_type; // ethertype after VLAN tags
+    uint16_t  ppp_protocol; // PPP protocol (PPPoE session only)
+    uint16_t  l3_type; // ETH_TYPE_IPV4 or ETH_TYPE_IPV6 (also via PPPoE)
+    uint16_t  l3_offset; // PPPoE, ARP, IPv4 or IPv6 header
+    uint16_t  l4_offset; // IPv4 or IPv6 payload
+    uint16_t  l4_len;
+    uint8_t   ip_protocol; // IPv4 protocol or IPv6 next header
+    uint16_t  src_port; // UDP only
+    uint16_t  dst_port; // UDP only
+    uint16_t  payload_offset; // UDP payload
+} bbl_parse_t;
+
 /*
  * PPPoE Discovery Structure
  */
@@ -434,6 +468,7 @@ typedef struct bbl_udp_ {
     uint16_t    src;
     uint16_t    dst;
     uint8_t     protocol;
+    bool        checksum; // calculate IPv4 UDP checksum (always set for IPv6)
     void       *next; // next header
     void       *payload; // UDP payload
     uint16_t    payload_len; // UDP payload length
@@ -514,6 +549,30 @@ typedef struct bbl_bbl_ {
     uint64_t     timestamp;
 } bbl_bbl_t;
 
+/*
+ * checksum
+ */
+uint32_t
+checksum_sum(const uint8_t *buf, uint len);
+
+uint32_t
+checksum_sum_kernel(checksum_kernel_t kernel, const uint8_t *buf, uint len);
+
+bool
+checksum_kernel_supported(checksum_kernel_t kernel);
+
+const char *
+checksum_kernel_name(checksum_kernel_t kernel);
+
+checksum_kernel_t
+checksum_kernel(void);
+
+uint16_t
+checksum(uint16_t *buf, uint16_t len);
+
+void
+bbl_checksum_update_bbl(uint8_t *buf, uint len, uint64_t seq, struct timespec *timestamp);
+
 /*
  * decode_ethernet
  */
@@ -522,6 +581,47 @@ decode_ethernet(uint8_t *buf, uint len,
                 uint8_t *sp, uint sp_len,
                 bbl_ethernet_header_t **ethernet);
 
+/*
+ * parse_ethernet
+ */
+protocol_error_t
+parse_ethernet(uint8_t *buf, uint len,
+               bbl_parse_t *parse);
+
+/*
+ * decode_ethernet_parsed
+ */
+protocol_error_t
+decode_ethernet_parsed(uint8_t *buf, uint len,
+                       uint8_t *sp, uint sp_len,
+                       bbl_parse_t *parse,
+                       bbl_ethernet_header_t **ethernet);
+
+/*
+ * decode_arp
+ */
+protocol_error_t
+decode_arp(uint8_t *buf, uint len,
+           uint8_t *sp, uint sp_len,
+           bbl_arp_t **arp);
+
+/*
+ * decode_bbl_parsed
+ */
+protocol_error_t
+decode_bbl_parsed(uint8_t *buf, uint len,
+                  uint8_t *sp, uint sp_len,
+                  bbl_parse_t *parse,
+                  bbl_bbl_t **bbl);
+
+/*
+ * decode_bbl
+ */
+protocol_error_t
+decode_bbl(uint8_t *buf, uint len,
+           uint8_t *sp, uint sp_len,
+           bbl_bbl_t **bbl);
+
 /*
  * encode_ethernet
  */
@@ -529,4 +629,11 @@ protocol_error_t
 encode_ethernet(uint8_t *buf, uint *len,
                 bbl_ethernet_header_t *eth);
 
+/*
+ * encode_ethernet_fast
+ */
+protocol_error_t
+encode_ethernet_fast(uint8_t *buf, uint *len,
+                     bbl_ethernet_header_t *eth);
+
 #endif
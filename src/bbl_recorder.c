@@ -0,0 +1,390 @@
+/*
+ * BNG Blaster (BBL) - Flight Recorder
+ *
+ * All frames sent and received are copied into a byte ring
+ * per interface, bounded by size, overwriting the oldest
+ * frames. If a trigger fires (traffic loss, session down
+ * or control command), the frames of the last seconds of all
+ * interfaces are merged by time and written to a new pcapng
+ * file using the pcapng block writers. The dump is delayed
+ * by BBL_RECORDER_DUMP_DELAY such that the file also contains
+ * the frames following the trigger. Dumps are written by the
+ * periodic recorder job, so at most one per second.
+ *
+ * Copyright (C) 2020-2021, RtBrick, Inc.
+ */
+
+#include "bbl.h"
+#include "bbl_pcap.h"
+#include "bbl_recorder.h"
+
+#include <fcntl.h>
+#include <limits.h>
+
+const char *recorder_trigger_names[BBL_RECORDER_TRIGGER_MAX] = {
+    "loss",
+    "session-down",
+    "ctrl"
+};
+
+static uint32_t
+bbl_recorder_align (uint32_t len)
+{
+    return (len + BBL_RECORDER_ALIGN - 1) & ~(BBL_RECORDER_ALIGN - 1);
+}
+
+static bbl_recorder_record_s *
+bbl_recorder_record (bbl_recorder_ring_s *ring, uint64_t pos)
+{
+    return (bbl_recorder_record_s*)(ring->buf + (pos % ring->size));
+}
+
+/*
+ * Drop oldest records until there are at least len bytes free.
+ */
+static void
+bbl_recorder_reserve (bbl_recorder_ring_s *ring, uint32_t len)
+{
+    while (ring->write_pos + len - ring->read_pos > ring->size) {
+        ring->read_pos += bbl_recorder_record(ring, ring->read_pos)->len;
+    }
+}
+
+void
+bbl_recorder_push (bbl_interface_s *interface, struct timespec *timestamp, uint8_t *data, uint len, uint direction)
+{
+    bbl_ctx_s *ctx = interface->ctx;
+    bbl_recorder_ring_s *ring = interface->recorder;
+    bbl_recorder_record_s *record;
+    uint32_t captured_length = len;
+    uint32_t record_len, offset;
+
+    if (captured_length > ctx->recorder->snaplen) {
+        captured_length = ctx->recorder->snaplen;
+    }
+    record_len = bbl_recorder_align(sizeof(bbl_recorder_record_s) + captured_length);
+
+    /* Records never wrap around the end of the buffer. */
+    offset = ring->write_pos % ring->size;
+    if (offset + record_len > ring->size) {
+        bbl_recorder_reserve(ring, ring->size - offset);
+        record = bbl_recorder_record(ring, ring->write_pos);
+        record->len = ring->size - offset;
+        record->flags = BBL_RECORDER_PAD;
+        ring->write_pos += record->len;
+    }
+    bbl_recorder_reserve(ring, record_len);
+
+    record = bbl_recorder_record(ring, ring->write_pos);
+    record->len = record_len;
+    record->flags = direction;
+    record->timestamp = *timestamp;
+    record->captured_length = captured_length;
+    record->packet_length = len;
+    memcpy((uint8_t*)record + sizeof(bbl_recorder_record_s), data, captured_length);
+    ring->write_pos += record_len;
+    ctx->recorder->stats.packets++;
+}
+
+/*
+ * Skip padding and records older than start.
+ */
+static bbl_recorder_record_s *
+bbl_recorder_next (bbl_recorder_ring_s *ring, uint64_t *pos, struct timespec *start)
+{
+    bbl_recorder_record_s *record;
+
+    while (*pos < ring->write_pos) {
+        record = bbl_recorder_record(ring, *pos);
+        if (!(record->flags & BBL_RECORDER_PAD) &&
+            (record->timestamp.tv_sec > start->tv_sec ||
+             (record->timestamp.tv_sec == start->tv_sec && record->timestamp.tv_nsec >= start->tv_nsec))) {
+            return record;
+        }
+        *pos += record->len;
+    }
+    return NULL;
+}
+
+static bool
+bbl_recorder_write (int fd, uint8_t *buf, uint len)
+{
+    ssize_t res;
+
+    while (len) {
+        res = write(fd, buf, len);
+        if (res < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        buf += res;
+        len -= res;
+    }
+    return true;
+}
+
+/*
+ * Merge the records of all interfaces by time into
+ * a new pcapng file. The pcapng block writers encode
+ * into the recorder buffer instead of the capture buffer.
+ */
+static bool
+bbl_recorder_dump (bbl_ctx_s *ctx, const char *filename)
+{
+    bbl_recorder_s *recorder = ctx->recorder;
+    bbl_interface_s *interface;
+    bbl_recorder_ring_s **rings;
+    bbl_recorder_record_s *record, *next;
+    uint64_t *pos;
+    struct timespec start;
+    uint8_t *save_buf = ctx->pcap.write_buf;
+    uint save_idx = ctx->pcap.write_idx;
+    uint32_t i, min;
+    uint64_t packets = 0;
+    bool success = true;
+    int fd;
+
+    rings = calloc(ctx->pcap.index, sizeof(bbl_recorder_ring_s*));
+    pos = calloc(ctx->pcap.index, sizeof(uint64_t));
+    if (!(rings && pos)) {
+        free(rings);
+        free(pos);
+        return false;
+    }
+
+    fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, PCAPNG_PERMS);
+    if (fd == -1) {
+        LOG(ERROR, "Failed to open flight recorder file %s (%s)\n", filename, strerror(errno));
+        free(rings);
+        free(pos);
+        return false;
+    }
+
+    start = recorder->trigger_time;
+    start.tv_sec -= ctx->config.recorder_seconds;
+
+    CIRCLEQ_FOREACH(interface, &ctx->interface_qhead, interface_qnode) {
+        if (interface->recorder && interface->pcap_index < ctx->pcap.index) {
+            rings[interface->pcap_index] = interface->recorder;
+            pos[interface->pcap_index] = interface->recorder->read_pos;
+        }
+    }
+
+    ctx->pcap.write_buf = recorder->write_buf;
+    ctx->pcap.write_idx = 0;
+    pcapng_push_file_header(ctx);
+
+    while (success) {
+        record = NULL;
+        min = 0;
+        for (i = 0; i < ctx->pcap.index; i++) {
+            if (!rings[i]) continue;
+            next = bbl_recorder_next(rings[i], &pos[i], &start);
+            if (next && (!record ||
+                next->timestamp.tv_sec < record->timestamp.tv_sec ||
+                (next->timestamp.tv_sec == record->timestamp.tv_sec &&
+                 next->timestamp.tv_nsec < record->timestamp.tv_nsec))) {
+                record = next;
+                min = i;
+            }
+        }
+        if (!record) break;
+
+        if (ctx->pcap.write_idx + record->captured_length + PCAPNG_MAX_BLOCK_OVERHEAD > PCAPNG_WRITEBUFSIZE) {
+            success = bbl_recorder_write(fd, ctx->pcap.write_buf, ctx->pcap.write_idx);
+            ctx->pcap.write_idx = 0;
+        }
+        pcapng_push_enhanced_packet_block(ctx, &record->timestamp,
+                                          (uint8_t*)record + sizeof(bbl_recorder_record_s),
+                                          record->captured_length, record->packet_length,
+                                          min, record->flags);
+        pos[min] += record->len;
+        packets++;
+    }
+    if (success) {
+        success = bbl_recorder_write(fd, ctx->pcap.write_buf, ctx->pcap.write_idx);
+    }
+    close(fd);
+    free(rings);
+    free(pos);
+
+    ctx->pcap.write_buf = save_buf;
+    ctx->pcap.write_idx = save_idx;
+
+    if (!success) {
+        LOG(ERROR, "Failed to write flight recorder file %s (%s)\n", filename, strerror(errno));
+        return false;
+    }
+    LOG(NORMAL, "Flight recorder (%s) wrote %lu packets to %s\n",
+        recorder_trigger_names[recorder->trigger], packets, filename);
+    return true;
+}
+
+static void
+bbl_recorder_dump_pending (bbl_ctx_s *ctx)
+{
+    bbl_recorder_s *recorder = ctx->recorder;
+    char filename[PATH_MAX];
+
+    recorder->dump_pending = false;
+    snprintf(filename, sizeof(filename), "%s-%u.pcapng",
+             ctx->config.recorder_filename, recorder->stats.dumps + 1);
+    if (bbl_recorder_dump(ctx, filename)) {
+        recorder->stats.dumps++;
+    } else {
+        recorder->stats.dump_errors++;
+    }
+}
+
+/*
+ * Schedule a dump unless one is already pending.
+ */
+void
+bbl_recorder_trigger (bbl_ctx_s *ctx, bbl_recorder_trigger_t trigger)
+{
+    bbl_recorder_s *recorder = ctx->recorder;
+
+    if (!recorder) {
+        return;
+    }
+    recorder->stats.triggers[trigger]++;
+    if (recorder->dump_pending) {
+        return;
+    }
+    if (recorder->stats.dumps + recorder->stats.dump_errors >= ctx->config.recorder_max_files) {
+        recorder->stats.suppressed++;
+        return;
+    }
+    LOG(NORMAL, "Flight recorder triggered by %s\n", recorder_trigger_names[trigger]);
+    recorder->dump_pending = true;
+    recorder->trigger = trigger;
+    timer_clock_gettime(&ctx->timer_root, CLOCK_REALTIME, &recorder->trigger_time);
+}
+
+/*
+ * Check the traffic loss counters once per second, which
+ * keeps the trigger out of the RX fast path, and write
+ * pending dumps.
+ */
+static void
+bbl_recorder_job (timer_s *timer)
+{
+    bbl_ctx_s *ctx = timer->data;
+    bbl_recorder_s *recorder = ctx->recorder;
+    bbl_interface_s *interface;
+    struct timespec now;
+    uint64_t loss = 0;
+
+    if (recorder->dump_pending) {
+        timer_clock_gettime(&ctx->timer_root, CLOCK_REALTIME, &now);
+        if (now.tv_sec >= recorder->trigger_time.tv_sec + BBL_RECORDER_DUMP_DELAY) {
+            bbl_recorder_dump_pending(ctx);
+        }
+    }
+
+    CIRCLEQ_FOREACH(interface, &ctx->interface_qhead, interface_qnode) {
+        loss += interface->stats.session_ipv4_loss;
+        loss += interface->stats.session_ipv6_loss;
+        loss += interface->stats.session_ipv6pd_loss;
+        loss += interface->stats.mc_loss;
+    }
+    if (loss > recorder->loss) {
+        recorder->loss = loss;
+        if (ctx->config.recorder_loss) {
+            bbl_recorder_trigger(ctx, BBL_RECORDER_TRIGGER_LOSS);
+        }
+    }
+}
+
+bool
+bbl_recorder_init (bbl_ctx_s *ctx)
+{
+    bbl_recorder_s *recorder;
+    bbl_recorder_ring_s *ring;
+    bbl_interface_s *interface;
+
+    if (!ctx->config.recorder) {
+        return true;
+    }
+    recorder = calloc(1, sizeof(bbl_recorder_s));
+    if (!recorder) {
+        return false;
+    }
+    ctx->recorder = recorder;
+    recorder->snaplen = ctx->config.pcap_snaplen ? ctx->config.pcap_snaplen : PCAPNG_SNAPLEN;
+    recorder->write_buf = malloc(PCAPNG_WRITEBUFSIZE);
+    if (!recorder->write_buf) {
+        return false;
+    }
+    CIRCLEQ_FOREACH(interface, &ctx->interface_qhead, interface_qnode) {
+        ring = calloc(1, sizeof(bbl_recorder_ring_s));
+        if (!ring) {
+            return false;
+        }
+        interface->recorder = ring;
+        ring->size = bbl_recorder_align(ctx->config.recorder_bytes);
+        ring->buf = malloc(ring->size);
+        if (!ring->buf) {
+            return false;
+        }
+    }
+    timer_add_periodic(&ctx->timer_root, &recorder->job, "Recorder", 1, 0, ctx, bbl_recorder_job);
+    LOG(NORMAL, "Flight recorder with %u bytes per interface\n", ctx->config.recorder_bytes);
+    return true;
+}
+
+void
+bbl_recorder_stdout (bbl_ctx_s *ctx)
+{
+    bbl_recorder_s *recorder = ctx->recorder;
+    int i;
+
+    if (!recorder) return;
+
+    printf("\nFlight Recorder:\n");
+    printf("  Recorded Packets:  %10lu\n", recorder->stats.packets);
+    for (i = 0; i < BBL_RECORDER_TRIGGER_MAX; i++) {
+        printf("  Trigger %-13s %7u\n", recorder_trigger_names[i], recorder->stats.triggers[i]);
+    }
+    printf("  Dumps:             %10u (%u failed, %u suppressed)\n", recorder->stats.dumps,
+           recorder->stats.dump_errors, recorder->stats.suppressed);
+}
+
+json_t *
+bbl_recorder_json (bbl_ctx_s *ctx)
+{
+    bbl_recorder_s *recorder = ctx->recorder;
+    json_t *jobj, *jobj_triggers;
+    int i;
+
+    jobj = json_object();
+    json_object_set(jobj, "packets", json_integer(recorder->stats.packets));
+    jobj_triggers = json_object();
+    for (i = 0; i < BBL_RECORDER_TRIGGER_MAX; i++) {
+        json_object_set(jobj_triggers, recorder_trigger_names[i], json_integer(recorder->stats.triggers[i]));
+    }
+    json_object_set(jobj, "triggers", jobj_triggers);
+    json_object_set(jobj, "dumps", json_integer(recorder->stats.dumps));
+    json_object_set(jobj, "dumps-failed", json_integer(recorder->stats.dump_errors));
+    json_object_set(jobj, "dumps-suppressed", json_integer(recorder->stats.suppressed));
+    return jobj;
+}
+
+void
+bbl_recorder_free (bbl_ctx_s *ctx)
+{
+    bbl_interface_s *interface;
+
+    if (!ctx->recorder) return;
+
+    CIRCLEQ_FOREACH(interface, &ctx->interface_qhead, interface_qnode) {
+        if (interface->recorder) {
+            free(interface->recorder->buf);
+            free(interface->recorder);
+            interface->recorder = NULL;
+        }
+    }
+    free(ctx->recorder->write_buf);
+    free(ctx->recorder);
+    ctx->recorder = NULL;
+}
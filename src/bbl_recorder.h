@@ -0,0 +1,109 @@
+/*
+ * BNG Blaster (BBL) - Flight Recorder
+ *
+ * Keep the last seconds of frames per interface in memory
+ * and dump them to a pcapng file if a trigger fires.
+ *
+ * Copyright (C) 2020-2021, RtBrick, Inc.
+ */
+
+#ifndef __BBL_RECORDER_H__
+#define __BBL_RECORDER_H__
+
+#include <jansson.h>
+#include "bbl_pcap.h"
+
+#define BBL_RECORDER_BYTES          4194304 /* default per interface */
+#define BBL_RECORDER_BYTES_MIN      65536
+#define BBL_RECORDER_SECONDS        10
+#define BBL_RECORDER_MAX_FILES      10
+#define BBL_RECORDER_FILENAME       "bngblaster-recorder"
+#define BBL_RECORDER_DUMP_DELAY     1 /* seconds of frames after the trigger */
+#define BBL_RECORDER_ALIGN          8
+#define BBL_RECORDER_PAD            0x80000000 /* record flag for unused space at the end */
+
+typedef enum {
+    BBL_RECORDER_TRIGGER_LOSS = 0,
+    BBL_RECORDER_TRIGGER_SESSION_DOWN,
+    BBL_RECORDER_TRIGGER_CTRL,
+    BBL_RECORDER_TRIGGER_MAX
+} bbl_recorder_trigger_t;
+
+/*
+ * Record header followed by frame data.
+ */
+typedef struct bbl_recorder_record_ {
+    uint32_t len; /* record length including header and padding */
+    uint32_t flags; /* direction or BBL_RECORDER_PAD */
+    struct timespec timestamp;
+    uint32_t captured_length;
+    uint32_t packet_length;
+} bbl_recorder_record_s;
+
+/*
+ * Per interface byte ring of variable length records. Positions
+ * are increasing byte counters, the buffer offset is position
+ * modulo size. Records never wrap, unused space at the end of
+ * the buffer is marked with a padding record.
+ */
+typedef struct bbl_recorder_ring_ {
+    uint8_t *buf;
+    uint32_t size;
+    uint64_t write_pos;
+    uint64_t read_pos; /* oldest record */
+} bbl_recorder_ring_s;
+
+typedef struct bbl_recorder_ {
+    struct timer_ *job;
+    bool dump_pending;
+    bbl_recorder_trigger_t trigger;
+    struct timespec trigger_time;
+
+    uint32_t snaplen;
+    uint64_t loss; /* last known loss counter sum */
+    uint8_t *write_buf; /* pcapng encoding buffer */
+
+    struct {
+        uint64_t packets;
+        uint32_t triggers[BBL_RECORDER_TRIGGER_MAX];
+        uint32_t dumps;
+        uint32_t dump_errors;
+        uint32_t suppressed; /* max-files reached */
+    } stats;
+} bbl_recorder_s;
+
+bool
+bbl_recorder_init (bbl_ctx_s *ctx);
+
+void
+bbl_recorder_push (bbl_interface_s *interface, struct timespec *timestamp, uint8_t *data, uint len, uint direction);
+
+void
+bbl_recorder_trigger (bbl_ctx_s *ctx, bbl_recorder_trigger_t trigger);
+
+void
+bbl_recorder_stdout (bbl_ctx_s *ctx);
+
+json_t *
+bbl_recorder_json (bbl_ctx_s *ctx);
+
+void
+bbl_recorder_free (bbl_ctx_s *ctx);
+
+/*
+ * Hand a sent or received frame to the pcapng
+ * capture and to the flight recorder.
+ */
+static inline void
+bbl_capture_frame (bbl_ctx_s *ctx, bbl_interface_s *interface, struct timespec *timestamp,
+                   uint8_t *data, uint len, uint16_t vlan, uint direction)
+{
+    if (ctx->pcap.write_buf && pcapng_capture(ctx, interface, data, len, vlan)) {
+        pcapng_push_packet_header(ctx, timestamp, data, len, interface->pcap_index, direction);
+    }
+    if (interface->recorder) {
+        bbl_recorder_push(interface, timestamp, data, len, direction);
+    }
+}
+
+#endif
@@ -0,0 +1,482 @@
+/*
+ * BNG Blaster (BBL) - PCAP Replay
+ *
+ * A packet capture (pcap or pcapng) taken from a real BNG
+ * session is loaded into memory and all inbound frames are
+ * fed through the same RX handlers used with the kernel ring,
+ * without any sockets and as fast as possible. This allows to
+ * profile the RX path with realistic traffic in a repeatable
+ * way. The capture is replayed until BBL_REPLAY_MIN_PACKETS
+ * are processed, so the first pass establishes the sessions
+ * while further passes show the steady state costs.
+ *
+ * The outer VLAN is stripped from the frames and passed as
+ * meta data like done by the kernel. Frames are assigned to
+ * the interface with the same pcapng interface index, pcap
+ * files are replayed on the first access interface.
+ *
+ * Copyright (C) 2020-2021, RtBrick, Inc.
+ */
+
+#include "bbl.h"
+#include "bbl_replay.h"
+#include "bbl_pcap.h"
+
+const char *replay_protocol_names[BBL_REPLAY_PROTOCOL_MAX] = {
+    [BBL_REPLAY_PPPOE_DISCOVERY]    = "pppoe-discovery",
+    [BBL_REPLAY_LCP]                = "lcp",
+    [BBL_REPLAY_PAP]                = "pap",
+    [BBL_REPLAY_CHAP]               = "chap",
+    [BBL_REPLAY_IPCP]               = "ipcp",
+    [BBL_REPLAY_IP6CP]              = "ip6cp",
+    [BBL_REPLAY_ARP]                = "arp",
+    [BBL_REPLAY_ICMP]               = "icmp",
+    [BBL_REPLAY_IGMP]               = "igmp",
+    [BBL_REPLAY_ICMPV6]             = "icmpv6",
+    [BBL_REPLAY_DHCPV6]             = "dhcpv6",
+    [BBL_REPLAY_SESSION_TRAFFIC]    = "session-traffic",
+    [BBL_REPLAY_IPV4]               = "ipv4",
+    [BBL_REPLAY_IPV6]               = "ipv6",
+    [BBL_REPLAY_OTHER]              = "other",
+};
+
+static uint32_t
+bbl_replay_read32 (uint8_t *buf, bool swap) {
+    uint32_t value;
+    memcpy(&value, buf, sizeof(value));
+    return swap ? __builtin_bswap32(value) : value;
+}
+
+static uint16_t
+bbl_replay_read16 (uint8_t *buf, bool swap) {
+    uint16_t value;
+    memcpy(&value, buf, sizeof(value));
+    return swap ? __builtin_bswap16(value) : value;
+}
+
+static bbl_replay_protocol_t
+bbl_replay_classify (uint8_t *buf, uint len) {
+    bbl_parse_t parse;
+
+    if(parse_ethernet(buf, len, &parse) != PROTOCOL_SUCCESS) {
+        return BBL_REPLAY_OTHER;
+    }
+    switch(parse.eth_type) {
+        case ETH_TYPE_PPPOE_DISCOVERY:
+            return BBL_REPLAY_PPPOE_DISCOVERY;
+        case ETH_TYPE_ARP:
+            return BBL_REPLAY_ARP;
+        case ETH_TYPE_PPPOE_SESSION:
+            switch(parse.ppp_protocol) {
+                case PROTOCOL_LCP: return BBL_REPLAY_LCP;
+                case PROTOCOL_PAP: return BBL_REPLAY_PAP;
+                case PROTOCOL_CHAP: return BBL_REPLAY_CHAP;
+                case PROTOCOL_IPCP: return BBL_REPLAY_IPCP;
+                case PROTOCOL_IP6CP: return BBL_REPLAY_IP6CP;
+                default: break;
+            }
+            break;
+        default:
+            break;
+    }
+    if(parse.l3_type == ETH_TYPE_IPV4) {
+        switch(parse.ip_protocol) {
+            case PROTOCOL_IPV4_ICMP: return BBL_REPLAY_ICMP;
+            case PROTOCOL_IPV4_IGMP: return BBL_REPLAY_IGMP;
+            default: break;
+        }
+    } else if(parse.l3_type == ETH_TYPE_IPV6) {
+        if(parse.ip_protocol == IPV6_NEXT_HEADER_ICMPV6) {
+            return BBL_REPLAY_ICMPV6;
+        }
+    }
+    if(parse.ip_protocol == PROTOCOL_IPV4_UDP) {
+        if(parse.dst_port == BBL_UDP_PORT) {
+            return BBL_REPLAY_SESSION_TRAFFIC;
+        }
+        if(parse.dst_port == DHCPV6_UDP_CLIENT || parse.dst_port == DHCPV6_UDP_SERVER) {
+            return BBL_REPLAY_DHCPV6;
+        }
+    }
+    if(parse.l3_type == ETH_TYPE_IPV4) return BBL_REPLAY_IPV4;
+    if(parse.l3_type == ETH_TYPE_IPV6) return BBL_REPLAY_IPV6;
+    return BBL_REPLAY_OTHER;
+}
+
+static bbl_interface_s *
+bbl_replay_interface (bbl_ctx_s *ctx, uint32_t pcap_index, bbl_interface_s *fallback) {
+    bbl_interface_s *interface;
+
+    CIRCLEQ_FOREACH(interface, &ctx->interface_qhead, interface_qnode) {
+        if(interface->pcap_index == pcap_index) {
+            return interface;
+        }
+    }
+    return fallback;
+}
+
+/*
+ * Add frame to replay list. The outer VLAN is stripped
+ * in place by moving the MAC addresses behind the tag.
+ */
+static bool
+bbl_replay_add_frame (bbl_ctx_s *ctx, bbl_interface_s *interface, uint8_t *buf, uint len,
+                      uint32_t sec, uint32_t nsec) {
+    bbl_replay_s *replay = ctx->replay;
+    bbl_replay_frame_s *frame;
+    uint16_t type;
+
+    if(!interface || len < sizeof(struct ether_header) || len > UINT16_MAX) {
+        replay->frames_skipped++;
+        return true;
+    }
+    if(replay->frame_count == replay->frame_max) {
+        replay->frame_max = replay->frame_max ? replay->frame_max * 2 : 4096;
+        frame = realloc(replay->frames, replay->frame_max * sizeof(bbl_replay_frame_s));
+        if(!frame) {
+            return false;
+        }
+        replay->frames = frame;
+    }
+    frame = &replay->frames[replay->frame_count++];
+    memset(frame, 0x0, sizeof(bbl_replay_frame_s));
+
+    type = be16toh(*(uint16_t*)(buf + 12));
+    if((type == ETH_TYPE_VLAN || type == ETH_TYPE_QINQ) && len >= sizeof(struct ether_header) + 4) {
+        frame->tphdr.tp_vlan_tci = be16toh(*(uint16_t*)(buf + 14));
+        frame->tphdr.tp_vlan_tpid = type;
+        frame->tphdr.tp_status = TP_STATUS_VLAN_VALID;
+        memmove(buf + 4, buf, 12);
+        buf += 4;
+        len -= 4;
+    }
+    frame->tphdr.tp_len = len;
+    frame->tphdr.tp_snaplen = len;
+    frame->tphdr.tp_sec = sec;
+    frame->tphdr.tp_nsec = nsec;
+    frame->interface = interface;
+    frame->buf = buf;
+    frame->len = len;
+    frame->protocol = bbl_replay_classify(buf, len);
+    return true;
+}
+
+static bool
+bbl_replay_load_pcap (bbl_ctx_s *ctx, bbl_interface_s *interface) {
+    bbl_replay_s *replay = ctx->replay;
+    uint8_t *buf = replay->file_buf;
+    size_t offset = PCAP_FILE_HEADER_LEN;
+    uint32_t magic, caplen, sec, frac;
+    bool swap = false;
+    bool nsec = false;
+
+    magic = bbl_replay_read32(buf, false);
+    if(magic == __builtin_bswap32(PCAP_MAGIC) || magic == __builtin_bswap32(PCAP_MAGIC_NSEC)) {
+        swap = true;
+        magic = __builtin_bswap32(magic);
+    }
+    if(magic == PCAP_MAGIC_NSEC) {
+        nsec = true;
+    }
+    if(bbl_replay_read32(buf + 20, swap) != DLT_EN10MB) {
+        LOG(ERROR, "Replay capture %s is not ethernet\n", ctx->config.replay_filename);
+        return false;
+    }
+
+    while(offset + PCAP_RECORD_HEADER_LEN <= replay->file_len) {
+        sec = bbl_replay_read32(buf + offset, swap);
+        frac = bbl_replay_read32(buf + offset + 4, swap);
+        caplen = bbl_replay_read32(buf + offset + 8, swap);
+        offset += PCAP_RECORD_HEADER_LEN;
+        if(offset + caplen > replay->file_len) {
+            break;
+        }
+        if(!bbl_replay_add_frame(ctx, interface, buf + offset, caplen, sec, nsec ? frac : frac * 1000)) {
+            return false;
+        }
+        offset += caplen;
+    }
+    return true;
+}
+
+static bool
+bbl_replay_load_pcapng (bbl_ctx_s *ctx, bbl_interface_s *interface) {
+    bbl_replay_s *replay = ctx->replay;
+    uint8_t *buf = replay->file_buf;
+    uint8_t *block;
+    size_t offset = 0;
+    uint32_t type, len, body, caplen, ifindex, option, option_len, flags;
+    uint32_t idb_count = 0;
+    uint8_t exp;
+    uint64_t tsresol[BBL_REPLAY_MAX_INTERFACES];
+    uint64_t ts;
+    bool ethernet[BBL_REPLAY_MAX_INTERFACES];
+    bool swap = false;
+
+    while(offset + 12 <= replay->file_len) {
+        block = buf + offset;
+        type = bbl_replay_read32(block, false);
+        if(type == PCAPNG_SHB) {
+            /* New section, the byte order magic defines the endianess. */
+            swap = bbl_replay_read32(block + 8, false) != PCAPNG_BYTE_ORDER_MAGIC;
+            idb_count = 0;
+        }
+        type = bbl_replay_read32(block, swap);
+        len = bbl_replay_read32(block + 4, swap);
+        if(len < 12 || offset + len > replay->file_len) {
+            break;
+        }
+        offset += len;
+
+        switch(type) {
+            case PCAPNG_IDB:
+                if(idb_count >= BBL_REPLAY_MAX_INTERFACES) break;
+                ethernet[idb_count] = bbl_replay_read16(block + 8, swap) == DLT_EN10MB;
+                tsresol[idb_count] = 1000000; /* default usec */
+                /* Search options for if_tsresol. */
+                body = 16;
+                while(body + 4 <= len - 4) {
+                    option = bbl_replay_read16(block + body, swap);
+                    option_len = bbl_replay_read16(block + body + 2, swap);
+                    if(option == 0) break;
+                    if(option == PCAPNG_IDB_TSRESOL_OPTION && option_len == 1) {
+                        if(block[body+4] & 0x80) {
+                            tsresol[idb_count] = 1ULL << (block[body+4] & 0x3f);
+                        } else {
+                            tsresol[idb_count] = 1;
+                            for(exp = 0; exp < block[body+4] && exp < 19; exp++) {
+                                tsresol[idb_count] *= 10;
+                            }
+                        }
+                    }
+                    body += 4 + ((option_len + 3) & ~3);
+                }
+                idb_count++;
+                break;
+            case PCAPNG_EPB:
+                if(len < 32) break;
+                ifindex = bbl_replay_read32(block + 8, swap);
+                caplen = bbl_replay_read32(block + 20, swap);
+                if(ifindex >= idb_count || !ethernet[ifindex] || 28 + caplen > len - 4) {
+                    replay->frames_skipped++;
+                    break;
+                }
+                /* Search options for the packet direction, outbound frames are skipped. */
+                flags = 0;
+                body = 28 + ((caplen + 3) & ~3);
+                while(body + 4 <= len - 4) {
+                    option = bbl_replay_read16(block + body, swap);
+                    option_len = bbl_replay_read16(block + body + 2, swap);
+                    if(option == 0) break;
+                    if(option == PCAPNG_EPB_FLAGS_OPTION && option_len == 4) {
+                        flags = bbl_replay_read32(block + body + 4, swap);
+                    }
+                    body += 4 + ((option_len + 3) & ~3);
+                }
+                if(flags & PCAPNG_EPB_FLAGS_OUTBOUND) {
+                    replay->frames_skipped++;
+                    break;
+                }
+                ts = ((uint64_t)bbl_replay_read32(block + 12, swap) << 32) | bbl_replay_read32(block + 16, swap);
+                if(!bbl_replay_add_frame(ctx, bbl_replay_interface(ctx, ifindex, interface), block + 28, caplen,
+                                         ts / tsresol[ifindex],
+                                         tsresol[ifindex] <= 1000000000ULL ?
+                                         (ts % tsresol[ifindex]) * (1000000000ULL / tsresol[ifindex]) :
+                                         (ts % tsresol[ifindex]) / (tsresol[ifindex] / 1000000000ULL))) {
+                    return false;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    return true;
+}
+
+/*
+ * Load the capture file configured via -R into memory.
+ */
+bool
+bbl_replay_load (bbl_ctx_s *ctx) {
+    bbl_replay_s *replay;
+    bbl_interface_s *interface = NULL;
+    FILE *file;
+    long file_len;
+    uint32_t magic;
+    bool result;
+
+    replay = calloc(1, sizeof(bbl_replay_s));
+    if(!replay) {
+        return false;
+    }
+    ctx->replay = replay;
+
+    file = fopen(ctx->config.replay_filename, "r");
+    if(!file) {
+        LOG(ERROR, "Failed to open replay capture %s\n", ctx->config.replay_filename);
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    file_len = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if(file_len < PCAP_FILE_HEADER_LEN) {
+        LOG(ERROR, "Invalid replay capture %s\n", ctx->config.replay_filename);
+        fclose(file);
+        return false;
+    }
+    replay->file_len = file_len;
+    replay->file_buf = malloc(replay->file_len);
+    if(!replay->file_buf || fread(replay->file_buf, 1, replay->file_len, file) != replay->file_len) {
+        LOG(ERROR, "Failed to read replay capture %s\n", ctx->config.replay_filename);
+        fclose(file);
+        return false;
+    }
+    fclose(file);
+
+    /* Frames without pcapng interface are replayed on the first access interface. */
+    if(ctx->op.access_if_count) {
+        interface = ctx->op.access_if[0];
+    } else {
+        interface = ctx->op.network_if;
+    }
+
+    magic = bbl_replay_read32(replay->file_buf, false);
+    if(magic == PCAPNG_SHB) {
+        result = bbl_replay_load_pcapng(ctx, interface);
+    } else if(magic == PCAP_MAGIC || magic == PCAP_MAGIC_NSEC ||
+              magic == __builtin_bswap32(PCAP_MAGIC) || magic == __builtin_bswap32(PCAP_MAGIC_NSEC)) {
+        result = bbl_replay_load_pcap(ctx, interface);
+    } else {
+        LOG(ERROR, "Unknown replay capture format %s\n", ctx->config.replay_filename);
+        return false;
+    }
+    if(result) {
+        LOG(NORMAL, "Loaded %u frames (%u skipped) from replay capture %s\n",
+            replay->frame_count, replay->frames_skipped, ctx->config.replay_filename);
+    }
+    return result;
+}
+
+static inline uint64_t
+bbl_replay_nsec (struct timespec *start, struct timespec *stop) {
+    return (stop->tv_sec - start->tv_sec) * 1000000000ULL + stop->tv_nsec - start->tv_nsec;
+}
+
+/*
+ * Replay all frames through the RX handlers.
+ */
+void
+bbl_replay_run (bbl_ctx_s *ctx) {
+    bbl_replay_s *replay = ctx->replay;
+    bbl_replay_frame_s *frame;
+    bbl_session_s *session;
+    struct timespec start, stop, t0, t1;
+    uint64_t nsec;
+    uint32_t i;
+
+    if(!replay->frame_count) {
+        return;
+    }
+
+    /* Start all sessions, so that they accept the first response. */
+    while(true) {
+        if(!CIRCLEQ_EMPTY(&ctx->sessions_qhead[BBL_SESSIONS_IDLE])) {
+            session = CIRCLEQ_FIRST(&ctx->sessions_qhead[BBL_SESSIONS_IDLE]);
+        } else {
+            session = bbl_session_pending_next(ctx);
+            if(!session) {
+                break;
+            }
+        }
+        bbl_session_start(ctx, session);
+    }
+
+    /* Measure the overhead of the per packet timestamps. */
+    replay->timer_overhead_nsec = UINT64_MAX;
+    for(i = 0; i < 1000; i++) {
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        nsec = bbl_replay_nsec(&t0, &t1);
+        if(nsec < replay->timer_overhead_nsec) {
+            replay->timer_overhead_nsec = nsec;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    do {
+        for(i = 0; i < replay->frame_count; i++) {
+            frame = &replay->frames[i];
+            frame->interface->rx_timestamp.tv_sec = frame->tphdr.tp_sec;
+            frame->interface->rx_timestamp.tv_nsec = frame->tphdr.tp_nsec;
+            clock_gettime(CLOCK_MONOTONIC, &t0);
+            bbl_rx_packet(frame->interface, &frame->tphdr, frame->buf, frame->len);
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            nsec = bbl_replay_nsec(&t0, &t1);
+            nsec = nsec > replay->timer_overhead_nsec ? nsec - replay->timer_overhead_nsec : 0;
+            replay->protocol[frame->protocol].packets++;
+            replay->protocol[frame->protocol].nsec += nsec;
+        }
+        replay->packets += replay->frame_count;
+        replay->passes++;
+    } while(replay->packets < BBL_REPLAY_MIN_PACKETS);
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    replay->nsec = bbl_replay_nsec(&start, &stop);
+}
+
+void
+bbl_replay_stdout (bbl_ctx_s *ctx) {
+    bbl_replay_s *replay = ctx->replay;
+    int i;
+
+    if(!(replay && replay->packets)) return;
+
+    printf("\nReplay ( %s ):\n", ctx->config.replay_filename);
+    printf("  Frames:            %10u (%u skipped)\n", replay->frame_count, replay->frames_skipped);
+    printf("  Passes:            %10u\n", replay->passes);
+    printf("  Packets:           %10lu\n", replay->packets);
+    printf("  Packets/s:         %10.0lf\n", replay->packets * 1e9 / (replay->nsec ? replay->nsec : 1));
+    printf("  Timer Overhead:    %10lu ns/packet (subtracted)\n", replay->timer_overhead_nsec);
+    for(i = 0; i < BBL_REPLAY_PROTOCOL_MAX; i++) {
+        if(!replay->protocol[i].packets) continue;
+        printf("  %-18s %10lu packets %8.1lf ns/packet\n", replay_protocol_names[i],
+               replay->protocol[i].packets,
+               (double)replay->protocol[i].nsec / replay->protocol[i].packets);
+    }
+}
+
+json_t *
+bbl_replay_json (bbl_ctx_s *ctx) {
+    bbl_replay_s *replay = ctx->replay;
+    json_t *jobj, *jobj_protocols, *jobj_protocol;
+    int i;
+
+    jobj = json_object();
+    json_object_set(jobj, "filename", json_string(ctx->config.replay_filename));
+    json_object_set(jobj, "frames", json_integer(replay->frame_count));
+    json_object_set(jobj, "frames-skipped", json_integer(replay->frames_skipped));
+    json_object_set(jobj, "passes", json_integer(replay->passes));
+    json_object_set(jobj, "packets", json_integer(replay->packets));
+    json_object_set(jobj, "packets-per-second", json_real(replay->packets * 1e9 / (replay->nsec ? replay->nsec : 1)));
+    json_object_set(jobj, "timer-overhead-ns", json_integer(replay->timer_overhead_nsec));
+    jobj_protocols = json_object();
+    for(i = 0; i < BBL_REPLAY_PROTOCOL_MAX; i++) {
+        if(!replay->protocol[i].packets) continue;
+        jobj_protocol = json_object();
+        json_object_set(jobj_protocol, "packets", json_integer(replay->protocol[i].packets));
+        json_object_set(jobj_protocol, "ns-per-packet", json_real((double)replay->protocol[i].nsec / replay->protocol[i].packets));
+        json_object_set(jobj_protocols, replay_protocol_names[i], jobj_protocol);
+    }
+    json_object_set(jobj, "protocols", jobj_protocols);
+    return jobj;
+}
+
+void
+bbl_replay_free (bbl_ctx_s *ctx) {
+    bbl_replay_s *replay = ctx->replay;
+
+    if(!replay) return;
+    if(replay->frames) free(replay->frames);
+    if(replay->file_buf) free(replay->file_buf);
+    free(replay);
+    ctx->replay = NULL;
+}
@@ -0,0 +1,88 @@
+/*
+ * BNG Blaster (BBL) - PCAP Replay
+ *
+ * Feed frames from a packet capture through the
+ * RX handlers at maximum speed to measure the
+ * per protocol processing costs.
+ *
+ * Copyright (C) 2020-2021, RtBrick, Inc.
+ */
+
+#ifndef __BBL_REPLAY_H__
+#define __BBL_REPLAY_H__
+
+#include <jansson.h>
+
+#define BBL_REPLAY_MIN_PACKETS      1000000 /* replay capture until this number of packets is reached */
+#define BBL_REPLAY_MAX_INTERFACES   64      /* pcapng interface description blocks */
+
+#define PCAP_MAGIC                  0xa1b2c3d4
+#define PCAP_MAGIC_NSEC             0xa1b23c4d
+#define PCAP_FILE_HEADER_LEN        24
+#define PCAP_RECORD_HEADER_LEN      16
+
+#define PCAPNG_BYTE_ORDER_MAGIC     0x1a2b3c4d
+
+typedef enum {
+    BBL_REPLAY_PPPOE_DISCOVERY = 0,
+    BBL_REPLAY_LCP,
+    BBL_REPLAY_PAP,
+    BBL_REPLAY_CHAP,
+    BBL_REPLAY_IPCP,
+    BBL_REPLAY_IP6CP,
+    BBL_REPLAY_ARP,
+    BBL_REPLAY_ICMP,
+    BBL_REPLAY_IGMP,
+    BBL_REPLAY_ICMPV6,
+    BBL_REPLAY_DHCPV6,
+    BBL_REPLAY_SESSION_TRAFFIC,
+    BBL_REPLAY_IPV4,
+    BBL_REPLAY_IPV6,
+    BBL_REPLAY_OTHER,
+    BBL_REPLAY_PROTOCOL_MAX
+} bbl_replay_protocol_t;
+
+typedef struct bbl_replay_frame_ {
+    struct tpacket2_hdr tphdr; /* RX meta data (outer VLAN, timestamp) */
+    struct bbl_interface_ *interface;
+    uint8_t *buf; /* frame with outer VLAN stripped */
+    uint16_t len;
+    bbl_replay_protocol_t protocol;
+} bbl_replay_frame_s;
+
+typedef struct bbl_replay_ {
+    uint8_t *file_buf; /* capture file loaded into memory */
+    size_t file_len;
+
+    bbl_replay_frame_s *frames;
+    uint32_t frame_count;
+    uint32_t frame_max;
+    uint32_t frames_skipped; /* outbound or not ethernet */
+
+    uint32_t passes;
+    uint64_t packets;
+    uint64_t nsec; /* wall clock of all passes */
+    uint64_t timer_overhead_nsec; /* per packet */
+
+    struct {
+        uint64_t packets;
+        uint64_t nsec;
+    } protocol[BBL_REPLAY_PROTOCOL_MAX];
+} bbl_replay_s;
+
+bool
+bbl_replay_load (bbl_ctx_s *ctx);
+
+void
+bbl_replay_run (bbl_ctx_s *ctx);
+
+void
+bbl_replay_stdout (bbl_ctx_s *ctx);
+
+json_t *
+bbl_replay_json (bbl_ctx_s *ctx);
+
+void
+bbl_replay_free (bbl_ctx_s *ctx);
+
+#endif
@@ -0,0 +1,121 @@
+/*
+ * BNG Blaster (BBL) - Retransmission Lists
+ *
+ * Sessions waiting for a response are queued per protocol phase
+ * in the order the request was sent. As all sessions of a list
+ * share the same timeout, the lists are sorted by expiry and a
+ * single periodic job retransmits all expired requests in batches,
+ * instead of one timer per session and protocol.
+ *
+ * Copyright (C) 2020-2021, RtBrick, Inc.
+ */
+
+#include "bbl.h"
+#include "bbl_retry.h"
+
+typedef void bbl_retry_handler(bbl_session_s *session);
+
+static bbl_retry_handler *retry_handler[BBL_RETRY_MAX] = {
+    [BBL_RETRY_DISCOVERY]       = bbl_discovery_timeout,
+    [BBL_RETRY_LCP]             = bbl_lcp_timeout,
+    [BBL_RETRY_LCP_TERMINATE]   = bbl_lcp_timeout,
+    [BBL_RETRY_AUTH]            = bbl_auth_timeout,
+    [BBL_RETRY_IPCP]            = bbl_ipcp_timeout,
+    [BBL_RETRY_IP6CP]           = bbl_ip6cp_timeout,
+    [BBL_RETRY_ICMPV6]          = bbl_icmpv6_timeout,
+    [BBL_RETRY_DHCPV6]          = bbl_dhcpv6_timeout,
+    [BBL_RETRY_ARP]             = bbl_arp_timeout,
+    [BBL_RETRY_ARP_REFRESH]     = bbl_arp_timeout,
+};
+
+static uint64_t
+bbl_retry_now (bbl_ctx_s *ctx) {
+    struct timespec now;
+    timer_clock_gettime(&ctx->timer_root, CLOCK_MONOTONIC, &now);
+    return (now.tv_sec * 1000ULL) + (now.tv_nsec / 1000000);
+}
+
+/*
+ * Queue session at the end of the given retransmission list.
+ * A session already queued is moved to the end, which
+ * restarts the timeout similar to timer_add().
+ */
+void
+bbl_retry_add (bbl_session_s *session, bbl_retry_type_t type) {
+    bbl_ctx_s *ctx = session->interface->ctx;
+
+    bbl_retry_del(session, type);
+    session->retry[type].expire = bbl_retry_now(ctx) + ctx->retry[type].timeout;
+    CIRCLEQ_INSERT_TAIL(&ctx->retry[type].qhead, session, retry[type].qnode);
+    ctx->retry[type].count++;
+}
+
+void
+bbl_retry_del (bbl_session_s *session, bbl_retry_type_t type) {
+    bbl_ctx_s *ctx = session->interface->ctx;
+
+    if(!CIRCLEQ_NEXT(session, retry[type].qnode)) {
+        return;
+    }
+    CIRCLEQ_REMOVE(&ctx->retry[type].qhead, session, retry[type].qnode);
+    CIRCLEQ_NEXT(session, retry[type].qnode) = NULL;
+    CIRCLEQ_PREV(session, retry[type].qnode) = NULL;
+    ctx->retry[type].count--;
+}
+
+void
+bbl_retry_del_all (bbl_session_s *session) {
+    int type;
+    for(type = 0; type < BBL_RETRY_MAX; type++) {
+        bbl_retry_del(session, type);
+    }
+}
+
+void
+bbl_retry_job (timer_s *timer) {
+    bbl_ctx_s *ctx = timer->data;
+    bbl_session_s *session;
+    uint64_t now = bbl_retry_now(ctx);
+    int type;
+
+    for(type = 0; type < BBL_RETRY_MAX; type++) {
+        while(!CIRCLEQ_EMPTY(&ctx->retry[type].qhead)) {
+            session = CIRCLEQ_FIRST(&ctx->retry[type].qhead);
+            if(session->retry[type].expire > now) {
+                /* All remaining sessions are queued later. */
+                break;
+            }
+            bbl_retry_del(session, type);
+            bbl_session_log_scope(session);
+            retry_handler[type](session);
+            log_scope_clear();
+        }
+    }
+}
+
+/*
+ * Set the timeouts of all retransmission lists
+ * from config and start the retransmission job.
+ */
+void
+bbl_retry_init (bbl_ctx_s *ctx) {
+    int type;
+
+    for(type = 0; type < BBL_RETRY_MAX; type++) {
+        CIRCLEQ_INIT(&ctx->retry[type].qhead);
+        ctx->retry[type].count = 0;
+    }
+    ctx->retry[BBL_RETRY_DISCOVERY].timeout = ctx->config.pppoe_discovery_timeout * 1000ULL;
+    ctx->retry[BBL_RETRY_LCP].timeout = ctx->config.lcp_conf_request_timeout * 1000ULL;
+    ctx->retry[BBL_RETRY_LCP_TERMINATE].timeout = 1000;
+    ctx->retry[BBL_RETRY_AUTH].timeout = ctx->config.authentication_timeout * 1000ULL;
+    ctx->retry[BBL_RETRY_IPCP].timeout = ctx->config.ipcp_conf_request_timeout * 1000ULL;
+    ctx->retry[BBL_RETRY_IP6CP].timeout = ctx->config.ip6cp_conf_request_timeout * 1000ULL;
+    ctx->retry[BBL_RETRY_ICMPV6].timeout = 5000;
+    ctx->retry[BBL_RETRY_DHCPV6].timeout = 5000;
+    ctx->retry[BBL_RETRY_ARP].timeout = 1000;
+    ctx->retry[BBL_RETRY_ARP_REFRESH].timeout = 300000;
+
+    timer_add_periodic(&ctx->timer_root, &ctx->retry_timer, "Retransmission", 0,
+                       BBL_RETRY_INTERVAL_MSEC * MSEC, ctx, bbl_retry_job);
+}
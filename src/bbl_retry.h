@@ -0,0 +1,34 @@
+/*
+ * BNG Blaster (BBL) - Retransmission Lists
+ *
+ * Copyright (C) 2020-2021, RtBrick, Inc.
+ */
+
+#ifndef __BBL_RETRY_H__
+#define __BBL_RETRY_H__
+
+#define BBL_RETRY_INTERVAL_MSEC 100
+
+/* Retransmission handlers (bbl_tx.c) */
+void bbl_discovery_timeout (bbl_session_s *session);
+void bbl_lcp_timeout (bbl_session_s *session);
+void bbl_auth_timeout (bbl_session_s *session);
+void bbl_ipcp_timeout (bbl_session_s *session);
+void bbl_ip6cp_timeout (bbl_session_s *session);
+void bbl_icmpv6_timeout (bbl_session_s *session);
+void bbl_dhcpv6_timeout (bbl_session_s *session);
+void bbl_arp_timeout (bbl_session_s *session);
+
+void
+bbl_retry_init (bbl_ctx_s *ctx);
+
+void
+bbl_retry_add (bbl_session_s *session, bbl_retry_type_t type);
+
+void
+bbl_retry_del (bbl_session_s *session, bbl_retry_type_t type);
+
+void
+bbl_retry_del_all (bbl_session_s *session);
+
+#endif
@@ -9,6 +9,8 @@
 
 #include "bbl.h"
 #include "bbl_pcap.h"
+#include "bbl_recorder.h"
+#include "bbl_stats.h"
 #include <openssl/md5.h>
 #include <openssl/rand.h>
 
@@ -69,6 +71,7 @@ bbl_add_session_packets_ipv4 (bbl_ctx_s *ctx, bbl_session_s *session)
     udp.src = BBL_UDP_PORT;
     udp.dst = BBL_UDP_PORT;
     udp.protocol = UDP_PROTOCOL_BBL;
+    udp.checksum = ctx->config.session_traffic_ipv4_udp_checksum;
     udp.next = &bbl;
     session->access_ipv4_tx_seq = 1;
     if(!session->access_ipv4_tx_flow_id) {
@@ -330,6 +333,7 @@ bbl_lcp_echo(timer_s *timer)
     bbl_ctx_s *ctx;
 
     session = timer->data;
+    bbl_session_log_scope(session);
     interface = session->interface;
     ctx = interface->ctx;
 
@@ -366,6 +370,7 @@ bbl_igmp_zapping(timer_s *timer)
     bbl_igmp_group_s *group;
 
     session = timer->data;
+    bbl_session_log_scope(session);
     interface = session->interface;
     ctx = interface->ctx;
 
@@ -386,7 +391,7 @@ bbl_igmp_zapping(timer_s *timer)
     }
 
     if(session->zapping_view_start_time.tv_sec) {
-        clock_gettime(CLOCK_MONOTONIC, &time_now);
+        timer_clock_gettime(&ctx->timer_root, CLOCK_MONOTONIC, &time_now);
         timespec_sub(&time_diff, &time_now, &session->zapping_view_start_time);
         if(time_diff.tv_sec >= ctx->config.igmp_zap_view_duration) {
             session->zapping_view_start_time.tv_sec = 0;
@@ -412,6 +417,7 @@ bbl_igmp_zapping(timer_s *timer)
             session->stats.min_join_delay = join_delay;
         }
         session->stats.avg_join_delay = session->zapping_join_delay_sum / session->zapping_join_delay_count;
+        bbl_stats_setup_latency_add(&ctx->stats.igmp_join_delay, join_delay * 1000);
 
         LOG(IGMP, "IGMP (Q-in-Q %u:%u) ZAPPING %u ms join delay for group %s\n",
                 session->key.outer_vlan_id, session->key.inner_vlan_id,
@@ -460,6 +466,7 @@ bbl_igmp_zapping(timer_s *timer)
             session->stats.min_leave_delay = leave_delay;
         }
         session->stats.avg_leave_delay = session->zapping_leave_delay_sum / session->zapping_leave_delay_count;
+        bbl_stats_setup_latency_add(&ctx->stats.igmp_leave_delay, leave_delay * 1000);
 
         LOG(IGMP, "IGMP (Q-in-Q %u:%u) ZAPPING %u ms leave delay for group %s\n",
                     session->key.outer_vlan_id, session->key.inner_vlan_id,
@@ -498,7 +505,7 @@ bbl_igmp_zapping(timer_s *timer)
     session->zapping_count++;
     if(ctx->config.igmp_zap_count && ctx->config.igmp_zap_view_duration) {
         if(session->zapping_count >= ctx->config.igmp_zap_count) {
-            clock_gettime(CLOCK_MONOTONIC, &session->zapping_view_start_time);
+            timer_clock_gettime(&ctx->timer_root, CLOCK_MONOTONIC, &session->zapping_view_start_time);
         }
     }
 }
@@ -514,6 +521,8 @@ bbl_igmp_initial_join(timer_s *timer)
 
     int group_start_index = 0;
 
+    bbl_session_log_scope(session);
+
     if(session->session_state != BBL_ESTABLISHED ||
        session->ipcp_state != BBL_PPP_OPENED) {
         return;
@@ -572,6 +581,8 @@ bbl_igmp_timeout(timer_s *timer)
     int i;
     bool send = false;
 
+    bbl_session_log_scope(session);
+
     if(session->access_type == ACCESS_TYPE_PPPOE) {
         if(session->session_state != BBL_ESTABLISHED ||
         session->ipcp_state != BBL_PPP_OPENED) {
@@ -659,6 +670,7 @@ bbl_rx_dhcpv6(bbl_ipv6_t *ipv6, bbl_interface_s *interface, bbl_session_s *sessi
         }
         session->dhcpv6_received = true;
         session->send_requests &= ~BBL_SEND_DHCPV6_REQUEST;
+        bbl_stats_setup_phase_stop(ctx, session, BBL_SETUP_PHASE_DHCPV6);
     } else if(dhcpv6->type == DHCPV6_MESSAGE_ADVERTISE) {
         if(dhcpv6->ia_pd_option_len && dhcpv6->ia_pd_option_len < DHCPV6_BUFFER) {
             memcpy(session->dhcpv6_ia_pd_option, dhcpv6->ia_pd_option, dhcpv6->ia_pd_option_len);
@@ -670,11 +682,83 @@ bbl_rx_dhcpv6(bbl_ipv6_t *ipv6, bbl_interface_s *interface, bbl_session_s *sessi
     }
 }
 
+/*
+ * Account session traffic received on access interface
+ * (loss detection via flow sequence numbers).
+ */
+static void
+bbl_rx_session_traffic_access(bbl_interface_s *interface, bbl_session_s *session, bbl_bbl_t *bbl) {
+    switch (bbl->sub_type) {
+        case BBL_SUB_TYPE_IPV4:
+            if(bbl->outer_vlan_id != session->key.outer_vlan_id ||
+               bbl->inner_vlan_id != session->key.inner_vlan_id) {
+                interface->stats.session_ipv4_wrong_session++;
+                return;
+            }
+            interface->stats.session_ipv4_rx++;
+            session->stats.access_ipv4_rx++;
+            if(!session->access_ipv4_rx_first_seq) {
+                session->access_ipv4_rx_first_seq = bbl->flow_seq;
+                interface->ctx->stats.session_traffic_flows_verified++;
+            } else {
+                if(session->access_ipv4_rx_last_seq +1 != bbl->flow_seq) {
+                    interface->stats.session_ipv4_loss++;
+                    session->stats.access_ipv4_loss++;
+                    bbl_loss_gap(interface->ctx, session, BBL_LOSS_ACCESS_IPV4, bbl->flow_id,
+                                 session->access_ipv4_rx_last_seq + 1, bbl->flow_seq, &interface->rx_timestamp);
+                }
+            }
+            session->access_ipv4_rx_last_seq = bbl->flow_seq;
+            break;
+        case BBL_SUB_TYPE_IPV6:
+            if(bbl->outer_vlan_id != session->key.outer_vlan_id ||
+               bbl->inner_vlan_id != session->key.inner_vlan_id) {
+                interface->stats.session_ipv6_wrong_session++;
+                return;
+            }
+            interface->stats.session_ipv6_rx++;
+            session->stats.access_ipv6_rx++;
+            if(!session->access_ipv6_rx_first_seq) {
+                session->access_ipv6_rx_first_seq = bbl->flow_seq;
+                interface->ctx->stats.session_traffic_flows_verified++;
+            } else {
+                if(session->access_ipv6_rx_last_seq +1 != bbl->flow_seq) {
+                    interface->stats.session_ipv6_loss++;
+                    session->stats.access_ipv6_loss++;
+                    bbl_loss_gap(interface->ctx, session, BBL_LOSS_ACCESS_IPV6, bbl->flow_id,
+                                 session->access_ipv6_rx_last_seq + 1, bbl->flow_seq, &interface->rx_timestamp);
+                }
+            }
+            session->access_ipv6_rx_last_seq = bbl->flow_seq;
+            break;
+        case BBL_SUB_TYPE_IPV6PD:
+            if(bbl->outer_vlan_id != session->key.outer_vlan_id ||
+               bbl->inner_vlan_id != session->key.inner_vlan_id) {
+                interface->stats.session_ipv6pd_wrong_session++;
+                return;
+            }
+            interface->stats.session_ipv6pd_rx++;
+            session->stats.access_ipv6pd_rx++;
+            if(!session->access_ipv6pd_rx_first_seq) {
+                session->access_ipv6pd_rx_first_seq = bbl->flow_seq;
+                interface->ctx->stats.session_traffic_flows_verified++;
+            } else {
+                if(session->access_ipv6pd_rx_last_seq +1 != bbl->flow_seq) {
+                    interface->stats.session_ipv6pd_loss++;
+                    session->stats.access_ipv6pd_loss++;
+                    bbl_loss_gap(interface->ctx, session, BBL_LOSS_ACCESS_IPV6PD, bbl->flow_id,
+                                 session->access_ipv6pd_rx_last_seq + 1, bbl->flow_seq, &interface->rx_timestamp);
+                }
+            }
+            session->access_ipv6pd_rx_last_seq = bbl->flow_seq;
+            break;
+    }
+}
+
 void
 bbl_rx_udp(bbl_ipv6_t *ipv6, bbl_interface_s *interface, bbl_session_s *session) {
 
     bbl_udp_t *udp = (bbl_udp_t*)ipv6->next;
-    bbl_bbl_t *bbl = NULL;
 
     switch(udp->dst) {
         case DHCPV6_UDP_CLIENT:
@@ -682,84 +766,9 @@ bbl_rx_udp(bbl_ipv6_t *ipv6, bbl_interface_s *interface, bbl_session_s *session)
             bbl_rx_dhcpv6(ipv6, interface, session);
             interface->stats.dhcpv6_rx++;
             break;
-        case BBL_UDP_PORT:
-            bbl = (bbl_bbl_t*)udp->next;
-            break;
         default:
             break;
     }
-
-    /* BBL receive handler */
-    if(bbl && bbl->type == BBL_TYPE_UNICAST_SESSION) {
-        switch (bbl->sub_type) {
-            case BBL_SUB_TYPE_IPV4:
-                if(bbl->outer_vlan_id != session->key.outer_vlan_id ||
-                   bbl->inner_vlan_id != session->key.inner_vlan_id) {
-                    interface->stats.session_ipv4_wrong_session++;
-                    return;
-                }
-                interface->stats.session_ipv4_rx++;
-                session->stats.access_ipv4_rx++;
-                if(!session->access_ipv4_rx_first_seq) {
-                    session->access_ipv4_rx_first_seq = bbl->flow_seq;
-                    interface->ctx->stats.session_traffic_flows_verified++;
-                } else {
-                    if(session->access_ipv4_rx_last_seq +1 != bbl->flow_seq) {
-                        interface->stats.session_ipv4_loss++;
-                        session->stats.access_ipv4_loss++;
-                        LOG(LOSS, "LOSS (Q-in-Q %u:%u) flow: %lu seq: %lu last: %lu\n",
-                            session->key.outer_vlan_id, session->key.inner_vlan_id,
-                            bbl->flow_id, bbl->flow_seq, session->access_ipv4_rx_last_seq);
-                    }
-                }
-                session->access_ipv4_rx_last_seq = bbl->flow_seq;
-                break;
-            case BBL_SUB_TYPE_IPV6:
-                if(bbl->outer_vlan_id != session->key.outer_vlan_id ||
-                   bbl->inner_vlan_id != session->key.inner_vlan_id) {
-                    interface->stats.session_ipv6_wrong_session++;
-                    return;
-                }
-                interface->stats.session_ipv6_rx++;
-                session->stats.access_ipv6_rx++;
-                if(!session->access_ipv6_rx_first_seq) {
-                    session->access_ipv6_rx_first_seq = bbl->flow_seq;
-                    interface->ctx->stats.session_traffic_flows_verified++;
-                } else {
-                    if(session->access_ipv6_rx_last_seq +1 != bbl->flow_seq) {
-                        interface->stats.session_ipv6_loss++;
-                        session->stats.access_ipv6_loss++;
-                        LOG(LOSS, "LOSS (Q-in-Q %u:%u) flow: %lu seq: %lu last: %lu\n",
-                            session->key.outer_vlan_id, session->key.inner_vlan_id,
-                            bbl->flow_id, bbl->flow_seq, session->access_ipv6_rx_last_seq);
-                    }
-                }
-                session->access_ipv6_rx_last_seq = bbl->flow_seq;
-                break;
-            case BBL_SUB_TYPE_IPV6PD:
-                if(bbl->outer_vlan_id != session->key.outer_vlan_id ||
-                   bbl->inner_vlan_id != session->key.inner_vlan_id) {
-                    interface->stats.session_ipv6pd_wrong_session++;
-                    return;
-                }
-                interface->stats.session_ipv6pd_rx++;
-                session->stats.access_ipv6pd_rx++;
-                if(!session->access_ipv6pd_rx_first_seq) {
-                    session->access_ipv6pd_rx_first_seq = bbl->flow_seq;
-                    interface->ctx->stats.session_traffic_flows_verified++;
-                } else {
-                    if(session->access_ipv6pd_rx_last_seq +1 != bbl->flow_seq) {
-                        interface->stats.session_ipv6pd_loss++;
-                        session->stats.access_ipv6pd_loss++;
-                        LOG(LOSS, "LOSS (Q-in-Q %u:%u) flow: %lu seq: %lu last: %lu\n",
-                            session->key.outer_vlan_id, session->key.inner_vlan_id,
-                            bbl->flow_id, bbl->flow_seq, session->access_ipv6pd_rx_last_seq);
-                    }
-                }
-                session->access_ipv6pd_rx_last_seq = bbl->flow_seq;
-                break;
-        }
-    }
 }
 
 void
@@ -809,11 +818,13 @@ bbl_rx_icmpv6(bbl_ipv6_t *ipv6, bbl_interface_s *interface, bbl_session_s *sessi
                     session->dhcpv6_requested = true;
                     session->dhcpv6_type = DHCPV6_MESSAGE_SOLICIT;
                     session->send_requests |= BBL_SEND_DHCPV6_REQUEST;
+                    bbl_stats_setup_phase_start(session, BBL_SETUP_PHASE_DHCPV6);
                     bbl_session_tx_qnode_insert(session);
                 }
             }
         }
         session->icmpv6_ra_received = true;
+        bbl_stats_setup_phase_stop(ctx, session, BBL_SETUP_PHASE_ICMPV6_RA);
     } else if(icmpv6->type == IPV6_ICMPV6_NEIGHBOR_SOLICITATION) {
         session->send_requests |= BBL_IF_SEND_ICMPV6_NA;
     }
@@ -889,84 +900,43 @@ bbl_rx_igmp(bbl_ipv4_t *ipv4, bbl_session_s *session) {
     }
 }
 
-void
-bbl_rx_ipv4(bbl_ethernet_header_t *eth, bbl_ipv4_t *ipv4, bbl_interface_s *interface, bbl_session_s *session) {
+/*
+ * Account multicast traffic received on access interface
+ * for all joined or leaving groups matching the destination.
+ */
+static void
+bbl_rx_multicast(bbl_interface_s *interface, bbl_session_s *session, struct tpacket2_hdr *tphdr,
+                 uint32_t dst, bbl_bbl_t *bbl) {
 
-    bbl_udp_t *udp;
-    bbl_bbl_t *bbl = NULL;
     bbl_igmp_group_s *group = NULL;
     int i;
 
-    switch(ipv4->protocol) {
-        case PROTOCOL_IPV4_IGMP:
-            session->stats.igmp_rx++;
-            interface->stats.igmp_rx++;
-            return bbl_rx_igmp(ipv4, session);
-        case PROTOCOL_IPV4_ICMP:
-            session->stats.icmp_rx++;
-            interface->stats.icmp_rx++;
-            return bbl_rx_icmp(ipv4, session);
-        case PROTOCOL_IPV4_UDP:
-            udp = (bbl_udp_t*)ipv4->next;
-            if(udp->protocol == UDP_PROTOCOL_BBL) {
-                bbl = (bbl_bbl_t*)udp->next;
-            }
-            break;
-        default:
-            break;
-    }
-
-    /* BBL receive handler */
     if(bbl) {
-        if(bbl->type == BBL_TYPE_UNICAST_SESSION) {
-            if(bbl->outer_vlan_id != session->key.outer_vlan_id ||
-               bbl->inner_vlan_id != session->key.inner_vlan_id) {
-                interface->stats.session_ipv4_wrong_session++;
-                return;
-            }
-            interface->stats.session_ipv4_rx++;
-            session->stats.access_ipv4_rx++;
-            if(!session->access_ipv4_rx_first_seq) {
-                session->access_ipv4_rx_first_seq = bbl->flow_seq;
-                interface->ctx->stats.session_traffic_flows_verified++;
-            } else {
-                if(session->access_ipv4_rx_last_seq +1 != bbl->flow_seq) {
-                    interface->stats.session_ipv4_loss++;
-                    session->stats.access_ipv4_loss++;
-                    LOG(LOSS, "LOSS (Q-in-Q %u:%u) flow: %lu seq: %lu last: %lu\n",
-                        session->key.outer_vlan_id, session->key.inner_vlan_id,
-                        bbl->flow_id, bbl->flow_seq, session->access_ipv4_rx_last_seq);
-                }
-            }
-            session->access_ipv4_rx_last_seq = bbl->flow_seq;
-
-        } else if(bbl->type == BBL_TYPE_MULTICAST) {
-            /* Multicast receive handler */
+        if(bbl->type == BBL_TYPE_MULTICAST) {
             for(i=0; i < IGMP_MAX_GROUPS; i++) {
                 group = &session->igmp_groups[i];
-                if(ipv4->dst == group->group) {
+                if(dst == group->group) {
                     if(group->state >= IGMP_GROUP_ACTIVE) {
                         interface->stats.mc_rx++;
                         session->stats.mc_rx++;
                         group->packets++;
                         if(!group->first_mc_rx_time.tv_sec) {
-                            group->first_mc_rx_time.tv_sec = eth->rx_sec;
-                            group->first_mc_rx_time.tv_nsec = eth->rx_nsec;
+                            group->first_mc_rx_time.tv_sec = tphdr->tp_sec;
+                            group->first_mc_rx_time.tv_nsec = tphdr->tp_nsec;
                         } else if(bbl->flow_seq > session->mc_rx_last_seq + 1) {
                             interface->stats.mc_loss++;
                             session->stats.mc_loss++;
                             group->loss++;
-                            LOG(LOSS, "LOSS (Q-in-Q %u:%u) flow: %lu seq: %lu last: %lu\n",
-                                session->key.outer_vlan_id, session->key.inner_vlan_id,
-                                bbl->flow_id, bbl->flow_seq, session->mc_rx_last_seq);
+                            bbl_loss_gap(interface->ctx, session, BBL_LOSS_MULTICAST, bbl->flow_id,
+                                         session->mc_rx_last_seq + 1, bbl->flow_seq, &interface->rx_timestamp);
                         }
                         session->mc_rx_last_seq = bbl->flow_seq;
                     } else {
                         interface->stats.mc_rx++;
                         session->stats.mc_rx++;
                         group->packets++;
-                        group->last_mc_rx_time.tv_sec = eth->rx_sec;
-                        group->last_mc_rx_time.tv_nsec = eth->rx_nsec;
+                        group->last_mc_rx_time.tv_sec = tphdr->tp_sec;
+                        group->last_mc_rx_time.tv_nsec = tphdr->tp_nsec;
                         if(session->zapping_joined_group &&
                             session->zapping_leaved_group == group) {
                             if(session->zapping_joined_group->first_mc_rx_time.tv_sec) {
@@ -979,24 +949,23 @@ bbl_rx_ipv4(bbl_ethernet_header_t *eth, bbl_ipv4_t *ipv4, bbl_interface_s *inter
             }
         }
     } else {
-        /* Multicast receive handler */
         for(i=0; i < IGMP_MAX_GROUPS; i++) {
             group = &session->igmp_groups[i];
-            if(ipv4->dst == group->group) {
+            if(dst == group->group) {
                 if(group->state >= IGMP_GROUP_ACTIVE) {
                     interface->stats.mc_rx++;
                     session->stats.mc_rx++;
                     group->packets++;
                     if(!group->first_mc_rx_time.tv_sec) {
-                        group->first_mc_rx_time.tv_sec = eth->rx_sec;
-                        group->first_mc_rx_time.tv_nsec = eth->rx_nsec;
+                        group->first_mc_rx_time.tv_sec = tphdr->tp_sec;
+                        group->first_mc_rx_time.tv_nsec = tphdr->tp_nsec;
                     }
                 } else {
                     interface->stats.mc_rx++;
                     session->stats.mc_rx++;
                     group->packets++;
-                    group->last_mc_rx_time.tv_sec = eth->rx_sec;
-                    group->last_mc_rx_time.tv_nsec = eth->rx_nsec;
+                    group->last_mc_rx_time.tv_sec = tphdr->tp_sec;
+                    group->last_mc_rx_time.tv_nsec = tphdr->tp_nsec;
                     if(session->zapping_joined_group &&
                        session->zapping_leaved_group == group) {
                         if(session->zapping_joined_group->first_mc_rx_time.tv_sec) {
@@ -1009,6 +978,22 @@ bbl_rx_ipv4(bbl_ethernet_header_t *eth, bbl_ipv4_t *ipv4, bbl_interface_s *inter
     }
 }
 
+void
+bbl_rx_ipv4(bbl_ipv4_t *ipv4, bbl_interface_s *interface, bbl_session_s *session) {
+    switch(ipv4->protocol) {
+        case PROTOCOL_IPV4_IGMP:
+            session->stats.igmp_rx++;
+            interface->stats.igmp_rx++;
+            return bbl_rx_igmp(ipv4, session);
+        case PROTOCOL_IPV4_ICMP:
+            session->stats.icmp_rx++;
+            interface->stats.icmp_rx++;
+            return bbl_rx_icmp(ipv4, session);
+        default:
+            break;
+    }
+}
+
 void
 bbl_rx_ipv6(bbl_ethernet_header_t *eth __attribute__((unused)), bbl_ipv6_t *ipv6, bbl_interface_s *interface, bbl_session_s *session) {
     switch(ipv6->protocol) {
@@ -1125,6 +1110,7 @@ bbl_session_timeout(timer_s *timer)
     bbl_ctx_s *ctx;
 
     session = timer->data;
+    bbl_session_log_scope(session);
     interface = session->interface;
     ctx = interface->ctx;
 
@@ -1281,6 +1267,8 @@ bbl_rx_ip6cp(bbl_ethernet_header_t *eth, bbl_interface_s *interface, bbl_session
                     break;
                 case BBL_PPP_LOCAL_ACK:
                     session->ip6cp_state = BBL_PPP_OPENED;
+                    bbl_stats_setup_phase_stop(ctx, session, BBL_SETUP_PHASE_IP6CP);
+                    bbl_stats_setup_phase_start(session, BBL_SETUP_PHASE_ICMPV6_RA);
                     bbl_rx_established(eth, interface, session);
                     session->link_local_ipv6_address[0] = 0xfe;
                     session->link_local_ipv6_address[0] = 0x80;
@@ -1313,6 +1301,8 @@ bbl_rx_ip6cp(bbl_ethernet_header_t *eth, bbl_interface_s *interface, bbl_session
                     break;
                 case BBL_PPP_PEER_ACK:
                     session->ip6cp_state = BBL_PPP_OPENED;
+                    bbl_stats_setup_phase_stop(ctx, session, BBL_SETUP_PHASE_IP6CP);
+                    bbl_stats_setup_phase_start(session, BBL_SETUP_PHASE_ICMPV6_RA);
                     bbl_rx_established(eth, interface, session);
                     session->link_local_ipv6_address[0] = 0xfe;
                     session->link_local_ipv6_address[1] = 0x80;
@@ -1381,6 +1371,7 @@ bbl_rx_ipcp(bbl_ethernet_header_t *eth, bbl_interface_s *interface, bbl_session_
                     break;
                 case BBL_PPP_LOCAL_ACK:
                     session->ipcp_state = BBL_PPP_OPENED;
+                    bbl_stats_setup_phase_stop(ctx, session, BBL_SETUP_PHASE_IPCP);
                     bbl_rx_established(eth, interface, session);
                     LOG(IP, "IPv4 (Q-in-Q %u:%u) address %s\n",
                             session->key.outer_vlan_id, session->key.inner_vlan_id,
@@ -1417,6 +1408,7 @@ bbl_rx_ipcp(bbl_ethernet_header_t *eth, bbl_interface_s *interface, bbl_session_
                     break;
                 case BBL_PPP_PEER_ACK:
                     session->ipcp_state = BBL_PPP_OPENED;
+                    bbl_stats_setup_phase_stop(ctx, session, BBL_SETUP_PHASE_IPCP);
                     bbl_rx_established(eth, interface, session);
                     LOG(IP, "IPv4 (Q-in-Q %u:%u) address %s\n",
                             session->key.outer_vlan_id, session->key.inner_vlan_id,
@@ -1603,7 +1595,7 @@ bbl_rx_session(bbl_ethernet_header_t *eth, bbl_interface_s *interface, bbl_sessi
             interface->stats.chap_rx++;
             break;
         case PROTOCOL_IPV4:
-            bbl_rx_ipv4(eth, (bbl_ipv4_t*)pppoes->next, interface, session);
+            bbl_rx_ipv4((bbl_ipv4_t*)pppoes->next, interface, session);
             break;
         case PROTOCOL_IPV6:
             bbl_rx_ipv6(eth, (bbl_ipv6_t*)pppoes->next, interface, session);
@@ -1638,6 +1630,7 @@ bbl_rx_discovery(bbl_ethernet_header_t *eth, bbl_interface_s *interface, bbl_ses
             interface->stats.pads_rx++;
             if(session->session_state == BBL_PPPOE_REQUEST) {
                 session->pppoe_session_id = pppoed->session_id;
+                session->lcp_echo_template_len = 0;
                 bbl_session_update_state(ctx, session, BBL_PPP_LINK);
                 session->send_requests = BBL_SEND_LCP_REQUEST;
                 session->lcp_request_code = PPP_CODE_CONF_REQUEST;
@@ -1675,63 +1668,71 @@ bbl_rx_arp(bbl_ethernet_header_t *eth, bbl_interface_s *interface, bbl_session_s
     }
 }
 
-void
-bbl_rx_handler_access(bbl_ethernet_header_t *eth, bbl_interface_s *interface) {
-    bbl_ctx_s *ctx;
+/*
+ * Return active session for packets received on access
+ * interface or NULL if packet should be dropped.
+ */
+static bbl_session_s *
+bbl_rx_access_session(bbl_interface_s *interface, uint16_t outer_vlan_id, uint16_t inner_vlan_id) {
     bbl_session_s *session;
     void **search;
     session_key_t key;
-    ctx = interface->ctx;
+
     key.ifindex = interface->addr.sll_ifindex;
-    key.outer_vlan_id = eth->vlan_outer;
-    key.inner_vlan_id = eth->vlan_inner;
-    search = dict_search(ctx->session_dict, &key);
+    key.outer_vlan_id = outer_vlan_id;
+    key.inner_vlan_id = inner_vlan_id;
+    search = dict_search(interface->ctx->session_dict, &key);
     if(search) {
         session = *search;
         if(session->session_state != BBL_TERMINATED &&
            session->session_state != BBL_IDLE) {
-            switch (session->access_type) {
-                case ACCESS_TYPE_PPPOE:
-                    switch(eth->type) {
-                        case ETH_TYPE_PPPOE_DISCOVERY:
-                            bbl_rx_discovery(eth, interface, session);
-                            break;
-                        case ETH_TYPE_PPPOE_SESSION:
-                            bbl_rx_session(eth, interface, session);
-                            break;
-                        default:
-                            interface->stats.packets_rx_drop_unknown++;
-                            break;
-                    }
+            return session;
+        }
+    }
+    return NULL;
+}
+
+void
+bbl_rx_handler_access(bbl_ethernet_header_t *eth, bbl_interface_s *interface, bbl_session_s *session) {
+    switch (session->access_type) {
+        case ACCESS_TYPE_PPPOE:
+            switch(eth->type) {
+                case ETH_TYPE_PPPOE_DISCOVERY:
+                    bbl_rx_discovery(eth, interface, session);
                     break;
-                case ACCESS_TYPE_IPOE:
-                    switch(eth->type) {
-                        case ETH_TYPE_ARP:
-                            interface->stats.arp_rx++;
-                            bbl_rx_arp(eth, interface, session);
-                            break;
-                        case ETH_TYPE_IPV4:
-                            bbl_rx_ipv4(eth, (bbl_ipv4_t*)eth->next, interface, session);
-                            break;
-                        case ETH_TYPE_IPV6:
-                            bbl_rx_ipv6(eth, (bbl_ipv6_t*)eth->next, interface, session);
-                            break;
-                        default:
-                            interface->stats.packets_rx_drop_unknown++;
-                            break;
-                    }
+                case ETH_TYPE_PPPOE_SESSION:
+                    bbl_rx_session(eth, interface, session);
                     break;
                 default:
                     interface->stats.packets_rx_drop_unknown++;
                     break;
             }
-        }
+            break;
+        case ACCESS_TYPE_IPOE:
+            switch(eth->type) {
+                case ETH_TYPE_ARP:
+                    interface->stats.arp_rx++;
+                    bbl_rx_arp(eth, interface, session);
+                    break;
+                case ETH_TYPE_IPV4:
+                    bbl_rx_ipv4((bbl_ipv4_t*)eth->next, interface, session);
+                    break;
+                case ETH_TYPE_IPV6:
+                    bbl_rx_ipv6(eth, (bbl_ipv6_t*)eth->next, interface, session);
+                    break;
+                default:
+                    interface->stats.packets_rx_drop_unknown++;
+                    break;
+            }
+            break;
+        default:
+            interface->stats.packets_rx_drop_unknown++;
+            break;
     }
 }
 
 void
-bbl_rx_network_arp(bbl_ethernet_header_t *eth, bbl_interface_s *interface) {
-    bbl_arp_t *arp = (bbl_arp_t*)eth->next;
+bbl_rx_network_arp(bbl_arp_t *arp, bbl_interface_s *interface) {
     if(arp->sender_ip == interface->gateway) {
         interface->arp_resolved = true;
         if(*(uint32_t*)interface->gateway_mac == 0) {
@@ -1743,19 +1744,21 @@ bbl_rx_network_arp(bbl_ethernet_header_t *eth, bbl_interface_s *interface) {
     }
 }
 
+/*
+ * Only the ICMPv6 type is needed here, which is
+ * read from the parsed offsets without decoding.
+ */
 void
-bbl_rx_network_icmpv6(bbl_ethernet_header_t *eth, bbl_interface_s *interface) {
-    bbl_ipv6_t *ipv6;
-    bbl_icmpv6_t *icmpv6;
-    ipv6 = (bbl_ipv6_t*)eth->next;
-    icmpv6 = (bbl_icmpv6_t*)ipv6->next;
+bbl_rx_network_icmpv6(uint8_t *eth_start, bbl_parse_t *parse, bbl_interface_s *interface) {
+    uint8_t *src = eth_start + parse->l3_offset + 8;
+    uint8_t type = *(eth_start + parse->l4_offset);
 
-    if(memcmp(ipv6->src, interface->gateway6.address, ETH_ADDR_LEN) == 0) {
+    if(memcmp(src, interface->gateway6.address, ETH_ADDR_LEN) == 0) {
         interface->icmpv6_nd_resolved = true;
         if(*(uint32_t*)interface->gateway_mac == 0) {
-            memcpy(interface->gateway_mac, eth->src, ETH_ADDR_LEN);
+            memcpy(interface->gateway_mac, eth_start + ETH_ADDR_LEN, ETH_ADDR_LEN);
         }
-        switch(icmpv6->type) {
+        switch(type) {
             case IPV6_ICMPV6_NEIGHBOR_SOLICITATION:
                 interface->send_requests |= BBL_IF_SEND_ICMPV6_NA;
                 break;
@@ -1765,120 +1768,295 @@ bbl_rx_network_icmpv6(bbl_ethernet_header_t *eth, bbl_interface_s *interface) {
     }
 }
 
-void
-bbl_rx_handler_network(bbl_ethernet_header_t *eth, bbl_interface_s *interface) {
-
-    bbl_ctx_s *ctx;
-
-    bbl_ipv4_t *ipv4;
-    bbl_ipv6_t *ipv6;
-    bbl_udp_t *udp;
-    bbl_bbl_t *bbl = NULL;
-
+/*
+ * Account session traffic received on network interface
+ * (loss detection via flow sequence numbers).
+ */
+static void
+bbl_rx_session_traffic_network(bbl_interface_s *interface, bbl_bbl_t *bbl) {
+    bbl_ctx_s *ctx = interface->ctx;
     bbl_session_s *session;
     void **search;
     session_key_t key;
 
-    ctx = interface->ctx;
-    if(ctx->config.network_vlan && (ctx->config.network_vlan != eth->vlan_outer)) {
-        /* Drop wrong VLAN */
-        return;
+    key.ifindex = bbl->ifindex;
+    key.outer_vlan_id = bbl->outer_vlan_id;
+    key.inner_vlan_id = bbl->inner_vlan_id;
+    search = dict_search(ctx->session_dict, &key);
+    if(search) {
+        session = *search;
+        bbl_session_log_scope(session);
+        switch (bbl->sub_type) {
+            case BBL_SUB_TYPE_IPV4:
+                interface->stats.session_ipv4_rx++;
+                session->stats.network_ipv4_rx++;
+                if(!session->network_ipv4_rx_first_seq) {
+                    session->network_ipv4_rx_first_seq = bbl->flow_seq;
+                    interface->ctx->stats.session_traffic_flows_verified++;
+                } else {
+                    if(session->network_ipv4_rx_last_seq +1 != bbl->flow_seq) {
+                        interface->stats.session_ipv4_loss++;
+                        session->stats.network_ipv4_loss++;
+                        bbl_loss_gap(interface->ctx, session, BBL_LOSS_NETWORK_IPV4, bbl->flow_id,
+                                     session->network_ipv4_rx_last_seq + 1, bbl->flow_seq, &interface->rx_timestamp);
+                    }
+                }
+                session->network_ipv4_rx_last_seq = bbl->flow_seq;
+                break;
+            case BBL_SUB_TYPE_IPV6:
+                interface->stats.session_ipv6_rx++;
+                session->stats.network_ipv6_rx++;
+                if(!session->network_ipv6_rx_first_seq) {
+                    session->network_ipv6_rx_first_seq = bbl->flow_seq;
+                    interface->ctx->stats.session_traffic_flows_verified++;
+                } else {
+                    if(session->network_ipv6_rx_last_seq +1 != bbl->flow_seq) {
+                        interface->stats.session_ipv6_loss++;
+                        session->stats.network_ipv6_loss++;
+                        bbl_loss_gap(interface->ctx, session, BBL_LOSS_NETWORK_IPV6, bbl->flow_id,
+                                     session->network_ipv6_rx_last_seq + 1, bbl->flow_seq, &interface->rx_timestamp);
+                    }
+                }
+                session->network_ipv6_rx_last_seq = bbl->flow_seq;
+                break;
+            case BBL_SUB_TYPE_IPV6PD:
+                interface->stats.session_ipv6pd_rx++;
+                session->stats.network_ipv6pd_rx++;
+                if(!session->network_ipv6pd_rx_first_seq) {
+                    session->network_ipv6pd_rx_first_seq = bbl->flow_seq;
+                    interface->ctx->stats.session_traffic_flows_verified++;
+                } else {
+                    if(session->network_ipv6pd_rx_last_seq +1 != bbl->flow_seq) {
+                        interface->stats.session_ipv6pd_loss++;
+                        session->stats.network_ipv6pd_loss++;
+                        bbl_loss_gap(interface->ctx, session, BBL_LOSS_NETWORK_IPV6PD, bbl->flow_id,
+                                     session->network_ipv6pd_rx_last_seq + 1, bbl->flow_seq, &interface->rx_timestamp);
+                    }
+                }
+                session->network_ipv6pd_rx_last_seq = bbl->flow_seq;
+                break;
+            default:
+                break;
+        }
     }
+}
+
+/*
+ * Packets received on network interface are handled from the
+ * parsed offsets, only ARP and the BBL header are decoded.
+ */
+static protocol_error_t
+bbl_rx_handler_network(bbl_interface_s *interface, struct tpacket2_hdr *tphdr, uint8_t *eth_start, bbl_parse_t *parse) {
+    bbl_ctx_s *ctx = interface->ctx;
+    bbl_arp_t *arp;
+    bbl_bbl_t *bbl;
+    protocol_error_t result;
 
-    switch(eth->type) {
+    if(ctx->config.network_vlan && (ctx->config.network_vlan != (tphdr->tp_vlan_tci & ETH_VLAN_ID_MAX))) {
+        /* Drop wrong VLAN */
+        return PROTOCOL_SUCCESS;
+    }
+    switch(parse->eth_type) {
         case ETH_TYPE_ARP:
-            return bbl_rx_network_arp(eth, interface);
-        case ETH_TYPE_IPV4:
-            ipv4 = (bbl_ipv4_t*)eth->next;
-            if(ipv4->protocol == PROTOCOL_IPV4_UDP) {
-                udp = (bbl_udp_t*)ipv4->next;
-                if(udp->protocol == UDP_PROTOCOL_BBL) {
-                    bbl = (bbl_bbl_t*)udp->next;
-                }
+            result = decode_arp(eth_start + parse->l3_offset, parse->len - parse->l3_offset,
+                                ctx->sp_rx, SCRATCHPAD_LEN, &arp);
+            if(result == PROTOCOL_SUCCESS) {
+                bbl_rx_network_arp(arp, interface);
             }
-            break;
+            return result;
         case ETH_TYPE_IPV6:
-            ipv6 = (bbl_ipv6_t*)eth->next;
-            if(ipv6->protocol == IPV6_NEXT_HEADER_UDP) {
-                udp = (bbl_udp_t*)ipv6->next;
-                if(udp->protocol == UDP_PROTOCOL_BBL) {
-                    bbl = (bbl_bbl_t*)udp->next;
+            if(parse->ip_protocol == IPV6_NEXT_HEADER_ICMPV6) {
+                if(parse->l4_len < 4) {
+                    return DECODE_ERROR;
+                }
+                bbl_rx_network_icmpv6(eth_start, parse, interface);
+                return PROTOCOL_SUCCESS;
+            }
+            /* Fall through */
+        case ETH_TYPE_IPV4:
+            if(parse->ip_protocol == PROTOCOL_IPV4_UDP && parse->dst_port == BBL_UDP_PORT) {
+                result = decode_bbl_parsed(eth_start, parse->len, ctx->sp_rx, SCRATCHPAD_LEN, parse, &bbl);
+                if(result == PROTOCOL_SUCCESS && bbl->type == BBL_TYPE_UNICAST_SESSION) {
+                    bbl_rx_session_traffic_network(interface, bbl);
                 }
-            } else if(ipv6->protocol == IPV6_NEXT_HEADER_ICMPV6) {
-                return bbl_rx_network_icmpv6(eth, interface);
+                return result;
             }
             break;
         default:
             break;
     }
+    return UNKNOWN_PROTOCOL;
+}
 
-    if(bbl) {
+/*
+ * Check if packet received on access interface needs to be
+ * decoded, session and multicast traffic is handled from the
+ * parsed offsets.
+ */
+static bool
+bbl_rx_access_decode(bbl_session_s *session, bbl_parse_t *parse) {
+    if(!parse->l3_type) {
+        return true;
+    }
+    if((parse->eth_type == ETH_TYPE_PPPOE_SESSION) != (session->access_type == ACCESS_TYPE_PPPOE)) {
+        /* Dropped by access handler */
+        return true;
+    }
+    switch(parse->ip_protocol) {
+        case PROTOCOL_IPV4_IGMP:
+        case PROTOCOL_IPV4_ICMP:
+            return parse->l3_type == ETH_TYPE_IPV4;
+        case IPV6_NEXT_HEADER_ICMPV6:
+            return parse->l3_type == ETH_TYPE_IPV6;
+        case IPV6_NEXT_HEADER_UDP:
+            return parse->l3_type == ETH_TYPE_IPV6 &&
+                   (parse->dst_port == DHCPV6_UDP_CLIENT || parse->dst_port == DHCPV6_UDP_SERVER);
+        default:
+            return false;
+    }
+}
+
+/*
+ * Session and multicast traffic received on access interface,
+ * only the BBL header is decoded.
+ */
+static protocol_error_t
+bbl_rx_access_traffic(bbl_interface_s *interface, bbl_session_s *session, struct tpacket2_hdr *tphdr,
+                      uint8_t *eth_start, bbl_parse_t *parse) {
+    bbl_bbl_t *bbl = NULL;
+    protocol_error_t result;
+
+    if(parse->ip_protocol == PROTOCOL_IPV4_UDP && parse->dst_port == BBL_UDP_PORT) {
+        result = decode_bbl_parsed(eth_start, parse->len, interface->ctx->sp_rx, SCRATCHPAD_LEN, parse, &bbl);
+        if(result != PROTOCOL_SUCCESS) {
+            return result;
+        }
         if(bbl->type == BBL_TYPE_UNICAST_SESSION) {
-            key.ifindex = bbl->ifindex;
-            key.outer_vlan_id = bbl->outer_vlan_id;
-            key.inner_vlan_id = bbl->inner_vlan_id;
-            search = dict_search(ctx->session_dict, &key);
-            if(search) {
-                session = *search;
-                switch (bbl->sub_type) {
-                    case BBL_SUB_TYPE_IPV4:
-                        interface->stats.session_ipv4_rx++;
-                        session->stats.network_ipv4_rx++;
-                        if(!session->network_ipv4_rx_first_seq) {
-                            session->network_ipv4_rx_first_seq = bbl->flow_seq;
-                            interface->ctx->stats.session_traffic_flows_verified++;
-                        } else {
-                            if(session->network_ipv4_rx_last_seq +1 != bbl->flow_seq) {
-                                interface->stats.session_ipv4_loss++;
-                                session->stats.network_ipv4_loss++;
-                                LOG(LOSS, "LOSS (Q-in-Q %u:%u) flow: %lu seq: %lu last: %lu\n",
-                                    session->key.outer_vlan_id, session->key.inner_vlan_id,
-                                    bbl->flow_id, bbl->flow_seq, session->network_ipv4_rx_last_seq);
-                            }
-                        }
-                        session->network_ipv4_rx_last_seq = bbl->flow_seq;
-                        break;
-                    case BBL_SUB_TYPE_IPV6:
-                        interface->stats.session_ipv6_rx++;
-                        session->stats.network_ipv6_rx++;
-                        if(!session->network_ipv6_rx_first_seq) {
-                            session->network_ipv6_rx_first_seq = bbl->flow_seq;
-                            interface->ctx->stats.session_traffic_flows_verified++;
-                        } else {
-                            if(session->network_ipv6_rx_last_seq +1 != bbl->flow_seq) {
-                                interface->stats.session_ipv6_loss++;
-                                session->stats.network_ipv6_loss++;
-                                LOG(LOSS, "LOSS (Q-in-Q %u:%u) flow: %lu seq: %lu last: %lu\n",
-                                    session->key.outer_vlan_id, session->key.inner_vlan_id,
-                                    bbl->flow_id, bbl->flow_seq, session->network_ipv6_rx_last_seq);
-                            }
-                        }
-                        session->network_ipv6_rx_last_seq = bbl->flow_seq;
-                        break;
-                    case BBL_SUB_TYPE_IPV6PD:
-                        interface->stats.session_ipv6pd_rx++;
-                        session->stats.network_ipv6pd_rx++;
-                        if(!session->network_ipv6pd_rx_first_seq) {
-                            session->network_ipv6pd_rx_first_seq = bbl->flow_seq;
-                            interface->ctx->stats.session_traffic_flows_verified++;
-                        } else {
-                            if(session->network_ipv6pd_rx_last_seq +1 != bbl->flow_seq) {
-                                interface->stats.session_ipv6pd_loss++;
-                                session->stats.network_ipv6pd_loss++;
-                                LOG(LOSS, "LOSS (Q-in-Q %u:%u) flow: %lu seq: %lu last: %lu\n",
-                                    session->key.outer_vlan_id, session->key.inner_vlan_id,
-                                    bbl->flow_id, bbl->flow_seq, session->network_ipv6pd_rx_last_seq);
-                            }
-                        }
-                        session->network_ipv6pd_rx_last_seq = bbl->flow_seq;
-                        break;
-                    default:
-                        break;
+            bbl_rx_session_traffic_access(interface, session, bbl);
+            return PROTOCOL_SUCCESS;
+        }
+    }
+    if(parse->l3_type == ETH_TYPE_IPV4) {
+        bbl_rx_multicast(interface, session, tphdr, *(uint32_t*)(eth_start + parse->l3_offset + 16), bbl);
+    }
+    return PROTOCOL_SUCCESS;
+}
+
+/*
+ * Fast path for session traffic.
+ *
+ * The BBL header is expected on the last 48 bytes of all data
+ * packets, so unicast session traffic can be accounted directly
+ * from the packet tail without decoding all headers. Returns
+ * false if the packet must be decoded (control traffic, multicast).
+ */
+static bool
+bbl_rx_fast_path(bbl_interface_s *interface, struct tpacket2_hdr *tphdr, uint8_t *eth_start, uint eth_len) {
+    bbl_ctx_s *ctx = interface->ctx;
+    bbl_session_s *session;
+    bbl_bbl_t *bbl;
+    uint16_t inner_vlan_id = 0;
+    uint16_t type;
+
+    if(eth_len < sizeof(struct ether_header) + BBL_HEADER_LEN) {
+        return false;
+    }
+    if(*(uint64_t*)(eth_start + eth_len - BBL_HEADER_LEN) != BBL_MAGIC_NUMBER) {
+        return false;
+    }
+    if(decode_bbl(eth_start + eth_len - BBL_HEADER_LEN, BBL_HEADER_LEN, ctx->sp_rx, SCRATCHPAD_LEN, &bbl) != PROTOCOL_SUCCESS ||
+       bbl->type != BBL_TYPE_UNICAST_SESSION) {
+        return false;
+    }
+
+    if(interface->access) {
+        if(bbl->direction != BBL_DIRECTION_DOWN) {
+            return false;
+        }
+        /* The outer VLAN is stripped from header */
+        type = be16toh(*(uint16_t*)(eth_start + 12));
+        if(type == ETH_TYPE_VLAN || type == ETH_TYPE_QINQ) {
+            inner_vlan_id = be16toh(*(uint16_t*)(eth_start + 14)) & ETH_VLAN_ID_MAX;
+        }
+        session = bbl_rx_access_session(interface, tphdr->tp_vlan_tci & ETH_VLAN_ID_MAX, inner_vlan_id);
+        if(session) {
+            bbl_rx_session_traffic_access(interface, session, bbl);
+        }
+    } else {
+        if(bbl->direction != BBL_DIRECTION_UP) {
+            return false;
+        }
+        if(ctx->config.network_vlan && (ctx->config.network_vlan != (tphdr->tp_vlan_tci & ETH_VLAN_ID_MAX))) {
+            /* Drop wrong VLAN */
+            return true;
+        }
+        bbl_rx_session_traffic_network(interface, bbl);
+    }
+    return true;
+}
+
+/*
+ * Process a single received frame. The outer VLAN is expected to
+ * be stripped from the frame and passed via tphdr->tp_vlan_tci,
+ * the same way as delivered by the kernel through the RX ring.
+ */
+void
+bbl_rx_packet (bbl_interface_s *interface, struct tpacket2_hdr *tphdr, uint8_t *eth_start, uint eth_len)
+{
+    bbl_ctx_s *ctx = interface->ctx;
+    bbl_ethernet_header_t *eth;
+    bbl_parse_t parse;
+    bbl_session_s *session = NULL;
+
+    protocol_error_t decode_result;
+
+    interface->stats.packets_rx++;
+
+    /*
+     * Dump the packet into pcap file.
+     */
+    bbl_capture_frame(ctx, interface, &interface->rx_timestamp, eth_start, eth_len,
+                      tphdr->tp_vlan_tci & ETH_VLAN_ID_MAX, PCAPNG_EPB_FLAGS_INBOUND);
+
+    if(bbl_rx_fast_path(interface, tphdr, eth_start, eth_len)) {
+        return;
+    }
+
+    /* Parse all headers in one pass, so that packets which are
+     * dropped or only accounted are not decoded. Control packets
+     * received on access interface are decoded from the parsed
+     * L3 offset. */
+    decode_result = parse_ethernet(eth_start, eth_len, &parse);
+    if(decode_result == PROTOCOL_SUCCESS) {
+        if(interface->access) {
+            /* The outer VLAN is stripped from header */
+            session = bbl_rx_access_session(interface, tphdr->tp_vlan_tci & ETH_VLAN_ID_MAX, parse.vlan_outer);
+            if(!session) return;
+            bbl_session_log_scope(session);
+            if(bbl_rx_access_decode(session, &parse)) {
+                decode_result = decode_ethernet_parsed(eth_start, eth_len, ctx->sp_rx, SCRATCHPAD_LEN, &parse, &eth);
+                if(decode_result == PROTOCOL_SUCCESS) {
+                    /* The outer VLAN is stripped from header */
+                    eth->vlan_inner = eth->vlan_outer;
+                    eth->vlan_outer = tphdr->tp_vlan_tci & ETH_VLAN_ID_MAX;
+                    /* Copy RX timestamp */
+                    eth->rx_sec = tphdr->tp_sec; /* ktime/hw timestamp */
+                    eth->rx_nsec = tphdr->tp_nsec; /* ktime/hw timestamp */
+                    bbl_rx_handler_access(eth, interface, session);
                 }
+            } else {
+                decode_result = bbl_rx_access_traffic(interface, session, tphdr, eth_start, &parse);
             }
+        } else {
+            decode_result = bbl_rx_handler_network(interface, tphdr, eth_start, &parse);
         }
-    } else {
+        log_scope_clear();
+    }
+
+    if(decode_result == UNKNOWN_PROTOCOL) {
         interface->stats.packets_rx_drop_unknown++;
+    } else if(decode_result != PROTOCOL_SUCCESS) {
+        interface->stats.packets_rx_drop_decode_error++;
     }
 }
 
@@ -1891,12 +2069,6 @@ bbl_rx_job (timer_s *timer)
     u_char* frame_ptr;
     struct pollfd fds[1] = {0};
 
-    uint8_t *eth_start;
-    uint eth_len;
-    bbl_ethernet_header_t *eth;
-
-    protocol_error_t decode_result;
-
     interface = timer->data;
     if (!interface) {
         return;
@@ -1908,7 +2080,7 @@ bbl_rx_job (timer_s *timer)
     fds[0].revents = 0;
 
     /* Get RX timestamp */
-    clock_gettime(CLOCK_REALTIME, &interface->rx_timestamp);
+    timer_clock_gettime(&ctx->timer_root, CLOCK_REALTIME, &interface->rx_timestamp);
 
     while (true) {
 
@@ -1926,39 +2098,7 @@ bbl_rx_job (timer_s *timer)
             return;
         }
 
-        //printf("consumed packet #%llu, %p, len %u\n", interface->packets, frame_ptr, tphdr->tp_len);
-        interface->stats.packets_rx++;
-
-        eth_start = (uint8_t*)tphdr + tphdr->tp_mac;
-        eth_len = tphdr->tp_len;
-
-        /*
-	     * Dump the packet into pcap file.
-	     */
-        if (ctx->pcap.write_buf) {
-	        pcapng_push_packet_header(ctx, &interface->rx_timestamp, eth_start, eth_len,
-				                      interface->pcap_index, PCAPNG_EPB_FLAGS_INBOUND);
-        }
-
-        decode_result = decode_ethernet(eth_start, eth_len, interface->ctx->sp_rx, SCRATCHPAD_LEN, &eth);
-
-        if(decode_result == PROTOCOL_SUCCESS) {
-            /* The outer VLAN is stripped from header */
-            eth->vlan_inner = eth->vlan_outer;
-            eth->vlan_outer = tphdr->tp_vlan_tci & ETH_VLAN_ID_MAX;
-            /* Copy RX timestamp */
-            eth->rx_sec = tphdr->tp_sec; /* ktime/hw timestamp */
-            eth->rx_nsec = tphdr->tp_nsec; /* ktime/hw timestamp */
-            if(interface->access) {
-                bbl_rx_handler_access(eth, interface);
-            } else {
-                bbl_rx_handler_network(eth, interface);
-            }
-        } else if (decode_result == UNKNOWN_PROTOCOL) {
-            interface->stats.packets_rx_drop_unknown++;
-        } else {
-            interface->stats.packets_rx_drop_decode_error++;
-        }
+        bbl_rx_packet(interface, tphdr, (uint8_t*)tphdr + tphdr->tp_mac, tphdr->tp_len);
 
         tphdr->tp_status = TP_STATUS_KERNEL; /* Return ownership back to kernel */
         interface->cursor_rx = (interface->cursor_rx + 1) % interface->req_rx.tp_frame_nr;
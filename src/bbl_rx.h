@@ -10,9 +10,14 @@
 #ifndef __BBL_RX_H__
 #define __BBL_RX_H__
 
+struct bbl_interface_;
+
 void
 bbl_igmp_timeout(timer_s *timer);
 
+void
+bbl_rx_packet (struct bbl_interface_ *interface, struct tpacket2_hdr *tphdr, uint8_t *eth_start, uint eth_len);
+
 void
 bbl_rx_job (timer_s *timer);
 
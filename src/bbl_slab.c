@@ -0,0 +1,133 @@
+/*
+ * BNG Blaster (BBL) - Slab Allocator
+ *
+ * Sessions, timers and timer buckets are allocated from
+ * per type slabs instead of individual calloc() calls to
+ * keep hot data densely packed on few (huge) pages and
+ * optionally on the NUMA node of the network interface.
+ *
+ * Copyright (C) 2020-2021, RtBrick, Inc.
+ */
+
+#include "bbl.h"
+#include <sys/syscall.h>
+
+#define BBL_SLAB_MPOL_PREFERRED 1
+
+void
+bbl_slab_init (bbl_slab_s *slab, const char *name, size_t size, bool hugepages, int numa_node)
+{
+    memset(slab, 0x0, sizeof(bbl_slab_s));
+    snprintf(slab->name, sizeof(slab->name), "%s", name);
+    slab->size = (size + BBL_SLAB_ALIGN - 1) & ~(BBL_SLAB_ALIGN - 1);
+    slab->chunk_size = BBL_SLAB_CHUNK_SIZE;
+    while(slab->chunk_size < slab->size) {
+        slab->chunk_size += BBL_SLAB_CHUNK_SIZE;
+    }
+    slab->objects = slab->chunk_size / slab->size;
+    slab->hugepages = hugepages;
+    slab->numa_node = numa_node;
+}
+
+/*
+ * Return NUMA node of the given network interface
+ * or -1 if unknown (e.g. virtual interfaces).
+ */
+int
+bbl_slab_numa_node (const char *interface_name)
+{
+    char path[128];
+    FILE *file;
+    int node = -1;
+
+    snprintf(path, sizeof(path), "/sys/class/net/%s/device/numa_node", interface_name);
+    file = fopen(path, "r");
+    if(file) {
+        if(fscanf(file, "%d", &node) != 1) {
+            node = -1;
+        }
+        fclose(file);
+    }
+    return node;
+}
+
+static bool
+bbl_slab_grow (bbl_slab_s *slab)
+{
+    uint8_t *chunk = MAP_FAILED;
+    unsigned long nodemask;
+    uint32_t i;
+
+    if(slab->hugepages) {
+        chunk = mmap(NULL, slab->chunk_size, PROT_READ|PROT_WRITE,
+                     MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+        if(chunk == MAP_FAILED) {
+            LOG(DEBUG, "Slab %s failed to allocate huge pages, fallback to normal pages\n", slab->name);
+        } else {
+            slab->chunks_hugepages++;
+        }
+    }
+    if(chunk == MAP_FAILED) {
+        chunk = mmap(NULL, slab->chunk_size, PROT_READ|PROT_WRITE,
+                     MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if(chunk == MAP_FAILED) {
+            return false;
+        }
+    }
+    if(slab->numa_node >= 0 && slab->numa_node < (int)(sizeof(nodemask) * 8)) {
+        /* Memory is not touched yet, so pages will be
+         * faulted in on the preferred node. */
+        nodemask = 1UL << slab->numa_node;
+        if(syscall(SYS_mbind, chunk, slab->chunk_size, BBL_SLAB_MPOL_PREFERRED,
+                   &nodemask, sizeof(nodemask) * 8, 0) != 0) {
+            LOG(DEBUG, "Slab %s failed to bind to NUMA node %d (%s)\n", slab->name, slab->numa_node, strerror(errno));
+        }
+    }
+
+    /* Put all objects of the new chunk on the free list. */
+    for(i = slab->objects; i > 0; i--) {
+        *(void**)(chunk + ((i-1) * slab->size)) = slab->free_list;
+        slab->free_list = chunk + ((i-1) * slab->size);
+    }
+    slab->chunks++;
+    slab->bytes += slab->chunk_size;
+    return true;
+}
+
+/*
+ * Allocate zeroed object.
+ */
+void *
+bbl_slab_alloc (bbl_slab_s *slab)
+{
+    void *object;
+
+    if(!slab->free_list) {
+        if(!bbl_slab_grow(slab)) {
+            slab->failed++;
+            return NULL;
+        }
+    }
+    object = slab->free_list;
+    slab->free_list = *(void**)object;
+    memset(object, 0x0, slab->size);
+
+    slab->allocs++;
+    slab->in_use++;
+    if(slab->in_use > slab->in_use_max) {
+        slab->in_use_max = slab->in_use;
+    }
+    return object;
+}
+
+void
+bbl_slab_free (bbl_slab_s *slab, void *object)
+{
+    if(!object) {
+        return;
+    }
+    *(void**)object = slab->free_list;
+    slab->free_list = object;
+    slab->frees++;
+    slab->in_use--;
+}
@@ -0,0 +1,45 @@
+/*
+ * BNG Blaster (BBL) - Slab Allocator
+ *
+ * Copyright (C) 2020-2021, RtBrick, Inc.
+ */
+
+#ifndef __BBL_SLAB_H__
+#define __BBL_SLAB_H__
+
+#define BBL_SLAB_CHUNK_SIZE     (2*1024*1024) /* 2MB (huge page size) */
+#define BBL_SLAB_ALIGN          64 /* cache line */
+
+/*
+ * Fixed size object allocator. Objects are carved out of
+ * large chunks which are never returned to the system,
+ * freed objects are kept on a free list for reuse.
+ */
+typedef struct bbl_slab_
+{
+    char name[32];
+    size_t size; /* object size (cache line aligned) */
+    size_t chunk_size;
+    uint32_t objects; /* objects per chunk */
+
+    bool hugepages; /* try MAP_HUGETLB */
+    int numa_node; /* preferred NUMA node or -1 */
+
+    void *free_list;
+
+    uint64_t chunks;
+    uint64_t chunks_hugepages;
+    uint64_t bytes;
+    uint64_t in_use;
+    uint64_t in_use_max;
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t failed;
+} bbl_slab_s;
+
+void bbl_slab_init(bbl_slab_s *slab, const char *name, size_t size, bool hugepages, int numa_node);
+void *bbl_slab_alloc(bbl_slab_s *slab);
+void bbl_slab_free(bbl_slab_s *slab, void *object);
+int bbl_slab_numa_node(const char *interface_name);
+
+#endif
@@ -9,10 +9,73 @@
 
 #include "bbl.h"
 #include "bbl_stats.h"
-#include <jansson.h>
+#include "bbl_replay.h"
+#include "bbl_pcap.h"
+#include "bbl_recorder.h"
 
 extern const char banner[];
 
+const char *setup_phase_names[BBL_SETUP_PHASE_MAX] = {
+    "padi-pado", "padr-pads", "lcp", "authentication",
+    "ipcp", "ip6cp", "icmpv6-rs-ra", "dhcpv6", "total"
+};
+
+static const char *setup_phase_labels[BBL_SETUP_PHASE_MAX] = {
+    "PADI -> PADO", "PADR -> PADS", "LCP", "Authentication",
+    "IPCP", "IP6CP", "RS -> RA", "DHCPv6", "Total"
+};
+
+static uint64_t
+bbl_stats_now_us (bbl_ctx_s *ctx) {
+    struct timespec now;
+    timer_clock_gettime(&ctx->timer_root, CLOCK_MONOTONIC, &now);
+    return (now.tv_sec * 1000000ULL) + (now.tv_nsec / 1000);
+}
+
+void
+bbl_stats_setup_latency_add (bbl_setup_latency_s *latency, uint32_t us) {
+    uint32_t ms = us / 1000;
+    int i = 0;
+
+    while(ms && i < BBL_SETUP_LATENCY_BUCKETS - 1) {
+        ms >>= 1;
+        i++;
+    }
+    latency->bucket[i]++;
+    if(!latency->count || us < latency->min_us) latency->min_us = us;
+    if(us > latency->max_us) latency->max_us = us;
+    latency->sum_us += us;
+    latency->count++;
+}
+
+/*
+ * Remember the start of the given setup phase.
+ */
+void
+bbl_stats_setup_phase_start (bbl_session_s *session, bbl_setup_phase_t phase) {
+    session->setup_phase_start[phase] = bbl_stats_now_us(session->interface->ctx);
+}
+
+/*
+ * Account the time since the start of the given setup phase
+ * to the global and per access config latency statistics.
+ * Only the first completion after a start is counted.
+ */
+void
+bbl_stats_setup_phase_stop (bbl_ctx_s *ctx, bbl_session_s *session, bbl_setup_phase_t phase) {
+    uint64_t us;
+
+    if(!session->setup_phase_start[phase]) return;
+    us = bbl_stats_now_us(ctx) - session->setup_phase_start[phase];
+    session->setup_phase_start[phase] = 0;
+    if(us > UINT32_MAX) us = UINT32_MAX;
+
+    bbl_stats_setup_latency_add(&ctx->stats.setup_latency[phase], us);
+    if(session->access_config) {
+        bbl_stats_setup_latency_add(&session->access_config->setup_latency[phase], us);
+    }
+}
+
 void
 bbl_stats_update_cps (bbl_ctx_s *ctx) {
     struct timespec time_diff = {0};
@@ -47,111 +110,138 @@ bbl_stats_update_cps (bbl_ctx_s *ctx) {
     }
 }
 
-void
-bbl_stats_generate (bbl_ctx_s *ctx, bbl_stats_t * stats) {
+/*
+ * Add session to report stats. Sessions are added when the
+ * report is generated, such that terminated sessions include
+ * all counter updates after they were terminated.
+ */
+static void
+bbl_stats_add_session (bbl_stats_t *stats, bbl_session_s *session) {
+    /* Multicast */
+    stats->mc_old_rx_after_first_new += session->stats.mc_old_rx_after_first_new;
+    stats->mc_not_received += session->stats.mc_not_received;
+
+    if(session->stats.avg_join_delay) {
+        stats->join_delays++;
+        stats->avg_join_delay += session->stats.avg_join_delay;
+        if(session->stats.max_join_delay > stats->max_join_delay) stats->max_join_delay = session->stats.max_join_delay;
+        if(stats->min_join_delay) {
+            if(session->stats.min_join_delay < stats->min_join_delay) stats->min_join_delay = session->stats.min_join_delay;
+        } else {
+            stats->min_join_delay = session->stats.min_join_delay;
+        }
 
-    struct dict_itor *itor;
-    bbl_session_s *session;
+    }
+    if(session->stats.avg_leave_delay) {
+        stats->leave_delays++;
+        stats->avg_leave_delay += session->stats.avg_leave_delay;
+        if(session->stats.max_leave_delay > stats->max_leave_delay) stats->max_leave_delay = session->stats.max_leave_delay;
+        if(stats->min_leave_delay) {
+            if(session->stats.min_leave_delay < stats->min_leave_delay) stats->min_leave_delay = session->stats.min_leave_delay;
+        } else {
+            stats->min_leave_delay = session->stats.min_leave_delay;
+        }
+    }
 
-    int join_delays = 0;
-    int leave_delays = 0;
+    /* Session Traffic */
+    if(session->access_ipv4_rx_first_seq) stats->sessions_access_ipv4_rx++;
+    if(session->network_ipv4_rx_first_seq) stats->sessions_network_ipv4_rx++;
+    if(session->access_ipv6_rx_first_seq) stats->sessions_access_ipv6_rx++;
+    if(session->network_ipv6_rx_first_seq) stats->sessions_network_ipv6_rx++;
+    if(session->access_ipv6pd_rx_first_seq) stats->sessions_access_ipv6pd_rx++;
+    if(session->network_ipv6pd_rx_first_seq) stats->sessions_network_ipv6pd_rx++;
 
-    bbl_stats_update_cps(ctx);
+    if(stats->min_access_ipv4_rx_first_seq) {
+        if(session->access_ipv4_rx_first_seq < stats->min_access_ipv4_rx_first_seq) stats->min_access_ipv4_rx_first_seq = session->access_ipv4_rx_first_seq;
+    } else {
+        stats->min_access_ipv4_rx_first_seq = session->access_ipv4_rx_first_seq;
+    }
+    if(session->access_ipv4_rx_first_seq > stats->max_access_ipv4_rx_first_seq) stats->max_access_ipv4_rx_first_seq = session->access_ipv4_rx_first_seq;
 
-    /* Iterate over all sessions */
-    itor = dict_itor_new(ctx->session_dict);
-    dict_itor_first(itor);
-    for (; dict_itor_valid(itor); dict_itor_next(itor)) {
-        session = (bbl_session_s*)*dict_itor_datum(itor);
-
-        /* Multicast */
-        stats->mc_old_rx_after_first_new += session->stats.mc_old_rx_after_first_new;
-        stats->mc_not_received += session->stats.mc_not_received;
-
-        if(session->stats.avg_join_delay) {
-            join_delays++;
-            stats->avg_join_delay += session->stats.avg_join_delay;
-            if(session->stats.max_join_delay > stats->max_join_delay) stats->max_join_delay = session->stats.max_join_delay;
-            if(stats->min_join_delay) {
-                if(session->stats.min_join_delay < stats->min_join_delay) stats->min_join_delay = session->stats.min_join_delay;
-            } else {
-                stats->min_join_delay = session->stats.min_join_delay;
-            }
+    if(stats->min_network_ipv4_rx_first_seq) {
+        if(session->network_ipv4_rx_first_seq < stats->min_network_ipv4_rx_first_seq) stats->min_network_ipv4_rx_first_seq = session->network_ipv4_rx_first_seq;
+    } else {
+        stats->min_network_ipv4_rx_first_seq = session->network_ipv4_rx_first_seq;
+    }
+    if(session->network_ipv4_rx_first_seq > stats->max_network_ipv4_rx_first_seq) stats->max_network_ipv4_rx_first_seq = session->network_ipv4_rx_first_seq;
 
-        }
-        if(session->stats.avg_leave_delay) {
-            leave_delays++;
-            stats->avg_leave_delay += session->stats.avg_leave_delay;
-            if(session->stats.max_leave_delay > stats->max_leave_delay) stats->max_leave_delay = session->stats.max_leave_delay;
-            if(stats->min_leave_delay) {
-                if(session->stats.min_leave_delay < stats->min_leave_delay) stats->min_leave_delay = session->stats.min_leave_delay;
-            } else {
-                stats->min_leave_delay = session->stats.min_leave_delay;
-            }
-        }
+    if(stats->min_access_ipv6_rx_first_seq) {
+        if(session->access_ipv6_rx_first_seq < stats->min_access_ipv6_rx_first_seq) stats->min_access_ipv6_rx_first_seq = session->access_ipv6_rx_first_seq;
+    } else {
+        stats->min_access_ipv6_rx_first_seq = session->access_ipv6_rx_first_seq;
+    }
+    if(session->access_ipv6_rx_first_seq > stats->max_access_ipv6_rx_first_seq) stats->max_access_ipv6_rx_first_seq = session->access_ipv6_rx_first_seq;
 
-        /* Session Traffic */
-        if(session->access_ipv4_rx_first_seq) stats->sessions_access_ipv4_rx++;
-        if(session->network_ipv4_rx_first_seq) stats->sessions_network_ipv4_rx++;
-        if(session->access_ipv6_rx_first_seq) stats->sessions_access_ipv6_rx++;
-        if(session->network_ipv6_rx_first_seq) stats->sessions_network_ipv6_rx++;
-        if(session->access_ipv6pd_rx_first_seq) stats->sessions_access_ipv6pd_rx++;
-        if(session->network_ipv6pd_rx_first_seq) stats->sessions_network_ipv6pd_rx++;
+    if(stats->min_network_ipv6_rx_first_seq) {
+        if(session->network_ipv6_rx_first_seq < stats->min_network_ipv6_rx_first_seq) stats->min_network_ipv6_rx_first_seq = session->network_ipv6_rx_first_seq;
+    } else {
+        stats->min_network_ipv6_rx_first_seq = session->network_ipv6_rx_first_seq;
+    }
+    if(session->network_ipv6_rx_first_seq > stats->max_network_ipv6_rx_first_seq) stats->max_network_ipv6_rx_first_seq = session->network_ipv6_rx_first_seq;
 
-        if(stats->min_access_ipv4_rx_first_seq) {
-            if(session->access_ipv4_rx_first_seq < stats->min_access_ipv4_rx_first_seq) stats->min_access_ipv4_rx_first_seq = session->access_ipv4_rx_first_seq;
-        } else {
-            stats->min_access_ipv4_rx_first_seq = session->access_ipv4_rx_first_seq;
-        }
-        if(session->access_ipv4_rx_first_seq > stats->max_access_ipv4_rx_first_seq) stats->max_access_ipv4_rx_first_seq = session->access_ipv4_rx_first_seq;
+    if(stats->min_access_ipv6pd_rx_first_seq) {
+        if(session->access_ipv6pd_rx_first_seq < stats->min_access_ipv6pd_rx_first_seq) stats->min_access_ipv6pd_rx_first_seq = session->access_ipv6pd_rx_first_seq;
+    } else {
+        stats->min_access_ipv6pd_rx_first_seq = session->access_ipv6pd_rx_first_seq;
+    }
+    if(session->access_ipv6pd_rx_first_seq > stats->max_access_ipv6pd_rx_first_seq) stats->max_access_ipv6pd_rx_first_seq = session->access_ipv6pd_rx_first_seq;
 
-        if(stats->min_network_ipv4_rx_first_seq) {
-            if(session->network_ipv4_rx_first_seq < stats->min_network_ipv4_rx_first_seq) stats->min_network_ipv4_rx_first_seq = session->network_ipv4_rx_first_seq;
-        } else {
-            stats->min_network_ipv4_rx_first_seq = session->network_ipv4_rx_first_seq;
-        }
-        if(session->network_ipv4_rx_first_seq > stats->max_network_ipv4_rx_first_seq) stats->max_network_ipv4_rx_first_seq = session->network_ipv4_rx_first_seq;
+    if(stats->min_network_ipv6pd_rx_first_seq) {
+        if(session->network_ipv6pd_rx_first_seq < stats->min_network_ipv6pd_rx_first_seq) stats->min_network_ipv6pd_rx_first_seq = session->network_ipv6pd_rx_first_seq;
+    } else {
+        stats->min_network_ipv6pd_rx_first_seq = session->network_ipv6pd_rx_first_seq;
+    }
+    if(session->network_ipv6pd_rx_first_seq > stats->max_network_ipv6pd_rx_first_seq) stats->max_network_ipv6pd_rx_first_seq = session->network_ipv6pd_rx_first_seq;
+}
 
-        if(stats->min_access_ipv6_rx_first_seq) {
-            if(session->access_ipv6_rx_first_seq < stats->min_access_ipv6_rx_first_seq) stats->min_access_ipv6_rx_first_seq = session->access_ipv6_rx_first_seq;
-        } else {
-            stats->min_access_ipv6_rx_first_seq = session->access_ipv6_rx_first_seq;
-        }
-        if(session->access_ipv6_rx_first_seq > stats->max_access_ipv6_rx_first_seq) stats->max_access_ipv6_rx_first_seq = session->access_ipv6_rx_first_seq;
+void
+bbl_stats_generate (bbl_ctx_s *ctx, bbl_stats_t * stats) {
 
-        if(stats->min_network_ipv6_rx_first_seq) {
-            if(session->network_ipv6_rx_first_seq < stats->min_network_ipv6_rx_first_seq) stats->min_network_ipv6_rx_first_seq = session->network_ipv6_rx_first_seq;
-        } else {
-            stats->min_network_ipv6_rx_first_seq = session->network_ipv6_rx_first_seq;
-        }
-        if(session->network_ipv6_rx_first_seq > stats->max_network_ipv6_rx_first_seq) stats->max_network_ipv6_rx_first_seq = session->network_ipv6_rx_first_seq;
+    bbl_session_s *session;
+    int list;
 
-        if(stats->min_access_ipv6pd_rx_first_seq) {
-            if(session->access_ipv6pd_rx_first_seq < stats->min_access_ipv6pd_rx_first_seq) stats->min_access_ipv6pd_rx_first_seq = session->access_ipv6pd_rx_first_seq;
-        } else {
-            stats->min_access_ipv6pd_rx_first_seq = session->access_ipv6pd_rx_first_seq;
-        }
-        if(session->access_ipv6pd_rx_first_seq > stats->max_access_ipv6pd_rx_first_seq) stats->max_access_ipv6pd_rx_first_seq = session->access_ipv6pd_rx_first_seq;
+    bbl_stats_update_cps(ctx);
 
-        if(stats->min_network_ipv6pd_rx_first_seq) {
-            if(session->network_ipv6pd_rx_first_seq < stats->min_network_ipv6pd_rx_first_seq) stats->min_network_ipv6pd_rx_first_seq = session->network_ipv6pd_rx_first_seq;
-        } else {
-            stats->min_network_ipv6pd_rx_first_seq = session->network_ipv6pd_rx_first_seq;
+    /* Iterate over all session lists */
+    for(list = 0; list < BBL_SESSIONS_MAX; list++) {
+        CIRCLEQ_FOREACH(session, &ctx->sessions_qhead[list], session_state_qnode) {
+            bbl_stats_add_session(stats, session);
         }
-        if(session->network_ipv6pd_rx_first_seq > stats->max_network_ipv6pd_rx_first_seq) stats->max_network_ipv6pd_rx_first_seq = session->network_ipv6pd_rx_first_seq;
-
     }
-    if(join_delays) {
-        stats->avg_join_delay = round(stats->avg_join_delay / join_delays);
+    if(stats->join_delays) {
+        stats->avg_join_delay = round(stats->avg_join_delay / stats->join_delays);
     }
-    if(leave_delays) {
-        stats->avg_leave_delay = round(stats->avg_leave_delay / leave_delays);
+    if(stats->leave_delays) {
+        stats->avg_leave_delay = round(stats->avg_leave_delay / stats->leave_delays);
     }
 }
 
+static void
+bbl_stats_setup_latency_stdout (bbl_setup_latency_s *latency, const char *indent) {
+    int phase;
+
+    for(phase = 0; phase < BBL_SETUP_PHASE_MAX; phase++) {
+        if(!latency[phase].count) continue;
+        printf("%s%-16s COUNT: %8u MIN: %9.3f AVG: %9.3f MAX: %9.3f ms\n", indent,
+            setup_phase_labels[phase], latency[phase].count,
+            latency[phase].min_us / 1000.0,
+            (latency[phase].sum_us / latency[phase].count) / 1000.0,
+            latency[phase].max_us / 1000.0);
+    }
+}
+
+static void
+bbl_stats_slab_stdout (bbl_slab_s *slab) {
+    if(!slab->chunks) return;
+    printf("  %-16s SIZE: %5zu IN-USE: %8lu MAX: %8lu CHUNKS: %4lu (%lu huge) %lu KB\n",
+        slab->name, slab->size, slab->in_use, slab->in_use_max,
+        slab->chunks, slab->chunks_hugepages, slab->bytes / 1024);
+}
+
 void
 bbl_stats_stdout (bbl_ctx_s *ctx, bbl_stats_t * stats) {
     struct bbl_interface_ *access_if;    
+    bbl_access_config_s *access_config;
     int i;
 
     printf("%s", banner);
@@ -164,6 +254,21 @@ bbl_stats_stdout (bbl_ctx_s *ctx, bbl_stats_t * stats) {
            ctx->stats.cps, ctx->stats.cps_min, ctx->stats.cps_avg, ctx->stats.cps_max);
     printf("Flapped: %u\n", ctx->sessions_flapped);
 
+    printf("\nSetup Latency:\n");
+    bbl_stats_setup_latency_stdout(ctx->stats.setup_latency, "  ");
+    if(ctx->config.access_config && ctx->config.access_config->next) {
+        access_config = ctx->config.access_config;
+        i = 1;
+        while(access_config) {
+            printf("  Access Config %d ( %s %s VLAN %u-%u:%u-%u ):\n", i++, access_config->interface,
+                access_config->access_type == ACCESS_TYPE_PPPOE ? "PPPoE" : "IPoE",
+                access_config->access_outer_vlan_min, access_config->access_outer_vlan_max,
+                access_config->access_inner_vlan_min, access_config->access_inner_vlan_max);
+            bbl_stats_setup_latency_stdout(access_config->setup_latency, "    ");
+            access_config = access_config->next;
+        }
+    }
+
     if(ctx->op.network_if) {
         printf("\nNetwork Interface ( %s ):\n", ctx->op.network_if->name);
         printf("  TX:                %10lu packets\n", ctx->op.network_if->stats.packets_tx);
@@ -212,30 +317,30 @@ bbl_stats_stdout (bbl_ctx_s *ctx, bbl_stats_t * stats) {
             printf("  TX Poll Kernel:    %10lu\n", access_if->stats.poll_tx);
             printf("  RX Poll Kernel:    %10lu\n", access_if->stats.poll_rx);
             printf("\n  Access Interface Protocol Packet Stats:\n");
-            printf("    ARP    TX: %10u RX: %10u\n", access_if->stats.arp_tx, access_if->stats.arp_rx);
-            printf("    PADI   TX: %10u RX: %10u\n", access_if->stats.padi_tx, 0);
-            printf("    PADO   TX: %10u RX: %10u\n", 0, access_if->stats.pado_rx);
-            printf("    PADR   TX: %10u RX: %10u\n", access_if->stats.padr_tx, 0);
-            printf("    PADS   TX: %10u RX: %10u\n", 0, access_if->stats.pads_rx);
-            printf("    PADT   TX: %10u RX: %10u\n", access_if->stats.padt_tx, access_if->stats.padt_rx);
-            printf("    LCP    TX: %10u RX: %10u\n", access_if->stats.lcp_tx, access_if->stats.lcp_rx);
-            printf("    PAP    TX: %10u RX: %10u\n", access_if->stats.pap_tx, access_if->stats.pap_rx);
-            printf("    CHAP   TX: %10u RX: %10u\n", access_if->stats.chap_tx, access_if->stats.chap_rx);
-            printf("    IPCP   TX: %10u RX: %10u\n", access_if->stats.ipcp_tx, access_if->stats.ipcp_rx);
-            printf("    IP6CP  TX: %10u RX: %10u\n", access_if->stats.ip6cp_tx, access_if->stats.ip6cp_rx);
-            printf("    IGMP   TX: %10u RX: %10u\n", access_if->stats.igmp_tx, access_if->stats.igmp_rx);
-            printf("    ICMP   TX: %10u RX: %10u\n", access_if->stats.icmp_tx, access_if->stats.icmp_rx);
-            printf("    ICMPv6 TX: %10u RX: %10u\n", access_if->stats.icmpv6_tx, access_if->stats.icmpv6_rx);
-            printf("    DHCPv6 TX: %10u RX: %10u\n", access_if->stats.dhcpv6_tx, access_if->stats.dhcpv6_rx);
+            printf("    ARP    TX: %10lu RX: %10lu\n", access_if->stats.arp_tx, access_if->stats.arp_rx);
+            printf("    PADI   TX: %10lu RX: %10lu\n", access_if->stats.padi_tx, 0UL);
+            printf("    PADO   TX: %10lu RX: %10lu\n", 0UL, access_if->stats.pado_rx);
+            printf("    PADR   TX: %10lu RX: %10lu\n", access_if->stats.padr_tx, 0UL);
+            printf("    PADS   TX: %10lu RX: %10lu\n", 0UL, access_if->stats.pads_rx);
+            printf("    PADT   TX: %10lu RX: %10lu\n", access_if->stats.padt_tx, access_if->stats.padt_rx);
+            printf("    LCP    TX: %10lu RX: %10lu\n", access_if->stats.lcp_tx, access_if->stats.lcp_rx);
+            printf("    PAP    TX: %10lu RX: %10lu\n", access_if->stats.pap_tx, access_if->stats.pap_rx);
+            printf("    CHAP   TX: %10lu RX: %10lu\n", access_if->stats.chap_tx, access_if->stats.chap_rx);
+            printf("    IPCP   TX: %10lu RX: %10lu\n", access_if->stats.ipcp_tx, access_if->stats.ipcp_rx);
+            printf("    IP6CP  TX: %10lu RX: %10lu\n", access_if->stats.ip6cp_tx, access_if->stats.ip6cp_rx);
+            printf("    IGMP   TX: %10lu RX: %10lu\n", access_if->stats.igmp_tx, access_if->stats.igmp_rx);
+            printf("    ICMP   TX: %10lu RX: %10lu\n", access_if->stats.icmp_tx, access_if->stats.icmp_rx);
+            printf("    ICMPv6 TX: %10lu RX: %10lu\n", access_if->stats.icmpv6_tx, access_if->stats.icmpv6_rx);
+            printf("    DHCPv6 TX: %10lu RX: %10lu\n", access_if->stats.dhcpv6_tx, access_if->stats.dhcpv6_rx);
             printf("\n  Access Interface Protocol Timeout Stats:\n");
-            printf("    LCP Echo Request: %10u\n", access_if->stats.lcp_echo_timeout);
-            printf("    LCP Request:      %10u\n", access_if->stats.lcp_timeout);
-            printf("    IPCP Request:     %10u\n", access_if->stats.ipcp_timeout);
-            printf("    IP6CP Request:    %10u\n", access_if->stats.ip6cp_timeout);
-            printf("    PAP:              %10u\n", access_if->stats.pap_timeout);
-            printf("    CHAP:             %10u\n", access_if->stats.chap_timeout);
-            printf("    ICMPv6 RS:        %10u\n", access_if->stats.dhcpv6_timeout);
-            printf("    DHCPv6 Request:   %10u\n", access_if->stats.dhcpv6_timeout);
+            printf("    LCP Echo Request: %10lu\n", access_if->stats.lcp_echo_timeout);
+            printf("    LCP Request:      %10lu\n", access_if->stats.lcp_timeout);
+            printf("    IPCP Request:     %10lu\n", access_if->stats.ipcp_timeout);
+            printf("    IP6CP Request:    %10lu\n", access_if->stats.ip6cp_timeout);
+            printf("    PAP:              %10lu\n", access_if->stats.pap_timeout);
+            printf("    CHAP:             %10lu\n", access_if->stats.chap_timeout);
+            printf("    ICMPv6 RS:        %10lu\n", access_if->stats.dhcpv6_timeout);
+            printf("    DHCPv6 Request:   %10lu\n", access_if->stats.dhcpv6_timeout);
         }
     }
 
@@ -284,6 +389,88 @@ bbl_stats_stdout (bbl_ctx_s *ctx, bbl_stats_t * stats) {
             printf("    Not Received: %u\n", stats->mc_not_received);
         }
     }
+
+    printf("\nMemory:\n");
+    for(i = 0; i < ctx->op.access_if_count; i++) {
+        bbl_stats_slab_stdout(&ctx->op.access_if[i]->session_slab);
+    }
+    bbl_stats_slab_stdout(&ctx->timer_slab);
+    bbl_stats_slab_stdout(&ctx->timer_bucket_slab);
+
+    pcapng_stdout(ctx);
+    bbl_recorder_stdout(ctx);
+    bbl_loss_stdout(ctx);
+}
+
+static json_t *
+bbl_stats_slab_json (bbl_slab_s *slab) {
+    json_t *jobj = json_object();
+    json_object_set(jobj, "name", json_string(slab->name));
+    json_object_set(jobj, "object-size", json_integer(slab->size));
+    json_object_set(jobj, "numa-node", json_integer(slab->numa_node));
+    json_object_set(jobj, "in-use", json_integer(slab->in_use));
+    json_object_set(jobj, "in-use-max", json_integer(slab->in_use_max));
+    json_object_set(jobj, "allocs", json_integer(slab->allocs));
+    json_object_set(jobj, "frees", json_integer(slab->frees));
+    json_object_set(jobj, "failed", json_integer(slab->failed));
+    json_object_set(jobj, "chunks", json_integer(slab->chunks));
+    json_object_set(jobj, "chunks-hugepages", json_integer(slab->chunks_hugepages));
+    json_object_set(jobj, "bytes", json_integer(slab->bytes));
+    return jobj;
+}
+
+static json_t *
+bbl_stats_setup_latency_phases_json (bbl_setup_latency_s *latency) {
+    json_t *jobj = json_object();
+    json_t *jobj_phase;
+    json_t *jobj_histogram;
+    int phase, i;
+
+    for(phase = 0; phase < BBL_SETUP_PHASE_MAX; phase++) {
+        if(!latency[phase].count) continue;
+        jobj_phase = json_object();
+        json_object_set(jobj_phase, "count", json_integer(latency[phase].count));
+        json_object_set(jobj_phase, "min-ms", json_real(latency[phase].min_us / 1000.0));
+        json_object_set(jobj_phase, "avg-ms", json_real((latency[phase].sum_us / latency[phase].count) / 1000.0));
+        json_object_set(jobj_phase, "max-ms", json_real(latency[phase].max_us / 1000.0));
+        jobj_histogram = json_array();
+        for(i = 0; i < BBL_SETUP_LATENCY_BUCKETS - 1; i++) {
+            json_array_append(jobj_histogram, json_pack("{sisi}", "lt-ms", 1 << i, "count", latency[phase].bucket[i]));
+        }
+        json_array_append(jobj_histogram, json_pack("{sisi}", "ge-ms", 1 << (i - 1), "count", latency[phase].bucket[i]));
+        json_object_set(jobj_phase, "histogram", jobj_histogram);
+        json_object_set(jobj, setup_phase_names[phase], jobj_phase);
+    }
+    return jobj;
+}
+
+/*
+ * Session setup latency per phase, globally
+ * and for each access configuration.
+ */
+json_t *
+bbl_stats_setup_latency_json (bbl_ctx_s *ctx) {
+    bbl_access_config_s *access_config = ctx->config.access_config;
+    json_t *jobj = json_object();
+    json_t *jobj_array = json_array();
+    json_t *jobj_config;
+
+    json_object_set(jobj, "phases", bbl_stats_setup_latency_phases_json(ctx->stats.setup_latency));
+    while(access_config) {
+        jobj_config = json_object();
+        json_object_set(jobj_config, "interface", json_string(access_config->interface));
+        json_object_set(jobj_config, "type", json_string(access_config->access_type == ACCESS_TYPE_PPPOE ? "pppoe" : "ipoe"));
+        json_object_set(jobj_config, "outer-vlan-min", json_integer(access_config->access_outer_vlan_min));
+        json_object_set(jobj_config, "outer-vlan-max", json_integer(access_config->access_outer_vlan_max));
+        json_object_set(jobj_config, "inner-vlan-min", json_integer(access_config->access_inner_vlan_min));
+        json_object_set(jobj_config, "inner-vlan-max", json_integer(access_config->access_inner_vlan_max));
+        json_object_set(jobj_config, "sessions", json_integer(access_config->sessions));
+        json_object_set(jobj_config, "phases", bbl_stats_setup_latency_phases_json(access_config->setup_latency));
+        json_array_append(jobj_array, jobj_config);
+        access_config = access_config->next;
+    }
+    json_object_set(jobj, "access-configs", jobj_array);
+    return jobj;
 }
 
 void
@@ -316,6 +503,7 @@ bbl_stats_json (bbl_ctx_s *ctx, bbl_stats_t * stats) {
     json_object_set(jobj, "setup-rate-cps-avg", json_real(ctx->stats.cps_avg));
     json_object_set(jobj, "setup-rate-cps-max", json_real(ctx->stats.cps_max));
     json_object_set(jobj, "dhcpv6-sessions-established", json_integer(ctx->dhcpv6_established_max));
+    json_object_set(jobj, "setup-latency", bbl_stats_setup_latency_json(ctx));
 
     jobj_array = json_array();
     if (ctx->op.network_if) {
@@ -326,18 +514,18 @@ bbl_stats_json (bbl_ctx_s *ctx, bbl_stats_t * stats) {
         json_object_set(jobj_network_if, "tx-session-packets", json_integer(ctx->op.network_if->stats.session_ipv4_tx));
         json_object_set(jobj_network_if, "rx-session-packets", json_integer(ctx->op.network_if->stats.session_ipv4_rx));
         json_object_set(jobj_network_if, "rx-session-packets-loss", json_integer(ctx->op.network_if->stats.session_ipv4_loss));
-        json_object_set(jobj_network_if, "tx-session-packets-avg-pps-max", json_integer(ctx->op.network_if->stats.rate_session_ipv4_tx.avg_max));
-        json_object_set(jobj_network_if, "rx-session-packets-avg-pps-max", json_integer(ctx->op.network_if->stats.rate_session_ipv4_rx.avg_max));
+        json_object_set(jobj_network_if, "tx-session-packets-avg-pps-max", json_integer(ctx->op.network_if->rate.session_ipv4_tx.avg_max));
+        json_object_set(jobj_network_if, "rx-session-packets-avg-pps-max", json_integer(ctx->op.network_if->rate.session_ipv4_rx.avg_max));
         json_object_set(jobj_network_if, "tx-session-packets-ipv6", json_integer(ctx->op.network_if->stats.session_ipv6_tx));
         json_object_set(jobj_network_if, "rx-session-packets-ipv6", json_integer(ctx->op.network_if->stats.session_ipv6_rx));
         json_object_set(jobj_network_if, "rx-session-packets-ipv6-loss", json_integer(ctx->op.network_if->stats.session_ipv6_loss));
-        json_object_set(jobj_network_if, "tx-session-packets-avg-pps-max-ipv6", json_integer(ctx->op.network_if->stats.rate_session_ipv6_tx.avg_max));
-        json_object_set(jobj_network_if, "rx-session-packets-avg-pps-max-ipv6", json_integer(ctx->op.network_if->stats.rate_session_ipv6_rx.avg_max));
+        json_object_set(jobj_network_if, "tx-session-packets-avg-pps-max-ipv6", json_integer(ctx->op.network_if->rate.session_ipv6_tx.avg_max));
+        json_object_set(jobj_network_if, "rx-session-packets-avg-pps-max-ipv6", json_integer(ctx->op.network_if->rate.session_ipv6_rx.avg_max));
         json_object_set(jobj_network_if, "tx-session-packets-ipv6pd", json_integer(ctx->op.network_if->stats.session_ipv6pd_tx));
         json_object_set(jobj_network_if, "rx-session-packets-ipv6pd", json_integer(ctx->op.network_if->stats.session_ipv6pd_rx));
         json_object_set(jobj_network_if, "rx-session-packets-ipv6pd-loss", json_integer(ctx->op.network_if->stats.session_ipv6pd_loss));
-        json_object_set(jobj_network_if, "tx-session-packets-avg-pps-max-ipv6pd", json_integer(ctx->op.network_if->stats.rate_session_ipv6pd_tx.avg_max));
-        json_object_set(jobj_network_if, "rx-session-packets-avg-pps-max-ipv6pd", json_integer(ctx->op.network_if->stats.rate_session_ipv6pd_rx.avg_max));
+        json_object_set(jobj_network_if, "tx-session-packets-avg-pps-max-ipv6pd", json_integer(ctx->op.network_if->rate.session_ipv6pd_tx.avg_max));
+        json_object_set(jobj_network_if, "rx-session-packets-avg-pps-max-ipv6pd", json_integer(ctx->op.network_if->rate.session_ipv6pd_rx.avg_max));
         json_object_set(jobj_network_if, "tx-multicast-packets", json_integer(ctx->op.network_if->stats.mc_tx));
         json_array_append(jobj_array, jobj_network_if);
     }
@@ -355,20 +543,20 @@ bbl_stats_json (bbl_ctx_s *ctx, bbl_stats_t * stats) {
             json_object_set(jobj_access_if, "rx-session-packets", json_integer(access_if->stats.session_ipv4_rx));
             json_object_set(jobj_access_if, "rx-session-packets-loss", json_integer(access_if->stats.session_ipv4_loss));
             json_object_set(jobj_access_if, "rx-session-packets-wrong-session", json_integer(access_if->stats.session_ipv4_wrong_session));
-            json_object_set(jobj_access_if, "tx-session-packets-avg-pps-max", json_integer(access_if->stats.rate_session_ipv4_tx.avg_max));
-            json_object_set(jobj_access_if, "rx-session-packets-avg-pps-max", json_integer(access_if->stats.rate_session_ipv4_rx.avg_max));
+            json_object_set(jobj_access_if, "tx-session-packets-avg-pps-max", json_integer(access_if->rate.session_ipv4_tx.avg_max));
+            json_object_set(jobj_access_if, "rx-session-packets-avg-pps-max", json_integer(access_if->rate.session_ipv4_rx.avg_max));
             json_object_set(jobj_access_if, "tx-session-packets-ipv6", json_integer(access_if->stats.session_ipv6_tx));
             json_object_set(jobj_access_if, "rx-session-packets-ipv6", json_integer(access_if->stats.session_ipv6_rx));
             json_object_set(jobj_access_if, "rx-session-packets-ipv6-loss", json_integer(access_if->stats.session_ipv6_loss));
             json_object_set(jobj_access_if, "rx-session-packets-ipv6-wrong-session", json_integer(access_if->stats.session_ipv6_wrong_session));
-            json_object_set(jobj_access_if, "tx-session-packets-avg-pps-max-ipv6", json_integer(access_if->stats.rate_session_ipv6_tx.avg_max));
-            json_object_set(jobj_access_if, "rx-session-packets-avg-pps-max-ipv6", json_integer(access_if->stats.rate_session_ipv6_rx.avg_max));
+            json_object_set(jobj_access_if, "tx-session-packets-avg-pps-max-ipv6", json_integer(access_if->rate.session_ipv6_tx.avg_max));
+            json_object_set(jobj_access_if, "rx-session-packets-avg-pps-max-ipv6", json_integer(access_if->rate.session_ipv6_rx.avg_max));
             json_object_set(jobj_access_if, "tx-session-packets-ipv6pd", json_integer(access_if->stats.session_ipv6pd_tx));
             json_object_set(jobj_access_if, "rx-session-packets-ipv6pd", json_integer(access_if->stats.session_ipv6pd_rx));
             json_object_set(jobj_access_if, "rx-session-packets-ipv6pd-loss", json_integer(access_if->stats.session_ipv6pd_loss));
             json_object_set(jobj_access_if, "rx-session-packets-ipv6pd-wrong-session", json_integer(access_if->stats.session_ipv6pd_wrong_session));
-            json_object_set(jobj_access_if, "tx-session-packets-avg-pps-max-ipv6pd", json_integer(access_if->stats.rate_session_ipv6pd_tx.avg_max));
-            json_object_set(jobj_access_if, "rx-session-packets-avg-pps-max-ipv6pd", json_integer(access_if->stats.rate_session_ipv6pd_rx.avg_max));
+            json_object_set(jobj_access_if, "tx-session-packets-avg-pps-max-ipv6pd", json_integer(access_if->rate.session_ipv6pd_tx.avg_max));
+            json_object_set(jobj_access_if, "rx-session-packets-avg-pps-max-ipv6pd", json_integer(access_if->rate.session_ipv6pd_rx.avg_max));
             json_object_set(jobj_access_if, "rx-multicast-packets", json_integer(access_if->stats.mc_rx));
             json_object_set(jobj_access_if, "rx-multicast-packets-loss", json_integer(access_if->stats.mc_loss));
             jobj_protocols = json_object();
@@ -459,6 +647,25 @@ bbl_stats_json (bbl_ctx_s *ctx, bbl_stats_t * stats) {
             json_object_set(jobj, "multicast", jobj_multicast);
         }
     }
+    jobj_array = json_array();
+    for(i = 0; i < ctx->op.access_if_count; i++) {
+        json_array_append(jobj_array, bbl_stats_slab_json(&ctx->op.access_if[i]->session_slab));
+    }
+    json_array_append(jobj_array, bbl_stats_slab_json(&ctx->timer_slab));
+    json_array_append(jobj_array, bbl_stats_slab_json(&ctx->timer_bucket_slab));
+    json_object_set(jobj, "memory", jobj_array);
+    if(ctx->pcap.ring) {
+        json_object_set(jobj, "pcap", pcapng_json(ctx));
+    }
+    if(ctx->recorder) {
+        json_object_set(jobj, "recorder", bbl_recorder_json(ctx));
+    }
+    if(ctx->loss) {
+        json_object_set(jobj, "loss-events", bbl_loss_json(ctx));
+    }
+    if(ctx->replay) {
+        json_object_set(jobj, "replay", bbl_replay_json(ctx));
+    }
     json_object_set(root, "report", jobj);
     if(json_dump_file(root, ctx->config.json_report_filename, JSON_REAL_PRECISION(4)) != 0) {
         LOG(ERROR, "Failed to create JSON report file %s\n", ctx->config.json_report_filename);
@@ -504,14 +711,14 @@ bbl_compute_interface_rate_job (timer_s *timer)
 
     interface = timer->data;
 
-    bbl_compute_avg_rate(&interface->stats.rate_packets_tx, interface->stats.packets_tx);
-    bbl_compute_avg_rate(&interface->stats.rate_packets_rx, interface->stats.packets_rx);
-    bbl_compute_avg_rate(&interface->stats.rate_mc_tx, interface->stats.mc_tx);
-    bbl_compute_avg_rate(&interface->stats.rate_mc_rx, interface->stats.mc_rx);
-    bbl_compute_avg_rate(&interface->stats.rate_session_ipv4_tx, interface->stats.session_ipv4_tx);
-    bbl_compute_avg_rate(&interface->stats.rate_session_ipv4_rx, interface->stats.session_ipv4_rx);
-    bbl_compute_avg_rate(&interface->stats.rate_session_ipv6_tx, interface->stats.session_ipv6_tx);
-    bbl_compute_avg_rate(&interface->stats.rate_session_ipv6_rx, interface->stats.session_ipv6_rx);
-    bbl_compute_avg_rate(&interface->stats.rate_session_ipv6pd_tx, interface->stats.session_ipv6pd_tx);
-    bbl_compute_avg_rate(&interface->stats.rate_session_ipv6pd_rx, interface->stats.session_ipv6pd_rx);
+    bbl_compute_avg_rate(&interface->rate.packets_tx, interface->stats.packets_tx);
+    bbl_compute_avg_rate(&interface->rate.packets_rx, interface->stats.packets_rx);
+    bbl_compute_avg_rate(&interface->rate.mc_tx, interface->stats.mc_tx);
+    bbl_compute_avg_rate(&interface->rate.mc_rx, interface->stats.mc_rx);
+    bbl_compute_avg_rate(&interface->rate.session_ipv4_tx, interface->stats.session_ipv4_tx);
+    bbl_compute_avg_rate(&interface->rate.session_ipv4_rx, interface->stats.session_ipv4_rx);
+    bbl_compute_avg_rate(&interface->rate.session_ipv6_tx, interface->stats.session_ipv6_tx);
+    bbl_compute_avg_rate(&interface->rate.session_ipv6_rx, interface->stats.session_ipv6_rx);
+    bbl_compute_avg_rate(&interface->rate.session_ipv6pd_tx, interface->stats.session_ipv6pd_tx);
+    bbl_compute_avg_rate(&interface->rate.session_ipv6pd_rx, interface->stats.session_ipv6pd_rx);
 }
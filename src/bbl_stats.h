@@ -10,6 +10,8 @@
 #ifndef __BBL_STATS_H__
 #define __BBL_STATS_H__
 
+#include <jansson.h>
+
 typedef struct bbl_stats_ {
     uint32_t min_join_delay; // IGMP join delay
     uint32_t avg_join_delay; // IGMP join delay
@@ -19,6 +21,9 @@ typedef struct bbl_stats_ {
     uint32_t avg_leave_delay; // IGMP leave delay
     uint32_t max_leave_delay; // IGMP leave delay
 
+    uint32_t join_delays;
+    uint32_t leave_delays;
+
     uint32_t mc_old_rx_after_first_new;
     uint32_t mc_not_received;
 
@@ -43,10 +48,16 @@ typedef struct bbl_stats_ {
     uint32_t sessions_network_ipv6pd_rx;
 } bbl_stats_t;
 
+extern const char *setup_phase_names[BBL_SETUP_PHASE_MAX];
+
 void bbl_stats_update_cps (bbl_ctx_s *ctx);
 void bbl_stats_generate(bbl_ctx_s *ctx, bbl_stats_t *stats);
 void bbl_stats_stdout(bbl_ctx_s *ctx, bbl_stats_t *stats);
 void bbl_stats_json(bbl_ctx_s *ctx, bbl_stats_t *stats);
 void bbl_compute_interface_rate_job(timer_s *timer);
+void bbl_stats_setup_latency_add(bbl_setup_latency_s *latency, uint32_t us);
+void bbl_stats_setup_phase_start(bbl_session_s *session, bbl_setup_phase_t phase);
+void bbl_stats_setup_phase_stop(bbl_ctx_s *ctx, bbl_session_s *session, bbl_setup_phase_t phase);
+json_t *bbl_stats_setup_latency_json(bbl_ctx_s *ctx);
 
 #endif
@@ -120,7 +120,11 @@ timer_enqueue_bucket (timer_root_s *root, timer_s *timer, time_t sec, long nsec)
     /*
      * No bucket found that matches the timer values. Create a fresh bucket.
      */
-    timer_bucket = calloc(1, sizeof(timer_bucket_s));
+    if (root->timer_bucket_slab) {
+        timer_bucket = bbl_slab_alloc(root->timer_bucket_slab);
+    } else {
+        timer_bucket = calloc(1, sizeof(timer_bucket_s));
+    }
     if (!timer_bucket) {
         return;
     }
@@ -168,7 +172,7 @@ timer_smear_bucket (timer_root_s *root, time_t sec, long nsec)
         if (!last_timer) {
             return;
         }
-        clock_gettime(CLOCK_MONOTONIC, &now);
+        timer_clock_gettime(root, CLOCK_MONOTONIC, &now);
         timespec_sub(&diff, &last_timer->expire, &now);
         step_nsec = (diff.tv_sec * 1e9 + diff.tv_nsec) / (timer_bucket->timers); /* calculate smear step */
         step.tv_sec = step_nsec / 1e9;
@@ -215,7 +219,11 @@ timer_dequeue_bucket (timer_s *timer)
 	LOG(TIMER_DETAIL, "  Delete timer bucket %lu.%06lus\n",
 	    timer_bucket->sec, timer_bucket->nsec/1000);
 
-	free(timer_bucket);
+	if (timer_root->timer_bucket_slab) {
+	    bbl_slab_free(timer_root->timer_bucket_slab, timer_bucket);
+	} else {
+	    free(timer_bucket);
+	}
 	timer_root->buckets--;
     }
 }
@@ -229,7 +237,7 @@ timer_requeue (timer_s *timer, time_t sec, long nsec)
     timer_bucket = timer->timer_bucket;
     timer_root = timer_bucket->timer_root;
 
-    timer_set_expire(timer, sec, nsec);
+    timer_set_expire(timer_root, timer, sec, nsec);
 
     /*
      * If the expiration {sec,nsec} matches the bucket, then simply
@@ -289,9 +297,9 @@ timer_del (timer_s *timer)
  * Set timer expiration.
  */
 void
-timer_set_expire (timer_s *timer, time_t sec, long nsec)
+timer_set_expire (timer_root_s *root, timer_s *timer, time_t sec, long nsec)
 {
-    clock_gettime(CLOCK_MONOTONIC, &timer->expire);
+    timer_clock_gettime(root, CLOCK_MONOTONIC, &timer->expire);
     timer->expire.tv_sec += sec;
     timer->expire.tv_nsec += nsec;
 
@@ -383,7 +391,11 @@ timer_add (timer_root_s *root,
         /*
          * GC queue is empty, make a fresh allocation.
          */
-        timer = calloc(1, sizeof(timer_s));
+        if (root->timer_slab) {
+            timer = bbl_slab_alloc(root->timer_slab);
+        } else {
+            timer = calloc(1, sizeof(timer_s));
+        }
     } else {
 
         /*
@@ -405,7 +417,7 @@ timer_add (timer_root_s *root,
     snprintf(timer->name, sizeof(timer->name), "%s", name);
     timer->data = data;
     timer->cb = cb;
-    timer_set_expire(timer, sec, nsec);
+    timer_set_expire(root, timer, sec, nsec);
     timer->ptimer = ptimer;
     *ptimer = timer;
 
@@ -480,7 +492,7 @@ timer_walk (timer_root_s *root)
             return;
         }
 
-        clock_gettime(CLOCK_MONOTONIC, &now);
+        timer_clock_gettime(root, CLOCK_MONOTONIC, &now);
         LOG(TIMER_DETAIL, "Walk timer queue, now %s\n", timespec_format(&now));
         min.tv_sec = 0;
         min.tv_nsec = 0;
@@ -515,6 +527,7 @@ timer_walk (timer_root_s *root)
                 if (timer->cb) {
                     LOG(TIMER_DETAIL, "  Firing %s timer\n", timer->name);
                     (*timer->cb)(timer);
+                    log_scope_clear();
                 }
 
                 if (timer->periodic) {
@@ -584,7 +597,7 @@ timer_walk (timer_root_s *root)
         LOG(TIMER_DETAIL, "  Now %s\n", timespec_format(&now));
         LOG(TIMER_DETAIL, "  Min %s\n", timespec_format(&min));
 
-        clock_gettime(CLOCK_MONOTONIC, &now);
+        timer_clock_gettime(root, CLOCK_MONOTONIC, &now);
         if (timespec_compare(&now, &min) == -1) {
             timespec_sub(&sleep, &min, &now);
         } else {
@@ -592,6 +605,15 @@ timer_walk (timer_root_s *root)
             sleep.tv_nsec = 1 * MSEC; /* sleep time is negative, sleep at least some time */
         }
 
+        /*
+         * Virtual time does not sleep but jumps straight to the next expiry.
+         */
+        if (root->virtual_time) {
+            timespec_add(&root->virtual_now, &now, &sleep);
+            LOG(TIMER_DETAIL, "  Advance virtual time to %s\n", timespec_format(&root->virtual_now));
+            continue;
+        }
+
         LOG(TIMER_DETAIL, "  Sleep %s\n", timespec_format(&sleep));
         res = nanosleep(&sleep, &rem);
         if (res == -1) {
@@ -612,6 +634,32 @@ timer_init_root (timer_root_s *timer_root)
     CIRCLEQ_INIT(&timer_root->timer_change_qhead);
 }
 
+/*
+ * Switch a timer root to virtual time, starting at the current
+ * wall clock such that timestamps derived from it look sane.
+ * This must be done before the first timer is added.
+ */
+void
+timer_enable_virtual_time (timer_root_s *timer_root)
+{
+    clock_gettime(CLOCK_REALTIME, &timer_root->virtual_now);
+    timer_root->virtual_time = true;
+}
+
+/*
+ * Get the time of the given clock, or the virtual time
+ * which is shared by all clocks if enabled.
+ */
+void
+timer_clock_gettime (timer_root_s *timer_root, clockid_t clock_id, struct timespec *ts)
+{
+    if (timer_root->virtual_time) {
+        *ts = timer_root->virtual_now;
+        return;
+    }
+    clock_gettime(clock_id, ts);
+}
+
 /*
  * Flush all timers hanging off a timer root.
  */
@@ -638,7 +686,11 @@ timer_flush_root (timer_root_s *timer_root)
         timer = CIRCLEQ_FIRST(&timer_root->timer_gc_qhead);
         CIRCLEQ_REMOVE(&timer_root->timer_gc_qhead, timer, timer_qnode);
 	timer_root->gc--;
-	free(timer);
+	if (timer_root->timer_slab) {
+	    bbl_slab_free(timer_root->timer_slab, timer);
+	} else {
+	    free(timer);
+	}
     }
 }
 
@@ -647,7 +699,7 @@ timer_test_cb (timer_s *timer)
 {
     bbl_ctx_s *ctx;
     ctx = timer->data;
-    LOG(TIMER, "  CB %s, ctx %p\n", timer->name, ctx);
+    LOG(TIMER, "  CB %s, ctx %p\n", timer->name, (void*)ctx);
 }
 
 void
@@ -23,6 +23,12 @@ typedef struct timer_root_
     uint buckets; /* # of buckets hanging off */
     uint gc; /* # of timers waiting for GC */
 
+    struct bbl_slab_ *timer_slab; /* optional, calloc() if not set */
+    struct bbl_slab_ *timer_bucket_slab; /* optional, calloc() if not set */
+
+    bool virtual_time; /* advance virtual_now to the next expiry instead of sleeping */
+    struct timespec virtual_now;
+
 } timer_root_s;
 
 /*
@@ -67,12 +73,14 @@ typedef struct timer_
 /*
  * Prototypes
  */
-void timer_set_expire(timer_s *, time_t, long);
+void timer_set_expire(timer_root_s *, timer_s *, time_t, long);
 
 /*
  * Public API.
  */
 void timer_init_root(timer_root_s *);
+void timer_enable_virtual_time(timer_root_s *);
+void timer_clock_gettime(timer_root_s *, clockid_t, struct timespec *);
 void timer_flush_root(timer_root_s *);
 void timer_test(void *);
 void timer_add(timer_root_s *, timer_s **, char *, time_t , long , void *, void *);
@@ -80,6 +88,7 @@ void timer_add_periodic(timer_root_s *, timer_s **, char *, time_t , long , void
 void timer_del(timer_s *);
 void timer_smear_bucket(timer_root_s *, time_t, long);
 void timer_walk(struct timer_root_ *);
+void timer_process_changes(timer_root_s *);
 
 void timespec_add(struct timespec *, struct timespec *, struct timespec *);
 void timespec_sub(struct timespec *, struct timespec *, struct timespec *);
@@ -9,6 +9,9 @@
 
 #include "bbl.h"
 #include "bbl_pcap.h"
+#include "bbl_recorder.h"
+#include "bbl_retry.h"
+#include "bbl_io_memory.h"
 
 protocol_error_t
 bbl_encode_packet_session_ipv4 (bbl_session_s *session)
@@ -33,9 +36,7 @@ bbl_encode_packet_session_ipv4 (bbl_session_s *session)
     memcpy(session->write_buf, session->access_ipv4_tx_packet_template, session->access_ipv4_tx_packet_len);
     session->write_idx = session->access_ipv4_tx_packet_len;
 
-    *(uint64_t*)(session->write_buf + (session->access_ipv4_tx_packet_len - 16)) = session->access_ipv4_tx_seq++;
-    *(uint32_t*)(session->write_buf + (session->access_ipv4_tx_packet_len - 8)) = interface->tx_timestamp.tv_sec;
-    *(uint32_t*)(session->write_buf + (session->access_ipv4_tx_packet_len - 4)) = interface->tx_timestamp.tv_nsec;
+    bbl_checksum_update_bbl(session->write_buf, session->access_ipv4_tx_packet_len, session->access_ipv4_tx_seq++, &interface->tx_timestamp);
     return PROTOCOL_SUCCESS;
 }
 
@@ -62,9 +63,7 @@ bbl_encode_packet_session_ipv6 (bbl_session_s *session)
     memcpy(session->write_buf, session->access_ipv6_tx_packet_template, session->access_ipv6_tx_packet_len);
     session->write_idx = session->access_ipv6_tx_packet_len;
 
-    *(uint64_t*)(session->write_buf + (session->access_ipv6_tx_packet_len - 16)) = session->access_ipv6_tx_seq++;
-    *(uint32_t*)(session->write_buf + (session->access_ipv6_tx_packet_len - 8)) = interface->tx_timestamp.tv_sec;
-    *(uint32_t*)(session->write_buf + (session->access_ipv6_tx_packet_len - 4)) = interface->tx_timestamp.tv_nsec;
+    bbl_checksum_update_bbl(session->write_buf, session->access_ipv6_tx_packet_len, session->access_ipv6_tx_seq++, &interface->tx_timestamp);
     return PROTOCOL_SUCCESS;
 }
 
@@ -91,9 +90,7 @@ bbl_encode_packet_session_ipv6pd (bbl_session_s *session)
     memcpy(session->write_buf, session->access_ipv6pd_tx_packet_template, session->access_ipv6pd_tx_packet_len);
     session->write_idx = session->access_ipv6pd_tx_packet_len;
 
-    *(uint64_t*)(session->write_buf + (session->access_ipv6pd_tx_packet_len - 16)) = session->access_ipv6pd_tx_seq++;
-    *(uint32_t*)(session->write_buf + (session->access_ipv6pd_tx_packet_len - 8)) = interface->tx_timestamp.tv_sec;
-    *(uint32_t*)(session->write_buf + (session->access_ipv6pd_tx_packet_len - 4)) = interface->tx_timestamp.tv_nsec;
+    bbl_checksum_update_bbl(session->write_buf, session->access_ipv6pd_tx_packet_len, session->access_ipv6pd_tx_seq++, &interface->tx_timestamp);
     return PROTOCOL_SUCCESS;
 }
 
@@ -117,9 +114,7 @@ bbl_encode_packet_network_session_ipv4 (bbl_interface_s *interface, bbl_session_
     memcpy(session->write_buf, session->network_ipv4_tx_packet_template, session->network_ipv4_tx_packet_len);
     session->write_idx = session->network_ipv4_tx_packet_len;
 
-    *(uint64_t*)(session->write_buf + (session->network_ipv4_tx_packet_len - 16)) = session->network_ipv4_tx_seq++;
-    *(uint32_t*)(session->write_buf + (session->network_ipv4_tx_packet_len - 8)) = interface->tx_timestamp.tv_sec;
-    *(uint32_t*)(session->write_buf + (session->network_ipv4_tx_packet_len - 4)) = interface->tx_timestamp.tv_nsec;
+    bbl_checksum_update_bbl(session->write_buf, session->network_ipv4_tx_packet_len, session->network_ipv4_tx_seq++, &interface->tx_timestamp);
     return PROTOCOL_SUCCESS;
 }
 
@@ -143,9 +138,7 @@ bbl_encode_packet_network_session_ipv6 (bbl_interface_s *interface, bbl_session_
     memcpy(session->write_buf, session->network_ipv6_tx_packet_template, session->network_ipv6_tx_packet_len);
     session->write_idx = session->network_ipv6_tx_packet_len;
 
-    *(uint64_t*)(session->write_buf + (session->network_ipv6_tx_packet_len - 16)) = session->network_ipv6_tx_seq++;
-    *(uint32_t*)(session->write_buf + (session->network_ipv6_tx_packet_len - 8)) = interface->tx_timestamp.tv_sec;
-    *(uint32_t*)(session->write_buf + (session->network_ipv6_tx_packet_len - 4)) = interface->tx_timestamp.tv_nsec;
+    bbl_checksum_update_bbl(session->write_buf, session->network_ipv6_tx_packet_len, session->network_ipv6_tx_seq++, &interface->tx_timestamp);
     return PROTOCOL_SUCCESS;
 }
 
@@ -169,9 +162,7 @@ bbl_encode_packet_network_session_ipv6pd (bbl_interface_s *interface, bbl_sessio
     memcpy(session->write_buf, session->network_ipv6pd_tx_packet_template, session->network_ipv6pd_tx_packet_len);
     session->write_idx = session->network_ipv6pd_tx_packet_len;
 
-    *(uint64_t*)(session->write_buf + (session->network_ipv6pd_tx_packet_len - 16)) = session->network_ipv6pd_tx_seq++;
-    *(uint32_t*)(session->write_buf + (session->network_ipv6pd_tx_packet_len - 8)) = interface->tx_timestamp.tv_sec;
-    *(uint32_t*)(session->write_buf + (session->network_ipv6pd_tx_packet_len - 4)) = interface->tx_timestamp.tv_nsec;
+    bbl_checksum_update_bbl(session->write_buf, session->network_ipv6pd_tx_packet_len, session->network_ipv6pd_tx_seq++, &interface->tx_timestamp);
     return PROTOCOL_SUCCESS;
 }
 
@@ -341,7 +332,7 @@ bbl_encode_packet_igmp (bbl_session_s *session)
     timer_add(&ctx->timer_root, &session->timer_igmp, "IGMP", 1, 0, session, bbl_igmp_timeout);
     session->stats.igmp_tx++;
     interface->stats.igmp_tx++;
-    return encode_ethernet(session->write_buf, &session->write_idx, &eth);
+    return encode_ethernet_fast(session->write_buf, &session->write_idx, &eth);
 }
 
 protocol_error_t
@@ -389,15 +380,17 @@ bbl_encode_packet_icmp_reply (bbl_session_s *session)
 }
 
 void
-bbl_pap_timeout (timer_s *timer)
+bbl_auth_timeout (bbl_session_s *session)
 {
-    bbl_session_s *session;
-    bbl_interface_s *interface;
-    session = timer->data;
-    interface = session->interface;
+    bbl_interface_s *interface = session->interface;
     if(session->session_state == BBL_PPP_AUTH) {
-        interface->stats.pap_timeout++;
-        session->send_requests |= BBL_SEND_PAP_REQUEST;
+        if(session->auth_protocol == PROTOCOL_CHAP) {
+            interface->stats.chap_timeout++;
+            session->send_requests |= BBL_SEND_CHAP_RESPONSE;
+        } else {
+            interface->stats.pap_timeout++;
+            session->send_requests |= BBL_SEND_PAP_REQUEST;
+        }
         bbl_session_tx_qnode_insert(session);
     }
 }
@@ -405,14 +398,12 @@ bbl_pap_timeout (timer_s *timer)
 protocol_error_t
 bbl_encode_packet_pap_request (bbl_session_s *session) {
     bbl_interface_s *interface;
-    bbl_ctx_s *ctx;
 
     bbl_ethernet_header_t eth = {0};
     bbl_pppoe_session_t pppoe = {0};
     bbl_pap_t pap = {0};
 
     interface = session->interface;
-    ctx = interface->ctx;
     interface->stats.pap_tx++;
 
     eth.dst = session->server_mac;
@@ -432,35 +423,19 @@ bbl_encode_packet_pap_request (bbl_session_s *session) {
     pap.username_len = strlen(session->username);
     pap.password = session->password;
     pap.password_len = strlen(session->password);
-    timer_add(&ctx->timer_root, &session->timer_auth, "Authentication Timeout", 5, 0, session, bbl_pap_timeout);
+    bbl_retry_add(session, BBL_RETRY_AUTH);
     return encode_ethernet(session->write_buf, &session->write_idx, &eth);
 }
 
-void
-bbl_chap_timeout (timer_s *timer)
-{
-    bbl_session_s *session;
-    bbl_interface_s *interface;
-    session = timer->data;
-    interface = session->interface;
-    if(session->session_state == BBL_PPP_AUTH) {
-        interface->stats.chap_timeout++;
-        session->send_requests |= BBL_SEND_CHAP_RESPONSE;
-        bbl_session_tx_qnode_insert(session);
-    }
-}
-
 protocol_error_t
 bbl_encode_packet_chap_response (bbl_session_s *session) {
     bbl_interface_s *interface;
-    bbl_ctx_s *ctx;
 
     bbl_ethernet_header_t eth = {0};
     bbl_pppoe_session_t pppoe = {0};
     bbl_chap_t chap = {0};
 
     interface = session->interface;
-    ctx = interface->ctx;
     interface->stats.chap_tx++;
 
     eth.dst = session->server_mac;
@@ -479,17 +454,14 @@ bbl_encode_packet_chap_response (bbl_session_s *session) {
     chap.challenge_len = CHALLENGE_LEN;
     chap.name = session->username;
     chap.name_len = strlen(session->username);
-    timer_add(&ctx->timer_root, &session->timer_auth, "Authentication Timeout", 5, 0, session, bbl_chap_timeout);
+    bbl_retry_add(session, BBL_RETRY_AUTH);
     return encode_ethernet(session->write_buf, &session->write_idx, &eth);
 }
 
 void
-bbl_icmpv6_timeout (timer_s *timer)
+bbl_icmpv6_timeout (bbl_session_s *session)
 {
-    bbl_session_s *session;
-    bbl_interface_s *interface;
-    session = timer->data;
-    interface = session->interface;
+    bbl_interface_s *interface = session->interface;
     if(!session->icmpv6_ra_received) {
         interface->stats.icmpv6_rs_timeout++;
         session->send_requests |= BBL_SEND_ICMPV6_RS;
@@ -500,7 +472,6 @@ bbl_icmpv6_timeout (timer_s *timer)
 protocol_error_t
 bbl_encode_packet_icmpv6_rs (bbl_session_s *session) {
     bbl_interface_s *interface;
-    bbl_ctx_s *ctx;
 
     bbl_ethernet_header_t eth = {0};
     bbl_pppoe_session_t pppoe = {0};
@@ -508,7 +479,6 @@ bbl_encode_packet_icmpv6_rs (bbl_session_s *session) {
     bbl_icmpv6_t icmpv6 = {0};
 
     interface = session->interface;
-    ctx = interface->ctx;
     interface->stats.icmpv6_tx++;
 
     eth.dst = session->server_mac;
@@ -536,17 +506,14 @@ bbl_encode_packet_icmpv6_rs (bbl_session_s *session) {
     ipv6.protocol = IPV6_NEXT_HEADER_ICMPV6;
     ipv6.next = &icmpv6;
     icmpv6.type = IPV6_ICMPV6_ROUTER_SOLICITATION;
-    timer_add(&ctx->timer_root, &session->timer_icmpv6, "ICMPv6", 5, 0, session, bbl_icmpv6_timeout);
+    bbl_retry_add(session, BBL_RETRY_ICMPV6);
     return encode_ethernet(session->write_buf, &session->write_idx, &eth);
 }
 
 void
-bbl_dhcpv6_timeout (timer_s *timer)
+bbl_dhcpv6_timeout (bbl_session_s *session)
 {
-    bbl_session_s *session;
-    bbl_interface_s *interface;
-    session = timer->data;
-    interface = session->interface;
+    bbl_interface_s *interface = session->interface;
     if(!session->dhcpv6_received) {
         interface->stats.dhcpv6_timeout++;
         session->send_requests |= BBL_SEND_DHCPV6_REQUEST;
@@ -616,18 +583,16 @@ bbl_encode_packet_dhcpv6_request (bbl_session_s *session) {
         dhcpv6.rapid = ctx->config.dhcpv6_rapid_commit;
         dhcpv6.oro = true;
     }
-    timer_add(&ctx->timer_root, &session->timer_dhcpv6, "DHCPv6", 5, 0, session, bbl_dhcpv6_timeout);
+    bbl_retry_add(session, BBL_RETRY_DHCPV6);
     return encode_ethernet(session->write_buf, &session->write_idx, &eth);
 }
 
 void
-bbl_ip6cp_timeout (timer_s *timer)
+bbl_ip6cp_timeout (bbl_session_s *session)
 {
-    bbl_session_s *session;
     bbl_interface_s *interface;
     bbl_ctx_s *ctx;
 
-    session = timer->data;
     interface = session->interface;
     ctx = interface->ctx;
     if(session->session_state == BBL_PPP_NETWORK && session->ip6cp_state != BBL_PPP_OPENED) {
@@ -651,7 +616,6 @@ bbl_ip6cp_timeout (timer_s *timer)
 protocol_error_t
 bbl_encode_packet_ip6cp_request (bbl_session_s *session) {
     bbl_interface_s *interface;
-    bbl_ctx_s *ctx;
 
     bbl_ethernet_header_t eth = {0};
     bbl_pppoe_session_t pppoe = {0};
@@ -662,7 +626,6 @@ bbl_encode_packet_ip6cp_request (bbl_session_s *session) {
     }
 
     interface = session->interface;
-    ctx = interface->ctx;
     interface->stats.ip6cp_tx++;
 
     eth.dst = session->server_mac;
@@ -681,7 +644,7 @@ bbl_encode_packet_ip6cp_request (bbl_session_s *session) {
     if(ip6cp.code == PPP_CODE_CONF_REQUEST) {
         ip6cp.ipv6_identifier = session->ip6cp_ipv6_identifier;
     }
-    timer_add(&ctx->timer_root, &session->timer_ip6cp, "IP6CP timeout", ctx->config.ip6cp_conf_request_timeout, 0, session, bbl_ip6cp_timeout);
+    bbl_retry_add(session, BBL_RETRY_IP6CP);
     return encode_ethernet(session->write_buf, &session->write_idx, &eth);
 }
 
@@ -716,13 +679,11 @@ bbl_encode_packet_ip6cp_response (bbl_session_s *session) {
 }
 
 void
-bbl_ipcp_timeout (timer_s *timer)
+bbl_ipcp_timeout (bbl_session_s *session)
 {
-    bbl_session_s *session;
     bbl_interface_s *interface;
     bbl_ctx_s *ctx;
 
-    session = timer->data;
     interface = session->interface;
     ctx = interface->ctx;
     if(session->session_state == BBL_PPP_NETWORK && session->ipcp_state != BBL_PPP_OPENED) {
@@ -787,7 +748,7 @@ bbl_encode_packet_ipcp_request (bbl_session_s *session) {
             ipcp.option_dns2 = true;
         }
     }
-    timer_add(&ctx->timer_root, &session->timer_ipcp, "IPCP timeout", ctx->config.ipcp_conf_request_timeout, 0, session, bbl_ipcp_timeout);
+    bbl_retry_add(session, BBL_RETRY_IPCP);
     return encode_ethernet(session->write_buf, &session->write_idx, &eth);
 }
 
@@ -820,13 +781,11 @@ bbl_encode_packet_ipcp_response (bbl_session_s *session) {
 }
 
 void
-bbl_lcp_timeout (timer_s *timer)
+bbl_lcp_timeout (bbl_session_s *session)
 {
-    bbl_session_s *session;
     bbl_interface_s *interface;
     bbl_ctx_s *ctx;
 
-    session = timer->data;
     interface = session->interface;
     ctx = interface->ctx;
 
@@ -852,20 +811,66 @@ bbl_lcp_timeout (timer_s *timer)
     }
 }
 
+/*
+ * bbl_encode_packet_lcp_echo
+ *
+ * LCP echo request and reply differ only in code,
+ * identifier and magic number. The first echo encodes
+ * the full frame into the session template, all further
+ * echos copy the template and patch those fields.
+ */
+static protocol_error_t
+bbl_encode_packet_lcp_echo (bbl_session_s *session, uint8_t code, uint8_t identifier) {
+    bbl_ethernet_header_t eth = {0};
+    bbl_pppoe_session_t pppoe = {0};
+    bbl_lcp_t lcp = {0};
+
+    uint8_t *buf;
+    uint len = 0;
+
+    if(!session->lcp_echo_template_len) {
+        eth.dst = session->server_mac;
+        eth.src = session->client_mac;
+        eth.vlan_outer = session->key.outer_vlan_id;
+        eth.vlan_inner = session->key.inner_vlan_id;
+        eth.vlan_three = session->access_third_vlan;
+        eth.type = ETH_TYPE_PPPOE_SESSION;
+        eth.next = &pppoe;
+        pppoe.session_id = session->pppoe_session_id;
+        pppoe.protocol = PROTOCOL_LCP;
+        pppoe.next = &lcp;
+        lcp.code = PPP_CODE_ECHO_REQUEST;
+        if(encode_ethernet_fast(session->lcp_echo_template, &len, &eth) != PROTOCOL_SUCCESS) {
+            return ENCODE_ERROR;
+        }
+        session->lcp_echo_template_len = len;
+    }
+
+    buf = session->write_buf + session->write_idx;
+    memcpy(buf, session->lcp_echo_template, session->lcp_echo_template_len);
+    buf += session->lcp_echo_template_len - 8;
+    *buf = code;
+    *(buf+1) = identifier;
+    *(uint32_t*)(buf+4) = session->magic_number;
+    session->write_idx += session->lcp_echo_template_len;
+    return PROTOCOL_SUCCESS;
+}
+
 protocol_error_t
 bbl_encode_packet_lcp_request (bbl_session_s *session) {
     bbl_interface_s *interface;
-    bbl_ctx_s *ctx;
 
     bbl_ethernet_header_t eth = {0};
     bbl_pppoe_session_t pppoe = {0};
     bbl_lcp_t lcp = {0};
-    uint16_t timeout = 1; /* default timeout 1 second */
 
     interface = session->interface;
-    ctx = interface->ctx;
     interface->stats.lcp_tx++;
 
+    if(session->lcp_request_code == PPP_CODE_ECHO_REQUEST) {
+        return bbl_encode_packet_lcp_echo(session, PPP_CODE_ECHO_REQUEST, ++session->lcp_identifier);
+    }
+
     eth.dst = session->server_mac;
     eth.src = session->client_mac;
     eth.vlan_outer = session->key.outer_vlan_id;
@@ -879,18 +884,17 @@ bbl_encode_packet_lcp_request (bbl_session_s *session) {
 
     lcp.code = session->lcp_request_code;
     lcp.identifier = ++session->lcp_identifier;
-    if(lcp.code == PPP_CODE_ECHO_REQUEST) {
-        lcp.magic = session->magic_number;
-        timeout = 0;
-    } else if(lcp.code == PPP_CODE_CONF_REQUEST) {
+    if(lcp.code == PPP_CODE_CONF_REQUEST) {
         lcp.mru = session->mru;
         lcp.magic = session->magic_number;
-        timeout = ctx->config.lcp_conf_request_timeout;
-    }
-    if(timeout) {
-        timer_add(&ctx->timer_root, &session->timer_lcp, "LCP timeout", timeout, 0, session, bbl_lcp_timeout);
+        bbl_retry_del(session, BBL_RETRY_LCP_TERMINATE);
+        bbl_retry_add(session, BBL_RETRY_LCP);
+    } else {
+        /* Default timeout of 1 second for all other requests. */
+        bbl_retry_del(session, BBL_RETRY_LCP);
+        bbl_retry_add(session, BBL_RETRY_LCP_TERMINATE);
     }
-    return encode_ethernet(session->write_buf, &session->write_idx, &eth);
+    return encode_ethernet_fast(session->write_buf, &session->write_idx, &eth);
 }
 
 protocol_error_t
@@ -901,6 +905,10 @@ bbl_encode_packet_lcp_response (bbl_session_s *session) {
 
     session->interface->stats.lcp_tx++;
 
+    if(session->lcp_response_code == PPP_CODE_ECHO_REPLY) {
+        return bbl_encode_packet_lcp_echo(session, PPP_CODE_ECHO_REPLY, session->lcp_peer_identifier);
+    }
+
     eth.dst = session->server_mac;
     eth.src = session->client_mac;
     eth.vlan_outer = session->key.outer_vlan_id;
@@ -915,36 +923,22 @@ bbl_encode_packet_lcp_response (bbl_session_s *session) {
     lcp.code = session->lcp_response_code;
     lcp.identifier = session->lcp_peer_identifier;
 
-    if(lcp.code == PPP_CODE_ECHO_REPLY) {
-        lcp.magic = session->magic_number;
+    if(session->lcp_options_len) {
+        lcp.options = session->lcp_options;
+        lcp.options_len = session->lcp_options_len;
     } else {
-        if(session->lcp_options_len) {
-            lcp.options = session->lcp_options;
-            lcp.options_len = session->lcp_options_len;
-        } else {
-            lcp.mru = session->peer_mru;
-            lcp.auth = session->auth_protocol;
-            lcp.magic = session->peer_magic_number;
-        }
+        lcp.mru = session->peer_mru;
+        lcp.auth = session->auth_protocol;
+        lcp.magic = session->peer_magic_number;
     }
-    return encode_ethernet(session->write_buf, &session->write_idx, &eth);
+    return encode_ethernet_fast(session->write_buf, &session->write_idx, &eth);
 }
 
 void
-bbl_padi_timeout (timer_s *timer)
+bbl_discovery_timeout (bbl_session_s *session)
 {
-    bbl_session_s *session = timer->data;
-    if(session->session_state == BBL_PPPOE_INIT) {
-        session->send_requests = BBL_SEND_DISCOVERY;
-        bbl_session_tx_qnode_insert(session);
-    }
-}
-
-void
-bbl_padr_timeout (timer_s *timer)
-{
-    bbl_session_s *session = timer->data;
-    if(session->session_state == BBL_PPPOE_REQUEST) {
+    if(session->session_state == BBL_PPPOE_INIT ||
+       session->session_state == BBL_PPPOE_REQUEST) {
         session->send_requests = BBL_SEND_DISCOVERY;
         bbl_session_tx_qnode_insert(session);
     }
@@ -1034,7 +1028,7 @@ bbl_encode_packet_discovery (bbl_session_s *session) {
      switch(session->session_state) {
         case BBL_PPPOE_INIT:
             result = bbl_encode_padi(session);
-            timer_add(&ctx->timer_root, &session->timer_padi, "PADI timeout", 5, 0, session, bbl_padi_timeout);
+            bbl_retry_add(session, BBL_RETRY_DISCOVERY);
             interface->stats.padi_tx++;
             if(!ctx->stats.first_session_tx.tv_sec) {
                 ctx->stats.first_session_tx.tv_sec = interface->tx_timestamp.tv_sec;
@@ -1043,7 +1037,7 @@ bbl_encode_packet_discovery (bbl_session_s *session) {
             break;
         case BBL_PPPOE_REQUEST:
             result = bbl_encode_padr(session);
-            timer_add(&ctx->timer_root, &session->timer_padr, "PADR timeout", 5, 0, session, bbl_padr_timeout);
+            bbl_retry_add(session, BBL_RETRY_DISCOVERY);
             interface->stats.padr_tx++;
             break;
         case BBL_TERMINATING:
@@ -1059,9 +1053,8 @@ bbl_encode_packet_discovery (bbl_session_s *session) {
 }
 
 void
-bbl_arp_timeout (timer_s *timer)
+bbl_arp_timeout (bbl_session_s *session)
 {
-    bbl_session_s *session = timer->data;
     session->send_requests |= BBL_SEND_ARP_REQUEST;
     bbl_session_tx_qnode_insert(session);
 }
@@ -1089,16 +1082,18 @@ bbl_encode_packet_arp_request (bbl_session_s *session)
     arp.target_ip = session->peer_ip_address;
 
     if(session->arp_resolved) {
-        timer_add(&ctx->timer_root, &session->timer_arp, "ARP timeout", 300, 0, session, bbl_arp_timeout);
+        bbl_retry_del(session, BBL_RETRY_ARP);
+        bbl_retry_add(session, BBL_RETRY_ARP_REFRESH);
     } else {
-        timer_add(&ctx->timer_root, &session->timer_arp, "ARP timeout", 1, 0, session, bbl_arp_timeout);
+        bbl_retry_del(session, BBL_RETRY_ARP_REFRESH);
+        bbl_retry_add(session, BBL_RETRY_ARP);
     }
     interface->stats.arp_tx++;
     if(!ctx->stats.first_session_tx.tv_sec) {
         ctx->stats.first_session_tx.tv_sec = interface->tx_timestamp.tv_sec;
         ctx->stats.first_session_tx.tv_nsec = interface->tx_timestamp.tv_nsec;
     }
-    return encode_ethernet(session->write_buf, &session->write_idx, &eth);
+    return encode_ethernet_fast(session->write_buf, &session->write_idx, &eth);
 }
 
 protocol_error_t
@@ -1119,7 +1114,7 @@ bbl_encode_packet_arp_reply (bbl_session_s *session)
     arp.target = session->server_mac;
     arp.target_ip = session->peer_ip_address;
     session->interface->stats.arp_tx++;
-    return encode_ethernet(session->write_buf, &session->write_idx, &eth);
+    return encode_ethernet_fast(session->write_buf, &session->write_idx, &eth);
 }
 
 bool
@@ -1346,9 +1341,7 @@ bbl_encode_multicast_packet (bbl_interface_s *interface, int i, u_char *frame_pt
     struct tpacket2_hdr* tphdr;
     uint8_t *buf = frame_ptr + TPACKET2_HDRLEN - sizeof(struct sockaddr_ll);
     memcpy(buf, interface->mc_packets + (i*interface->mc_packet_len), interface->mc_packet_len);
-    *(uint64_t*)(buf + (interface->mc_packet_len - 16)) = interface->mc_packet_seq;
-    *(uint32_t*)(buf + (interface->mc_packet_len - 8)) = interface->tx_timestamp.tv_sec;
-    *(uint32_t*)(buf + (interface->mc_packet_len - 4)) = interface->tx_timestamp.tv_nsec;
+    bbl_checksum_update_bbl(buf, interface->mc_packet_len, interface->mc_packet_seq, &interface->tx_timestamp);
     tphdr = (struct tpacket2_hdr *)frame_ptr;
     tphdr->tp_len = interface->mc_packet_len;
     tphdr->tp_status = TP_STATUS_SEND_REQUEST;
@@ -1391,7 +1384,7 @@ bbl_tx_job (timer_s *timer)
     }
 
     /* Get TX timestamp */
-    clock_gettime(CLOCK_REALTIME, &interface->tx_timestamp);
+    timer_clock_gettime(&ctx->timer_root, CLOCK_REALTIME, &interface->tx_timestamp);
 
     /* Write per interface frames like ARP, ICMPv6 NS or LLDP. */
     while(interface->send_requests) {
@@ -1407,17 +1400,16 @@ bbl_tx_job (timer_s *timer)
             interface->stats.packets_tx++;
             interface->cursor_tx = (interface->cursor_tx + 1) % interface->req_tx.tp_frame_nr;
             /* Dump the packet into pcap file. */
-            if (ctx->pcap.write_buf) {
-                pcapng_push_packet_header(ctx, &interface->tx_timestamp,
-                            frame_ptr + TPACKET2_HDRLEN - sizeof(struct sockaddr_ll),
-			    tphdr->tp_len, interface->pcap_index, PCAPNG_EPB_FLAGS_OUTBOUND);
-            }
+            bbl_capture_frame(ctx, interface, &interface->tx_timestamp,
+                              frame_ptr + TPACKET2_HDRLEN - sizeof(struct sockaddr_ll),
+                              tphdr->tp_len, 0, PCAPNG_EPB_FLAGS_OUTBOUND);
         }
     }
 
     /* Write per session frames. */
     while (!CIRCLEQ_EMPTY(&interface->session_tx_qhead)) {
         session = CIRCLEQ_FIRST(&interface->session_tx_qhead);
+        bbl_session_log_scope(session);
 
         frame_ptr = interface->ring_tx + (interface->cursor_tx * interface->req_tx.tp_frame_size);
         tphdr = (struct tpacket2_hdr *)frame_ptr;
@@ -1462,14 +1454,13 @@ bbl_tx_job (timer_s *timer)
         if(encode_success) {
             interface->stats.packets_tx++;
             interface->cursor_tx = (interface->cursor_tx + 1) % interface->req_tx.tp_frame_nr;
-            /* Dump the packet into PCAP file. */
-            if (ctx->pcap.write_buf) {
-                pcapng_push_packet_header(ctx, &interface->tx_timestamp,
-                            frame_ptr + TPACKET2_HDRLEN - sizeof(struct sockaddr_ll),
-                            tphdr->tp_len, interface->pcap_index, PCAPNG_EPB_FLAGS_OUTBOUND);
-            }
+            /* Dump the packet into pcap file. */
+            bbl_capture_frame(ctx, interface, &interface->tx_timestamp,
+                              frame_ptr + TPACKET2_HDRLEN - sizeof(struct sockaddr_ll),
+                              tphdr->tp_len, 0, PCAPNG_EPB_FLAGS_OUTBOUND);
         }
     }
+    log_scope_clear();
 
     /* Network Interface Only! */
     if(!interface->access) {
@@ -1491,12 +1482,10 @@ bbl_tx_job (timer_s *timer)
                     interface->stats.packets_tx++;
                     interface->stats.mc_tx++;
                     interface->cursor_tx = (interface->cursor_tx + 1) % interface->req_tx.tp_frame_nr;
-                    /* Dump the packet into PCAP file. */
-                    if (ctx->pcap.write_buf) {
-                        pcapng_push_packet_header(ctx, &interface->tx_timestamp,
-                                    frame_ptr + TPACKET2_HDRLEN - sizeof(struct sockaddr_ll),
-                                    tphdr->tp_len, interface->pcap_index, PCAPNG_EPB_FLAGS_OUTBOUND);
-                    }
+                    /* Dump the packet into pcap file. */
+                    bbl_capture_frame(ctx, interface, &interface->tx_timestamp,
+                                      frame_ptr + TPACKET2_HDRLEN - sizeof(struct sockaddr_ll),
+                                      tphdr->tp_len, 0, PCAPNG_EPB_FLAGS_OUTBOUND);
                 }
             }
         }
@@ -1504,6 +1493,12 @@ bbl_tx_job (timer_s *timer)
 
     pcapng_fflush(ctx);
 
+    /* Hand over to the responder if simulated. */
+    if (ctx->simulation.responder) {
+        bbl_io_memory_tx(interface);
+        return;
+    }
+
     /* Notify kernel. */
     if (sendto(interface->fd_tx, NULL, 0 , 0, NULL, 0) == -1) {
         interface->stats.sendto_failed++;
@@ -110,3 +110,109 @@ replace_substring (const char* s,
     result[i] = '\0';
     return result;
 }
+
+static bool
+session_template_add (session_template_s *template, session_template_part_t type, uint16_t offset, uint16_t len)
+{
+    if(template->parts >= SESSION_TEMPLATE_PARTS_MAX) {
+        return false;
+    }
+    template->part[template->parts].type = type;
+    template->part[template->parts].offset = offset;
+    template->part[template->parts].len = len;
+    template->parts++;
+    return true;
+}
+
+/*
+ * Split string into text and variable parts once, so that
+ * rendering per session does not need to search the string.
+ */
+bool
+session_template_compile (session_template_s *template, const char *s)
+{
+    const char *text = s;
+    const char *p = s;
+
+    memset(template, 0x0, sizeof(session_template_s));
+    template->s = s;
+
+    while (*p) {
+        if(*p == '{') {
+            if(strncmp(p, "{session}", 9) == 0) {
+                if(p > text && !session_template_add(template, SESSION_TEMPLATE_TEXT, text - s, p - text)) return false;
+                if(!session_template_add(template, SESSION_TEMPLATE_SESSION, 0, 0)) return false;
+                p += 9;
+                text = p;
+                continue;
+            }
+            if(strncmp(p, "{session-global}", 16) == 0) {
+                if(p > text && !session_template_add(template, SESSION_TEMPLATE_TEXT, text - s, p - text)) return false;
+                if(!session_template_add(template, SESSION_TEMPLATE_SESSION_GLOBAL, 0, 0)) return false;
+                p += 16;
+                text = p;
+                continue;
+            }
+        }
+        p++;
+    }
+    if(p > text && !session_template_add(template, SESSION_TEMPLATE_TEXT, text - s, p - text)) return false;
+    return true;
+}
+
+void
+session_template_render (session_template_s *template, char *buf, size_t len, uint32_t session, uint32_t session_global)
+{
+    char num[10];
+    const char *src;
+    size_t src_len;
+    size_t i = 0;
+    uint32_t value;
+    int part;
+
+    if(!len) return;
+    len--; /* reserve space for terminating zero */
+
+    for(part = 0; part < template->parts && i < len; part++) {
+        if(template->part[part].type == SESSION_TEMPLATE_TEXT) {
+            src = template->s + template->part[part].offset;
+            src_len = template->part[part].len;
+        } else {
+            /* Format number backwards into num buffer. */
+            value = template->part[part].type == SESSION_TEMPLATE_SESSION ? session : session_global;
+            src_len = 0;
+            do {
+                num[sizeof(num) - 1 - src_len++] = '0' + (value % 10);
+                value /= 10;
+            } while (value);
+            src = &num[sizeof(num) - src_len];
+        }
+        if(src_len > len - i) src_len = len - i;
+        memcpy(&buf[i], src, src_len);
+        i += src_len;
+    }
+    buf[i] = '\0';
+}
+
+/*
+ * A session key fits in 64-Bits. Lets do this instead of a memcmp()
+ */
+int
+bbl_compare_session (void *key1, void *key2)
+{
+    const uint64_t a = *(const uint64_t*)key1;
+    const uint64_t b = *(const uint64_t*)key2;
+    return (a > b) - (a < b);
+}
+
+uint
+bbl_session_hash (const void* k)
+{
+    uint hash = 2166136261U;
+
+    hash ^= *(uint32_t *)k;
+    hash ^= *(uint16_t *)(k+4) << 12;
+    hash ^= *(uint16_t *)(k+6);
+
+    return hash;
+}
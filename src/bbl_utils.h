@@ -19,7 +19,33 @@ char *format_ipv4_address(uint32_t *addr4);
 char *format_ipv6_address(ipv6addr_t *addr6);
 char *format_ipv6_prefix(ipv6_prefix *addr6);
 
+/*
+ * Precompiled template for {session} and {session-global}
+ * substitution in username, password, ACI and ARI.
+ */
+#define SESSION_TEMPLATE_PARTS_MAX  16
+
+typedef enum {
+    SESSION_TEMPLATE_TEXT = 0,
+    SESSION_TEMPLATE_SESSION,           // {session}
+    SESSION_TEMPLATE_SESSION_GLOBAL     // {session-global}
+} __attribute__ ((__packed__)) session_template_part_t;
+
+typedef struct session_template_ {
+    const char *s;
+    uint8_t parts;
+    struct {
+        session_template_part_t type;
+        uint16_t offset;
+        uint16_t len;
+    } part[SESSION_TEMPLATE_PARTS_MAX];
+} session_template_s;
+
 char *replace_substring (const char* s, const char* old, const char* new);
+bool session_template_compile (session_template_s *template, const char *s);
+void session_template_render (session_template_s *template, char *buf, size_t len, uint32_t session, uint32_t session_global);
 const char *val2key (struct keyval_ *keyval, uint val);
+int bbl_compare_session (void *key1, void *key2);
+uint bbl_session_hash (const void* k);
 
 #endif
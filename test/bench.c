@@ -0,0 +1,642 @@
+/*
+ * BNG Blaster (BBL) - Micro Benchmarks
+ *
+ * This application measures the hot path components
+ * of the BNG Blaster (decode, encode, checksum, session
+ * lookup, timers, TX templates and PCAP) and prints
+ * the results as JSON to be compared between releases.
+ *
+ * Usage: bbl-bench [filter]
+ *
+ * Copyright (C) 2020-2021, RtBrick, Inc.
+ */
+#include <jansson.h>
+#include <bbl.h>
+#include <bbl_protocols.h>
+#include <bbl_pcap.h>
+#include "ethernet_packets.h"
+
+#define BENCH_RUNS      5
+#define BENCH_OPS       1000000
+
+bool g_interactive = false;
+char *g_log_file = NULL;
+
+const char *g_filter = NULL;
+json_t *g_results = NULL;
+
+typedef uint64_t (*bench_fn)(void *arg, uint64_t ops);
+
+typedef struct bench_packet_ {
+    const char *name;
+    uint8_t buf[256];
+    uint len;
+    uint8_t mac[ETH_ADDR_LEN];
+    ipv6addr_t ipv6_src;
+    ipv6addr_t ipv6_dst;
+    bbl_ethernet_header_t eth;
+    bbl_pppoe_session_t pppoe;
+    bbl_lcp_t lcp;
+    bbl_arp_t arp;
+    bbl_ipv4_t ipv4;
+    bbl_ipv6_t ipv6;
+    bbl_igmp_t igmp;
+    bbl_udp_t udp;
+    bbl_bbl_t bbl;
+} bench_packet_s;
+
+typedef enum {
+    BENCH_PACKET_LCP_ECHO = 0,
+    BENCH_PACKET_ARP,
+    BENCH_PACKET_IGMP,
+    BENCH_PACKET_PPPOE_IPV4,
+    BENCH_PACKET_PPPOE_IPV6,
+    BENCH_PACKET_IPV4,
+    BENCH_PACKET_IPV4_CHECKSUM,
+    BENCH_PACKET_MULTICAST,
+    BENCH_PACKET_MAX
+} bench_packet_t;
+
+static uint64_t
+bench_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static int
+bench_compare(const void *a, const void *b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Execute a benchmark BENCH_RUNS times after
+ * a short warmup and add min and median to
+ * the results.
+ */
+static void
+bench(const char *name, bench_fn fn, void *arg, uint64_t ops) {
+    json_t *jobj;
+    double ns[BENCH_RUNS];
+    int i;
+
+    if(g_filter && !strstr(name, g_filter)) {
+        return;
+    }
+    fn(arg, ops / 10 ? ops / 10 : 1);
+    for(i = 0; i < BENCH_RUNS; i++) {
+        ns[i] = (double)fn(arg, ops) / ops;
+    }
+    qsort(ns, BENCH_RUNS, sizeof(double), bench_compare);
+
+    jobj = json_object();
+    json_object_set(jobj, "name", json_string(name));
+    json_object_set(jobj, "ops", json_integer(ops));
+    json_object_set(jobj, "ns-per-op-min", json_real(ns[0]));
+    json_object_set(jobj, "ns-per-op-median", json_real(ns[BENCH_RUNS/2]));
+    json_object_set(jobj, "mops", json_real(ns[0] ? 1000.0 / ns[0] : 0));
+    json_array_append(g_results, jobj);
+}
+
+static void
+bench_packet_init(bench_packet_s *p, bench_packet_t type) {
+    ipv6addr_t ipv6_src = {0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x01};
+    ipv6addr_t ipv6_dst = {0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x02};
+    uint8_t mac[ETH_ADDR_LEN] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+
+    memset(p, 0x0, sizeof(bench_packet_s));
+    memcpy(p->mac, mac, ETH_ADDR_LEN);
+    memcpy(p->ipv6_src, ipv6_src, IPV6_ADDR_LEN);
+    memcpy(p->ipv6_dst, ipv6_dst, IPV6_ADDR_LEN);
+
+    /* Access packets with two VLAN tags. */
+    p->eth.dst = p->mac;
+    p->eth.src = p->mac;
+    p->eth.vlan_outer = 128;
+    p->eth.vlan_inner = 7;
+    p->eth.type = ETH_TYPE_PPPOE_SESSION;
+    p->eth.next = &p->pppoe;
+    p->pppoe.session_id = 4711;
+
+    p->ipv4.src = htobe32(0x0a000001);
+    p->ipv4.dst = htobe32(0x0a000002);
+    p->ipv4.ttl = 64;
+    p->ipv4.protocol = PROTOCOL_IPV4_UDP;
+    p->ipv4.next = &p->udp;
+    p->ipv6.src = p->ipv6_src;
+    p->ipv6.dst = p->ipv6_dst;
+    p->ipv6.ttl = 64;
+    p->ipv6.protocol = IPV6_NEXT_HEADER_UDP;
+    p->ipv6.next = &p->udp;
+    p->udp.src = BBL_UDP_PORT;
+    p->udp.dst = BBL_UDP_PORT;
+    p->udp.protocol = UDP_PROTOCOL_BBL;
+    p->udp.next = &p->bbl;
+    p->bbl.type = BBL_TYPE_UNICAST_SESSION;
+    p->bbl.sub_type = BBL_SUB_TYPE_IPV4;
+    p->bbl.direction = BBL_DIRECTION_UP;
+    p->bbl.flow_id = 1;
+
+    switch(type) {
+        case BENCH_PACKET_LCP_ECHO:
+            p->name = "pppoe-lcp-echo";
+            p->pppoe.protocol = PROTOCOL_LCP;
+            p->pppoe.next = &p->lcp;
+            p->lcp.code = PPP_CODE_ECHO_REQUEST;
+            p->lcp.identifier = 1;
+            p->lcp.magic = 0x12345678;
+            break;
+        case BENCH_PACKET_ARP:
+            p->name = "ipoe-arp";
+            p->eth.type = ETH_TYPE_ARP;
+            p->eth.next = &p->arp;
+            p->arp.code = ARP_REQUEST;
+            p->arp.sender = p->mac;
+            p->arp.sender_ip = p->ipv4.src;
+            p->arp.target_ip = p->ipv4.dst;
+            break;
+        case BENCH_PACKET_IGMP:
+            p->name = "pppoe-igmpv3";
+            p->pppoe.protocol = PROTOCOL_IPV4;
+            p->pppoe.next = &p->ipv4;
+            p->ipv4.dst = IPV4_MC_IGMP;
+            p->ipv4.ttl = 1;
+            p->ipv4.protocol = PROTOCOL_IPV4_IGMP;
+            p->ipv4.router_alert_option = true;
+            p->ipv4.next = &p->igmp;
+            p->igmp.version = IGMP_VERSION_3;
+            p->igmp.type = IGMP_TYPE_REPORT_V3;
+            p->igmp.group_records = 1;
+            p->igmp.group_record[0].type = IGMP_EXCLUDE;
+            p->igmp.group_record[0].group = htobe32(0xe8010101);
+            break;
+        case BENCH_PACKET_PPPOE_IPV4:
+            p->name = "pppoe-ipv4-bbl";
+            p->pppoe.protocol = PROTOCOL_IPV4;
+            p->pppoe.next = &p->ipv4;
+            break;
+        case BENCH_PACKET_PPPOE_IPV6:
+            p->name = "pppoe-ipv6-bbl";
+            p->pppoe.protocol = PROTOCOL_IPV6;
+            p->pppoe.next = &p->ipv6;
+            p->bbl.sub_type = BBL_SUB_TYPE_IPV6;
+            break;
+        case BENCH_PACKET_MULTICAST:
+            p->name = "ipoe-ipv4-bbl-multicast";
+            p->eth.type = ETH_TYPE_IPV4;
+            p->eth.next = &p->ipv4;
+            p->ipv4.dst = htobe32(0xe8010101);
+            p->bbl.type = BBL_TYPE_MULTICAST;
+            p->bbl.sub_type = 0;
+            p->bbl.direction = BBL_DIRECTION_DOWN;
+            p->bbl.mc_source = p->ipv4.src;
+            p->bbl.mc_group = p->ipv4.dst;
+            break;
+        case BENCH_PACKET_IPV4_CHECKSUM:
+            p->udp.checksum = true;
+            /* fallthrough */
+        default:
+            p->name = p->udp.checksum ? "ipv4-bbl-udp-checksum" : "ipv4-bbl";
+            p->eth.vlan_inner = 0;
+            p->eth.type = ETH_TYPE_IPV4;
+            p->eth.next = &p->ipv4;
+            p->bbl.direction = BBL_DIRECTION_DOWN;
+            break;
+    }
+    if(encode_ethernet(p->buf, &p->len, &p->eth) != PROTOCOL_SUCCESS) {
+        fprintf(stderr, "Failed to encode %s\n", p->name);
+        exit(1);
+    }
+}
+
+/*
+ * Decode and Encode
+ */
+
+static uint64_t
+bench_decode(void *arg, uint64_t ops) {
+    bench_packet_s *p = arg;
+    bbl_ethernet_header_t *eth;
+    static uint8_t *sp = NULL;
+    uint64_t start, i;
+
+    if(!sp) sp = malloc(SCRATCHPAD_LEN);
+    start = bench_now();
+    for(i = 0; i < ops; i++) {
+        if(decode_ethernet(p->buf, p->len, sp, SCRATCHPAD_LEN, &eth) != PROTOCOL_SUCCESS) {
+            break;
+        }
+    }
+    return bench_now() - start;
+}
+
+static uint64_t
+bench_parse(void *arg, uint64_t ops) {
+    bench_packet_s *p = arg;
+    bbl_parse_t parse;
+    uint64_t start, i;
+
+    start = bench_now();
+    for(i = 0; i < ops; i++) {
+        if(parse_ethernet(p->buf, p->len, &parse) != PROTOCOL_SUCCESS) {
+            break;
+        }
+    }
+    return bench_now() - start;
+}
+
+/*
+ * RX path for packets not handled by the fast path
+ * (see bbl_rx_packet), compare with decode-ethernet.
+ * Session and multicast traffic is accounted from the
+ * parsed offsets, only control packets are decoded.
+ */
+static uint64_t
+bench_rx(void *arg, uint64_t ops) {
+    bench_packet_s *p = arg;
+    bbl_ethernet_header_t *eth;
+    bbl_bbl_t *bbl;
+    bbl_parse_t parse;
+    static uint8_t *sp = NULL;
+    uint64_t start, i;
+
+    if(!sp) sp = malloc(SCRATCHPAD_LEN);
+    start = bench_now();
+    for(i = 0; i < ops; i++) {
+        if(parse_ethernet(p->buf, p->len, &parse) != PROTOCOL_SUCCESS) {
+            break;
+        }
+        if(parse.dst_port == BBL_UDP_PORT) {
+            if(decode_bbl_parsed(p->buf, p->len, sp, SCRATCHPAD_LEN, &parse, &bbl) != PROTOCOL_SUCCESS) {
+                break;
+            }
+        } else if(decode_ethernet_parsed(p->buf, p->len, sp, SCRATCHPAD_LEN, &parse, &eth) != PROTOCOL_SUCCESS) {
+            break;
+        }
+    }
+    return bench_now() - start;
+}
+
+static uint64_t
+bench_encode(void *arg, uint64_t ops) {
+    bench_packet_s *p = arg;
+    uint8_t buf[256];
+    uint64_t start, i;
+    uint len;
+
+    start = bench_now();
+    for(i = 0; i < ops; i++) {
+        len = 0;
+        encode_ethernet(buf, &len, &p->eth);
+    }
+    return bench_now() - start;
+}
+
+static uint64_t
+bench_encode_fast(void *arg, uint64_t ops) {
+    bench_packet_s *p = arg;
+    uint8_t buf[256];
+    uint64_t start, i;
+    uint len;
+
+    start = bench_now();
+    for(i = 0; i < ops; i++) {
+        len = 0;
+        encode_ethernet_fast(buf, &len, &p->eth);
+    }
+    return bench_now() - start;
+}
+
+/*
+ * Session traffic template copy with sequence
+ * number, timestamp and checksum update.
+ */
+static uint64_t
+bench_tx_template(void *arg, uint64_t ops) {
+    bench_packet_s *p = arg;
+    uint8_t buf[256];
+    struct timespec timestamp;
+    uint64_t start, i;
+
+    clock_gettime(CLOCK_REALTIME, &timestamp);
+    start = bench_now();
+    for(i = 0; i < ops; i++) {
+        memcpy(buf, p->buf, p->len);
+        bbl_checksum_update_bbl(buf, p->len, i, &timestamp);
+    }
+    return bench_now() - start;
+}
+
+/*
+ * Checksum
+ */
+
+typedef struct bench_checksum_ {
+    checksum_kernel_t kernel;
+    uint8_t *buf;
+    uint len;
+} bench_checksum_s;
+
+static uint64_t
+bench_checksum(void *arg, uint64_t ops) {
+    bench_checksum_s *c = arg;
+    volatile uint32_t sum = 0;
+    uint64_t start, i;
+
+    start = bench_now();
+    for(i = 0; i < ops; i++) {
+        sum += checksum_sum_kernel(c->kernel, c->buf, c->len);
+    }
+    return bench_now() - start;
+}
+
+/*
+ * Session Lookup
+ */
+
+typedef struct bench_lookup_ {
+    dict *session_dict;
+    session_key_t *keys;
+    uint32_t *order;
+    uint32_t sessions;
+} bench_lookup_s;
+
+static void
+bench_lookup_init(bench_lookup_s *l, uint32_t sessions) {
+    dict_insert_result result;
+    uint32_t i, r, tmp;
+
+    l->sessions = sessions;
+    l->keys = calloc(sessions, sizeof(session_key_t));
+    l->order = calloc(sessions, sizeof(uint32_t));
+    l->session_dict = hashtable2_dict_new((dict_compare_func)bbl_compare_session,
+                                          bbl_session_hash,
+                                          BBL_SESSION_HASHTABLE_SIZE);
+    for(i = 0; i < sessions; i++) {
+        l->keys[i].ifindex = 1 + (i >> 24);
+        l->keys[i].outer_vlan_id = 1 + ((i >> 12) & 0xfff);
+        l->keys[i].inner_vlan_id = 1 + (i & 0xfff);
+        result = dict_insert(l->session_dict, &l->keys[i]);
+        if(result.inserted) {
+            *result.datum_ptr = &l->keys[i];
+        }
+        l->order[i] = i;
+    }
+    /* Lookup sessions in random order. */
+    srand(1);
+    for(i = sessions - 1; i > 0; i--) {
+        r = rand() % (i + 1);
+        tmp = l->order[i];
+        l->order[i] = l->order[r];
+        l->order[r] = tmp;
+    }
+}
+
+static void
+bench_lookup_free(bench_lookup_s *l) {
+    dict_free(l->session_dict, NULL);
+    free(l->keys);
+    free(l->order);
+}
+
+static uint64_t
+bench_lookup(void *arg, uint64_t ops) {
+    bench_lookup_s *l = arg;
+    session_key_t key;
+    uint64_t start, i;
+    uint32_t found = 0;
+
+    start = bench_now();
+    for(i = 0; i < ops; i++) {
+        key = l->keys[l->order[i % l->sessions]];
+        if(dict_search(l->session_dict, &key)) {
+            found++;
+        }
+    }
+    if(found != ops) {
+        fprintf(stderr, "Session lookup failed\n");
+        exit(1);
+    }
+    return bench_now() - start;
+}
+
+/*
+ * Timer
+ */
+
+typedef struct bench_timer_ {
+    timer_root_s root;
+    timer_s **timers;
+    uint32_t count;
+    uint32_t expired;
+    uint64_t last_expired;
+} bench_timer_s;
+
+static void
+bench_timer_cb(timer_s *timer) {
+    bench_timer_s *t = timer->data;
+    if(++t->expired == t->count) {
+        t->last_expired = bench_now();
+    }
+}
+
+static uint64_t
+bench_timer_add(void *arg, uint64_t ops) {
+    bench_timer_s *t = arg;
+    uint64_t start, stop, i;
+
+    start = bench_now();
+    for(i = 0; i < ops; i++) {
+        timer_add(&t->root, &t->timers[i], "BENCH", 1, 0, t, bench_timer_cb);
+    }
+    stop = bench_now();
+    for(i = 0; i < ops; i++) {
+        timer_del(t->timers[i]);
+    }
+    timer_process_changes(&t->root);
+    return stop - start;
+}
+
+static uint64_t
+bench_timer_del(void *arg, uint64_t ops) {
+    bench_timer_s *t = arg;
+    uint64_t start, i;
+
+    for(i = 0; i < ops; i++) {
+        timer_add(&t->root, &t->timers[i], "BENCH", 1, 0, t, bench_timer_cb);
+    }
+    start = bench_now();
+    for(i = 0; i < ops; i++) {
+        timer_del(t->timers[i]);
+    }
+    timer_process_changes(&t->root);
+    return bench_now() - start;
+}
+
+/*
+ * Measured from start of timer walk until the
+ * last timer has fired, excluding the final sleep.
+ */
+static uint64_t
+bench_timer_walk(void *arg, uint64_t ops) {
+    bench_timer_s *t = arg;
+    uint64_t start, i;
+
+    t->count = ops;
+    t->expired = 0;
+    t->last_expired = 0;
+    for(i = 0; i < ops; i++) {
+        timer_add(&t->root, &t->timers[i], "BENCH", 0, 0, t, bench_timer_cb);
+    }
+    start = bench_now();
+    timer_walk(&t->root);
+    return t->last_expired - start;
+}
+
+/*
+ * PCAP
+ */
+
+static uint64_t
+bench_pcapng(void *arg, uint64_t ops) {
+    bench_packet_s *p = arg;
+    static bbl_ctx_s *ctx = NULL;
+    struct timespec timestamp;
+    uint64_t start, i;
+
+    if(!ctx) {
+        ctx = calloc(1, sizeof(bbl_ctx_s));
+        CIRCLEQ_INIT(&ctx->interface_qhead);
+        ctx->pcap.filename = "/dev/null";
+        pcapng_init(ctx);
+    }
+    clock_gettime(CLOCK_REALTIME, &timestamp);
+    start = bench_now();
+    for(i = 0; i < ops; i++) {
+        pcapng_push_packet_header(ctx, &timestamp, p->buf, p->len, 0, PCAPNG_EPB_FLAGS_OUTBOUND);
+        /* The RX/TX jobs flush after each batch. */
+        if((i & 63) == 63) {
+            pcapng_fflush(ctx);
+        }
+    }
+    pcapng_fflush(ctx);
+    return bench_now() - start;
+}
+
+int
+main (int argc, char **argv) {
+    bench_packet_s packets[BENCH_PACKET_MAX];
+    bench_packet_s ipcp = {0};
+    bench_checksum_s checksum_arg;
+    bench_lookup_s lookup;
+    bench_timer_s timer = {0};
+    json_t *root;
+
+    uint32_t lookup_sessions[] = {10000, 100000, 1000000};
+    uint32_t timer_count[] = {10000, 100000};
+    uint checksum_len[] = {64, 512, 1500};
+    uint8_t checksum_buf[1500];
+    char name[128];
+    int i, i2;
+
+    if(argc > 1) {
+        g_filter = argv[1];
+    }
+    g_results = json_array();
+
+    for(i = 0; i < BENCH_PACKET_MAX; i++) {
+        bench_packet_init(&packets[i], i);
+    }
+    ipcp.name = "pppoe-ipcp-conf-request";
+    ipcp.len = sizeof(pppoe_ipcp_conf_request);
+    memcpy(ipcp.buf, pppoe_ipcp_conf_request, ipcp.len);
+
+    /* Decode */
+    bench("decode-ethernet-pppoe-ipcp-conf-request", bench_decode, &ipcp, BENCH_OPS);
+    for(i = 0; i < BENCH_PACKET_MAX; i++) {
+        snprintf(name, sizeof(name), "decode-ethernet-%s", packets[i].name);
+        bench(name, bench_decode, &packets[i], BENCH_OPS);
+    }
+    for(i = 0; i < BENCH_PACKET_MAX; i++) {
+        snprintf(name, sizeof(name), "parse-ethernet-%s", packets[i].name);
+        bench(name, bench_parse, &packets[i], BENCH_OPS);
+    }
+    bench("rx-pppoe-ipcp-conf-request", bench_rx, &ipcp, BENCH_OPS);
+    for(i = 0; i < BENCH_PACKET_MAX; i++) {
+        snprintf(name, sizeof(name), "rx-%s", packets[i].name);
+        bench(name, bench_rx, &packets[i], BENCH_OPS);
+    }
+
+    /* Encode */
+    for(i = 0; i < BENCH_PACKET_MAX; i++) {
+        snprintf(name, sizeof(name), "encode-ethernet-%s", packets[i].name);
+        bench(name, bench_encode, &packets[i], BENCH_OPS);
+    }
+    for(i = BENCH_PACKET_LCP_ECHO; i <= BENCH_PACKET_IGMP; i++) {
+        snprintf(name, sizeof(name), "encode-ethernet-fast-%s", packets[i].name);
+        bench(name, bench_encode_fast, &packets[i], BENCH_OPS);
+    }
+
+    /* TX Templates */
+    for(i = BENCH_PACKET_PPPOE_IPV4; i < BENCH_PACKET_MAX; i++) {
+        snprintf(name, sizeof(name), "tx-template-%s", packets[i].name);
+        bench(name, bench_tx_template, &packets[i], BENCH_OPS);
+    }
+
+    /* Checksum */
+    for(i = 0; i < (int)sizeof(checksum_buf); i++) {
+        checksum_buf[i] = i;
+    }
+    for(i = 0; i < CHECKSUM_KERNEL_MAX; i++) {
+        if(!checksum_kernel_supported(i)) {
+            continue;
+        }
+        for(i2 = 0; i2 < 3; i2++) {
+            checksum_arg.kernel = i;
+            checksum_arg.buf = checksum_buf;
+            checksum_arg.len = checksum_len[i2];
+            snprintf(name, sizeof(name), "checksum-%s-%u", checksum_kernel_name(i), checksum_len[i2]);
+            bench(name, bench_checksum, &checksum_arg, BENCH_OPS);
+        }
+    }
+
+    /* Session Lookup */
+    for(i = 0; i < 3; i++) {
+        snprintf(name, sizeof(name), "session-lookup-%u", lookup_sessions[i]);
+        if(g_filter && !strstr(name, g_filter)) {
+            continue;
+        }
+        bench_lookup_init(&lookup, lookup_sessions[i]);
+        bench(name, bench_lookup, &lookup, BENCH_OPS);
+        bench_lookup_free(&lookup);
+    }
+
+    /* Timer */
+    timer_init_root(&timer.root);
+    for(i = 0; i < 2; i++) {
+        timer.timers = calloc(timer_count[i], sizeof(timer_s*));
+        snprintf(name, sizeof(name), "timer-add-%u", timer_count[i]);
+        bench(name, bench_timer_add, &timer, timer_count[i]);
+        snprintf(name, sizeof(name), "timer-del-%u", timer_count[i]);
+        bench(name, bench_timer_del, &timer, timer_count[i]);
+        snprintf(name, sizeof(name), "timer-walk-%u", timer_count[i]);
+        bench(name, bench_timer_walk, &timer, timer_count[i]);
+        free(timer.timers);
+    }
+
+    /* PCAP */
+    bench("pcapng-push-packet-header", bench_pcapng, &packets[BENCH_PACKET_PPPOE_IPV4], BENCH_OPS);
+
+    root = json_object();
+    json_object_set(root, "version", json_string(BNGBLASTER_VERSION));
+    json_object_set(root, "git-sha", json_string(GIT_SHA));
+    json_object_set(root, "checksum-kernel", json_string(checksum_kernel_name(checksum_kernel())));
+    json_object_set(root, "runs", json_integer(BENCH_RUNS));
+    json_object_set(root, "results", g_results);
+    json_dumpf(root, stdout, JSON_INDENT(2));
+    printf("\n");
+    json_decref(root);
+    return 0;
+}
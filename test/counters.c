@@ -0,0 +1,189 @@
+/*
+ * BNG Blaster (BBL) - Counters Tests
+ *
+ * Copyright (C) 2020-2021, RtBrick, Inc.
+ */
+#include <stddef.h>
+#include <stdarg.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include <cmocka.h>
+#include <bbl.h>
+#include <bbl_counters.h>
+
+#define TEST_ACCESS_INTERFACES  3
+#define TEST_UPDATES            200000
+
+bool g_interactive = false;
+char *g_log_file = NULL;
+
+static bbl_ctx_s *
+test_counters_ctx(void) {
+    bbl_ctx_s *ctx = calloc(1, sizeof(bbl_ctx_s));
+    bbl_interface_s *interface;
+    int i;
+
+    for(i = 0; i < TEST_ACCESS_INTERFACES; i++) {
+        assert_int_equal(posix_memalign((void**)&interface, BBL_CACHE_LINE, sizeof(bbl_interface_s)), 0);
+        memset(interface, 0x0, sizeof(bbl_interface_s));
+        interface->name = "access";
+        ctx->op.access_if[ctx->op.access_if_count++] = interface;
+    }
+    assert_int_equal(posix_memalign((void**)&interface, BBL_CACHE_LINE, sizeof(bbl_interface_s)), 0);
+    memset(interface, 0x0, sizeof(bbl_interface_s));
+    interface->name = "network";
+    ctx->op.network_if = interface;
+    return ctx;
+}
+
+static void
+test_counters_ctx_free(bbl_ctx_s *ctx) {
+    int i;
+
+    for(i = 0; i < ctx->op.access_if_count; i++) {
+        free(ctx->op.access_if[i]);
+    }
+    free(ctx->op.network_if);
+    free(ctx);
+}
+
+static void
+test_counters_aggregate(void **unused) {
+    (void) unused;
+
+    bbl_ctx_s *ctx = test_counters_ctx();
+    bbl_counters_snapshot_s *snapshot = calloc(1, sizeof(bbl_counters_snapshot_s));
+    int i;
+
+    ctx->sessions = 3000;
+    ctx->sessions_established = 2999;
+    ctx->sessions_count[BBL_SESSIONS_ESTABLISHED] = 2999;
+    ctx->stats.session_traffic_flows = 6000;
+
+    /* First and last counter of the block and one beyond 32 bit. */
+    for(i = 0; i < TEST_ACCESS_INTERFACES; i++) {
+        ctx->op.access_if[i]->stats.packets_tx = i + 1;
+        ctx->op.access_if[i]->stats.dhcpv6_timeout = 10 * (i + 1);
+        ctx->op.access_if[i]->stats.session_ipv4_rx = UINT32_MAX;
+        ctx->op.access_if[i]->rate.packets_tx.avg = 100;
+    }
+    ctx->op.network_if->stats.packets_rx = 42;
+
+    bbl_counters_update(ctx);
+    bbl_counters_snapshot(snapshot);
+
+    assert_int_equal(snapshot->sessions, 3000);
+    assert_int_equal(snapshot->sessions_established, 2999);
+    assert_int_equal(snapshot->sessions_count[BBL_SESSIONS_ESTABLISHED], 2999);
+    assert_int_equal(snapshot->session_traffic_flows, 6000);
+
+    assert_string_equal(snapshot->network_if.name, "network");
+    assert_int_equal(snapshot->network_if.stats.packets_rx, 42);
+
+    assert_int_equal(snapshot->access_if_count, TEST_ACCESS_INTERFACES);
+    for(i = 0; i < TEST_ACCESS_INTERFACES; i++) {
+        assert_string_equal(snapshot->access_if[i].name, "access");
+        assert_int_equal(snapshot->access_if[i].stats.packets_tx, i + 1);
+        assert_int_equal(snapshot->access_if[i].rate.packets_tx.avg, 100);
+    }
+    assert_int_equal(snapshot->access_total.packets_tx, 1 + 2 + 3);
+    assert_int_equal(snapshot->access_total.dhcpv6_timeout, 10 + 20 + 30);
+    assert_true(snapshot->access_total.session_ipv4_rx == (uint64_t)UINT32_MAX * TEST_ACCESS_INTERFACES);
+    assert_int_equal(snapshot->access_total.packets_rx, 0);
+
+    /* The total is rebuilt and not accumulated by each update. */
+    bbl_counters_update(ctx);
+    bbl_counters_snapshot(snapshot);
+    assert_int_equal(snapshot->access_total.packets_tx, 1 + 2 + 3);
+
+    /* Without network interface. */
+    ctx->op.network_if->stats.packets_rx = 0;
+    free(ctx->op.network_if);
+    ctx->op.network_if = NULL;
+    bbl_counters_update(ctx);
+    bbl_counters_snapshot(snapshot);
+    assert_null(snapshot->network_if.name);
+
+    free(snapshot);
+    test_counters_ctx_free(ctx);
+}
+
+static struct {
+    bool stop;
+    uint64_t snapshots;
+    uint64_t torn;
+} reader;
+
+/*
+ * All values are set to the same number by the writer,
+ * any difference within a snapshot is a torn read.
+ */
+static void *
+test_counters_reader(void *arg) {
+    bbl_counters_snapshot_s *snapshot = arg;
+    uint64_t value;
+    int i;
+
+    while(!__atomic_load_n(&reader.stop, __ATOMIC_ACQUIRE)) {
+        bbl_counters_snapshot(snapshot);
+        value = snapshot->sessions;
+        if(snapshot->sessions_established != value ||
+           snapshot->session_traffic_flows != value ||
+           snapshot->network_if.stats.packets_rx != value ||
+           snapshot->access_total.packets_tx != value * TEST_ACCESS_INTERFACES) {
+            reader.torn++;
+        }
+        for(i = 0; i < TEST_ACCESS_INTERFACES; i++) {
+            if(snapshot->access_if[i].stats.dhcpv6_timeout != value) {
+                reader.torn++;
+            }
+        }
+        reader.snapshots++;
+    }
+    return NULL;
+}
+
+static void
+test_counters_snapshot_consistent(void **unused) {
+    (void) unused;
+
+    bbl_ctx_s *ctx = test_counters_ctx();
+    bbl_counters_snapshot_s *snapshot = calloc(1, sizeof(bbl_counters_snapshot_s));
+    pthread_t thread;
+    uint64_t value;
+    int i;
+
+    bbl_counters_update(ctx);
+    assert_int_equal(pthread_create(&thread, NULL, test_counters_reader, snapshot), 0);
+    for(value = 1; value <= TEST_UPDATES; value++) {
+        ctx->sessions = value;
+        ctx->sessions_established = value;
+        ctx->stats.session_traffic_flows = value;
+        ctx->op.network_if->stats.packets_rx = value;
+        for(i = 0; i < TEST_ACCESS_INTERFACES; i++) {
+            ctx->op.access_if[i]->stats.packets_tx = value;
+            ctx->op.access_if[i]->stats.dhcpv6_timeout = value;
+        }
+        bbl_counters_update(ctx);
+    }
+    __atomic_store_n(&reader.stop, true, __ATOMIC_RELEASE);
+    pthread_join(thread, NULL);
+
+    assert_true(reader.snapshots > 0);
+    assert_int_equal(reader.torn, 0);
+
+    /* The last update is visible after the writer is done. */
+    bbl_counters_snapshot(snapshot);
+    assert_int_equal(snapshot->sessions, TEST_UPDATES);
+
+    free(snapshot);
+    test_counters_ctx_free(ctx);
+}
+
+int main() {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_counters_aggregate),
+        cmocka_unit_test(test_counters_snapshot_consistent),
+    };
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
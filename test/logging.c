@@ -0,0 +1,193 @@
+/*
+ * BNG Blaster (BBL) - Logging Tests
+ *
+ * Copyright (C) 2020-2021, RtBrick, Inc.
+ */
+#include <stddef.h>
+#include <stdarg.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <bbl.h>
+
+bool g_interactive = false;
+char *g_log_file = NULL;
+
+/*
+ * Capture the arguments like LOG() and format them
+ * with log_format() as well as with snprintf().
+ */
+#define TEST_FORMAT(fmt_, ...) \
+    do { \
+        char _buf[LOG_LINE_LEN]; \
+        char _expected[LOG_LINE_LEN]; \
+        log_arg_s _args[] = { LOG_ARGS(_, ##__VA_ARGS__) }; \
+        int _len = log_format(_buf, sizeof(_buf), fmt_, _args, sizeof(_args)/sizeof(log_arg_s)); \
+        snprintf(_expected, sizeof(_expected), fmt_, ##__VA_ARGS__); \
+        assert_string_equal(_buf, _expected); \
+        assert_int_equal(_len, strlen(_expected)); \
+    } while (0)
+
+static void
+test_logging_format_mixed(void **unused) {
+    (void) unused;
+
+    char *name = "eth1";
+    const char *state = "Established";
+    uint8_t u8 = 200;
+    uint16_t u16 = 4094;
+    uint32_t u32 = UINT32_MAX;
+    uint64_t u64 = UINT64_MAX;
+    int32_t i32 = -42;
+    int64_t i64 = INT64_MIN;
+    double d = 3.14159;
+
+    TEST_FORMAT("no arguments\n");
+    TEST_FORMAT("100%% done\n");
+    TEST_FORMAT("%s %u %lu %x\n", name, u32, u64, u16);
+    TEST_FORMAT("Session %u (%s) state %s\n", u32, name, state);
+    TEST_FORMAT("%s: %lu packets, %u sessions, flags 0x%02x, vlan %u\n", name, u64, u32, u8, u16);
+    TEST_FORMAT("%d %ld %i\n", i32, i64, i32);
+    TEST_FORMAT("%08x %X %#x %o\n", u32, u32, u16, u8);
+    TEST_FORMAT("[%-10s] [%10s] [%.3s]\n", name, state, state);
+    TEST_FORMAT("%5u|%-5u|%05u\n", u16, u16, u16);
+    TEST_FORMAT("%llu %lld %zu\n", (unsigned long long)u64, (long long)i64, sizeof(d));
+    TEST_FORMAT("%.2f %e %g %5.1f\n", d, d, d, d);
+    TEST_FORMAT("%c%c%c\n", 'b', 'b', 'l');
+    TEST_FORMAT("%s and %s\n", "literal", name);
+}
+
+static void
+test_logging_format_special(void **unused) {
+    (void) unused;
+
+    char buf[LOG_LINE_LEN];
+    char *null_string = NULL;
+    uint8_t packet[4] = {'a', 'b', 'c', 'd'}; /* not terminated */
+    char long_string[LOG_STRINGS_LEN * 2];
+    log_arg_s args[4];
+    int len;
+
+    /* Packet buffers are pointers and not strings. */
+    args[0] = LOG_ARG(packet);
+    assert_int_equal(args[0].type, LOG_ARG_POINTER);
+    args[0] = LOG_ARG((const uint8_t*)packet);
+    assert_int_equal(args[0].type, LOG_ARG_POINTER);
+    args[0] = LOG_ARG((char*)packet);
+    assert_int_equal(args[0].type, LOG_ARG_STRING);
+    args[0] = LOG_ARG((const char*)packet);
+    assert_int_equal(args[0].type, LOG_ARG_STRING);
+    args[0] = LOG_ARG((uint8_t)1);
+    assert_int_equal(args[0].type, LOG_ARG_INT);
+    args[0] = LOG_ARG(1.5f);
+    assert_int_equal(args[0].type, LOG_ARG_DOUBLE);
+
+    /* A non string argument for %s is not dereferenced. */
+    args[0] = LOG_ARG(packet);
+    args[1] = LOG_ARG(7);
+    log_format(buf, sizeof(buf), "%s %u", args, 2);
+    assert_string_equal(buf, "(null) 7");
+
+    /* NULL string */
+    args[0] = LOG_ARG(null_string);
+    args[1] = LOG_ARG("x");
+    log_format(buf, sizeof(buf), "%s %s", args, 2);
+    assert_string_equal(buf, "(null) x");
+
+    /* Missing arguments are printed as conversion. */
+    args[0] = LOG_ARG(1);
+    log_format(buf, sizeof(buf), "%u %lu %s", args, 1);
+    assert_string_equal(buf, "1 %lu %s");
+
+    /* Strings are truncated to the record size,
+     * strings beyond are empty. */
+    memset(long_string, 'a', sizeof(long_string) - 1);
+    long_string[sizeof(long_string) - 1] = 0;
+    args[0] = LOG_ARG(long_string);
+    args[1] = LOG_ARG(long_string);
+    args[2] = LOG_ARG(3);
+    len = log_format(buf, sizeof(buf), "%s|%s|%u", args, 3);
+    assert_int_equal(len, LOG_STRINGS_LEN - 1 + strlen("||3"));
+    assert_int_equal(strspn(buf, "a"), LOG_STRINGS_LEN - 1);
+    assert_string_equal(buf + LOG_STRINGS_LEN - 1, "||3");
+
+    /* The output is truncated to the buffer size. */
+    args[0] = LOG_ARG("abcdefghij");
+    args[1] = LOG_ARG(12345);
+    len = log_format(buf, 8, "%s %u", args, 2);
+    assert_int_equal(len, 7);
+    assert_string_equal(buf, "abcdefg");
+}
+
+static void
+test_logging_filter_expect(char *str, uint32_t ifindex,
+                           uint16_t outer_min, uint16_t outer_max,
+                           uint16_t inner_min, uint16_t inner_max) {
+    log_filter_s filter;
+    char copy[64];
+
+    snprintf(copy, sizeof(copy), "%s", str);
+    assert_true(log_filter_parse(copy, &filter));
+    assert_int_equal(filter.ifindex, ifindex);
+    assert_int_equal(filter.outer_vlan_min, outer_min);
+    assert_int_equal(filter.outer_vlan_max, outer_max);
+    assert_int_equal(filter.inner_vlan_min, inner_min);
+    assert_int_equal(filter.inner_vlan_max, inner_max);
+}
+
+static void
+test_logging_filter_parse(void **unused) {
+    (void) unused;
+
+    test_logging_filter_expect("1000", 0, 1000, 1000, 0, 4095);
+    test_logging_filter_expect("1000:1", 0, 1000, 1000, 1, 1);
+    test_logging_filter_expect("1000-1099", 0, 1000, 1099, 0, 4095);
+    test_logging_filter_expect("1000-1099:*", 0, 1000, 1099, 0, 4095);
+    test_logging_filter_expect("1000:1-10", 0, 1000, 1000, 1, 10);
+    test_logging_filter_expect("1000-1000:10-10", 0, 1000, 1000, 10, 10);
+    test_logging_filter_expect("*", 0, 0, 4095, 0, 4095);
+    test_logging_filter_expect("*:7", 0, 0, 4095, 7, 7);
+    test_logging_filter_expect("0-4095:0-4095", 0, 0, 4095, 0, 4095);
+    test_logging_filter_expect("2/1000-1099:*", 2, 1000, 1099, 0, 4095);
+    test_logging_filter_expect("4294967295/1:2", UINT32_MAX, 1, 1, 2, 2);
+}
+
+static void
+test_logging_filter_parse_invalid(void **unused) {
+    (void) unused;
+
+    char *invalid[] = {
+        "",
+        /* max < min */
+        "1000-999", "1:10-9", "5/2-1:1",
+        /* out of range */
+        "4096", "1:4096", "0-4096", "1:1-4096", "4294967296/1",
+        "99999999999999999999", "-1", "1:-1", "-1/1",
+        /* missing values */
+        ":1", "1:", "1-", "1-:2", "/1", "1/", "1/:1", "-",
+        /* trailing junk */
+        "1000x", "1000:1x", "1000:1:2", "1000-1099-2000", "1/2/3",
+        "1000:1 ", "**", "*-10", "1000:*1", "1000;1",
+        /* leading junk */
+        " 1000", "+1000", "1: 1", "x/1", "+1/1", " 1/1",
+        NULL
+    };
+    log_filter_s filter;
+    char copy[64];
+    int i;
+
+    assert_false(log_filter_parse(NULL, &filter));
+    for(i = 0; invalid[i]; i++) {
+        snprintf(copy, sizeof(copy), "%s", invalid[i]);
+        assert_false(log_filter_parse(copy, &filter));
+    }
+}
+
+int main() {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_logging_format_mixed),
+        cmocka_unit_test(test_logging_format_special),
+        cmocka_unit_test(test_logging_filter_parse),
+        cmocka_unit_test(test_logging_filter_parse_invalid),
+    };
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
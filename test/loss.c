@@ -0,0 +1,176 @@
+/*
+ * BNG Blaster (BBL) - Loss Events Tests
+ *
+ * Copyright (C) 2020-2021, RtBrick, Inc.
+ */
+#include <stddef.h>
+#include <stdarg.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <bbl.h>
+
+#define TEST_LOSS_SESSIONS      6
+#define TEST_LOSS_TICK_MSEC     100
+#define TEST_LOSS_TICKS         25
+
+bool g_interactive = false;
+char *g_log_file = NULL;
+
+static struct {
+    bbl_ctx_s *ctx;
+    bbl_session_s session[TEST_LOSS_SESSIONS];
+    timer_s *timer;
+    uint tick;
+} test;
+
+static void
+test_loss_gap(bbl_session_s *session, bbl_loss_flow_t flow, uint64_t flow_id, uint64_t expected, uint64_t seq) {
+    struct timespec now;
+
+    timer_clock_gettime(&test.ctx->timer_root, CLOCK_REALTIME, &now);
+    bbl_loss_gap(test.ctx, session, flow, flow_id, expected, seq, &now);
+}
+
+/*
+ * Feed sequence gaps every 100ms of virtual time
+ * and check the loss events between the loss jobs
+ * which run every second.
+ */
+static void
+test_loss_tick(timer_s *timer) {
+    bbl_loss_s *loss = test.ctx->loss;
+    uint64_t expected;
+    int i;
+
+    test.tick++;
+    switch(test.tick) {
+        case 1: case 2: case 3: case 4: case 5:
+            /* One flow with a gap of two packets per tick,
+             * reordered and duplicate packets are ignored. */
+            expected = test.tick * 100;
+            test_loss_gap(&test.session[0], BBL_LOSS_ACCESS_IPV4, 1, expected, expected + 2);
+            test_loss_gap(&test.session[0], BBL_LOSS_ACCESS_IPV4, 1, expected, expected - 1);
+            test_loss_gap(&test.session[0], BBL_LOSS_ACCESS_IPV4, 1, expected, expected);
+            if(test.tick == 3) {
+                for(i = 1; i < TEST_LOSS_SESSIONS; i++) {
+                    test_loss_gap(&test.session[i], BBL_LOSS_MULTICAST, 7, 10, 11);
+                }
+            }
+            break;
+        case 6:
+            /* A new flow id closes the open event of the flow. */
+            test_loss_gap(&test.session[0], BBL_LOSS_ACCESS_IPV4, 2, 50, 55);
+            break;
+        case 8:
+            assert_int_equal(loss->open, TEST_LOSS_SESSIONS);
+            assert_int_equal(loss->pending, 1);
+            assert_int_equal(loss->stats.events, 1);
+            assert_int_equal(loss->stats.lost, 10);
+            assert_int_equal(loss->stats.gaps, 5);
+            assert_int_equal(loss->history_count, 0);
+            assert_int_equal(test.session[0].loss_event[BBL_LOSS_ACCESS_IPV4]->flow_id, 2);
+            break;
+        case 15:
+            /* The first job emitted the closed event, the open
+             * events are within the hold time. */
+            assert_int_equal(loss->open, TEST_LOSS_SESSIONS);
+            assert_int_equal(loss->pending, 0);
+            assert_int_equal(loss->history_count, 1);
+            assert_int_equal(loss->history[0].flow_id, 1);
+            assert_int_equal(loss->history[0].lost, 10);
+            assert_int_equal(loss->history[0].gaps, 5);
+            break;
+        case TEST_LOSS_TICKS:
+            /* The second job closed all events after the hold
+             * time, but emitted only two of them. */
+            assert_int_equal(loss->open, 0);
+            assert_int_equal(loss->pending, TEST_LOSS_SESSIONS - 2);
+            assert_int_equal(loss->stats.events, TEST_LOSS_SESSIONS + 1);
+            assert_int_equal(loss->stats.lost, 10 + 5 + (TEST_LOSS_SESSIONS - 1));
+            assert_int_equal(loss->stats.gaps, 5 + 1 + (TEST_LOSS_SESSIONS - 1));
+            assert_int_equal(loss->history_count, 3);
+            assert_int_equal(loss->stats.suppressed, 0);
+            for(i = 0; i < TEST_LOSS_SESSIONS; i++) {
+                assert_null(test.session[i].loss_event[BBL_LOSS_ACCESS_IPV4]);
+                assert_null(test.session[i].loss_event[BBL_LOSS_MULTICAST]);
+            }
+            /* Stop the timer walk. */
+            timer_del(loss->job);
+            timer_del(timer);
+            break;
+        default:
+            break;
+    }
+}
+
+static void
+test_loss_events(void **unused) {
+    (void) unused;
+
+    bbl_ctx_s *ctx = calloc(1, sizeof(bbl_ctx_s));
+    bbl_loss_s *loss;
+    json_t *jobj, *history, *event;
+    int i;
+
+    timer_init_root(&ctx->timer_root);
+    timer_enable_virtual_time(&ctx->timer_root);
+    timer_clock_gettime(&ctx->timer_root, CLOCK_REALTIME, &ctx->timestamp_start);
+    ctx->config.loss_hold_time = 1;
+    ctx->config.loss_rate = 2;
+    ctx->config.loss_history = 3;
+    test.ctx = ctx;
+    for(i = 0; i < TEST_LOSS_SESSIONS; i++) {
+        test.session[i].key.ifindex = 1;
+        test.session[i].key.outer_vlan_id = 100 + i;
+        test.session[i].key.inner_vlan_id = 1;
+    }
+
+    assert_true(bbl_loss_init(ctx));
+    loss = ctx->loss;
+    timer_add_periodic(&ctx->timer_root, &test.timer, "Test", 0, TEST_LOSS_TICK_MSEC * MSEC, ctx, test_loss_tick);
+    timer_walk(&ctx->timer_root);
+    assert_int_equal(test.tick, TEST_LOSS_TICKS);
+
+    /* Close emits two more events, the rest is suppressed. */
+    bbl_loss_close(ctx);
+    assert_int_equal(loss->pending, 0);
+    assert_int_equal(loss->stats.events, TEST_LOSS_SESSIONS + 1);
+    assert_int_equal(loss->stats.suppressed, TEST_LOSS_SESSIONS - 4);
+
+    /* A second close does not count them again. */
+    bbl_loss_close(ctx);
+    assert_int_equal(loss->stats.suppressed, TEST_LOSS_SESSIONS - 4);
+    assert_int_equal(loss->history_count, 3);
+
+    /* Emitted are the first event, the multicast events of
+     * sessions 1 to 4 and the history keeps the last three. */
+    jobj = bbl_loss_json(ctx);
+    assert_int_equal(json_integer_value(json_object_get(jobj, "events")), TEST_LOSS_SESSIONS + 1);
+    assert_int_equal(json_integer_value(json_object_get(jobj, "events-open")), 0);
+    assert_int_equal(json_integer_value(json_object_get(jobj, "events-suppressed")), TEST_LOSS_SESSIONS - 4);
+    assert_int_equal(json_integer_value(json_object_get(jobj, "packets-lost")), 10 + 5 + (TEST_LOSS_SESSIONS - 1));
+    history = json_object_get(jobj, "history");
+    assert_int_equal(json_array_size(history), 3);
+    for(i = 0; i < 3; i++) {
+        event = json_array_get(history, i);
+        assert_int_equal(json_integer_value(json_object_get(event, "outer-vlan")), 102 + i);
+        assert_string_equal(json_string_value(json_object_get(event, "type")), "multicast");
+        assert_int_equal(json_integer_value(json_object_get(event, "flow-id")), 7);
+        assert_int_equal(json_integer_value(json_object_get(event, "packets-lost")), 1);
+        assert_int_equal(json_integer_value(json_object_get(event, "gaps")), 1);
+        assert_int_equal(json_integer_value(json_object_get(event, "start-ms")), 3 * TEST_LOSS_TICK_MSEC);
+        assert_int_equal(json_integer_value(json_object_get(event, "end-ms")), 3 * TEST_LOSS_TICK_MSEC);
+    }
+    json_decref(jobj);
+
+    bbl_loss_free(ctx);
+    assert_null(ctx->loss);
+    free(ctx);
+}
+
+int main() {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_loss_events),
+    };
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
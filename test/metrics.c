@@ -0,0 +1,183 @@
+/*
+ * BNG Blaster (BBL) - Metrics Tests
+ *
+ * Copyright (C) 2020-2021, RtBrick, Inc.
+ */
+#include <stddef.h>
+#include <stdarg.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <bbl.h>
+#include <bbl_counters.h>
+#include <bbl_metrics.h>
+
+bool g_interactive = false;
+char *g_log_file = NULL;
+
+/* Defined in bbl_stats.c which is not linked. */
+const char *setup_phase_names[BBL_SETUP_PHASE_MAX] = {
+    "padi-pado", "padr-pads", "lcp", "authentication",
+    "ipcp", "ip6cp", "icmpv6-rs-ra", "dhcpv6", "total"
+};
+
+static char *
+test_metrics_render(bbl_counters_snapshot_s *snapshot) {
+    char *buf = NULL;
+    size_t len = 0;
+    FILE *out;
+
+    out = open_memstream(&buf, &len);
+    assert_non_null(out);
+    bbl_metrics_write(out, snapshot);
+    fclose(out);
+    assert_non_null(buf);
+    assert_int_equal(strlen(buf), len);
+    return buf;
+}
+
+static bbl_counters_snapshot_s *
+test_metrics_snapshot(void) {
+    bbl_counters_snapshot_s *snapshot = calloc(1, sizeof(bbl_counters_snapshot_s));
+    int i;
+
+    snapshot->sessions = 100;
+    snapshot->sessions_flapped = 3;
+    snapshot->loss.events = 5;
+    for(i = 0; i < BBL_SETUP_LATENCY_BUCKETS; i++) {
+        snapshot->setup_latency[BBL_SETUP_PHASE_LCP].bucket[i] = i % 3;
+        snapshot->setup_latency[BBL_SETUP_PHASE_LCP].count += i % 3;
+    }
+    snapshot->setup_latency[BBL_SETUP_PHASE_LCP].sum_us = 1500000;
+    snapshot->igmp_join_delay.bucket[BBL_SETUP_LATENCY_BUCKETS-1] = 2;
+    snapshot->igmp_join_delay.count = 2;
+
+    snapshot->network_if.name = "eth1";
+    snapshot->network_if.stats.packets_tx = 42;
+    snapshot->access_if_count = 1;
+    snapshot->access_if[0].name = "eth\"2\\\n";
+    snapshot->access_if[0].stats.packets_tx = 7;
+    return snapshot;
+}
+
+static void
+test_metrics_format(void **unused) {
+    (void) unused;
+
+    bbl_counters_snapshot_s *snapshot = test_metrics_snapshot();
+    char *buf = test_metrics_render(snapshot);
+    char family[128] = "";
+    char type[32] = "";
+    char *line, *next, *name;
+    size_t family_len = 0;
+    uint counters = 0;
+
+    /* Exactly one EOF marker at the end. */
+    assert_true(strlen(buf) > 6);
+    assert_string_equal(buf + strlen(buf) - 6, "# EOF\n");
+    assert_true(strstr(buf, "# EOF\n") == buf + strlen(buf) - 6);
+
+    for(line = buf; *line; line = next) {
+        next = strchr(line, '\n');
+        assert_non_null(next);
+        *next++ = '\0';
+        if(sscanf(line, "# TYPE %127s %31s", family, type) == 2) {
+            family_len = strlen(family);
+            continue;
+        }
+        if(*line == '#') {
+            continue;
+        }
+        /* Samples follow the family they belong to. */
+        name = line;
+        assert_true(family_len > 0);
+        assert_int_equal(strncmp(name, family, family_len), 0);
+        if(strcmp(type, "counter") == 0) {
+            assert_int_equal(strncmp(name + family_len, "_total", 6), 0);
+            counters++;
+        } else if(strcmp(type, "gauge") == 0) {
+            assert_true(name[family_len] == ' ' || name[family_len] == '{');
+        }
+    }
+    assert_true(counters > 0);
+    free(buf);
+
+    buf = test_metrics_render(snapshot);
+    assert_non_null(strstr(buf, "bngblaster_sessions 100\n"));
+    assert_non_null(strstr(buf, "bngblaster_sessions_flapped_total 3\n"));
+    assert_non_null(strstr(buf, "bngblaster_loss_events_total 5\n"));
+    assert_non_null(strstr(buf, "bngblaster_interface_packets_tx_total{interface=\"eth1\",type=\"network\"} 42\n"));
+
+    /* Backslash, double quote and line feed are escaped. */
+    assert_non_null(strstr(buf, "bngblaster_interface_packets_tx_total{interface=\"eth\\\"2\\\\\\n\",type=\"access\"} 7\n"));
+
+    free(buf);
+    free(snapshot);
+}
+
+/*
+ * Check that the buckets of one histogram are
+ * cumulative and that +Inf equals the count.
+ */
+static void
+test_metrics_check_histogram(char *buf, const char *name, const char *labels, uint64_t count) {
+    char prefix[256];
+    char *line;
+    size_t prefix_len;
+    uint64_t last = 0, value;
+    double le, last_le = 0;
+    uint buckets = 0;
+    bool inf = false;
+
+    prefix_len = snprintf(prefix, sizeof(prefix), "bngblaster_%s_bucket{%s", name, labels);
+    for(line = strstr(buf, prefix); line; line = strstr(line + 1, prefix)) {
+        line += prefix_len;
+        if(strncmp(line, "le=\"+Inf\"} ", 11) == 0) {
+            assert_int_equal(sscanf(line + 11, "%lu", &value), 1);
+            inf = true;
+        } else {
+            assert_false(inf);
+            assert_int_equal(sscanf(line, "le=\"%lf\"} %lu", &le, &value), 2);
+            assert_true(le > last_le);
+            last_le = le;
+        }
+        assert_true(value >= last);
+        last = value;
+        buckets++;
+    }
+    assert_true(inf);
+    assert_int_equal(buckets, BBL_SETUP_LATENCY_BUCKETS);
+    assert_int_equal(last, count);
+
+    if(*labels) {
+        snprintf(prefix, sizeof(prefix), "bngblaster_%s_count{%.*s} %lu\n",
+                 name, (int)strlen(labels) - 1, labels, count);
+    } else {
+        snprintf(prefix, sizeof(prefix), "bngblaster_%s_count %lu\n", name, count);
+    }
+    assert_non_null(strstr(buf, prefix));
+}
+
+static void
+test_metrics_histogram(void **unused) {
+    (void) unused;
+
+    bbl_counters_snapshot_s *snapshot = test_metrics_snapshot();
+    char *buf = test_metrics_render(snapshot);
+
+    test_metrics_check_histogram(buf, "setup_latency_seconds", "phase=\"lcp\",",
+                                 snapshot->setup_latency[BBL_SETUP_PHASE_LCP].count);
+    test_metrics_check_histogram(buf, "setup_latency_seconds", "phase=\"ipcp\",", 0);
+    test_metrics_check_histogram(buf, "igmp_join_delay_seconds", "", 2);
+    assert_non_null(strstr(buf, "bngblaster_setup_latency_seconds_sum{phase=\"lcp\"} 1.500000\n"));
+
+    free(buf);
+    free(snapshot);
+}
+
+int main() {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_metrics_format),
+        cmocka_unit_test(test_metrics_histogram),
+    };
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -43,9 +43,620 @@ test_protocols_decode_pppoe_ipcp_conf_request(void **unused) {
 
 }
 
+static void
+test_protocols_parse_pppoe_ipcp_conf_request(void **unused) {
+    (void) unused;
+
+    bbl_parse_t parse;
+    protocol_error_t parse_result;
+
+    parse_result = parse_ethernet(pppoe_ipcp_conf_request, sizeof(pppoe_ipcp_conf_request), &parse);
+    assert_int_equal(parse_result, PROTOCOL_SUCCESS);
+
+    assert_int_equal(parse.len, sizeof(pppoe_ipcp_conf_request));
+    assert_int_equal(parse.vlan_outer, 1);
+    assert_int_equal(parse.vlan_inner, 1);
+    assert_int_equal(parse.vlan_three, 0);
+    assert_int_equal(parse.eth_type, ETH_TYPE_PPPOE_SESSION);
+    assert_int_equal(parse.l3_offset, 22);
+    assert_int_equal(parse.ppp_protocol, PROTOCOL_IPCP);
+    assert_int_equal(parse.l3_type, 0);
+    assert_int_equal(parse.l4_offset, 0);
+
+    /* Truncated PPPoE header */
+    parse_result = parse_ethernet(pppoe_ipcp_conf_request, 26, &parse);
+    assert_int_equal(parse_result, DECODE_ERROR);
+}
+
+/*
+ * Encode session traffic (BBL over UDP) with one VLAN
+ * over IPv4, IPv6 or PPPoE (IPv4) for the parse tests.
+ */
+static uint
+test_protocols_encode_session_traffic(uint8_t *buf, uint16_t eth_type) {
+    uint8_t mac[ETH_ADDR_LEN] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+    ipv6addr_t ipv6_src = {0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x01};
+    ipv6addr_t ipv6_dst = {0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x02};
+
+    bbl_ethernet_header_t eth = {0};
+    bbl_pppoe_session_t pppoe = {0};
+    bbl_ipv4_t ipv4 = {0};
+    bbl_ipv6_t ipv6 = {0};
+    bbl_udp_t udp = {0};
+    bbl_bbl_t bbl = {0};
+    uint len = 0;
+
+    eth.dst = mac;
+    eth.src = mac;
+    eth.vlan_outer = 7;
+    eth.type = eth_type;
+    ipv4.src = htobe32(0x0a000001);
+    ipv4.dst = htobe32(0x0a000002);
+    ipv4.ttl = 64;
+    ipv4.protocol = PROTOCOL_IPV4_UDP;
+    ipv4.next = &udp;
+    ipv6.src = ipv6_src;
+    ipv6.dst = ipv6_dst;
+    ipv6.ttl = 64;
+    ipv6.protocol = IPV6_NEXT_HEADER_UDP;
+    ipv6.next = &udp;
+    udp.src = BBL_UDP_PORT;
+    udp.dst = BBL_UDP_PORT;
+    udp.protocol = UDP_PROTOCOL_BBL;
+    udp.next = &bbl;
+    bbl.type = BBL_TYPE_UNICAST_SESSION;
+    bbl.flow_id = 1234;
+
+    switch(eth_type) {
+        case ETH_TYPE_PPPOE_SESSION:
+            pppoe.session_id = 1;
+            pppoe.protocol = PROTOCOL_IPV4;
+            pppoe.next = &ipv4;
+            eth.next = &pppoe;
+            break;
+        case ETH_TYPE_IPV6:
+            eth.next = &ipv6;
+            break;
+        default:
+            eth.next = &ipv4;
+            break;
+    }
+    assert_int_equal(encode_ethernet(buf, &len, &eth), PROTOCOL_SUCCESS);
+    return len;
+}
+
+/*
+ * The parse result of a complete frame, all shorter
+ * frames must fail and the parsed decode must be
+ * equal to the full decode.
+ */
+static void
+test_protocols_parse_session_traffic_frame(uint8_t *buf, uint len, bbl_parse_t *expected) {
+    uint8_t *sp = calloc(1, SCRATCHPAD_LEN);
+    uint8_t *sp_parsed = calloc(1, SCRATCHPAD_LEN);
+    bbl_ethernet_header_t *eth;
+    bbl_ethernet_header_t *eth_parsed;
+    bbl_bbl_t *bbl;
+    bbl_parse_t parse;
+    uint i;
+
+    assert_int_equal(parse_ethernet(buf, len, &parse), PROTOCOL_SUCCESS);
+    assert_int_equal(parse.len, len);
+    assert_int_equal(parse.vlan_outer, expected->vlan_outer);
+    assert_int_equal(parse.vlan_inner, 0);
+    assert_int_equal(parse.eth_type, expected->eth_type);
+    assert_int_equal(parse.ppp_protocol, expected->ppp_protocol);
+    assert_int_equal(parse.l3_type, expected->l3_type);
+    assert_int_equal(parse.l3_offset, expected->l3_offset);
+    assert_int_equal(parse.l4_offset, expected->l4_offset);
+    assert_int_equal(parse.l4_len, 8 + BBL_HEADER_LEN);
+    assert_int_equal(parse.ip_protocol, PROTOCOL_IPV4_UDP);
+    assert_int_equal(parse.src_port, BBL_UDP_PORT);
+    assert_int_equal(parse.dst_port, BBL_UDP_PORT);
+    assert_int_equal(parse.payload_offset, parse.l4_offset + 8);
+    assert_int_equal(len - parse.payload_offset, BBL_HEADER_LEN);
+
+    /* The decoder continues at the parsed L3 offset. */
+    assert_int_equal(decode_ethernet(buf, len, sp, SCRATCHPAD_LEN, &eth), PROTOCOL_SUCCESS);
+    assert_int_equal(decode_ethernet_parsed(buf, len, sp_parsed, SCRATCHPAD_LEN, &parse, &eth_parsed), PROTOCOL_SUCCESS);
+    assert_true(eth_parsed->dst == eth->dst);
+    assert_true(eth_parsed->src == eth->src);
+    assert_int_equal(eth_parsed->type, eth->type);
+    assert_int_equal(eth_parsed->vlan_outer, eth->vlan_outer);
+    assert_int_equal(eth_parsed->vlan_inner, eth->vlan_inner);
+    assert_int_equal(eth_parsed->vlan_three, eth->vlan_three);
+    assert_non_null(eth_parsed->next);
+    if(parse.eth_type == ETH_TYPE_PPPOE_SESSION) {
+        assert_int_equal(((bbl_pppoe_session_t*)eth_parsed->next)->protocol, PROTOCOL_IPV4);
+    } else if(parse.eth_type == ETH_TYPE_IPV4) {
+        assert_int_equal(((bbl_ipv4_t*)eth_parsed->next)->src, ((bbl_ipv4_t*)eth->next)->src);
+        assert_int_equal(((bbl_udp_t*)((bbl_ipv4_t*)eth_parsed->next)->next)->protocol, UDP_PROTOCOL_BBL);
+    } else {
+        assert_memory_equal(((bbl_ipv6_t*)eth_parsed->next)->src, ((bbl_ipv6_t*)eth->next)->src, IPV6_ADDR_LEN);
+        assert_int_equal(((bbl_udp_t*)((bbl_ipv6_t*)eth_parsed->next)->next)->protocol, UDP_PROTOCOL_BBL);
+    }
+
+    /* Only the BBL header is decoded from the parsed offsets. */
+    assert_int_equal(decode_bbl_parsed(buf, len, sp_parsed, SCRATCHPAD_LEN, &parse, &bbl), PROTOCOL_SUCCESS);
+    assert_int_equal(bbl->type, BBL_TYPE_UNICAST_SESSION);
+    assert_int_equal(bbl->flow_id, 1234);
+
+    /* The parse result belongs to the frame length. */
+    assert_int_equal(decode_ethernet_parsed(buf, len - 1, sp_parsed, SCRATCHPAD_LEN, &parse, &eth_parsed), DECODE_ERROR);
+    assert_int_equal(decode_bbl_parsed(buf, len - 1, sp_parsed, SCRATCHPAD_LEN, &parse, &bbl), DECODE_ERROR);
+
+    /* Ethernet padding is allowed. */
+    assert_int_equal(parse_ethernet(buf, len + 4, &parse), PROTOCOL_SUCCESS);
+    assert_int_equal(parse.payload_offset, expected->l4_offset + 8);
+    assert_int_equal(decode_bbl_parsed(buf, len + 4, sp_parsed, SCRATCHPAD_LEN, &parse, &bbl), PROTOCOL_SUCCESS);
+    assert_int_equal(bbl->flow_id, 1234);
+
+    /* UDP length beyond the frame */
+    *(uint16_t*)(buf + parse.l4_offset + 4) = htobe16(8 + BBL_HEADER_LEN + 5);
+    assert_int_equal(decode_bbl_parsed(buf, len + 4, sp_parsed, SCRATCHPAD_LEN, &parse, &bbl), DECODE_ERROR);
+    *(uint16_t*)(buf + parse.l4_offset + 4) = htobe16(8 + BBL_HEADER_LEN);
+
+    /* Truncated frames */
+    for(i = 0; i < len; i++) {
+        assert_int_equal(parse_ethernet(buf, i, &parse), DECODE_ERROR);
+    }
+
+    free(sp);
+    free(sp_parsed);
+}
+
+static void
+test_protocols_parse_session_traffic(void **unused) {
+    (void) unused;
+
+    uint8_t buf[256] = {0};
+    bbl_parse_t expected;
+    uint len;
+
+    /* IPv4 */
+    memset(&expected, 0x0, sizeof(expected));
+    expected.vlan_outer = 7;
+    expected.eth_type = ETH_TYPE_IPV4;
+    expected.l3_type = ETH_TYPE_IPV4;
+    expected.l3_offset = 18;
+    expected.l4_offset = 18 + 20;
+    len = test_protocols_encode_session_traffic(buf, ETH_TYPE_IPV4);
+    assert_int_equal(len, 18 + 20 + 8 + BBL_HEADER_LEN);
+    test_protocols_parse_session_traffic_frame(buf, len, &expected);
+
+    /* IPv6 */
+    memset(&expected, 0x0, sizeof(expected));
+    expected.vlan_outer = 7;
+    expected.eth_type = ETH_TYPE_IPV6;
+    expected.l3_type = ETH_TYPE_IPV6;
+    expected.l3_offset = 18;
+    expected.l4_offset = 18 + 40;
+    len = test_protocols_encode_session_traffic(buf, ETH_TYPE_IPV6);
+    assert_int_equal(len, 18 + 40 + 8 + BBL_HEADER_LEN);
+    test_protocols_parse_session_traffic_frame(buf, len, &expected);
+
+    /* PPPoE IPv4 */
+    memset(&expected, 0x0, sizeof(expected));
+    expected.vlan_outer = 7;
+    expected.eth_type = ETH_TYPE_PPPOE_SESSION;
+    expected.ppp_protocol = PROTOCOL_IPV4;
+    expected.l3_type = ETH_TYPE_IPV4;
+    expected.l3_offset = 18;
+    expected.l4_offset = 18 + 8 + 20;
+    len = test_protocols_encode_session_traffic(buf, ETH_TYPE_PPPOE_SESSION);
+    assert_int_equal(len, 18 + 8 + 20 + 8 + BBL_HEADER_LEN);
+    test_protocols_parse_session_traffic_frame(buf, len, &expected);
+}
+
+static void
+test_protocols_parse_invalid(void **unused) {
+    (void) unused;
+
+    uint8_t buf[256] = {0};
+    bbl_parse_t parse;
+    uint len;
+
+    /* IPv4 header length below 20 bytes */
+    len = test_protocols_encode_session_traffic(buf, ETH_TYPE_IPV4);
+    buf[18] = 0x44;
+    assert_int_equal(parse_ethernet(buf, len, &parse), DECODE_ERROR);
+
+    /* IPv4 total length above the frame */
+    len = test_protocols_encode_session_traffic(buf, ETH_TYPE_IPV4);
+    *(uint16_t*)(buf + 18 + 2) = htobe16(len);
+    assert_int_equal(parse_ethernet(buf, len, &parse), DECODE_ERROR);
+
+    /* IPv6 payload length above the frame */
+    len = test_protocols_encode_session_traffic(buf, ETH_TYPE_IPV6);
+    *(uint16_t*)(buf + 18 + 4) = htobe16(len);
+    assert_int_equal(parse_ethernet(buf, len, &parse), DECODE_ERROR);
+
+    /* PPPoE length above the frame */
+    len = test_protocols_encode_session_traffic(buf, ETH_TYPE_PPPOE_SESSION);
+    *(uint16_t*)(buf + 18 + 4) = htobe16(len);
+    assert_int_equal(parse_ethernet(buf, len, &parse), DECODE_ERROR);
+
+    /* Unknown ethertype after the VLAN */
+    len = test_protocols_encode_session_traffic(buf, ETH_TYPE_IPV4);
+    *(uint16_t*)(buf + 16) = htobe16(0x88cc);
+    assert_int_equal(parse_ethernet(buf, len, &parse), UNKNOWN_PROTOCOL);
+}
+
+static void
+test_protocols_encode_ethernet_fast(void **unused) {
+    (void) unused;
+
+    uint8_t generic_buf[256];
+    uint8_t fast_buf[256];
+    uint generic_len;
+    uint fast_len;
+
+    uint8_t client_mac[ETH_ADDR_LEN] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+    uint8_t server_mac[ETH_ADDR_LEN] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x02};
+    uint16_t vlans[4][3] = {{0, 0, 0}, {128, 0, 0}, {128, 7, 0}, {128, 7, 2001}};
+
+    bbl_ethernet_header_t eth;
+    bbl_pppoe_session_t pppoe;
+    bbl_lcp_t lcp;
+    bbl_arp_t arp;
+    bbl_ipv4_t ipv4;
+    bbl_igmp_t igmp;
+    int i, shape;
+
+    /* The fast encoder must produce the same
+     * result as the generic encoder for all
+     * supported packets and VLAN depths. */
+    for(i = 0; i < 4; i++) {
+        for(shape = 0; shape < 5; shape++) {
+            memset(&eth, 0x0, sizeof(eth));
+            memset(&pppoe, 0x0, sizeof(pppoe));
+            memset(&lcp, 0x0, sizeof(lcp));
+            memset(&arp, 0x0, sizeof(arp));
+            memset(&ipv4, 0x0, sizeof(ipv4));
+            memset(&igmp, 0x0, sizeof(igmp));
+
+            eth.dst = server_mac;
+            eth.src = client_mac;
+            eth.vlan_outer = vlans[i][0];
+            eth.vlan_inner = vlans[i][1];
+            eth.vlan_three = vlans[i][2];
+
+            ipv4.src = htobe32(0x0a000001);
+            ipv4.dst = IPV4_MC_IGMP;
+            ipv4.ttl = 1;
+            ipv4.protocol = PROTOCOL_IPV4_IGMP;
+            ipv4.router_alert_option = true;
+            ipv4.next = &igmp;
+            igmp.version = IGMP_VERSION_3;
+            igmp.type = IGMP_TYPE_REPORT_V3;
+            igmp.group_records = 1;
+            igmp.group_record[0].type = IGMP_EXCLUDE;
+            igmp.group_record[0].group = htobe32(0xe8010101);
+
+            switch(shape) {
+                case 0:
+                    /* PPPoE LCP echo request */
+                    eth.type = ETH_TYPE_PPPOE_SESSION;
+                    eth.next = &pppoe;
+                    pppoe.session_id = 4711;
+                    pppoe.protocol = PROTOCOL_LCP;
+                    pppoe.next = &lcp;
+                    lcp.code = PPP_CODE_ECHO_REQUEST;
+                    lcp.identifier = 42;
+                    lcp.magic = 0x12345678;
+                    break;
+                case 1:
+                    /* PPPoE LCP echo reply */
+                    eth.type = ETH_TYPE_PPPOE_SESSION;
+                    eth.next = &pppoe;
+                    pppoe.session_id = 4711;
+                    pppoe.protocol = PROTOCOL_LCP;
+                    pppoe.next = &lcp;
+                    lcp.code = PPP_CODE_ECHO_REPLY;
+                    lcp.identifier = 43;
+                    lcp.magic = 0x87654321;
+                    break;
+                case 2:
+                    /* PPPoE IGMPv3 report */
+                    eth.type = ETH_TYPE_PPPOE_SESSION;
+                    eth.next = &pppoe;
+                    pppoe.session_id = 4711;
+                    pppoe.protocol = PROTOCOL_IPV4;
+                    pppoe.next = &ipv4;
+                    break;
+                case 3:
+                    /* IPoE IGMPv2 leave */
+                    eth.type = ETH_TYPE_IPV4;
+                    eth.next = &ipv4;
+                    igmp.version = IGMP_VERSION_2;
+                    igmp.type = IGMP_TYPE_LEAVE;
+                    igmp.group = htobe32(0xe8010101);
+                    break;
+                default:
+                    /* ARP request */
+                    eth.dst = NULL;
+                    eth.type = ETH_TYPE_ARP;
+                    eth.next = &arp;
+                    arp.code = ARP_REQUEST;
+                    arp.sender = client_mac;
+                    arp.sender_ip = htobe32(0x0a000001);
+                    arp.target_ip = htobe32(0x0a0000fe);
+                    break;
+            }
+
+            memset(generic_buf, 0xaa, sizeof(generic_buf));
+            memset(fast_buf, 0xaa, sizeof(fast_buf));
+            generic_len = 0;
+            fast_len = 0;
+            assert_int_equal(encode_ethernet(generic_buf, &generic_len, &eth), PROTOCOL_SUCCESS);
+            assert_int_equal(encode_ethernet_fast(fast_buf, &fast_len, &eth), PROTOCOL_SUCCESS);
+            assert_int_equal(fast_len, generic_len);
+            assert_memory_equal(fast_buf, generic_buf, generic_len);
+        }
+    }
+}
+
+static uint16_t
+test_checksum_reference(uint8_t *buf, uint len) {
+    uint32_t sum = 0;
+    uint i;
+
+    for(i = 0; i + 1 < len; i += 2) {
+        sum += (buf[i] << 8) | buf[i+1];
+    }
+    if(len % 2) {
+        sum += buf[len-1] << 8;
+    }
+    while(sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return htobe16(~sum & 0xffff);
+}
+
+static void
+test_protocols_checksum(void **unused) {
+    (void) unused;
+
+    uint8_t *buf = malloc(UINT16_MAX + 64);
+    uint32_t expected;
+    uint offset;
+    uint len;
+    int kernel;
+
+    srand(1);
+    for(len = 0; len < UINT16_MAX + 64; len++) {
+        buf[len] = rand();
+    }
+
+    /* All kernels must return the same result as the
+     * scalar kernel for all lengths and alignments. */
+    for(offset = 0; offset < 32; offset++) {
+        for(len = 0; len <= 2048; len++) {
+            assert_int_equal(checksum((uint16_t*)(buf+offset), len), test_checksum_reference(buf+offset, len));
+            expected = checksum_sum_kernel(CHECKSUM_KERNEL_SCALAR, buf+offset, len);
+            for(kernel = 0; kernel < CHECKSUM_KERNEL_MAX; kernel++) {
+                if(checksum_kernel_supported(kernel)) {
+                    assert_int_equal(checksum_sum_kernel(kernel, buf+offset, len), expected);
+                }
+            }
+        }
+    }
+    for(offset = 0; offset < 64; offset++) {
+        len = UINT16_MAX - offset;
+        assert_int_equal(checksum((uint16_t*)(buf+offset), len), test_checksum_reference(buf+offset, len));
+        expected = checksum_sum_kernel(CHECKSUM_KERNEL_SCALAR, buf+offset, len);
+        for(kernel = 0; kernel < CHECKSUM_KERNEL_MAX; kernel++) {
+            if(checksum_kernel_supported(kernel)) {
+                assert_int_equal(checksum_sum_kernel(kernel, buf+offset, len), expected);
+            }
+        }
+    }
+
+    /* Worst case for lane overflow */
+    memset(buf, 0xff, UINT16_MAX + 64);
+    for(kernel = 0; kernel < CHECKSUM_KERNEL_MAX; kernel++) {
+        if(checksum_kernel_supported(kernel)) {
+            assert_int_equal(checksum_sum_kernel(kernel, buf, UINT16_MAX + 63), 0xffff);
+        }
+    }
+    free(buf);
+}
+
+static void
+test_protocols_checksum_update_bbl(void **unused) {
+    (void) unused;
+
+    uint8_t template[256];
+    uint8_t packet[256];
+    uint8_t expected[256];
+    uint template_len;
+    uint expected_len;
+
+    uint8_t mac[ETH_ADDR_LEN] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+    ipv6addr_t ipv6_src = {0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x01};
+    ipv6addr_t ipv6_dst = {0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x02};
+    struct timespec timestamp;
+
+    bbl_ethernet_header_t eth = {0};
+    bbl_ipv4_t ipv4 = {0};
+    bbl_ipv6_t ipv6 = {0};
+    bbl_udp_t udp = {0};
+    bbl_bbl_t bbl = {0};
+    uint64_t sum;
+    int i, ip;
+
+    eth.dst = mac;
+    eth.src = mac;
+    eth.vlan_outer = 1;
+    ipv4.src = htobe32(0x0a000001);
+    ipv4.dst = htobe32(0x0a000002);
+    ipv4.ttl = 64;
+    ipv4.protocol = PROTOCOL_IPV4_UDP;
+    ipv4.next = &udp;
+    ipv6.src = ipv6_src;
+    ipv6.dst = ipv6_dst;
+    ipv6.ttl = 64;
+    ipv6.protocol = IPV6_NEXT_HEADER_UDP;
+    ipv6.next = &udp;
+    udp.src = BBL_UDP_PORT;
+    udp.dst = BBL_UDP_PORT;
+    udp.protocol = UDP_PROTOCOL_BBL;
+    udp.checksum = true;
+    udp.next = &bbl;
+    bbl.type = BBL_TYPE_UNICAST_SESSION;
+    bbl.flow_id = 1;
+
+    /* Incrementally updated templates must
+     * be equal to fully encoded packets. */
+    for(ip = 0; ip < 2; ip++) {
+        if(ip) {
+            eth.type = ETH_TYPE_IPV6;
+            eth.next = &ipv6;
+        } else {
+            eth.type = ETH_TYPE_IPV4;
+            eth.next = &ipv4;
+        }
+        bbl.flow_seq = 0;
+        bbl.timestamp = 0;
+        memset(template, 0x0, sizeof(template));
+        memset(expected, 0x0, sizeof(expected));
+        template_len = 0;
+        assert_int_equal(encode_ethernet(template, &template_len, &eth), PROTOCOL_SUCCESS);
+        for(i = 0; i < 1000; i++) {
+            timestamp.tv_sec = rand();
+            timestamp.tv_nsec = rand() % 1000000000;
+            bbl.flow_seq = (uint64_t)rand() << 32 | rand();
+            bbl.timestamp = (uint64_t)timestamp.tv_nsec << 32 | (uint32_t)timestamp.tv_sec;
+            expected_len = 0;
+            assert_int_equal(encode_ethernet(expected, &expected_len, &eth), PROTOCOL_SUCCESS);
+            memcpy(packet, template, template_len);
+            bbl_checksum_update_bbl(packet, template_len, bbl.flow_seq, &timestamp);
+            assert_int_equal(template_len, expected_len);
+            assert_memory_equal(packet, expected, expected_len);
+        }
+
+        /* Choose the sequence such that the sum folds to 0xffff,
+         * the UDP checksum must be 0xffff and not zero. */
+        timestamp.tv_sec = 1234567;
+        timestamp.tv_nsec = 89012345;
+        sum = (uint16_t)~*(uint16_t*)(template + (template_len - BBL_HEADER_LEN - 2));
+        sum += (uint32_t)timestamp.tv_sec + (uint32_t)timestamp.tv_nsec;
+        while(sum >> 16) {
+            sum = (sum & 0xffff) + (sum >> 16);
+        }
+        bbl.flow_seq = sum == 0xffff ? 0xffff : 0xffff - sum;
+        bbl.timestamp = (uint64_t)timestamp.tv_nsec << 32 | (uint32_t)timestamp.tv_sec;
+        expected_len = 0;
+        assert_int_equal(encode_ethernet(expected, &expected_len, &eth), PROTOCOL_SUCCESS);
+        memcpy(packet, template, template_len);
+        bbl_checksum_update_bbl(packet, template_len, bbl.flow_seq, &timestamp);
+        assert_int_equal(*(uint16_t*)(packet + (template_len - BBL_HEADER_LEN - 2)), 0xffff);
+        assert_memory_equal(packet, expected, expected_len);
+    }
+}
+
+static void
+test_protocols_encode_router_advertisement(void **unused) {
+    (void) unused;
+
+    uint8_t *sp = calloc(1, SCRATCHPAD_LEN);
+    uint8_t buf[256];
+    uint len = 0;
+    uint8_t server_mac[ETH_ADDR_LEN] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x02};
+    uint8_t client_mac[ETH_ADDR_LEN] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+    ipv6addr_t src = {0xFE, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01};
+
+    bbl_ethernet_header_t eth = {0};
+    bbl_ethernet_header_t *eth_rx;
+    bbl_ipv6_t ipv6 = {0};
+    bbl_ipv6_t *ipv6_rx;
+    bbl_icmpv6_t icmpv6 = {0};
+    bbl_icmpv6_t *icmpv6_rx;
+
+    eth.dst = client_mac;
+    eth.src = server_mac;
+    eth.vlan_outer = 1000;
+    eth.type = ETH_TYPE_IPV6;
+    eth.next = &ipv6;
+    ipv6.src = src;
+    ipv6.dst = (uint8_t*)ipv6_multicast_all_nodes;
+    ipv6.protocol = IPV6_NEXT_HEADER_ICMPV6;
+    ipv6.ttl = 255;
+    ipv6.next = &icmpv6;
+    icmpv6.type = IPV6_ICMPV6_ROUTER_ADVERTISEMENT;
+    icmpv6.other = true;
+    icmpv6.mac = server_mac;
+    icmpv6.prefix.len = 64;
+    icmpv6.prefix.address[0] = 0xfc;
+    icmpv6.prefix.address[1] = 0x66;
+    icmpv6.prefix.address[7] = 0x01;
+    assert_int_equal(encode_ethernet(buf, &len, &eth), PROTOCOL_SUCCESS);
+    /* ethernet + VLAN + IPv6 + RA with prefix and link-layer option */
+    assert_int_equal(len, 18 + 40 + 16 + 32 + 8);
+
+    assert_int_equal(decode_ethernet(buf, len, sp, SCRATCHPAD_LEN, &eth_rx), PROTOCOL_SUCCESS);
+    ipv6_rx = (bbl_ipv6_t*)eth_rx->next;
+    icmpv6_rx = (bbl_icmpv6_t*)ipv6_rx->next;
+    assert_int_equal(icmpv6_rx->type, IPV6_ICMPV6_ROUTER_ADVERTISEMENT);
+    assert_true(icmpv6_rx->other);
+    assert_int_equal(icmpv6_rx->prefix.len, 64);
+    assert_memory_equal(icmpv6_rx->prefix.address, icmpv6.prefix.address, IPV6_ADDR_LEN);
+    free(sp);
+}
+
+static void
+test_protocols_encode_ppp_pap(void **unused) {
+    (void) unused;
+
+    uint8_t buf[64];
+    uint len = 0;
+    uint8_t server_mac[ETH_ADDR_LEN] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x02};
+    char username[] = "user";
+    char password[] = "test";
+    bbl_ethernet_header_t eth = {0};
+    bbl_pppoe_session_t pppoe = {0};
+    bbl_pap_t pap = {0};
+    uint8_t *ppp = buf + 22; /* ethernet, PPPoE and PPP header */
+
+    eth.src = server_mac;
+    eth.type = ETH_TYPE_PPPOE_SESSION;
+    eth.next = &pppoe;
+    pppoe.session_id = 1;
+    pppoe.protocol = PROTOCOL_PAP;
+    pppoe.next = &pap;
+
+    pap.code = PAP_CODE_REQUEST;
+    pap.identifier = 7;
+    pap.username = username;
+    pap.username_len = 4;
+    pap.password = password;
+    pap.password_len = 4;
+    assert_int_equal(encode_ethernet(buf, &len, &eth), PROTOCOL_SUCCESS);
+    assert_int_equal(len, 22 + 14);
+    assert_int_equal(be16toh(*(uint16_t*)(ppp+2)), 14);
+
+    /* Authenticate-Ack without message */
+    memset(&pap, 0x0, sizeof(pap));
+    pap.code = PAP_CODE_ACK;
+    pap.identifier = 7;
+    len = 0;
+    assert_int_equal(encode_ethernet(buf, &len, &eth), PROTOCOL_SUCCESS);
+    assert_int_equal(len, 22 + 5);
+    assert_int_equal(be16toh(*(uint16_t*)(ppp+2)), 5);
+    assert_int_equal(ppp[4], 0);
+}
+
 int main() {
     const struct CMUnitTest tests[] = {
         cmocka_unit_test(test_protocols_decode_pppoe_ipcp_conf_request),
+        cmocka_unit_test(test_protocols_parse_pppoe_ipcp_conf_request),
+        cmocka_unit_test(test_protocols_parse_session_traffic),
+        cmocka_unit_test(test_protocols_parse_invalid),
+        cmocka_unit_test(test_protocols_encode_ethernet_fast),
+        cmocka_unit_test(test_protocols_checksum),
+        cmocka_unit_test(test_protocols_checksum_update_bbl),
+        cmocka_unit_test(test_protocols_encode_router_advertisement),
+        cmocka_unit_test(test_protocols_encode_ppp_pap),
     };
     return cmocka_run_group_tests(tests, NULL, NULL);
 }
@@ -0,0 +1,299 @@
+/*
+ * BNG Blaster (BBL) - Responder Tests
+ *
+ * Copyright (C) 2020-2021, RtBrick, Inc.
+ */
+#include <stddef.h>
+#include <stdarg.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <bbl_responder.h>
+
+#define TEST_HASH_ENTRIES   4 /* 8 buckets */
+#define TEST_HASH_KEYS      64
+
+/* The I/O backend writes into a single test buffer. */
+static struct {
+    uint8_t buf[2048];
+    uint len;
+    uint count;
+} test_tx;
+
+uint8_t *
+responder_tx_buf (responder_ctx_s *ctx, responder_side_t side) {
+    (void) ctx;
+    (void) side;
+    return test_tx.buf;
+}
+
+void
+responder_tx_commit (responder_ctx_s *ctx, responder_side_t side, uint8_t *buf, uint len) {
+    (void) ctx;
+    (void) side;
+    (void) buf;
+    test_tx.len = len;
+    test_tx.count++;
+}
+
+/*
+ * Return the next key after the given one
+ * with the given home bucket.
+ */
+static responder_key_t
+test_hash_key_home(responder_hash_t *hash, uint32_t home, uint64_t *seed) {
+    responder_key_t key = {0};
+
+    while(true) {
+        key.mac_vlan = ++(*seed);
+        key.vlan = *seed >> 8;
+        if((responder_hash_key(&key) & hash->mask) == home) {
+            return key;
+        }
+    }
+}
+
+static void
+test_hash_expect(responder_hash_t *hash, responder_key_t *key, bool found, uint32_t expected) {
+    uint32_t value = UINT32_MAX;
+
+    assert_int_equal(responder_hash_lookup(hash, key, &value), found);
+    if(found) {
+        assert_int_equal(value, expected);
+    }
+}
+
+static void
+test_responder_hash_collisions(void **unused) {
+    (void) unused;
+
+    responder_hash_t hash;
+    responder_key_t key[4];
+    uint64_t seed = 0;
+    int i;
+
+    assert_true(responder_hash_init(&hash, TEST_HASH_ENTRIES));
+    assert_int_equal(hash.mask, 7);
+
+    /* Four keys with the same home bucket */
+    for(i = 0; i < 4; i++) {
+        key[i] = test_hash_key_home(&hash, 2, &seed);
+        assert_true(responder_hash_insert(&hash, &key[i], i));
+    }
+    assert_int_equal(hash.count, 4);
+    for(i = 0; i < 4; i++) {
+        test_hash_expect(&hash, &key[i], true, i);
+    }
+
+    /* Insert of an existing key updates the value. */
+    assert_true(responder_hash_insert(&hash, &key[3], 33));
+    assert_int_equal(hash.count, 4);
+    test_hash_expect(&hash, &key[3], true, 33);
+
+    /* Delete from the middle of the cluster. */
+    responder_hash_delete(&hash, &key[1]);
+    assert_int_equal(hash.count, 3);
+    test_hash_expect(&hash, &key[1], false, 0);
+    test_hash_expect(&hash, &key[0], true, 0);
+    test_hash_expect(&hash, &key[2], true, 2);
+    test_hash_expect(&hash, &key[3], true, 33);
+
+    /* The cluster is shifted back without holes. */
+    assert_true(hash.entries[2].used);
+    assert_true(hash.entries[3].used);
+    assert_true(hash.entries[4].used);
+    assert_false(hash.entries[5].used);
+
+    /* Delete of a missing key is ignored. */
+    responder_hash_delete(&hash, &key[1]);
+    assert_int_equal(hash.count, 3);
+
+    /* Delete the head of the cluster. */
+    responder_hash_delete(&hash, &key[0]);
+    assert_int_equal(hash.count, 2);
+    test_hash_expect(&hash, &key[2], true, 2);
+    test_hash_expect(&hash, &key[3], true, 33);
+    assert_true(hash.entries[2].used);
+    assert_true(hash.entries[3].used);
+    assert_false(hash.entries[4].used);
+
+    free(hash.entries);
+}
+
+static void
+test_responder_hash_wrap_around(void **unused) {
+    (void) unused;
+
+    responder_hash_t hash;
+    responder_key_t last[3];
+    responder_key_t first;
+    responder_key_t key;
+    uint64_t seed = 0;
+    int i;
+
+    assert_true(responder_hash_init(&hash, TEST_HASH_ENTRIES));
+
+    /* Three keys with the last bucket as home occupy
+     * buckets 7, 0 and 1, a key with home bucket 0
+     * is then placed in bucket 2. */
+    for(i = 0; i < 3; i++) {
+        last[i] = test_hash_key_home(&hash, 7, &seed);
+        assert_true(responder_hash_insert(&hash, &last[i], 70 + i));
+    }
+    first = test_hash_key_home(&hash, 0, &seed);
+    assert_true(responder_hash_insert(&hash, &first, 0));
+    assert_true(hash.entries[7].used);
+    assert_true(hash.entries[0].used);
+    assert_true(hash.entries[1].used);
+    assert_true(hash.entries[2].used);
+    assert_int_equal(hash.entries[2].value, 0);
+
+    /* Deleting the entry in the last bucket shifts
+     * the entries back across the end of the table. */
+    responder_hash_delete(&hash, &last[0]);
+    assert_int_equal(hash.count, 3);
+    test_hash_expect(&hash, &last[0], false, 0);
+    test_hash_expect(&hash, &last[1], true, 71);
+    test_hash_expect(&hash, &last[2], true, 72);
+    test_hash_expect(&hash, &first, true, 0);
+    assert_int_equal(hash.entries[7].value, 71);
+    assert_int_equal(hash.entries[0].value, 72);
+    assert_int_equal(hash.entries[1].value, 0);
+    assert_false(hash.entries[2].used);
+
+    /* An entry in its home bucket is not moved
+     * before its home across the end of the table. */
+    responder_hash_delete(&hash, &last[1]);
+    responder_hash_delete(&hash, &last[2]);
+    assert_int_equal(hash.count, 1);
+    test_hash_expect(&hash, &first, true, 0);
+    assert_true(hash.entries[0].used);
+    assert_false(hash.entries[7].used);
+    assert_false(hash.entries[1].used);
+
+    /* The table keeps one bucket free. */
+    for(i = 1; i < 7; i++) {
+        key = test_hash_key_home(&hash, i, &seed);
+        assert_true(responder_hash_insert(&hash, &key, i));
+    }
+    assert_int_equal(hash.count, 7);
+    key = test_hash_key_home(&hash, 3, &seed);
+    assert_false(responder_hash_insert(&hash, &key, 3));
+    test_hash_expect(&hash, &key, false, 0);
+
+    free(hash.entries);
+}
+
+/*
+ * Random inserts and deletes compared
+ * with a list of all inserted keys.
+ */
+static void
+test_responder_hash_random(void **unused) {
+    (void) unused;
+
+    responder_hash_t hash;
+    responder_key_t key[TEST_HASH_KEYS];
+    bool inserted[TEST_HASH_KEYS] = {0};
+    uint32_t count = 0;
+    int i, k;
+
+    assert_true(responder_hash_init(&hash, TEST_HASH_KEYS / 2));
+    for(k = 0; k < TEST_HASH_KEYS; k++) {
+        key[k].mac_vlan = 0x020000000000ULL | k;
+        key[k].vlan = k % 3;
+    }
+    srand(1);
+    for(i = 0; i < 100000; i++) {
+        k = rand() % TEST_HASH_KEYS;
+        if(inserted[k]) {
+            responder_hash_delete(&hash, &key[k]);
+            inserted[k] = false;
+            count--;
+        } else if(count < TEST_HASH_KEYS / 2) {
+            assert_true(responder_hash_insert(&hash, &key[k], k));
+            inserted[k] = true;
+            count++;
+        }
+        assert_int_equal(hash.count, count);
+        if(i % 64 == 0) {
+            for(k = 0; k < TEST_HASH_KEYS; k++) {
+                test_hash_expect(&hash, &key[k], inserted[k], k);
+            }
+        }
+    }
+    free(hash.entries);
+}
+
+/*
+ * BBL session traffic is forwarded with the IP length
+ * from the header, which must not exceed the frame.
+ */
+static void
+test_responder_forward_ip_len(void **unused) {
+    (void) unused;
+
+    responder_ctx_s *ctx = calloc(1, sizeof(responder_ctx_s));
+    uint8_t frame[256] = {0};
+    uint8_t mac[ETH_ADDR_LEN] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+    uint len = 0;
+    uint16_t ip_len;
+
+    bbl_ethernet_header_t eth = {0};
+    bbl_ipv4_t ipv4 = {0};
+    bbl_udp_t udp = {0};
+    bbl_bbl_t bbl = {0};
+
+    eth.dst = mac;
+    eth.src = mac;
+    eth.type = ETH_TYPE_IPV4;
+    eth.next = &ipv4;
+    ipv4.src = htobe32(0x0a000001);
+    ipv4.dst = htobe32(0x0a000002);
+    ipv4.ttl = 64;
+    ipv4.protocol = PROTOCOL_IPV4_UDP;
+    ipv4.next = &udp;
+    udp.src = BBL_UDP_PORT;
+    udp.dst = BBL_UDP_PORT;
+    udp.protocol = UDP_PROTOCOL_BBL;
+    udp.next = &bbl;
+    bbl.type = BBL_TYPE_UNICAST_SESSION;
+    assert_int_equal(encode_ethernet(frame, &len, &eth), PROTOCOL_SUCCESS);
+    ip_len = be16toh(*(uint16_t*)(frame + 16));
+    assert_int_equal(ip_len, len - 14);
+
+    ctx->network_enabled = true;
+    ctx->network_resolved = true;
+
+    /* Complete frame */
+    responder_rx_access(ctx, NULL, frame, len);
+    assert_int_equal(test_tx.count, 1);
+    assert_int_equal(test_tx.len, 14 + ip_len);
+    assert_memory_equal(test_tx.buf + 14, frame + 14, ip_len);
+
+    /* Ethernet padding is not forwarded. */
+    responder_rx_access(ctx, NULL, frame, len + 20);
+    assert_int_equal(test_tx.count, 2);
+    assert_int_equal(test_tx.len, 14 + ip_len);
+
+    /* Truncated frames are dropped. */
+    responder_rx_access(ctx, NULL, frame, len - 1);
+    responder_rx_access(ctx, NULL, frame, 14 + 20);
+    *(uint16_t*)(frame + 16) = htobe16(ip_len + 1);
+    responder_rx_access(ctx, NULL, frame, len);
+    *(uint16_t*)(frame + 16) = htobe16(0xffff);
+    responder_rx_access(ctx, NULL, frame, len);
+    assert_int_equal(test_tx.count, 2);
+    assert_int_equal(ctx->stats.traffic_upstream, 2);
+
+    free(ctx);
+}
+
+int main() {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_responder_hash_collisions),
+        cmocka_unit_test(test_responder_hash_wrap_around),
+        cmocka_unit_test(test_responder_hash_random),
+        cmocka_unit_test(test_responder_forward_ip_len),
+    };
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
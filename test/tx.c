@@ -0,0 +1,158 @@
+/*
+ * BNG Blaster (BBL) - TX Tests
+ *
+ * Copyright (C) 2020-2021, RtBrick, Inc.
+ */
+#include <stddef.h>
+#include <stdarg.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <bbl.h>
+#include <bbl_retry.h>
+
+bool g_interactive = false;
+char *g_log_file = NULL;
+
+/* Session, retry and I/O functions are not used by the tested encoders. */
+void bbl_igmp_timeout(timer_s *timer) { (void) timer; }
+void bbl_io_memory_tx(bbl_interface_s *interface) { (void) interface; }
+void bbl_recorder_push(bbl_interface_s *interface, struct timespec *timestamp, uint8_t *data, uint len, uint direction) {
+    (void) interface; (void) timestamp; (void) data; (void) len; (void) direction;
+}
+void bbl_retry_add(bbl_session_s *session, bbl_retry_type_t type) { (void) session; (void) type; }
+void bbl_retry_del(bbl_session_s *session, bbl_retry_type_t type) { (void) session; (void) type; }
+void bbl_session_tx_qnode_insert(bbl_session_s *session) { (void) session; }
+void bbl_session_tx_qnode_remove(bbl_session_s *session) { (void) session; }
+void bbl_session_network_tx_qnode_insert(bbl_session_s *session) { (void) session; }
+void bbl_session_network_tx_qnode_remove(bbl_session_s *session) { (void) session; }
+void bbl_session_update_state(bbl_ctx_s *ctx, bbl_session_s *session, session_state_t state) {
+    (void) ctx; (void) session; (void) state;
+}
+void bbl_session_clear(bbl_ctx_s *ctx, bbl_session_s *session) { (void) ctx; (void) session; }
+
+/* Not declared in bbl_tx.h */
+protocol_error_t bbl_encode_packet_lcp_request(bbl_session_s *session);
+protocol_error_t bbl_encode_packet_lcp_response(bbl_session_s *session);
+
+static uint8_t test_server_mac[ETH_ADDR_LEN] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05};
+static uint8_t test_client_mac[ETH_ADDR_LEN] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+
+static bbl_session_s *
+test_tx_session(uint16_t outer_vlan, uint16_t inner_vlan, uint16_t third_vlan) {
+    bbl_session_s *session = calloc(1, sizeof(bbl_session_s));
+    bbl_interface_s *interface;
+
+    assert_int_equal(posix_memalign((void**)&interface, BBL_CACHE_LINE, sizeof(bbl_interface_s)), 0);
+    memset(interface, 0x0, sizeof(bbl_interface_s));
+    session->interface = interface;
+    session->write_buf = calloc(1, 2048);
+    memcpy(session->server_mac, test_server_mac, ETH_ADDR_LEN);
+    memcpy(session->client_mac, test_client_mac, ETH_ADDR_LEN);
+    session->key.outer_vlan_id = outer_vlan;
+    session->key.inner_vlan_id = inner_vlan;
+    session->access_third_vlan = third_vlan;
+    session->pppoe_session_id = 0x1234;
+    session->magic_number = 0xdeadbeef;
+    session->lcp_request_code = PPP_CODE_ECHO_REQUEST;
+    session->lcp_response_code = PPP_CODE_ECHO_REPLY;
+    return session;
+}
+
+static void
+test_tx_session_free(bbl_session_s *session) {
+    free(session->interface);
+    free(session->write_buf);
+    free(session);
+}
+
+/*
+ * Encode the echo with the generic encoder from
+ * the session and compare with the written frame.
+ */
+static void
+test_tx_lcp_echo_expect(bbl_session_s *session, uint8_t code, uint8_t identifier) {
+    bbl_ethernet_header_t eth = {0};
+    bbl_pppoe_session_t pppoe = {0};
+    bbl_lcp_t lcp = {0};
+    uint8_t expected[256];
+    uint len = 0;
+
+    eth.dst = test_server_mac;
+    eth.src = test_client_mac;
+    eth.vlan_outer = session->key.outer_vlan_id;
+    eth.vlan_inner = session->key.inner_vlan_id;
+    eth.vlan_three = session->access_third_vlan;
+    eth.type = ETH_TYPE_PPPOE_SESSION;
+    eth.next = &pppoe;
+    pppoe.session_id = session->pppoe_session_id;
+    pppoe.protocol = PROTOCOL_LCP;
+    pppoe.next = &lcp;
+    lcp.code = code;
+    lcp.identifier = identifier;
+    lcp.magic = session->magic_number;
+    assert_int_equal(encode_ethernet(expected, &len, &eth), PROTOCOL_SUCCESS);
+
+    assert_int_equal(session->write_idx, len);
+    assert_int_equal(session->lcp_echo_template_len, len);
+    assert_memory_equal(session->write_buf, expected, len);
+}
+
+static void
+test_tx_lcp_echo(void **unused) {
+    (void) unused;
+
+    uint16_t vlans[][3] = {{0, 0, 0}, {100, 0, 0}, {100, 200, 0}, {100, 200, 300}, {4095, 4095, 1}};
+    bbl_session_s *session;
+    uint i;
+
+    for(i = 0; i < sizeof(vlans)/sizeof(vlans[0]); i++) {
+        session = test_tx_session(vlans[i][0], vlans[i][1], vlans[i][2]);
+
+        /* The first request builds the template. */
+        session->lcp_identifier = 7;
+        assert_int_equal(bbl_encode_packet_lcp_request(session), PROTOCOL_SUCCESS);
+        test_tx_lcp_echo_expect(session, PPP_CODE_ECHO_REQUEST, 8);
+        assert_int_equal(session->lcp_identifier, 8);
+
+        /* Further requests patch identifier and magic number. */
+        session->write_idx = 0;
+        session->lcp_identifier = 255;
+        session->magic_number = 0x01020304;
+        assert_int_equal(bbl_encode_packet_lcp_request(session), PROTOCOL_SUCCESS);
+        test_tx_lcp_echo_expect(session, PPP_CODE_ECHO_REQUEST, 0);
+
+        /* Replies use the same template with the peer identifier. */
+        session->write_idx = 0;
+        session->lcp_peer_identifier = 42;
+        session->magic_number = 0xa5a5a5a5;
+        assert_int_equal(bbl_encode_packet_lcp_response(session), PROTOCOL_SUCCESS);
+        test_tx_lcp_echo_expect(session, PPP_CODE_ECHO_REPLY, 42);
+
+        /* A new PPPoE session id invalidates the template. */
+        session->write_idx = 0;
+        session->pppoe_session_id = 0xfedc;
+        session->lcp_echo_template_len = 0;
+        assert_int_equal(bbl_encode_packet_lcp_response(session), PROTOCOL_SUCCESS);
+        test_tx_lcp_echo_expect(session, PPP_CODE_ECHO_REPLY, 42);
+
+        /* Frames are appended to the write buffer. */
+        session->write_idx = 0;
+        assert_int_equal(bbl_encode_packet_lcp_request(session), PROTOCOL_SUCCESS);
+        assert_int_equal(bbl_encode_packet_lcp_request(session), PROTOCOL_SUCCESS);
+        assert_int_equal(session->write_idx, 2 * session->lcp_echo_template_len);
+        memmove(session->write_buf, session->write_buf + session->lcp_echo_template_len,
+                session->lcp_echo_template_len);
+        session->write_idx = session->lcp_echo_template_len;
+        test_tx_lcp_echo_expect(session, PPP_CODE_ECHO_REQUEST, 2);
+
+        assert_int_equal(session->interface->stats.lcp_tx, 6);
+        test_tx_session_free(session);
+    }
+}
+
+int main() {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_tx_lcp_echo),
+    };
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}